@@ -30,6 +30,11 @@ char*   vmm_strcpy_s(char* dst, size_t dst_length, const char* src);
 int     vmm_strcmp(const char* string1, const char* string2);
 void    vmm_memcpy_assuming_mmio(UINT8 *dst, UINT8 *src, INT32 count);
 int     vmm_memcmp(const void* mem1, const void* mem2, size_t count);
+void    vmm_zero_page(void *page);
+
+// Select the memcpy/memset strategies from CPUID. XMM registers must be
+// usable (CR4.OSFXSR) on every CPU that runs after this call.
+void    vmm_mem_ops_init(void);
 
 #define vmm_zeromem(dest_, count_) vmm_memset(dest_, 0, count_);
 
@@ -126,6 +126,10 @@ UINT32 event_manager_initialize(UINT32 num_of_host_cpus);
 UINT32 event_manager_guest_initialize(GUEST_ID guest_id);
 UINT32 event_manager_gcpu_initialize(GUEST_CPU_HANDLE gcpu);
 
+// Called by every host CPU at points where it cannot be raising an event,
+// lets observer lists replaced since the previous call be freed
+void event_manager_quiescent_point(void);
+
 void event_cleanup_event_manger(void);
 
 BOOLEAN event_global_register(
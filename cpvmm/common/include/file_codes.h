@@ -43,6 +43,7 @@
 #define VMDB_C                           1014
 #define VMENTER_CHECKS_C                 1015
 #define VMX_TRACE_C                      1016
+#define EXIT_TRACE_C                     1107
 
 // vmm\emulator\emulator64
 #define EMULATOR64_DBG_C                 1017
@@ -88,9 +89,11 @@
 // vmm\ipc
 #define IPC_C                            1044
 #define IPC_API_C                        1045
+#define IPC_BATCH_C                      1109
 
 // vmm\libc
 #define VMM_SERIAL_LIBC                  1046
+#define VMM_LOG_BUFFER_C                 1111
 
 // vmm\memory\ept
 #define EPT_C                            1047
@@ -173,6 +176,7 @@
 // vmm\memory\ept
 #define FVS_C                            1108
 #define VE_C                             1230
+#define EPT_DIRTY_LOG_C                  1110
 
 // vmm\profiling
 #define PROFILING_C                      2000
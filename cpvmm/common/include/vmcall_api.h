@@ -33,6 +33,7 @@ typedef enum _VMCALL_ID {
     VMCALL_TMSL,
 
     VMCALL_UPDATE_LVT,        // Temporary for TSC deadline debugging
+    VMCALL_EXIT_TRACE_DUMP,
 
 #ifdef ENABLE_TMSL_PROFILING
          VMCALL_TMSL_PROFILING = 1022,  // for tmsl profiling.
@@ -215,4 +216,22 @@ typedef struct VMM_WRITE_STRING_PARAMS{
 } VMM_WRITE_STRING_PARAMS;
 
 
+typedef struct VMM_EXIT_TRACE_DUMP_PARAMS_S {
+    VMCALL_ID vmcall_id;                   // IN must be "VMCALL_EXIT_TRACE_DUMP"
+    UINT32 cpu_id;                         // IN host CPU whose ring is dumped
+    UINT64 buffer_gpa;                     // IN guest physical address of the buffer
+    UINT64 buffer_size;                    // IN size of the buffer, OUT size of the ring
+} VMM_EXIT_TRACE_DUMP_PARAMS;
+
+// FUNCTION : hw_vmcall_exit_trace_dump()
+// PURPOSE  : Call for VMM service for copying the VM exit trace ring of a
+//          : host CPU to a guest buffer. Only the primary guest may call it.
+// ARGUMENTS: param - pointer to "VMM_EXIT_TRACE_DUMP_PARAMS" structure
+// RETURNS  : VMM_OK = ok, other - error code
+//
+// VMM_STATUS hw_vmcall_exit_trace_dump(VMM_EXIT_TRACE_DUMP_PARAMS* param);
+#define hw_vmcall_exit_trace_dump(exit_trace_dump_params_ptr) \
+    hw_vmcall(VMCALL_EXIT_TRACE_DUMP, (exit_trace_dump_params_ptr), NULL, NULL)
+
+
 #endif // _VMCALL_API_H_
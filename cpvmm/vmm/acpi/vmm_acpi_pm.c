@@ -458,7 +458,11 @@ void vmm_acpi_pm_initialize(GUEST_ID guest_id)
         for (i = 0; i < NELEMENTS(pm_port); ++i) {
             if (0 != pm_port[i]) {
                 VMM_LOG(mask_anonymous, level_trace,"[ACPI] Install handler at Pm1%cControlBlock(%P)\n", 'a'+i, pm_port[i]);
-                io_vmexit_handler_register(guest_id, pm_port[i], vmm_acpi_pm1x_handler, NULL);
+                // the whole control block; the handler passes everything but
+                // full size writes to its first port through
+                io_vmexit_handler_register_range(guest_id, pm_port[i],
+                        (IO_PORT_ID)(pm_port[i] + port_size - 1),
+                        vmm_acpi_pm1x_handler, NULL);
             }
         }
     }
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+   VM exit trace
+
+   A ring has a single writer, its host CPU, which fills the record at
+   head and only then publishes it by advancing head. Readers on other
+   CPUs take head, copy the records and take head again; records written
+   in the meantime may have replaced the oldest ones and are reported in
+   dump_overrun.
+*/
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(EXIT_TRACE_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(EXIT_TRACE_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "heap.h"
+#include "common_libc.h"
+#include "hw_utils.h"
+#include "hw_interlocked.h"
+#include "guest.h"
+#include "guest_cpu.h"
+#include "gpm_api.h"
+#include "vmcall.h"
+#include "exit_trace.h"
+
+#pragma warning( disable : 4100) // warning C4100: unreferenced formal parameter
+
+static EXIT_TRACE_RING *exit_trace_rings[VMM_MAX_CPU_SUPPORTED];
+static UINT16 exit_trace_num_cpus = 0;
+static volatile BOOLEAN exit_trace_enabled = FALSE;
+
+static VMM_STATUS exit_trace_dump_service(GUEST_CPU_HANDLE gcpu,
+                ADDRESS *arg1, ADDRESS *arg2, ADDRESS *arg3);
+
+
+BOOLEAN exit_trace_initialize(UINT16 num_of_cpus)
+{
+    EXIT_TRACE_RING *ring;
+    UINT16 cpu_id;
+
+    if (exit_trace_num_cpus != 0 || num_of_cpus > VMM_MAX_CPU_SUPPORTED) {
+        return FALSE;
+    }
+    for (cpu_id = 0; cpu_id < num_of_cpus; cpu_id++) {
+        ring = vmm_memory_alloc(EXIT_TRACE_RING_SIZE(EXIT_TRACE_RECORDS_PER_CPU));
+        if (NULL == ring) {
+            VMM_LOG(mask_uvmm, level_error,
+                    "%s: Failed to allocate the ring of CPU%d\n", __FUNCTION__, cpu_id);
+            return FALSE;
+        }
+        vmm_zeromem(ring, EXIT_TRACE_RING_SIZE(EXIT_TRACE_RECORDS_PER_CPU));
+        ring->magic = EXIT_TRACE_MAGIC;
+        ring->version = EXIT_TRACE_VERSION;
+        ring->cpu_id = cpu_id;
+        ring->num_records = EXIT_TRACE_RECORDS_PER_CPU;
+        exit_trace_rings[cpu_id] = ring;
+    }
+    exit_trace_num_cpus = num_of_cpus;
+    exit_trace_enabled = TRUE;
+    return TRUE;
+}
+
+void exit_trace_guest_initialize(GUEST_ID guest_id)
+{
+    vmcall_register(guest_id, VMCALL_EXIT_TRACE_DUMP, exit_trace_dump_service, FALSE);
+}
+
+void exit_trace_enable(BOOLEAN enable)
+{
+    exit_trace_enabled = enable;
+}
+
+void exit_trace_record(UINT64 exit_tsc, UINT32 exit_reason, UINT64 guest_rip,
+                       GUEST_ID guest_id, CPU_ID guest_cpu_id)
+{
+    EXIT_TRACE_RING   *ring;
+    EXIT_TRACE_RECORD *record;
+    UINT64             head;
+    UINT64             cycles;
+
+    if (!exit_trace_enabled) {
+        return;
+    }
+    ring = exit_trace_rings[hw_cpu_id()];
+    if (NULL == ring) {
+        return;
+    }
+    head = ring->head;
+    record = &ring->records[head & (ring->num_records - 1)];
+    cycles = hw_rdtsc() - exit_tsc;
+
+    record->tsc = exit_tsc;
+    record->guest_rip = guest_rip;
+    record->handler_cycles = (cycles > UINT32_ALL_ONES) ? UINT32_ALL_ONES : (UINT32) cycles;
+    record->exit_reason = (UINT16) exit_reason;
+    record->guest_id = guest_id;
+    record->guest_cpu_id = guest_cpu_id;
+
+    // publish the record only once it is complete
+    hw_store_fence();
+    ring->head = head + 1;
+}
+
+const EXIT_TRACE_RING* exit_trace_ring(CPU_ID cpu_id)
+{
+    if (cpu_id >= exit_trace_num_cpus) {
+        return NULL;
+    }
+    return exit_trace_rings[cpu_id];
+}
+
+// copy to guest physical memory, page by page
+static BOOLEAN exit_trace_copy_to_guest(GPM_HANDLE gpm, GPA gpa,
+                                        const void *src, UINT64 size)
+{
+    const UINT8 *p_src = (const UINT8 *) src;
+    UINT64 chunk;
+    HVA    hva;
+
+    while (size > 0) {
+        chunk = MIN(size, PAGE_4KB_SIZE - (gpa & PAGE_4KB_MASK));
+        if (!gpm_gpa_to_hva(gpm, gpa, &hva)) {
+            return FALSE;
+        }
+        vmm_memcpy((void *) hva, p_src, (UINT32) chunk);
+        gpa += chunk;
+        p_src += chunk;
+        size -= chunk;
+    }
+    return TRUE;
+}
+
+// VMCALL_EXIT_TRACE_DUMP, arg1 holds the GVA of VMM_EXIT_TRACE_DUMP_PARAMS
+static VMM_STATUS exit_trace_dump_service(GUEST_CPU_HANDLE gcpu,
+                ADDRESS *arg1, ADDRESS *arg2 UNUSED, ADDRESS *arg3 UNUSED)
+{
+    GUEST_HANDLE                guest = gcpu_guest_handle(gcpu);
+    GVA                         params_gva = (GVA) *arg1;
+    HVA                         params_hva;
+    VMM_EXIT_TRACE_DUMP_PARAMS *params;
+    const EXIT_TRACE_RING      *ring;
+    EXIT_TRACE_RING             header;
+    UINT64                      ring_size;
+    UINT64                      records_offset = OFFSET_OF(EXIT_TRACE_RING, records);
+    GPM_HANDLE                  gpm;
+
+    // the trace shows what the other guests are doing
+    if (!guest_is_primary(guest)) {
+        return VMM_ERROR;
+    }
+    if (ALIGN_BACKWARD(params_gva, PAGE_4KB_SIZE) !=
+        ALIGN_BACKWARD(params_gva + sizeof(VMM_EXIT_TRACE_DUMP_PARAMS) - 1, PAGE_4KB_SIZE) ||
+        !gcpu_gva_to_hva(gcpu, params_gva, &params_hva)) {
+        VMM_LOG(mask_uvmm, level_trace,"%s: Invalid parameters address %P\n",
+                __FUNCTION__, params_gva);
+        return VMM_ERROR;
+    }
+    params = (VMM_EXIT_TRACE_DUMP_PARAMS *) params_hva;
+    if (params->vmcall_id != VMCALL_EXIT_TRACE_DUMP) {
+        return VMM_ERROR;
+    }
+    ring = (params->cpu_id < exit_trace_num_cpus) ?
+           exit_trace_ring((CPU_ID) params->cpu_id) : NULL;
+    if (NULL == ring) {
+        return VMM_ERROR;
+    }
+    ring_size = EXIT_TRACE_RING_SIZE(ring->num_records);
+    if (params->buffer_size < ring_size) {
+        params->buffer_size = ring_size;
+        return VMM_ERROR;
+    }
+    params->buffer_size = ring_size;
+
+    vmm_memcpy(&header, ring, (UINT32) records_offset);
+    header.head = ring->head;
+    gpm = gcpu_get_current_gpm(guest);
+    if (!exit_trace_copy_to_guest(gpm, params->buffer_gpa + records_offset,
+                                  ring->records, ring_size - records_offset)) {
+        return VMM_ERROR;
+    }
+    // the record at head may be in the middle of being written as well
+    header.dump_overrun = (params->cpu_id == hw_cpu_id()) ? 0 :
+                          ring->head - header.head + 1;
+    if (!exit_trace_copy_to_guest(gpm, params->buffer_gpa, &header, records_offset)) {
+        return VMM_ERROR;
+    }
+    return VMM_OK;
+}
@@ -193,7 +193,7 @@ void vmdb_thread_log(GUEST_CPU_HANDLE gcpu, const char *msg, const char *functio
       (void)gcpu;
       (void)msg;
       (void)function_name;
-#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG
+#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG || defined VMM_LOG_BUFFER
     const VIRTUAL_CPU_ID *vcpu = guest_vcpu(gcpu);
     VMM_ASSERT(vcpu);
 #endif
@@ -609,7 +609,7 @@ BOOLEAN vmdb_exception_handler(GUEST_CPU_HANDLE gcpu)
     IA32_VMX_EXIT_QUALIFICATION qualification;
     ADDRESS                 guest_rflags;
     int                     i;
-#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG
+#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG || defined VMM_LOG_BUFFER
     const VIRTUAL_CPU_ID   *vcpu = guest_vcpu(gcpu);
     VMM_ASSERT(vcpu);
 #endif
@@ -632,7 +632,7 @@ BOOLEAN vmdb_exception_handler(GUEST_CPU_HANDLE gcpu)
     else {
             for (i = 0; i < NUMBER_OF_HW_BREAKPOINTS; ++i) {
                 if (BIT_GET64(qualification.DbgException.BreakPoints, i)) {
-#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG
+#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG || defined VMM_LOG_BUFFER
                     UINT32 db_type = (UINT32) DR7_RW_GET(vmdb->dr7, i);
 #endif
 
@@ -940,7 +940,7 @@ int vmdb_cli_breakpoint_show(unsigned argc, char *args[])
         bp_address = vmdb->dr[i];
 
         if (0 != bp_address && DR7_GLOBAL_GET(vmdb->dr7, i)) {
-#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG
+#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG || defined VMM_LOG_BUFFER
             VMDB_BREAKPOINT_TYPE     bp_type = (VMDB_BREAKPOINT_TYPE)DR7_RW_GET(vmdb->dr7, i);
             VMDB_BREAK_LENGTH_TYPE   bp_len = (VMDB_BREAK_LENGTH_TYPE)DR7_LEN_GET(vmdb->dr7, i);
 #endif
@@ -144,7 +144,6 @@ GUEST_HANDLE guest_register(UINT32 magic_number, UINT32 physical_memory_size,
     else
         copy_policy(&guest->guest_policy, guest_policy);
     list_init(guest->cpuid_filter_list);    // prepare list for CPUID filters
-    list_init(guest->msr_control->msr_list); // prepare list for MSR handlers
     // vmexit_guest_initialize(guest->id);
     guest->next_guest = guests;
     guests = guest;
@@ -1100,6 +1100,16 @@ void gcpu_assign_timer(GUEST_CPU_HANDLE gcpu, void *timer)
     gcpu->timer = timer;
 }
 
+void *gcpu_get_page_walk_cache(GUEST_CPU_HANDLE gcpu)
+{
+    return gcpu->page_walk_cache;
+}
+
+void gcpu_set_page_walk_cache(GUEST_CPU_HANDLE gcpu, void *cache)
+{
+    gcpu->page_walk_cache = cache;
+}
+
 #pragma pack(1)
 /// ARBTYE format
 typedef union arch_arbyte_s {
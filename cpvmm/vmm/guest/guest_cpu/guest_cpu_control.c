@@ -953,6 +953,21 @@ BOOLEAN gcpu_cr3_virtualized( GUEST_CPU_HANDLE gcpu )
     return (proc_ctrl.Bits.Cr3Store && proc_ctrl.Bits.Cr3Load);
 }
 
+// TRUE if the guest can't flush its TLB without a VMEXIT: MOV to CR3 and
+// INVLPG exit, INVPCID is not enabled and CR4.PGE/PCIDE writes exit
+BOOLEAN gcpu_tlb_flushes_virtualized( GUEST_CPU_HANDLE gcpu )
+{
+    PROCESSOR_BASED_VM_EXECUTION_CONTROLS  proc_ctrl;
+    PROCESSOR_BASED_VM_EXECUTION_CONTROLS2 proc_ctrl2;
+    EM64T_CR4                              cr4_mask;
+
+    proc_ctrl.Uint32 = (UINT32)(gcpu->vmexit_setup.processor_ctrls.bit_field);
+    proc_ctrl2.Uint32 = (UINT32)(gcpu->vmexit_setup.processor_ctrls2.bit_field);
+    cr4_mask.Uint64 = gcpu->vmexit_setup.cr4.bit_field;
+    return (proc_ctrl.Bits.Cr3Load && proc_ctrl.Bits.Invlpg &&
+            !proc_ctrl2.Bits.EnableINVPCID && cr4_mask.Bits.PGE && cr4_mask.Bits.PCIDE);
+}
+
 
 /*
  *   Enforce settings on hardware VMCS only
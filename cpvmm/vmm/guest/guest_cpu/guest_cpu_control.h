@@ -58,6 +58,7 @@ void gcpu_temp_exceptions_setup( GUEST_CPU_HANDLE gcpu,
                                  GCPU_TEMP_EXCEPTIONS_SETUP action );
 
 BOOLEAN gcpu_cr3_virtualized(GUEST_CPU_HANDLE gcpu);
+BOOLEAN gcpu_tlb_flushes_virtualized(GUEST_CPU_HANDLE gcpu);
 
 void gcpu_enforce_settings_on_hardware(GUEST_CPU_HANDLE gcpu,
                                        GCPU_TEMP_EXCEPTIONS_SETUP action);
@@ -105,6 +105,7 @@ typedef struct _GUEST_CPU {
     UINT32                      trigger_log_event;
     UINT8                       pad2[4];
     VE_DESCRIPTOR               ve_desc;
+    void                        *page_walk_cache;   // see page_walker.c
 
 } GUEST_CPU;
 
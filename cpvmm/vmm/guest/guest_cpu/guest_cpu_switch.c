@@ -33,6 +33,7 @@
 #include "vmcs_init.h"
 #include "unrestricted_guest.h"
 #include "fvs.h"
+#include "page_walker.h"
 #ifdef JLMDEBUG
 #include "jlmdebug.h"
 #endif
@@ -407,6 +408,11 @@ void gcpu_vmexit_start( const GUEST_CPU_HANDLE gcpu )
         !gcpu_cr3_virtualized( gcpu )) {
         gcpu_set_guest_visible_control_reg( gcpu, IA32_CTRL_CR3, INVALID_CR3_SAVED_VALUE );
     }
+    // guest TLB flushes that do not VMEXIT can't be seen, so cached page
+    // walks are good only for the VMEXIT they were done in
+    if (!gcpu_tlb_flushes_virtualized( gcpu )) {
+        pw_cache_flush( gcpu );
+    }
 }
 
 void gcpu_raise_proper_events_after_level_change(GUEST_CPU_HANDLE gcpu,
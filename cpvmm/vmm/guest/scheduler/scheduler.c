@@ -23,6 +23,8 @@
 #include "list.h"
 #include "memory_allocator.h"
 #include "lock.h"
+#include "vmcs_init.h"
+#include "vmexit.h"
 #ifdef JLMDEBUG
 #include "jlmdebug.h"
 #endif
@@ -32,6 +34,12 @@
 // Principles:
 // 1. Scheduler works independently on each host CPU
 // 2. Scheduler on different host CPUs may communicate to make common decision
+// 3. A host CPU with one vCPU runs it until it stops being ready. A host
+//    CPU with several vCPUs gives them weighted fair time slices: the
+//    ready vCPU with the least weighted run time gets the next slice, the
+//    VMX preemption timer ends it, and a vCPU that executes HLT is parked
+//    until it is woken or has been halted for a slice. The full vCPU state
+//    is swapped only when the slice changes hands, not on every VM exit.
 
 
 // scheduler vCPU object
@@ -40,20 +48,38 @@ typedef struct _SCHEDULER_VCPU_OBJECT {
     GUEST_CPU_HANDLE               gcpu;
     CPU_ID                         host_cpu;
     UINT16                         flags;
-    UINT32                         reserved;
+    UINT32                         weight;
+    UINT64                         vruntime;   // TSC ticks run, scaled by weight
+    UINT64                         halt_tsc;   // when it was parked
     struct _SCHEDULER_VCPU_OBJECT* next_same_host_cpu;
     struct _SCHEDULER_VCPU_OBJECT* next_all_cpus;
+    struct _SCHEDULER_VCPU_OBJECT* next_ready;
 } SCHEDULER_VCPU_OBJECT;
 
 // SCHEDULER_VCPU_OBJECT flags
 #define VCPU_ALLOCATED_FLAG 1
 #define VCPU_READY_FLAG  2
+#define VCPU_HALTED_FLAG 4          // parked on HLT, not in the run queue
+#define VCPU_SLICING_FLAG 8         // HLT exiting and preemption timer requested
 
 typedef struct _SCHEDULER_CPU_STATE {
     SCHEDULER_VCPU_OBJECT*  vcpu_obj_list;
     SCHEDULER_VCPU_OBJECT*  current_vcpu_obj;
+    // ready vCPUs other than the current one, by increasing vruntime
+    SCHEDULER_VCPU_OBJECT*  ready_list;
+    // protects ready_list and the parked vCPUs; registration comes from
+    // any CPU
+    VMM_LOCK                lock;
+    UINT32                  num_vcpus;
+    UINT32                  num_halted;
+    UINT64                  min_vruntime;
+    UINT64                  last_charge_tsc;
+    UINT64                  slice_end_tsc;
+    UINT64                  switches;
 } SCHEDULER_CPU_STATE;
 
+#define SCHEDULER_TIME_SLICE_USEC   10000
+
 
 SCHEDULER_VCPU_OBJECT* scheduler_get_current_vcpu_for_guest( GUEST_ID guest_id );
 static UINT32 g_host_cpus_count  = 0;
@@ -68,6 +94,11 @@ static SCHEDULER_CPU_STATE* g_scheduler_state = 0;
 // lock to support guest addition while performing scheduling operations
 static VMM_READ_WRITE_LOCK g_registration_lock[1];
 
+// time slice in TSC ticks, and the VMX preemption timer rate
+static UINT64  g_slice_tsc = 0;
+static BOOLEAN g_vmx_timer_supported = FALSE;
+static UINT32  g_vmx_timer_rate = 0;     // timer ticks = TSC ticks >> rate
+
 
 static SCHEDULER_VCPU_OBJECT* gcpu_2_vcpu_obj( GUEST_CPU_HANDLE gcpu )
 {
@@ -96,16 +127,156 @@ void add_to_per_cpu_list(SCHEDULER_VCPU_OBJECT* vcpu_obj)
 #endif
     vcpu_obj->next_same_host_cpu = state->vcpu_obj_list;
     state->vcpu_obj_list = vcpu_obj;
+    state->num_vcpus++;
 #ifdef JLMDEBUG1
     bprint("add_to_per_cpu_list, done\n");
 #endif
     return;
 }
 
+// Run queue of a host CPU; called with state->lock held
+
+// insert after the vCPUs with the same vruntime, so equal ones round-robin
+static void ready_list_insert(SCHEDULER_CPU_STATE* state, SCHEDULER_VCPU_OBJECT* vcpu_obj)
+{
+    SCHEDULER_VCPU_OBJECT** link = &state->ready_list;
+
+    while (*link != NULL && (*link)->vruntime <= vcpu_obj->vruntime) {
+        link = &(*link)->next_ready;
+    }
+    vcpu_obj->next_ready = *link;
+    *link = vcpu_obj;
+}
+
+static void ready_list_remove(SCHEDULER_CPU_STATE* state, SCHEDULER_VCPU_OBJECT* vcpu_obj)
+{
+    SCHEDULER_VCPU_OBJECT** link = &state->ready_list;
+
+    while (*link != NULL && *link != vcpu_obj) {
+        link = &(*link)->next_ready;
+    }
+    if (*link != NULL) {
+        *link = vcpu_obj->next_ready;
+        vcpu_obj->next_ready = NULL;
+    }
+}
+
+// charge the run time since the last charge to the current vCPU
+static void charge_current_vcpu(SCHEDULER_CPU_STATE* state, UINT64 now)
+{
+    SCHEDULER_VCPU_OBJECT* current = state->current_vcpu_obj;
+    UINT64 min_vruntime;
+
+    if (current != NULL) {
+        current->vruntime += (now - state->last_charge_tsc) *
+                             SCHEDULER_DEFAULT_WEIGHT / current->weight;
+    }
+    state->last_charge_tsc = now;
+    // min_vruntime only grows; woken vCPUs start from it
+    min_vruntime = (current != NULL) ? current->vruntime : state->min_vruntime;
+    if (state->ready_list != NULL && state->ready_list->vruntime < min_vruntime) {
+        min_vruntime = state->ready_list->vruntime;
+    }
+    if (min_vruntime > state->min_vruntime) {
+        state->min_vruntime = min_vruntime;
+    }
+}
+
+// A woken vCPU does not get back the time it was halted, only up to a
+// slice of it, so it cannot monopolize the host CPU after a long halt
+static void wake_vcpu(SCHEDULER_CPU_STATE* state, SCHEDULER_VCPU_OBJECT* vcpu_obj)
+{
+    if (state->min_vruntime > g_slice_tsc &&
+        vcpu_obj->vruntime < state->min_vruntime - g_slice_tsc) {
+        vcpu_obj->vruntime = state->min_vruntime - g_slice_tsc;
+    }
+    vcpu_obj->flags &= (UINT16)~VCPU_HALTED_FLAG;
+    state->num_halted--;
+    // the current vCPU is not in the run queue, it goes back to it when
+    // its slice ends
+    if (vcpu_obj != state->current_vcpu_obj) {
+        ready_list_insert(state, vcpu_obj);
+    }
+}
+
+// The VMM does not see the interrupts that end a halt, so a parked vCPU
+// is woken after a slice and resumes after its HLT
+static void wake_expired_halts(SCHEDULER_CPU_STATE* state, UINT64 now)
+{
+    SCHEDULER_VCPU_OBJECT* vcpu_obj;
+
+    for (vcpu_obj = state->vcpu_obj_list; vcpu_obj != NULL;
+         vcpu_obj = vcpu_obj->next_same_host_cpu) {
+        if ((vcpu_obj->flags & VCPU_HALTED_FLAG) &&
+            (now - vcpu_obj->halt_tsc >= g_slice_tsc)) {
+            wake_vcpu(state, vcpu_obj);
+        }
+    }
+}
+
+// Request HLT exits and the VMX preemption timer for a vCPU that shares
+// its host CPU. Called once, with the vCPU active on this host CPU.
+static void setup_time_slicing(SCHEDULER_VCPU_OBJECT* vcpu_obj)
+{
+    VMEXIT_CONTROL                        request;
+    PIN_BASED_VM_EXECUTION_CONTROLS       pin_ctrls;
+    PROCESSOR_BASED_VM_EXECUTION_CONTROLS proc_ctrls;
+
+    vmm_memset(&request, 0, sizeof(request));
+    proc_ctrls.Uint32 = 0;
+    proc_ctrls.Bits.Hlt = 1;
+    request.proc_ctrls.bit_request = proc_ctrls.Uint32;
+    request.proc_ctrls.bit_mask = proc_ctrls.Uint32;
+    if (g_vmx_timer_supported) {
+        pin_ctrls.Uint32 = 0;
+        pin_ctrls.Bits.VmxTimer = 1;
+        request.pin_ctrls.bit_request = pin_ctrls.Uint32;
+        request.pin_ctrls.bit_mask = pin_ctrls.Uint32;
+    }
+    gcpu_control_setup(vcpu_obj->gcpu, &request);
+    vcpu_obj->flags |= VCPU_SLICING_FLAG;
+}
+
+// Let the current vCPU run to the end of the slice. Without the VMX
+// preemption timer the slice ends at the first VM exit after it.
+static void arm_slice_timer(SCHEDULER_CPU_STATE* state, SCHEDULER_VCPU_OBJECT* vcpu_obj,
+                            UINT64 now)
+{
+    UINT64 ticks = 0;
+
+    if (!(vcpu_obj->flags & VCPU_SLICING_FLAG)) {
+        setup_time_slicing(vcpu_obj);
+    }
+    if (!g_vmx_timer_supported) {
+        return;
+    }
+    if (state->slice_end_tsc > now) {
+        ticks = (state->slice_end_tsc - now) >> g_vmx_timer_rate;
+    }
+    if (ticks > 0xFFFFFFFF) {
+        ticks = 0xFFFFFFFF;
+    }
+    vmcs_write(gcpu_get_vmcs_layered(vcpu_obj->gcpu, VMCS_LEVEL_0),
+               VMCS_PREEMPTION_TIMER, ticks);
+}
+
+// save the full state of the previous vCPU and load the one of the next
+static void switch_to_vcpu(SCHEDULER_CPU_STATE* state, SCHEDULER_VCPU_OBJECT* next_vcpu)
+{
+    if (state->current_vcpu_obj != NULL) {
+        gcpu_swap_out(state->current_vcpu_obj->gcpu);
+    }
+    state->current_vcpu_obj = next_vcpu;
+    gcpu_swap_in(next_vcpu->gcpu);
+    state->switches++;
+}
+
 // init
 void scheduler_init( UINT16 number_of_host_cpus )
 {
     UINT32 memory_for_state  = 0;
+    const VMCS_HW_CONSTRAINTS* constraints = vmcs_hw_get_vmx_constraints();
+    UINT16 cpu;
 
     vmm_memset(g_registration_lock, 0, sizeof(g_registration_lock));
     g_host_cpus_count = number_of_host_cpus;
@@ -118,7 +289,6 @@ void scheduler_init( UINT16 number_of_host_cpus )
            g_host_cpus_count, memory_for_state);
 #endif
     g_scheduler_state = (SCHEDULER_CPU_STATE*) vmm_malloc(memory_for_state);
-    vmm_memset((void*)g_scheduler_state, 0, sizeof(SCHEDULER_CPU_STATE));
 #ifdef JLMDEBUG
     if(g_scheduler_state ==0) {
         bprint("Cant allocate scheduler state\n");
@@ -126,6 +296,13 @@ void scheduler_init( UINT16 number_of_host_cpus )
     }
 #endif
     VMM_ASSERT(g_scheduler_state != 0);
+    vmm_memset((void*)g_scheduler_state, 0, memory_for_state);
+    for (cpu = 0; cpu < number_of_host_cpus; cpu++) {
+        lock_initialize(&g_scheduler_state[cpu].lock);
+    }
+    g_slice_tsc = hw_get_tsc_ticks_per_second() / 1000000 * SCHEDULER_TIME_SLICE_USEC;
+    g_vmx_timer_supported = constraints->may1_pin_based_exec_ctrl.Bits.VmxTimer;
+    g_vmx_timer_rate = constraints->vmx_timer_length;
 }
 
 // register guest cpu
@@ -147,12 +324,20 @@ void scheduler_register_gcpu(GUEST_CPU_HANDLE gcpu_handle, CPU_ID host_cpu_id,
     vcpu_obj->gcpu  = gcpu_handle;
     vcpu_obj->flags = 0;
     vcpu_obj->host_cpu = host_cpu_id;
+    vcpu_obj->weight = SCHEDULER_DEFAULT_WEIGHT;
+    vcpu_obj->vruntime = 0;
+    vcpu_obj->next_ready = NULL;
     vcpu_obj->flags|= VCPU_ALLOCATED_FLAG;
     if (schedule_immediately) {
         vcpu_obj->flags|= (UINT16)VCPU_READY_FLAG;
     }
-    // add to the per-host-cpu list
+    // add to the per-host-cpu list and run queue
     add_to_per_cpu_list(vcpu_obj);
+    if (schedule_immediately) {
+        lock_acquire(&g_scheduler_state[host_cpu_id].lock);
+        ready_list_insert(&g_scheduler_state[host_cpu_id], vcpu_obj);
+        lock_release(&g_scheduler_state[host_cpu_id].lock);
+    }
     lock_release_writelock(g_registration_lock);
 #ifdef JLMDEBUG
     bprint("scheduler_register_gcpu done, gpus: %d\n", g_registered_vcpus_count);
@@ -212,52 +397,80 @@ GUEST_CPU_HANDLE scheduler_same_host_cpu_gcpu_first( SCHEDULER_GCPU_ITERATOR* ct
 }
 
 
+
 // scheduler
 GUEST_CPU_HANDLE scheduler_select_initial_gcpu(void)
 {
     CPU_ID                 host_cpu = hw_cpu_id();
     SCHEDULER_CPU_STATE*   state = &(g_scheduler_state[host_cpu]);
-    SCHEDULER_VCPU_OBJECT* next_vcpu = state->vcpu_obj_list;
+    SCHEDULER_VCPU_OBJECT* next_vcpu = NULL;
+    UINT64                 now = hw_rdtsc();
    
 #ifdef JLMDEBUG
     bprint("scheduler_select_initial_gcpu\n");
 #endif
-    // very simple implementation
-    // assume only one guest per host CPU
-    if (!(next_vcpu && ((next_vcpu->flags&VCPU_READY_FLAG)!=0))) {
+    lock_acquire(&state->lock);
+    next_vcpu = state->ready_list;
+    if (next_vcpu != NULL) {
+        ready_list_remove(state, next_vcpu);
+    }
+    state->last_charge_tsc = now;
+    state->slice_end_tsc = now + g_slice_tsc;
+    lock_release(&state->lock);
+    if (next_vcpu == NULL) {
         return NULL;
     }
     state->current_vcpu_obj = next_vcpu;
     // load full state of new guest from memory
     gcpu_swap_in(state->current_vcpu_obj->gcpu);  
+    if (state->num_vcpus > 1) {
+        arm_slice_timer(state, next_vcpu, now);
+    }
     return next_vcpu->gcpu;
 }
 
+// Called after every VM exit; the vCPU changes only at the end of a slice
 GUEST_CPU_HANDLE scheduler_select_next_gcpu( void )
 {
     CPU_ID                 host_cpu = hw_cpu_id();
     SCHEDULER_CPU_STATE*   state = &(g_scheduler_state[host_cpu]);
-    SCHEDULER_VCPU_OBJECT* next_vcpu = NULL;
-
-    if(state->current_vcpu_obj != NULL) {
-        next_vcpu = state->current_vcpu_obj->next_same_host_cpu;
+    SCHEDULER_VCPU_OBJECT* current = state->current_vcpu_obj;
+    SCHEDULER_VCPU_OBJECT* next_vcpu = current;
+    UINT64                 now;
+
+    // the only vCPU of this host CPU runs as long as it is ready
+    if (state->num_vcpus <= 1) {
+        if (!(current && ((current->flags&VCPU_READY_FLAG)!=0))) {
+            return NULL;
+        }
+        return current->gcpu;
     }
-    if(next_vcpu == NULL) {
-        next_vcpu = state->vcpu_obj_list;
+    now = hw_rdtsc();
+    lock_acquire(&state->lock);
+    charge_current_vcpu(state, now);
+    if (state->num_halted != 0) {
+        wake_expired_halts(state, now);
     }
-    // very simple implementation
-    // assume only one guest per host CPU
-    if (!(next_vcpu && ((next_vcpu->flags&VCPU_READY_FLAG)!=0))) {
+    if (current == NULL || (current->flags & VCPU_HALTED_FLAG) ||
+        now >= state->slice_end_tsc) {
+        // the ready vCPU that ran least, relative to its weight, gets a slice
+        if (current != NULL && !(current->flags & VCPU_HALTED_FLAG)) {
+            ready_list_insert(state, current);
+        }
+        next_vcpu = state->ready_list;
+        if (next_vcpu != NULL) {
+            ready_list_remove(state, next_vcpu);
+        }
+        state->slice_end_tsc = now + g_slice_tsc;
+    }
+    lock_release(&state->lock);
+    if (next_vcpu == NULL) {
         return NULL;
     }
-    if (state->current_vcpu_obj != next_vcpu) {
-        if (state->current_vcpu_obj != NULL) {
-            // save full state of prev. guest in memory
-            gcpu_swap_out(state->current_vcpu_obj->gcpu);   
-        }
-        state->current_vcpu_obj = next_vcpu;
-        gcpu_swap_in(state->current_vcpu_obj->gcpu);        // load full state of new guest from memory
+    if (next_vcpu != current) {
+        switch_to_vcpu(state, next_vcpu);
     }
+    arm_slice_timer(state, next_vcpu, now);
     return next_vcpu->gcpu;
 }
 
@@ -267,23 +480,64 @@ GUEST_CPU_HANDLE scheduler_schedule_gcpu( GUEST_CPU_HANDLE gcpu )
     CPU_ID                 host_cpu = hw_cpu_id();
     SCHEDULER_CPU_STATE*   state = NULL;
     SCHEDULER_VCPU_OBJECT* next_vcpu = gcpu_2_vcpu_obj(gcpu);
+    SCHEDULER_VCPU_OBJECT* current = NULL;
+    UINT64                 now;
 
     if (!(next_vcpu && ((next_vcpu->flags&VCPU_READY_FLAG)!=0))) {
         return NULL;
     }
     state = &(g_scheduler_state[host_cpu]);
-    if (state->current_vcpu_obj != next_vcpu) {
-        if (state->current_vcpu_obj != NULL) {
-            // save full state of prev. guest in memory
-            gcpu_swap_out(state->current_vcpu_obj->gcpu);   
+    current = state->current_vcpu_obj;
+    if (current != next_vcpu) {
+        if (state->num_vcpus > 1) {
+            // the requested vCPU starts a new slice, even if it is halted
+            now = hw_rdtsc();
+            lock_acquire(&state->lock);
+            charge_current_vcpu(state, now);
+            if (next_vcpu->flags & VCPU_HALTED_FLAG) {
+                wake_vcpu(state, next_vcpu);
+            }
+            ready_list_remove(state, next_vcpu);
+            if (current != NULL && !(current->flags & VCPU_HALTED_FLAG)) {
+                ready_list_insert(state, current);
+            }
+            state->slice_end_tsc = now + g_slice_tsc;
+            lock_release(&state->lock);
+            switch_to_vcpu(state, next_vcpu);
+            arm_slice_timer(state, next_vcpu, now);
+        }
+        else {
+            switch_to_vcpu(state, next_vcpu);
         }
-        state->current_vcpu_obj = next_vcpu;
-        // load full state of new guest from memory
-        gcpu_swap_in(state->current_vcpu_obj->gcpu);        
     }
     return state->current_vcpu_obj->gcpu;
 }
 
+// HLT exits are requested only for vCPUs that share their host CPU.
+// If another vCPU is ready the halted one is parked, otherwise the host
+// CPU halts in the guest until an interrupt or the end of the slice.
+BOOLEAN scheduler_halt_gcpu( GUEST_CPU_HANDLE gcpu )
+{
+    SCHEDULER_CPU_STATE*   state = &(g_scheduler_state[hw_cpu_id()]);
+    SCHEDULER_VCPU_OBJECT* vcpu_obj = state->current_vcpu_obj;
+
+    if (state->num_vcpus <= 1 || vcpu_obj == NULL || vcpu_obj->gcpu != gcpu) {
+        return FALSE;
+    }
+    gcpu_skip_guest_instruction(gcpu);
+    lock_acquire(&state->lock);
+    if (state->ready_list != NULL) {
+        vcpu_obj->flags |= VCPU_HALTED_FLAG;
+        vcpu_obj->halt_tsc = hw_rdtsc();
+        state->num_halted++;
+    }
+    else {
+        gcpu_set_activity_state(gcpu, Ia32VmxVmcsGuestSleepStateHlt);
+    }
+    lock_release(&state->lock);
+    return TRUE;
+}
+
 GUEST_CPU_HANDLE scheduler_get_current_gcpu_for_guest( GUEST_ID guest_id )
 {
     SCHEDULER_VCPU_OBJECT* vcpu_obj;
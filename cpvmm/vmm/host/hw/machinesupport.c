@@ -448,14 +448,13 @@ INT32 hw_interlocked_decrement(INT32 * minuend)
 
 INT32 hw_interlocked_add(INT32 volatile * addend, INT32 value)
 {
+    // xadd leaves the previous value in the source register
     __asm__ volatile(
-        "\tmovq     %[addend], %%rbx\n"
-        "\tmovl     %[value], %%eax\n"
-        "\tlock;    addl %%eax, (%%rbx)\n"
-    : 
-    : [addend] "p" (addend), [value] "r" (value)
-    : "%eax", "%rbx");
-    return *addend;
+        "\tlock;    xaddl %[value], %[addend]\n"
+    : [value] "+r" (value), [addend] "+m" (*addend)
+    :
+    : "memory", "cc");
+    return value;
 }
 
 INT32 hw_interlocked_or(INT32 volatile * value, INT32 mask)
@@ -494,25 +493,13 @@ void hw_store_fence(void)
 INT32 hw_interlocked_compare_exchange(INT32 volatile * destination,
                                       INT32 expected, INT32 comperand)
 {
-#ifdef JLMDEBUG1
-    bprint("expected: %d, new: %d --- ", expected, comperand);
-#endif
-    INT32 old = *destination;
+    // cmpxchg leaves the previous value in eax
     __asm__ volatile(
-        "\tmovq     %[destination], %%r15\n"
-        "\tmovl     (%%r15), %%edx\n"
-        "\tmovl     %[expected], %%eax\n"
-        "\tmovl     %[comperand], %%ecx\n"
-        "\tcmpxchgl %%ecx, %%edx\n"
-        "\tmovl     %%edx, (%%r15)\n"
-    :
-    : [expected] "m" (expected), [comperand] "m" (comperand),
-      [destination] "m" (destination)
-    :"%eax", "%ecx", "%edx", "%rbx", "%r15");
-#ifdef JLMDEBUG1
-    bprint("destination: %d\n", *destination);
-#endif
-    return old;
+        "\tlock;    cmpxchgl %[comperand], %[destination]\n"
+    : [expected] "+a" (expected), [destination] "+m" (*destination)
+    : [comperand] "r" (comperand)
+    : "memory", "cc");
+    return expected;
 }
 
 
@@ -554,14 +541,13 @@ INT64 hw_interlocked_compare_exchange_64(INT64 volatile * destination,
 
 INT32 hw_interlocked_assign(INT32 volatile * target, INT32 new_value)
 {
+    // xchg leaves the previous value in the register
     __asm__ volatile(
-        "\tmovq     %[target], %%rbx\n"
-        "\tmovl     %[new_value], %%eax\n"
-        "\txchgl %%eax, (%%rbx)\n"
-    : 
-    : [new_value] "m" (new_value), [target] "r" (target)
-    : "%eax", "%rbx");
-    return *target;
+        "\txchgl %[new_value], %[target]\n"
+    : [new_value] "+r" (new_value), [target] "+m" (*target)
+    :
+    : "memory");
+    return new_value;
 }
 
 
@@ -16,15 +16,32 @@
 #define _CACHE64_H_
 
 typedef struct CACHE64_STRUCT * CACHE64_OBJECT;
-typedef void (*CACHE64_FIELD_PROCESS_FUNCTION)(UINT32 entry_no, void *arg);
+// value is the cached value of entry_no
+typedef void (*CACHE64_FIELD_PROCESS_FUNCTION)(UINT32 entry_no, UINT64 value, void *arg);
 
 #define CACHE_ALL_ENTRIES   ((UINT32) -1)
 #define CACHE_DIRTY_FLAG 1
 #define CACHE_VALID_FLAG 2
 
-CACHE64_OBJECT cache64_create(UINT32 num_of_entries);
+#define CACHE64_MAX_ENTRIES 192
+#define CACHE64_MAX_WORDS   (CACHE64_MAX_ENTRIES / 64)
+
+// Placement of the entries in the caches that share it. The hot entries
+// are given the first slots, so the accesses of a typical VM exit stay
+// in the first dirty and valid words and in the first lines of the table.
+typedef struct _CACHE64_LAYOUT {
+    UINT8   slot_of_entry[CACHE64_MAX_ENTRIES];
+    UINT8   entry_of_slot[CACHE64_MAX_ENTRIES];
+} CACHE64_LAYOUT;
+
+void    cache64_layout_init(CACHE64_LAYOUT *layout, UINT32 num_of_entries,
+            const UINT32 *hot_entries, UINT32 num_of_hot_entries);
+// layout must stay valid for the life of the cache
+CACHE64_OBJECT cache64_create(UINT32 num_of_entries, const CACHE64_LAYOUT *layout);
 void    cache64_write(CACHE64_OBJECT cache, UINT64 value, UINT32 entry_no);
 BOOLEAN cache64_read(CACHE64_OBJECT cache, UINT64 *p_value, UINT32 entry_no); 
+// store a value just read from the backing store: valid, but not dirty
+void    cache64_fill(CACHE64_OBJECT cache, UINT64 value, UINT32 entry_no);
 // return cache flags
 UINT32  cache64_read_raw(CACHE64_OBJECT cache, UINT64 *p_value, UINT32 entry_no); 
 // clean valid bits
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+  VM exit trace
+
+  Every host CPU owns a ring of fixed size binary records, one per VM exit,
+  written only by that CPU and without locks. A ring is a single block of
+  memory, header followed by the records, and is dumped as is; the layout
+  below is shared with the host side decoder (test/exittrace.c).
+*/
+
+#ifndef EXIT_TRACE_H
+#define EXIT_TRACE_H
+
+#include "vmm_defs.h"
+
+#define EXIT_TRACE_MAGIC            0x52545845  // "EXTR"
+#define EXIT_TRACE_VERSION          1
+// must be a power of 2
+#define EXIT_TRACE_RECORDS_PER_CPU  4096
+
+typedef struct _EXIT_TRACE_RECORD {
+    UINT64  tsc;            // TSC at VM exit
+    UINT64  guest_rip;
+    UINT32  handler_cycles; // TSC cycles from VM exit to resume, saturated
+    UINT16  exit_reason;    // basic exit reason
+    UINT16  guest_id;
+    UINT16  guest_cpu_id;
+    UINT16  reserved0;
+    UINT32  reserved1;
+} EXIT_TRACE_RECORD;
+
+typedef struct _EXIT_TRACE_RING {
+    UINT32  magic;
+    UINT16  version;
+    UINT16  cpu_id;         // host CPU
+    UINT32  num_records;    // power of 2
+    UINT32  reserved;
+    // number of records ever written, record n is at records[n % num_records]
+    volatile UINT64 head;
+    // set in dumps only: records written while the dump was copied, they
+    // may have overwritten the oldest ones
+    UINT64  dump_overrun;
+    EXIT_TRACE_RECORD records[1];
+} EXIT_TRACE_RING;
+
+#define EXIT_TRACE_RING_SIZE(__num_records)                                     \
+    (sizeof(EXIT_TRACE_RING) + ((__num_records) - 1) * sizeof(EXIT_TRACE_RECORD))
+
+
+// FUNCTION : exit_trace_initialize()
+// PURPOSE  : Allocate the rings of all host CPUs and start tracing
+// ARGUMENTS: UINT16 num_of_cpus
+// RETURNS  : TRUE if the rings were allocated
+BOOLEAN exit_trace_initialize(UINT16 num_of_cpus);
+
+// FUNCTION : exit_trace_guest_initialize()
+// PURPOSE  : Register the VMCALL that dumps the rings to the guest
+// ARGUMENTS: GUEST_ID guest_id
+// RETURNS  : void
+void exit_trace_guest_initialize(GUEST_ID guest_id);
+
+// FUNCTION : exit_trace_enable()
+// PURPOSE  : Start or stop recording VM exits on all CPUs
+// ARGUMENTS: BOOLEAN enable
+// RETURNS  : void
+void exit_trace_enable(BOOLEAN enable);
+
+// FUNCTION : exit_trace_record()
+// PURPOSE  : Record a VM exit on the current host CPU. Called just before
+//          : the guest is resumed.
+// ARGUMENTS: UINT64   exit_tsc - TSC read when the VM exit was entered
+//          : UINT32   exit_reason
+//          : UINT64   guest_rip
+//          : GUEST_ID guest_id
+//          : CPU_ID   guest_cpu_id
+// RETURNS  : void
+void exit_trace_record(UINT64 exit_tsc, UINT32 exit_reason, UINT64 guest_rip,
+                       GUEST_ID guest_id, CPU_ID guest_cpu_id);
+
+// FUNCTION : exit_trace_ring()
+// PURPOSE  : Get the ring of a host CPU
+// ARGUMENTS: CPU_ID cpu_id
+// RETURNS  : the ring, NULL if tracing is not initialized
+const EXIT_TRACE_RING* exit_trace_ring(CPU_ID cpu_id);
+
+#endif // EXIT_TRACE_H
@@ -503,5 +503,7 @@ void *gcpu_get_vmdb(GUEST_CPU_HANDLE gcpu);
 void gcpu_set_vmdb(GUEST_CPU_HANDLE gcpu, void * vmdb);
 void * gcpu_get_timer(GUEST_CPU_HANDLE gcpu);
 void gcpu_assign_timer(GUEST_CPU_HANDLE gcpu, void *timer);
+void *gcpu_get_page_walk_cache(GUEST_CPU_HANDLE gcpu);
+void gcpu_set_page_walk_cache(GUEST_CPU_HANDLE gcpu, void *cache);
 #endif // _GUEST_CPU_H_
 
@@ -41,7 +41,8 @@ HASH64_HANDLE hash64_create_default_hash(UINT32 hash_size);
 /* Function: hash64_create_hash
 *  Description: This function is used in order to create 1-1 hash
 *  Input: hash_func - hash function which returns index in array which is lower
-*                     than "hash_size" parameter.
+*                     than "hash_size" parameter. Kept for compatibility, the
+*                     hash is open-addressing and mixes the keys itself.
  *         mem_alloc_func - function which will be used for allocation of inner
  *                    data structures. If it is NULL then allocation will
  *                    be performed directly from heap.
@@ -53,11 +54,12 @@ HASH64_HANDLE hash64_create_default_hash(UINT32 hash_size);
  *                    In order to know the required size, use "hash64_get_node_size"
  *                    function.
  *         node_dealloc_func - function which will be used for deallocation of each node,
- *                    when necessary.
+ *                    when necessary. 1-1 hash doesn't allocate nodes.
  *         node_allocation_deallocation_context - context which will be passed to
  *                    "node_alloc_func" and "node_dealloc_func"
  *                    functions as parameter.
- *         hash_size - number of cells in hash array.
+ *         hash_size - expected number of elements. The hash grows by itself
+ *                    when it fills up.
  *  Return value: Hash handle which should be used as parameter for other functions.
  *                In case of failure, HASH64_INVALID_HANDLE will be returned
  */
@@ -79,6 +81,8 @@ void hash64_destroy_hash(HASH64_HANDLE hash_handle);
 
 /* Function: hash64_lookup
  *  Description: This function is used in order to find the value in 1-1 hash for given key.
+ *         The hash does no locking: lookups must hold the same lock as the
+ *         insertions and removals, also while the hash is growing.
  *  Input:
  *         hash_handle - handle returned by "hash64_create_hash" function
  *         key -
@@ -137,6 +141,8 @@ BOOLEAN hash64_is_empty(HASH64_HANDLE hash_handle);
 
 /* Function: hash64_change_size_and_rehash
  *  Description: This function is used in order to change the size of the hash and rehash it.
+ *               The elements are moved to the new array gradually by the following
+ *               insertions and removals.
  *  Input:
  *         hash_handle - handle returned by "hash64_create_hash" function
  *         hash_size   - new size
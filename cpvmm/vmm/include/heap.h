@@ -25,9 +25,13 @@
 #define HEAP_PAGE_INT UINT32
 
 typedef struct {
-    HEAP_PAGE_INT number_of_pages:31; // When in_use=1, this represents the number of allocated pages
-                                      // When in_use=0, represents the number of contiguos pages from this address
+    HEAP_PAGE_INT number_of_pages:30; // When in_use=1, this represents the number of allocated pages
+                                      // When in_use=0, represents the length of the free run; kept
+                                      // in the first and the last page of the run
     HEAP_PAGE_INT in_use:1;           // 1=InUse
+    HEAP_PAGE_INT cached:1;           // 1=single page parked in a per-CPU page cache
+    HEAP_PAGE_INT next_free;          // free list links, valid in the first page of a free run
+    HEAP_PAGE_INT prev_free;
 
 #ifdef DEBUG
     INT32 line_number;
@@ -146,4 +146,79 @@ BOOLEAN ipc_sipi_vmexit_handler(GUEST_CPU_HANDLE gcpu);
 
 void ipc_print_cpu_context(CPU_ID cpu_id, BOOLEAN use_lock);
 
+
+// Batched IPC
+//
+// A sender collects TLB/EPT invalidations and handler calls in an IPC_BATCH
+// and sends them with ipc_batch_flush(), which signals every destination CPU
+// once for the whole batch. A destination goes over the batch in one pass:
+// it calls the handlers in order, and then does the invalidations, with
+// overlapping and adjacent ranges merged and large ones turned into a
+// single TLB flush or context wide INVEPT. The batch is sent synchronously,
+// ipc_batch_flush returns when all destinations are done with it.
+
+#define IPC_BATCH_MAX_ENTRIES       32
+
+typedef enum
+{
+    IPC_BATCH_INVLPG,               // range of HVAs
+    IPC_BATCH_FLUSH_TLB,
+    IPC_BATCH_INVEPT_ADDRESS,       // range of GPAs of an EPT context
+    IPC_BATCH_INVEPT_CONTEXT,       // EPT context, 0 for all contexts
+    IPC_BATCH_HANDLER
+} IPC_BATCH_ENTRY_TYPE;
+
+typedef struct _IPC_BATCH_ENTRY
+{
+    IPC_BATCH_ENTRY_TYPE type;
+    UINT32               padding;
+    union {
+        struct {
+            UINT64 eptp;
+            UINT64 start;
+            UINT64 size;
+        } range;
+        struct {
+            IPC_HANDLER_FN handler;
+            void           *arg;
+        } call;
+    } u;
+} IPC_BATCH_ENTRY;
+
+typedef struct _IPC_BATCH
+{
+    IPC_DESTINATION dst;
+    BOOLEAN         include_self;   // apply the batch on this CPU as well
+    UINT32          num_entries;
+    IPC_BATCH_ENTRY entries[IPC_BATCH_MAX_ENTRIES];
+} IPC_BATCH;
+
+// FUNCTION:        ipc_batch_init
+// DESCRIPTION:     Start an empty batch for the given destination CPUs.
+// ARGUMENTS:       include_self -- also apply the batch on this CPU when it is flushed
+void ipc_batch_init(IPC_BATCH *batch, IPC_DESTINATION dst, BOOLEAN include_self);
+
+// FUNCTION:        ipc_batch_add_invlpg, ipc_batch_add_flush_tlb
+// DESCRIPTION:     Add invalidation of the VMM TLB entries of a range of HVAs,
+//                  or of the whole TLB. A full batch is flushed first.
+void ipc_batch_add_invlpg(IPC_BATCH *batch, HVA start, UINT64 size);
+void ipc_batch_add_flush_tlb(IPC_BATCH *batch);
+
+// FUNCTION:        ipc_batch_add_invept, ipc_batch_add_invept_context
+// DESCRIPTION:     Add INVEPT of a range of GPAs of an EPT context, or of a
+//                  whole context (eptp 0 for all contexts). A full batch is
+//                  flushed first.
+void ipc_batch_add_invept(IPC_BATCH *batch, UINT64 eptp, GPA start, UINT64 size);
+void ipc_batch_add_invept_context(IPC_BATCH *batch, UINT64 eptp);
+
+// FUNCTION:        ipc_batch_add_handler
+// DESCRIPTION:     Add a handler call. A full batch is flushed first.
+void ipc_batch_add_handler(IPC_BATCH *batch, IPC_HANDLER_FN handler, void *arg);
+
+// FUNCTION:        ipc_batch_flush
+// DESCRIPTION:     Send the batch to its destinations and wait until they applied it,
+//                  then empty it.
+// RETURN VALUE:    number of other CPUs which applied the batch
+UINT32 ipc_batch_flush(IPC_BATCH *batch);
+
 #endif
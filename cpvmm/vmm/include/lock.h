@@ -20,13 +20,44 @@
 #include "vmm_dbg.h"
 
 
+// Ticket lock
+//
+// uint32_lock holds two 16 bit counters: the low half is the ticket being
+// served, the high half the next ticket to hand out. A CPU takes a ticket
+// with an atomic add and spins reading until it is served, so the lock is
+// granted in arrival order and waiters only write the lock line once.
+//
+// With LOCK_STATS defined every lock also counts its acquisitions, the ones
+// that had to wait and the TSC cycles spent waiting; "debug locks" in the
+// CLI prints them.
+
+#define LOCK_TICKET_SHIFT   16
+#define LOCK_TICKET_MASK    0xFFFF
+
 typedef struct _VMM_LOCK {
-    volatile UINT32 uint32_lock;
+    union {
+        volatile UINT32 uint32_lock;
+        struct {
+            volatile UINT16 serving;
+            volatile UINT16 next;
+        } ticket;
+    } u;
     volatile CPU_ID owner_cpu_id;
     char padding[2];
+#ifdef LOCK_STATS
+    UINT32  stats_index;    // 1 + slot in the table of locks seen, 0 if none
+    UINT32  stats_padding;
+    UINT64  acquisitions;
+    UINT64  contended_acquisitions;
+    UINT64  spin_cycles;
+#endif
 } VMM_LOCK;
 
-#define LOCK_INIT_STATE     {(UINT32) 0, (CPU_ID) -1, {0}}
+#ifdef LOCK_STATS
+#define LOCK_INIT_STATE     {{(UINT32) 0}, (CPU_ID) -1, {0}, 0, 0, 0, 0, 0}
+#else
+#define LOCK_INIT_STATE     {{(UINT32) 0}, (CPU_ID) -1, {0}}
+#endif
 
 
 // Read/Write lock
@@ -34,11 +65,18 @@ typedef struct _VMM_LOCK {
 // multiple readers can read the data in parallel but an exclusive lock is
 // needed while writing the data. When a writer is writing the data, readers
 // will be blocked until the writer has finished writing
+//
+// readers only do an atomic add on the readers word, they don't go through
+// the inner lock. Writers queue on the inner lock, then set
+// RW_LOCK_WRITER in readers, which turns new readers away, and wait for the
+// readers already in to leave.
+
+#define RW_LOCK_WRITER      0x40000000
 
 typedef struct _VMM_READ_WRITE_LOCK {
     VMM_LOCK        lock;
     UINT32          padding;
-    volatile INT32  readers;
+    volatile INT32  readers;    // RW_LOCK_WRITER | number of readers
 } VMM_READ_WRITE_LOCK;
 
 
@@ -56,11 +94,18 @@ lock_release(    VMM_LOCK* lock );
 void
 lock_initialize(  VMM_LOCK* lock );
 
+BOOLEAN
+lock_try_acquire(    VMM_LOCK* lock );
+
 #ifdef DEBUG
 void
 lock_print(    VMM_LOCK* lock );
 #endif
 
+// register "debug locks", which prints the LOCK_STATS counters
+void
+lock_cli_init( void );
+
 void
 lock_initialize_read_write_lock( VMM_READ_WRITE_LOCK * lock );
 
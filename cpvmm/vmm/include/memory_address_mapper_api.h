@@ -96,6 +96,18 @@ typedef UINT32 MAM_MAPPING_RESULT;
 MAM_HANDLE mam_create_mapping(MAM_ATTRIBUTES inner_level_attributes);
 
 
+/* Function: mam_translation_cache_initialize
+*  Description: Allocates the per CPU caches of the translations done by
+*               "mam_get_mapping". Must be called once hw_cpu_id() is valid;
+*               until then translations aren't cached. Exists only when
+*               built with MAM_TRANSLATION_CACHE.
+*  Input: num_of_cpus - number of CPUs
+*  Return Value: TRUE in case of success
+*/
+#ifdef MAM_TRANSLATION_CACHE
+BOOLEAN mam_translation_cache_initialize(UINT16 num_of_cpus);
+#endif
+
 /* Function: mam_destroy_mapping
 *  Description: Destroys all data structures relevant to particular
 *               mapping.
@@ -239,6 +251,17 @@ BOOLEAN mam_convert_to_64bit_page_tables(IN MAM_HANDLE mam_handle,
 BOOLEAN mam_convert_to_32bit_pae_page_tables(IN MAM_HANDLE mam_handle,
                                              OUT UINT32* pdpt_hpa);
 
+/* Function: mam_compact_mapping
+*  Description: This function replaces the tables that map uniform ranges
+*               (contiguous target, same attributes) by single 2MB or 1GB
+*               leaf entries, where the mapping format and the super page
+*               support allow it. Leaf entries are split again by the first
+*               update of a sub range. When the mapping is in use by the
+*               hardware, the caller must flush the TLBs (INVEPT) afterwards.
+*  Input: mam_handle - handle created by "mam_create_mapping";
+*/
+void mam_compact_mapping(IN MAM_HANDLE mam_handle);
+
 /* Function: mam_get_memory_ranges_iterator
 *  Description: This function returns the iterator, using which it is possible to iterate
 *               over existing mappings.
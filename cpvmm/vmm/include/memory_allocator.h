@@ -35,6 +35,11 @@ void vmm_mem_free( char *file_name, INT32 line_number,
 void* vmm_mem_allocate_aligned( char *file_name,
     INT32 line_number, IN UINT32 size, IN UINT32 alignment);
 
+// FUNCTION : vmm_mem_allocator_enable_cpu_cache()
+// PURPOSE  : Start serving allocations on the calling CPU from its
+//            magazines. Must be called on that CPU after hw_gdt_load().
+void vmm_mem_allocator_enable_cpu_cache(CPU_ID cpu_id);
+
 // FUNCTION : vmm_mem_buff_size()
 // PURPOSE  : Get size of buff
 // ARGUMENTS: IN void *p_buffer - the buffer
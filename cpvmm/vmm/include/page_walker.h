@@ -75,4 +75,17 @@ PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu,
 BOOLEAN pw_is_pdpt_in_32_bit_pae_mode_valid(IN GUEST_CPU_HANDLE gcpu,
                                             IN void* pdpt_ptr);
 
+/* Function: pw_cache_initialize
+ * Description: Allocates the page walk cache of every existing and later
+ *              added guest CPU. Page walks are not cached before this call.
+ */
+void pw_cache_initialize(void);
+
+/* Function: pw_cache_flush
+ * Description: Invalidates all the cached page walks of the guest CPU
+ * Input:
+ *       gcpu - gcpu handle
+ */
+void pw_cache_flush(IN GUEST_CPU_HANDLE gcpu);
+
 #endif
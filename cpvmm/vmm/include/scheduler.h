@@ -57,6 +57,15 @@ GUEST_CPU_HANDLE scheduler_select_next_gcpu( void );
 
 GUEST_CPU_HANDLE scheduler_schedule_gcpu( GUEST_CPU_HANDLE gcpu );
 
+// Handle HLT of the current gCPU when it shares the host CPU with others:
+// the gCPU is parked for one time slice, or until scheduler_schedule_gcpu()
+// picks it. Returns FALSE if the gCPU runs alone and the HLT was not handled.
+BOOLEAN scheduler_halt_gcpu( GUEST_CPU_HANDLE gcpu );
+
+// Relative share of the host CPU a gCPU gets when it shares it with
+// others; registered gCPUs get SCHEDULER_DEFAULT_WEIGHT
+#define SCHEDULER_DEFAULT_WEIGHT    1024
+
 
 // init scheduler.
 void scheduler_init( UINT16 number_of_host_cpus );
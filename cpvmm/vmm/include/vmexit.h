@@ -25,6 +25,13 @@ typedef enum {
 
 typedef VMEXIT_HANDLING_STATUS (*VMEXIT_HANDLER)(GUEST_CPU_HANDLE);
 
+// Fast path handlers run at the start of vmexit_common_handler(), before the
+// GCPU and VMCS caches are set up, and return TRUE if they fully handled the
+// VM exit, the guest is then resumed at once. They may only use the guest
+// GP registers and read and write the VMCS, FALSE lets the VM exit take the
+// regular path.
+typedef BOOLEAN (*VMEXIT_FAST_PATH_HANDLER)(GUEST_CPU_HANDLE);
+
 
 // FUNCTION : vmexit_initialize()
 // PURPOSE  : Perform basic vmexit initialization common for all guests
@@ -52,6 +59,19 @@ VMM_STATUS vmexit_install_handler(
     UINT32          reason);
 
 
+// FUNCTION : vmexit_install_fast_path_handler
+// PURPOSE  : Install a VMEXIT fast path handler, tried before the handler
+//          : installed with vmexit_install_handler()
+// ARGUMENTS: GUEST_ID                  guest_id
+//          : VMEXIT_FAST_PATH_HANDLER  handler, NULL to remove it
+//          : UINT32                    reason
+// RETURNS  : VMM_STATUS
+VMM_STATUS vmexit_install_fast_path_handler(
+    GUEST_ID                  guest_id,
+    VMEXIT_FAST_PATH_HANDLER  handler,
+    UINT32                    reason);
+
+
 VMEXIT_HANDLING_STATUS vmexit_handler_default(GUEST_CPU_HANDLE); // should not be here
 
 
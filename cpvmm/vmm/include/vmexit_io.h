@@ -68,6 +68,21 @@ VMM_STATUS io_vmexit_handler_register( GUEST_ID guest_id,
                 IO_PORT_ID  port_id, IO_ACCESS_HANDLER handler,
                 void *handler_context);
 
+// FUNCTION : io_vmexit_handler_register_range()
+// PURPOSE  : Register/update one IO handler for all ports in the range
+//          : [port_from, port_to] of the guest, e.g. a serial port or
+//          : the PCI configuration ports. The range takes a single
+//          : descriptor and replaces handlers registered before on its ports.
+// ARGUMENTS: GUEST_ID            guest_id
+//          : IO_PORT_ID          port_from
+//          : IO_PORT_ID          port_to
+//          : IO_ACCESS_HANDLER   handler
+//          : void*               handler_context - passed as it to the handler
+// RETURNS  : status
+VMM_STATUS io_vmexit_handler_register_range( GUEST_ID guest_id,
+                IO_PORT_ID port_from, IO_PORT_ID port_to,
+                IO_ACCESS_HANDLER handler, void *handler_context);
+
 // FUNCTION : io_vmexit_handler_unregister()
 // PURPOSE  : Unregister IO handler for spec port/guest pair.
 // ARGUMENTS: GUEST_ID            guest_id
@@ -23,10 +23,18 @@ typedef BOOLEAN (*MSR_ACCESS_HANDLER)(GUEST_CPU_HANDLE  gcpu,
                                       UINT64           *p_value,
                                       void             *context);
 
+// Handlers can be registered only for MSRs covered by the VMEXIT bitmap.
+// msr_index maps each of them, low range first, to 1 + its slot in
+// msr_descriptors, or to 0 if it has no handler.
+#define MSR_MAX_DESCRIPTORS     255
+#define MSR_INDEX_SIZE          ((MSR_LOW_LAST - MSR_LOW_FIRST + 1) +        \
+                                 (MSR_HIGH_LAST - MSR_HIGH_FIRST + 1))
+
 typedef struct _MSR_VMEXIT_CONTROL
 {
     UINT8          *msr_bitmap;
-    LIST_ELEMENT    msr_list[1];
+    UINT8          *msr_index;
+    struct _MSR_VMEXIT_DESCRIPTOR *msr_descriptors;
 } MSR_VMEXIT_CONTROL;
 
 
@@ -19,6 +19,7 @@
 #include "vmm_startup.h"
 #include "heap.h"
 #include "cli_monitor.h"
+#include "vmm_log_buffer.h"
 
 
 extern CPU_ID hw_cpu_id();
@@ -127,8 +128,14 @@ enum msg_level
 #define VMM_LEVEL_CHECK(LEVEL)		(LEVEL <= VMM_DEFAULT_LOG_LEVEL)
 #endif
 
+// With VMM_LOG_BUFFER, VMM_LOG formats into the buffered log of the host
+// CPU and VMM_LOG_FAST stores its format and up to VMM_LOG_MAX_ARGS
+// arguments without formatting them, for hot paths. See vmm_log_buffer.h.
+#ifdef VMM_LOG_BUFFER
+#define VMM_LOG(MASK,LEVEL,...) ((void)(((LEVEL==level_print_always) || (LEVEL==level_error) || (VMM_MASK_CHECK(MASK) && VMM_LEVEL_CHECK(LEVEL))) && vmm_log_printf(__VA_ARGS__)))
+#define VMM_LOG_FAST(MASK,LEVEL,...) ((void)(((LEVEL==level_print_always) || (LEVEL==level_error) || (VMM_MASK_CHECK(MASK) && VMM_LEVEL_CHECK(LEVEL))) && vmm_log_binary(VMM_LOG_NARGS(__VA_ARGS__), __VA_ARGS__)))
 //JLM(FIX)
-#if 0
+#elif 0
 #if defined ENABLE_RELEASE_VMM_LOG && !defined DEBUG
 #define VMM_LOG(MASK,LEVEL,...) ((((LEVEL==level_print_always) || (LEVEL==level_error)) && (VMM_MASK_CHECK(MASK) && VMM_LEVEL_CHECK(LEVEL))) && (vmm_printf(__VA_ARGS__)))
 #else
@@ -136,6 +143,7 @@ enum msg_level
 #endif
 #else
 #define VMM_LOG(MASK,LEVEL,...)
+#define VMM_LOG_FAST(MASK,LEVEL,...)
 #endif
 
 
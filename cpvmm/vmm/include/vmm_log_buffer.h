@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+  Buffered log
+
+  Every host CPU appends its log records to its own ring, without locks
+  and without touching the serial port. A record is either text formatted
+  when it was logged, or binary: the format string and its arguments, so
+  that logging does not format at all. The rings are drained to the debug
+  port in bursts from VM exits that are not on a fast path, as much as the
+  UART transmit FIFO takes without waiting, oldest record first. A record
+  that does not fit in its ring is dropped and counted; the drain reports
+  the count. Synchronous prints (vmm_printf) flush the rings first so the
+  output stays in order. A record logged while the same CPU is in a log
+  call, from an exception or NMI handler, is printed synchronously.
+
+  Built only with VMM_LOG_BUFFER, which routes VMM_LOG and VMM_LOG_FAST
+  here (vmm_dbg.h).
+*/
+
+#ifndef VMM_LOG_BUFFER_H
+#define VMM_LOG_BUFFER_H
+
+#include "vmm_defs.h"
+
+// must be a power of 2
+#define VMM_LOG_RING_BYTES          (16 * 1024)
+// longest text record, and longest line a binary record is formatted to
+#define VMM_LOG_LINE_MAX            256
+// most arguments of a binary record
+#define VMM_LOG_MAX_ARGS            6
+// least time between two bursts to the debug port
+#define VMM_LOG_DRAIN_USEC          500
+
+// number of arguments after the format, 0 to VMM_LOG_MAX_ARGS
+#define VMM_LOG_NARGS(...)                                                      \
+    VMM_LOG_NARGS_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0, ~)
+#define VMM_LOG_NARGS_(__f, __a1, __a2, __a3, __a4, __a5, __a6, __n, ...) __n
+
+
+// FUNCTION : vmm_log_initialize()
+// PURPOSE  : Allocate the rings of all host CPUs. Until then records are
+//          : printed synchronously.
+// ARGUMENTS: UINT16 num_of_cpus
+// RETURNS  : TRUE if the rings were allocated
+BOOLEAN vmm_log_initialize(UINT16 num_of_cpus);
+
+// FUNCTION : vmm_log_printf()
+// PURPOSE  : Format a text record into the ring of the current host CPU.
+//          : The record takes the length of the formatted text.
+// ARGUMENTS: const char *format, ...
+// RETURNS  : 1, so it can be used in VMM_LOG expressions
+int vmm_log_printf(const char *format, ...);
+
+// FUNCTION : vmm_log_binary()
+// PURPOSE  : Append a binary record to the ring of the current host CPU;
+//          : it is formatted only when it is drained. Each argument takes
+//          : one 64 bit slot, and %s arguments must point to strings that
+//          : live until then, e.g. literals. Use through VMM_LOG_FAST.
+// ARGUMENTS: UINT32 num_args - number of arguments after format
+//          : const char *format, ...
+// RETURNS  : 1
+int vmm_log_binary(UINT32 num_args, const char *format, ...);
+
+// FUNCTION : vmm_log_drain()
+// PURPOSE  : Write buffered records to the debug port. Unless flush is
+//          : set, returns right away if the last burst is too recent or
+//          : another CPU is draining, and writes only what the UART takes
+//          : without waiting.
+// ARGUMENTS: BOOLEAN flush - write all records, waiting for the UART
+// RETURNS  : void
+void vmm_log_drain(BOOLEAN flush);
+
+// FUNCTION : vmm_log_dropped()
+// PURPOSE  : Get the number of records a host CPU dropped as its ring was full
+// ARGUMENTS: CPU_ID cpu_id
+// RETURNS  : the number of dropped records
+UINT64 vmm_log_dropped(CPU_ID cpu_id);
+
+#endif // VMM_LOG_BUFFER_H
@@ -83,6 +83,18 @@ vmm_serial_puts(void       *h_device,   // In:  Handle of the device
                 const char  string[]);   // In:  String to send
 
 
+// Write as many characters of a buffer as the transmit FIFO takes, without
+// waiting for the UART.
+// Like vmm_serial_putc(), this function is for use where the serial device
+// has been previously locked, and it may be interrupted by
+// vmm_serial_put*_nolock().
+
+UINT32                                            // Ret: Characters sent
+vmm_serial_write_nowait(void       *h_device,     // In:  Handle of the device
+                        const char *buffer,       // In:  Characters to send
+                        UINT32      length);      // In:  Number of characters
+
+
 // Poll the serial device and read a single character if ready.
 // This function is not reentrant.  Calling it while it runs in another thread
 // may result in a junk character returned, but the s/w will not crash.
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(IPC_BATCH_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(IPC_BATCH_C, __condition)
+#include "vmm_defs.h"
+#include "ipc.h"
+#include "hw_utils.h"
+#include "vmm_dbg.h"
+#include "vmcs_init.h"
+#include "ept_hw_layer.h"
+
+#pragma warning( disable : 4100)        // unreferenced formal parameter
+
+// Past this number of pages, a range is invalidated with a single TLB flush
+// or context wide INVEPT instead of page by page.
+#define IPC_BATCH_MAX_PAGES_TO_INVALIDATE   32
+
+typedef struct _IPC_BATCH_RANGE
+{
+    UINT64 eptp;        // 0 for HVA ranges
+    UINT64 start;
+    UINT64 end;         // exclusive
+} IPC_BATCH_RANGE;
+
+
+void ipc_batch_init(IPC_BATCH *batch, IPC_DESTINATION dst, BOOLEAN include_self)
+{
+    VMM_ASSERT(batch != NULL);
+    batch->dst = dst;
+    batch->include_self = include_self;
+    batch->num_entries = 0;
+}
+
+static IPC_BATCH_ENTRY *ipc_batch_new_entry(IPC_BATCH *batch, IPC_BATCH_ENTRY_TYPE type)
+{
+    IPC_BATCH_ENTRY *entry;
+
+    if (batch->num_entries == IPC_BATCH_MAX_ENTRIES) {
+        ipc_batch_flush(batch);
+    }
+    entry = &batch->entries[batch->num_entries++];
+    entry->type = type;
+    return entry;
+}
+
+// Add a range, or extend the last entry if the range follows it
+static void ipc_batch_add_range(IPC_BATCH *batch, IPC_BATCH_ENTRY_TYPE type,
+                                UINT64 eptp, UINT64 start, UINT64 size)
+{
+    IPC_BATCH_ENTRY *entry;
+
+    if (size == 0) {
+        return;
+    }
+    if (batch->num_entries > 0) {
+        entry = &batch->entries[batch->num_entries - 1];
+        if (entry->type == type && entry->u.range.eptp == eptp &&
+            entry->u.range.start + entry->u.range.size == start) {
+            entry->u.range.size += size;
+            return;
+        }
+    }
+    entry = ipc_batch_new_entry(batch, type);
+    entry->u.range.eptp = eptp;
+    entry->u.range.start = start;
+    entry->u.range.size = size;
+}
+
+void ipc_batch_add_invlpg(IPC_BATCH *batch, HVA start, UINT64 size)
+{
+    ipc_batch_add_range(batch, IPC_BATCH_INVLPG, 0, start, size);
+}
+
+void ipc_batch_add_flush_tlb(IPC_BATCH *batch)
+{
+    ipc_batch_new_entry(batch, IPC_BATCH_FLUSH_TLB);
+}
+
+void ipc_batch_add_invept(IPC_BATCH *batch, UINT64 eptp, GPA start, UINT64 size)
+{
+    VMM_ASSERT(eptp != 0);
+    ipc_batch_add_range(batch, IPC_BATCH_INVEPT_ADDRESS, eptp, start, size);
+}
+
+void ipc_batch_add_invept_context(IPC_BATCH *batch, UINT64 eptp)
+{
+    IPC_BATCH_ENTRY *entry = ipc_batch_new_entry(batch, IPC_BATCH_INVEPT_CONTEXT);
+
+    entry->u.range.eptp = eptp;
+}
+
+void ipc_batch_add_handler(IPC_BATCH *batch, IPC_HANDLER_FN handler, void *arg)
+{
+    IPC_BATCH_ENTRY *entry;
+
+    VMM_ASSERT(handler != NULL);
+    entry = ipc_batch_new_entry(batch, IPC_BATCH_HANDLER);
+    entry->u.call.handler = handler;
+    entry->u.call.arg = arg;
+}
+
+
+// Sort ranges by context and start, and merge the overlapping and adjacent
+// ones of the same context.
+// RETURN VALUE:    number of ranges left
+static UINT32 ipc_batch_merge_ranges(IPC_BATCH_RANGE *ranges, UINT32 num_ranges)
+{
+    IPC_BATCH_RANGE range;
+    UINT32 i, j, num_merged;
+
+    // at most IPC_BATCH_MAX_ENTRIES ranges, insertion sort will do
+    for (i = 1; i < num_ranges; i++) {
+        range = ranges[i];
+        for (j = i; j > 0 && (ranges[j - 1].eptp > range.eptp ||
+                              (ranges[j - 1].eptp == range.eptp &&
+                               ranges[j - 1].start > range.start)); j--) {
+            ranges[j] = ranges[j - 1];
+        }
+        ranges[j] = range;
+    }
+    num_merged = 0;
+    for (i = 0; i < num_ranges; i++) {
+        if (num_merged > 0 && ranges[num_merged - 1].eptp == ranges[i].eptp &&
+            ranges[num_merged - 1].end >= ranges[i].start) {
+            ranges[num_merged - 1].end = MAX(ranges[num_merged - 1].end, ranges[i].end);
+        }
+        else {
+            ranges[num_merged++] = ranges[i];
+        }
+    }
+    return num_merged;
+}
+
+static UINT64 ipc_batch_range_pages(const IPC_BATCH_RANGE *range)
+{
+    return (range->end - range->start) / PAGE_4KB_SIZE;
+}
+
+static void ipc_batch_invalidate_tlb(IPC_BATCH_RANGE *ranges, UINT32 num_ranges,
+                                     BOOLEAN flush_tlb)
+{
+    UINT64 num_pages = 0;
+    UINT64 page;
+    UINT32 i;
+
+    num_ranges = ipc_batch_merge_ranges(ranges, num_ranges);
+    for (i = 0; i < num_ranges; i++) {
+        num_pages += ipc_batch_range_pages(&ranges[i]);
+    }
+    if (flush_tlb || num_pages > IPC_BATCH_MAX_PAGES_TO_INVALIDATE) {
+        hw_flash_tlb();
+        return;
+    }
+    for (i = 0; i < num_ranges; i++) {
+        for (page = ranges[i].start; page < ranges[i].end; page += PAGE_4KB_SIZE) {
+            hw_invlpg((void *) page);
+        }
+    }
+}
+
+static void ipc_batch_invalidate_ept(IPC_BATCH_RANGE *ranges, UINT32 num_ranges,
+                                     UINT64 *contexts, UINT32 num_contexts,
+                                     BOOLEAN invept_all)
+{
+    const VMCS_HW_CONSTRAINTS *hw_constraints = vmcs_hw_get_vmx_constraints();
+    BOOLEAN invept_address = hw_constraints->ept_vpid_capabilities.Bits.InveptIndividualAddress;
+    UINT64 num_pages, page;
+    UINT32 i, j, first;
+
+    if (invept_all) {
+        ept_hw_invept_all_contexts();
+        return;
+    }
+    num_ranges = ipc_batch_merge_ranges(ranges, num_ranges);
+    for (first = 0; first < num_ranges; first = i) {
+        // the ranges of a context follow each other
+        num_pages = 0;
+        for (i = first; i < num_ranges && ranges[i].eptp == ranges[first].eptp; i++) {
+            num_pages += ipc_batch_range_pages(&ranges[i]);
+        }
+        for (j = 0; j < num_contexts && contexts[j] != ranges[first].eptp; j++) {
+        }
+        if (j < num_contexts) {
+            continue;       // the whole context is invalidated anyway
+        }
+        if (!invept_address || num_pages > IPC_BATCH_MAX_PAGES_TO_INVALIDATE) {
+            contexts[num_contexts++] = ranges[first].eptp;
+            continue;
+        }
+        for (j = first; j < i; j++) {
+            for (page = ranges[j].start; page < ranges[j].end; page += PAGE_4KB_SIZE) {
+                ept_hw_invept_individual_address(ranges[j].eptp, page);
+            }
+        }
+    }
+    for (j = 0; j < num_contexts; j++) {
+        ept_hw_invept_context(contexts[j]);
+    }
+}
+
+// Apply a batch on this CPU in one pass: call the handlers, then do the
+// merged invalidations
+static void ipc_batch_apply(CPU_ID from, IPC_BATCH *batch)
+{
+    IPC_BATCH_RANGE  tlb_ranges[IPC_BATCH_MAX_ENTRIES];
+    IPC_BATCH_RANGE  ept_ranges[IPC_BATCH_MAX_ENTRIES];
+    UINT64           ept_contexts[2 * IPC_BATCH_MAX_ENTRIES];
+    UINT32           num_tlb_ranges = 0, num_ept_ranges = 0, num_ept_contexts = 0;
+    BOOLEAN          flush_tlb = FALSE, invept_all = FALSE;
+    IPC_BATCH_ENTRY  *entry;
+    IPC_BATCH_RANGE  *range;
+    UINT32           i;
+
+    for (i = 0; i < batch->num_entries; i++) {
+        entry = &batch->entries[i];
+        switch (entry->type) {
+          case IPC_BATCH_INVLPG:
+          case IPC_BATCH_INVEPT_ADDRESS:
+            range = (entry->type == IPC_BATCH_INVLPG) ?
+                    &tlb_ranges[num_tlb_ranges++] : &ept_ranges[num_ept_ranges++];
+            range->eptp = entry->u.range.eptp;
+            range->start = ALIGN_BACKWARD(entry->u.range.start, PAGE_4KB_SIZE);
+            range->end = ALIGN_FORWARD(entry->u.range.start + entry->u.range.size, PAGE_4KB_SIZE);
+            break;
+          case IPC_BATCH_FLUSH_TLB:
+            flush_tlb = TRUE;
+            break;
+          case IPC_BATCH_INVEPT_CONTEXT:
+            if (entry->u.range.eptp == 0) {
+                invept_all = TRUE;
+            }
+            else {
+                ept_contexts[num_ept_contexts++] = entry->u.range.eptp;
+            }
+            break;
+          case IPC_BATCH_HANDLER:
+            entry->u.call.handler(from, entry->u.call.arg);
+            break;
+        }
+    }
+    if (flush_tlb || num_tlb_ranges > 0) {
+        ipc_batch_invalidate_tlb(tlb_ranges, num_tlb_ranges, flush_tlb);
+    }
+    if (invept_all || num_ept_ranges > 0 || num_ept_contexts > 0) {
+        ipc_batch_invalidate_ept(ept_ranges, num_ept_ranges,
+                                 ept_contexts, num_ept_contexts, invept_all);
+    }
+}
+
+static void ipc_batch_handler(CPU_ID from, void *arg)
+{
+    ipc_batch_apply(from, (IPC_BATCH *) arg);
+}
+
+UINT32 ipc_batch_flush(IPC_BATCH *batch)
+{
+    UINT32 num_of_receivers = 0;
+
+    if (batch->num_entries == 0) {
+        return 0;
+    }
+    // one message, and at most one NMI, per destination for the whole batch
+    if (batch->dst.addr_shorthand != IPI_DST_SELF) {
+        num_of_receivers = ipc_execute_handler_sync(batch->dst, ipc_batch_handler, batch);
+    }
+    if (batch->include_self) {
+        ipc_batch_apply(hw_cpu_id(), batch);
+    }
+    batch->num_entries = 0;
+    return num_of_receivers;
+}
@@ -17,90 +17,205 @@
 
 
 #include "common_libc.h"
+#include "hw_utils.h"
 
 extern void vmm_lock_xchg_byte(UINT8 *dst, UINT8 *src);
 
-#pragma optimize( "", off )
-void *  vmm_memset(void *dest, int filler, size_t count)
-{
-    UINT8* p= (UINT8*) dest;
-    while(count-->0)
-	*(p++)= (UINT8) filler;
-    return dest;
-#if 0
-    size_t i = 0, j, cnt_64bit;
-    UINT64 filler_64;
-    UINT64 *fill = &filler_64;
-
-    cnt_64bit = count >> 3;
-
-    if (cnt_64bit) {
-        if (filler != 0) {
-            *(UINT8*)fill = (UINT8)filler;
-            *((UINT8*)fill + 1) = (UINT8)filler;
-            *((UINT16*)fill + 1) = *(UINT16*)fill;
-            *((UINT32*)fill + 1) = *(UINT32*)fill;
-        }
+// Copy and fill strategies, selected by vmm_mem_ops_init() from CPUID.
+// Until then only general purpose registers are used, since CR4.OSFXSR
+// may not be set yet.
+#define MEM_OPS_SSE             BIT_VALUE(0)    // 16 byte moves
+#define MEM_OPS_ERMS            BIT_VALUE(1)    // fast rep movsb/stosb
+
+// sizes from which each strategy pays off (see test/copybench.c)
+#define MEM_OPS_SSE_THRESHOLD   64
+#define MEM_OPS_ERMS_THRESHOLD  1024
+
+#define CPUID_LEAF_7H_0H_EBX_ERMS_BIT   9
+
+static UINT32 g_mem_ops = 0;
 
-        for (i = 0; i < cnt_64bit; i++) {
-            if (filler == 0)
-                ((UINT64*) dest)[i] = 0;
-            else    
-                ((UINT64*) dest)[i] = filler_64;
+void vmm_mem_ops_init(void)
+{
+    CPUID_PARAMS cpuid_params = {0, 0, 0, 0};
+    UINT32 mem_ops = MEM_OPS_SSE;   // SSE2 is architectural on EM64T
+
+    hw_cpuid(&cpuid_params);
+    if (cpuid_params.m_rax >= 7) {
+        cpuid_params.m_rax = 7;
+        cpuid_params.m_rbx = 0;
+        cpuid_params.m_rcx = 0;
+        cpuid_params.m_rdx = 0;
+        hw_cpuid(&cpuid_params);
+        if (BIT_GET64(cpuid_params.m_rbx, CPUID_LEAF_7H_0H_EBX_ERMS_BIT)) {
+            mem_ops |= MEM_OPS_ERMS;
         }
-        i = i << 3;
     }
+    g_mem_ops = mem_ops;
+}
 
-    for (j = i; j < count; j++) {
-        ((UINT8*) dest)[j] = (UINT8)filler;
+// Only XMM0 and XMM1 are used: XMM0-XMM5 are part of the guest save area,
+// the rest of the guest XMM state is not saved on VM exit.
+INLINE void mem_copy_block32(UINT8 *dest, const UINT8 *src)
+{
+    __asm__ volatile(
+        "\tmovdqu (%[src]), %%xmm0\n"
+        "\tmovdqu 16(%[src]), %%xmm1\n"
+        "\tmovdqu %%xmm0, (%[dest])\n"
+        "\tmovdqu %%xmm1, 16(%[dest])\n"
+    :
+    : [dest] "r" (dest), [src] "r" (src)
+    : "xmm0", "xmm1", "memory");
+}
+
+void *  vmm_memset(void *dest, int filler, size_t count)
+{
+    UINT8* p = (UINT8*) dest;
+    UINT64 filler_64 = (UINT64)(UINT8)filler * 0x0101010101010101ULL;
+    size_t blocks;
+
+    if ((count >= MEM_OPS_ERMS_THRESHOLD) && (g_mem_ops & MEM_OPS_ERMS)) {
+        __asm__ volatile(
+            "\trep stosb\n"
+        : "+D" (p), "+c" (count)
+        : "a" (filler_64)
+        : "memory");
+        return dest;
+    }
+    if ((count >= MEM_OPS_SSE_THRESHOLD) && (g_mem_ops & MEM_OPS_SSE)) {
+        blocks = count >> 5;
+        __asm__ volatile(
+            "\tmovq %[filler], %%xmm0\n"
+            "\tpunpcklqdq %%xmm0, %%xmm0\n"
+            "1:\n"
+            "\tmovdqu %%xmm0, (%[p])\n"
+            "\tmovdqu %%xmm0, 16(%[p])\n"
+            "\taddq $32, %[p]\n"
+            "\tdecq %[blocks]\n"
+            "\tjnz 1b\n"
+        : [p] "+r" (p), [blocks] "+r" (blocks)
+        : [filler] "r" (filler_64)
+        : "xmm0", "memory", "cc");
+        count &= 31;
+    }
+    for (; count >= sizeof(UINT64); count -= sizeof(UINT64)) {
+        *(UINT64*)p = filler_64;
+        p += sizeof(UINT64);
+    }
+    while (count-- > 0) {
+        *(p++) = (UINT8) filler;
     }
     return dest;
-#endif
 }
-#pragma optimize( "", on )
 
-void *  vmm_memcpy_ascending(void *dest, const void* src, size_t count)
+// Zero a 4KB page with non-temporal stores. Meant for freshly allocated
+// pages: the zeroes do not push the working set out of the cache.
+void vmm_zero_page(void *page)
 {
-    size_t i = 0, j, cnt_64bit;
-    UINT64 *d = (UINT64 *)dest;
-    const UINT64 *s = (const UINT64*)src;
+    UINT8* p = (UINT8*) page;
+    size_t blocks = PAGE_4KB_SIZE / 32;
+
+    __asm__ volatile(
+        "1:\n"
+        "\tmovnti %[zero], (%[p])\n"
+        "\tmovnti %[zero], 8(%[p])\n"
+        "\tmovnti %[zero], 16(%[p])\n"
+        "\tmovnti %[zero], 24(%[p])\n"
+        "\taddq $32, %[p]\n"
+        "\tdecq %[blocks]\n"
+        "\tjnz 1b\n"
+        "\tsfence\n"
+    : [p] "+r" (p), [blocks] "+r" (blocks)
+    : [zero] "r" ((UINT64)0)
+    : "memory", "cc");
+}
 
-    cnt_64bit = count >> 3;
-    if (cnt_64bit) {
-        for(i = 0; i < cnt_64bit; i++)
-            ((UINT64*) d)[i] = ((UINT64*) s)[i];
-        i = i << 3;
+// Copy from low to high addresses; safe for overlapping buffers with
+// dest below src. Each SSE block is loaded before it is stored.
+void *  vmm_memcpy_ascending(void *dest, const void* src, size_t count)
+{
+    UINT8 *d = (UINT8 *)dest;
+    const UINT8 *s = (const UINT8 *)src;
+
+    if ((count >= MEM_OPS_ERMS_THRESHOLD) && (g_mem_ops & MEM_OPS_ERMS)) {
+        __asm__ volatile(
+            "\trep movsb\n"
+        : "+D" (d), "+S" (s), "+c" (count)
+        :
+        : "memory");
+        return dest;
     }
-
-    for (j = i; j < count; j++) {
-        ((UINT8*) dest)[j] = ((UINT8*)src)[j];
+    if ((count >= MEM_OPS_SSE_THRESHOLD) && (g_mem_ops & MEM_OPS_SSE)) {
+        for (; count >= 32; count -= 32) {
+            mem_copy_block32(d, s);
+            d += 32;
+            s += 32;
+        }
+    }
+    for (; count >= sizeof(UINT64); count -= sizeof(UINT64)) {
+        *(UINT64*)d = *(const UINT64*)s;
+        d += sizeof(UINT64);
+        s += sizeof(UINT64);
+    }
+    while (count-- > 0) {
+        *(d++) = *(s++);
     }
     return dest;
 }
 
+// Copy from high to low addresses; safe for overlapping buffers with
+// dest above src. Backward rep movsb is slow, so SSE is used at all sizes.
 void *  vmm_memcpy_descending(void *dest, const void* src, size_t count)
 {
-    size_t i, cnt, rem;
-    VMM_LONG *d = (VMM_LONG*)dest;
-    const VMM_LONG *s = (const VMM_LONG*)src;
-
-    cnt = COUNT_32_64(count);
-    rem = REMAINDER_32_64(count);
-
-    for (i = 0; i < rem; i++) {
-        ((UINT8*) d)[count - i - 1] = ((UINT8*)s)[count - i - 1];
+    UINT8 *d = (UINT8 *)dest + count;
+    const UINT8 *s = (const UINT8 *)src + count;
+
+    if ((count >= MEM_OPS_SSE_THRESHOLD) && (g_mem_ops & MEM_OPS_SSE)) {
+        for (; count >= 32; count -= 32) {
+            d -= 32;
+            s -= 32;
+            mem_copy_block32(d, s);
+        }
     }
-
-    if (cnt) {
-        for(i = cnt; i > 0; i--)
-            ((VMM_LONG*)d)[i - 1] = ((VMM_LONG*)s)[i - 1];
+    for (; count >= sizeof(UINT64); count -= sizeof(UINT64)) {
+        d -= sizeof(UINT64);
+        s -= sizeof(UINT64);
+        *(UINT64*)d = *(const UINT64*)s;
+    }
+    while (count-- > 0) {
+        *(--d) = *(--s);
     }
     return dest;
 }
 
+// Copies of 8 to 32 bytes: all the (overlapping) words are loaded before
+// any is stored, so this is safe for overlapping buffers in both directions
+INLINE void mem_copy_small(void *dest, const void* src, size_t count)
+{
+    UINT8 *d = (UINT8 *)dest;
+    const UINT8 *s = (const UINT8 *)src;
+    UINT64 head0 = *(const UINT64*)s;
+    UINT64 tail0 = *(const UINT64*)(s + count - 8);
+    UINT64 head1, tail1;
+
+    if (count > 16) {
+        head1 = *(const UINT64*)(s + 8);
+        tail1 = *(const UINT64*)(s + count - 16);
+        *(UINT64*)(d + 8) = head1;
+        *(UINT64*)(d + count - 16) = tail1;
+    }
+    *(UINT64*)d = head0;
+    *(UINT64*)(d + count - 8) = tail0;
+}
+
+// The descending copy is needed only when dest overlaps the tail of src
 void *  vmm_memcpy(void *dest, const void* src, size_t count)
 {
-    if (dest >= src) {
+    if ((count >= 8) && (count <= 32)) {
+        mem_copy_small(dest, src, count);
+        return dest;
+    }
+    if ((dest > src) && ((const UINT8*)dest < (const UINT8*)src + count)) {
         return vmm_memcpy_descending(dest, src, count);
     }
     else {
@@ -113,7 +228,11 @@ void *  vmm_memmove(void *dest, const void* src, int count)
     if (dest == src) {
         return dest;
     } 
-    else if (dest >= src) {
+    else if ((count >= 8) && (count <= 32)) {
+        mem_copy_small(dest, src, count);
+        return dest;
+    }
+    else if ((dest > src) && ((const UINT8*)dest < (const UINT8*)src + count)) {
         return vmm_memcpy_descending(dest, src, count);
     } 
     else {
@@ -20,6 +20,7 @@
 
 void vmm_io_init( void );
 void vmm_debug_port_clear(void);
+UINT32 vmm_debug_port_write(const char *string, UINT32 length, BOOLEAN wait);
 
 #endif // _UVMM_LIBC_INTERNAL_H_
 
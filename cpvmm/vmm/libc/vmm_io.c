@@ -21,6 +21,7 @@
 #include "host_memory_manager_api.h"
 #include "vmm_globals.h"
 #include "vmm_serial.h"
+#include "vmm_log_buffer.h"
 
 
 #define __builtin_va_end(p)
@@ -70,6 +71,12 @@ static void raw_lock(volatile UINT32 *p_lock_var)
 }
 
 
+static BOOLEAN raw_try_lock(volatile UINT32 *p_lock_var)
+{
+    return 0 == hw_interlocked_compare_exchange((INT32 *)p_lock_var, 0, 1);
+}
+
+
 static void raw_force_lock(volatile UINT32 *p_lock_var)
 {
     INT32 old_value;
@@ -277,6 +284,35 @@ static int vmm_debug_port_puts(BOOLEAN is_locked, const char *string)
 }
 
 
+// Writes the first length characters of a string to the debug port for the
+// buffered log.  Unless wait is set, writes only what the port takes right
+// away, and nothing while another print holds the port.
+// Returns the number of characters written.
+UINT32 vmm_debug_port_write(const char *string, UINT32 length, BOOLEAN wait)
+{
+    UINT32 written = 0;
+
+    if (emulator_is_running_as_guest()) {
+        hw_vmcall(VMCALL_EMULATOR_PUTS, (void*)string, 0, 0);
+        return length;
+    }
+    if (vmm_debug_port_get_type() != VMM_DEBUG_PORT_SERIAL)
+        return length;
+    if (wait) {
+        raw_lock(&printf_lock);
+        for (written = 0; written < length; written++)
+            vmm_serial_putc(debug_port_handle, string[written]);
+    }
+    else {
+        if (! raw_try_lock(&printf_lock))
+            return 0;
+        written = vmm_serial_write_nowait(debug_port_handle, string, length);
+    }
+    raw_unlock(&printf_lock);
+    return written;
+}
+
+
 // Emulator debug support functions
 
 #ifdef DEBUG
@@ -427,6 +463,10 @@ int vmm_vprintf(const char *format, va_list args)
         return vmm_printf_nolock_alloc_buffer(format, args);
     }
     else {
+#ifdef VMM_LOG_BUFFER
+        // keep the buffered log in order with direct prints
+        vmm_log_drain(TRUE);
+#endif
         return vmm_printf_int(TRUE, buffer, PRINTF_BUFFER_SIZE, format, args);
     }
 }
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+   Buffered log
+
+   A ring is a byte buffer with a single writer, its host CPU, and a
+   single reader, whichever CPU holds the drain lock. The writer appends a
+   record at head and publishes it by advancing head behind a store fence;
+   the reader formats the record at tail and then releases its space by
+   advancing tail. Records are 8 byte aligned and never wrap: when the
+   space left before the end of the ring is too small, it is filled with a
+   padding record and the record goes to the start of the ring.
+
+   A text record is formatted into the line of its ring first, and takes
+   only the space of the formatted text. An exception or NMI handler that
+   logs on top of a log call of its CPU finds the ring busy and prints
+   directly.
+*/
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(VMM_LOG_BUFFER_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(VMM_LOG_BUFFER_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "heap.h"
+#include "common_libc.h"
+#include "hw_utils.h"
+#include "hw_interlocked.h"
+#include "libc_internal.h"
+#include "vmm_log_buffer.h"
+
+#ifdef VMM_LOG_BUFFER
+
+#define VMM_LOG_RECORD_TEXT     1
+#define VMM_LOG_RECORD_BINARY   2
+#define VMM_LOG_RECORD_PAD      3
+
+typedef struct _VMM_LOG_RECORD {
+    UINT16  size;           // bytes, header included, multiple of 8
+    UINT8   type;
+    UINT8   num_args;       // binary records
+    UINT32  reserved;
+    UINT64  tsc;
+    // text:   the string, NUL terminated
+    // binary: the format string pointer, then num_args 64 bit arguments
+    UINT64  payload[1];
+} VMM_LOG_RECORD;
+
+#define VMM_LOG_RECORD_HEADER_SIZE  OFFSET_OF(VMM_LOG_RECORD, payload)
+#define VMM_LOG_RECORD_SIZE(__payload_bytes)                                    \
+    ALIGN_FORWARD(VMM_LOG_RECORD_HEADER_SIZE + (__payload_bytes), sizeof(UINT64))
+
+typedef struct _VMM_LOG_RING {
+    volatile UINT64 head;   // bytes ever appended, written by the owner CPU
+    volatile UINT64 tail;   // bytes ever drained, written by the drain
+    UINT64  dropped;        // records that did not fit, written by the owner
+    UINT64  reported;       // dropped records the drain has reported
+    UINT8   data[VMM_LOG_RING_BYTES];
+    char    line[VMM_LOG_LINE_MAX];     // a text record is formatted here
+    volatile UINT32 busy;   // the owner is in a log call
+} VMM_LOG_RING;
+
+static VMM_LOG_RING *log_rings[VMM_MAX_CPU_SUPPORTED];
+static UINT16 log_num_cpus = 0;
+
+// the drain state is owned by the holder of log_drain_lock
+static volatile UINT32 log_drain_lock = 0;
+static volatile UINT64 log_next_drain_tsc = 0;
+static UINT64 log_drain_period_tsc = 0;
+static char   log_line[VMM_LOG_LINE_MAX];
+static UINT32 log_line_length = 0;
+static UINT32 log_line_written = 0;
+
+
+BOOLEAN vmm_log_initialize(UINT16 num_of_cpus)
+{
+    VMM_LOG_RING *ring;
+    UINT16 cpu_id;
+
+    if (log_num_cpus != 0 || num_of_cpus > VMM_MAX_CPU_SUPPORTED) {
+        return FALSE;
+    }
+    for (cpu_id = 0; cpu_id < num_of_cpus; cpu_id++) {
+        ring = vmm_memory_alloc(sizeof(VMM_LOG_RING));
+        if (NULL == ring) {
+            return FALSE;
+        }
+        vmm_zeromem(ring, sizeof(VMM_LOG_RING));
+        log_rings[cpu_id] = ring;
+    }
+    log_drain_period_tsc = hw_get_tsc_ticks_per_second() / 1000000 * VMM_LOG_DRAIN_USEC;
+    // the rings are used once all of them exist
+    hw_store_fence();
+    log_num_cpus = num_of_cpus;
+    return TRUE;
+}
+
+// Returns the ring of the running CPU marked busy, or NULL if there are
+// no rings yet or a log call of this CPU was interrupted.
+static VMM_LOG_RING* log_enter(void)
+{
+    CPU_ID cpu_id = hw_cpu_id();
+    VMM_LOG_RING *ring;
+
+    if (cpu_id >= log_num_cpus) {
+        return NULL;
+    }
+    ring = log_rings[cpu_id];
+    if (ring->busy) {
+        return NULL;
+    }
+    ring->busy = 1;
+    __asm__ volatile("" ::: "memory");
+    return ring;
+}
+
+static void log_leave(VMM_LOG_RING *ring)
+{
+    __asm__ volatile("" ::: "memory");
+    ring->busy = 0;
+}
+
+// Reserve size bytes at head, after a padding record if they do not fit
+// before the end of the ring. Returns NULL and counts the record as
+// dropped if the ring is full. *p_head is where the record starts.
+static VMM_LOG_RECORD* log_reserve(VMM_LOG_RING *ring, UINT32 size, UINT64 *p_head)
+{
+    UINT64 head = ring->head;
+    UINT32 offset = (UINT32) head & (VMM_LOG_RING_BYTES - 1);
+    UINT32 to_end = VMM_LOG_RING_BYTES - offset;
+    UINT32 pad = (to_end < size) ? to_end : 0;
+    VMM_LOG_RECORD *record;
+
+    if (head + pad + size - ring->tail > VMM_LOG_RING_BYTES) {
+        ring->dropped++;
+        return NULL;
+    }
+    if (pad != 0) {
+        record = (VMM_LOG_RECORD *) &ring->data[offset];
+        record->size = (UINT16) pad;
+        record->type = VMM_LOG_RECORD_PAD;
+        head += pad;
+        offset = 0;
+    }
+    *p_head = head;
+    return (VMM_LOG_RECORD *) &ring->data[offset];
+}
+
+static void log_commit(VMM_LOG_RING *ring, VMM_LOG_RECORD *record, UINT64 head)
+{
+    // publish the record only once it is complete
+    hw_store_fence();
+    ring->head = head + record->size;
+}
+
+int vmm_log_printf(const char *format, ...)
+{
+    VMM_LOG_RING   *ring = log_enter();
+    VMM_LOG_RECORD *record;
+    UINT64          head;
+    int             length;
+    va_list         args;
+
+    va_start(args, format);
+    if (NULL == ring) {
+        // print it right away
+        vmm_vprintf(format, args);
+        return 1;
+    }
+    length = vmm_vsprintf_s(ring->line, VMM_LOG_LINE_MAX, format, args);
+    if (length < 0) {
+        length = 0;
+        ring->line[0] = '\0';
+    }
+    record = log_reserve(ring, VMM_LOG_RECORD_SIZE(length + 1), &head);
+    if (NULL != record) {
+        vmm_memcpy(record->payload, ring->line, length + 1);
+        record->size = (UINT16) VMM_LOG_RECORD_SIZE(length + 1);
+        record->type = VMM_LOG_RECORD_TEXT;
+        record->tsc = hw_rdtsc();
+        log_commit(ring, record, head);
+    }
+    log_leave(ring);
+    return 1;
+}
+
+int vmm_log_binary(UINT32 num_args, const char *format, ...)
+{
+    VMM_LOG_RING   *ring = log_enter();
+    VMM_LOG_RECORD *record;
+    UINT64          head;
+    UINT64          arg_values[VMM_LOG_MAX_ARGS];
+    UINT32          i;
+    va_list         args;
+
+    VMM_ASSERT(num_args <= VMM_LOG_MAX_ARGS);
+    va_start(args, format);
+    for (i = 0; i < VMM_LOG_MAX_ARGS; i++) {
+        arg_values[i] = (i < num_args) ? va_arg(args, UINT64) : 0;
+    }
+    if (NULL == ring) {
+        vmm_printf(format, arg_values[0], arg_values[1], arg_values[2],
+                   arg_values[3], arg_values[4], arg_values[5]);
+        return 1;
+    }
+    record = log_reserve(ring, VMM_LOG_RECORD_SIZE((num_args + 1) * sizeof(UINT64)), &head);
+    if (NULL != record) {
+        record->size = (UINT16) VMM_LOG_RECORD_SIZE((num_args + 1) * sizeof(UINT64));
+        record->type = VMM_LOG_RECORD_BINARY;
+        record->num_args = (UINT8) num_args;
+        record->tsc = hw_rdtsc();
+        record->payload[0] = (UINT64) format;
+        for (i = 0; i < num_args; i++) {
+            record->payload[i + 1] = arg_values[i];
+        }
+        log_commit(ring, record, head);
+    }
+    log_leave(ring);
+    return 1;
+}
+
+UINT64 vmm_log_dropped(CPU_ID cpu_id)
+{
+    return (cpu_id < log_num_cpus) ? log_rings[cpu_id]->dropped : 0;
+}
+
+// Format the next line to drain into log_line: a report of dropped
+// records, or the oldest record of all rings. Called with the drain lock.
+static BOOLEAN log_next_line(void)
+{
+    VMM_LOG_RING   *ring;
+    VMM_LOG_RING   *oldest = NULL;
+    VMM_LOG_RECORD *record;
+    VMM_LOG_RECORD *oldest_record = NULL;
+    UINT64          dropped;
+    UINT64          args[VMM_LOG_MAX_ARGS];
+    UINT16          cpu_id;
+    UINT32          i;
+
+    for (cpu_id = 0; cpu_id < log_num_cpus; cpu_id++) {
+        ring = log_rings[cpu_id];
+        dropped = ring->dropped;
+        if (dropped != ring->reported) {
+            log_line_length = vmm_sprintf_s(log_line, VMM_LOG_LINE_MAX,
+                                 "CPU%d: %d log records dropped\n",
+                                 cpu_id, (UINT32)(dropped - ring->reported));
+            ring->reported = dropped;
+            return TRUE;
+        }
+        while (ring->tail != ring->head) {
+            record = (VMM_LOG_RECORD *)
+                     &ring->data[(UINT32) ring->tail & (VMM_LOG_RING_BYTES - 1)];
+            if (record->type != VMM_LOG_RECORD_PAD) {
+                if (NULL == oldest_record || record->tsc < oldest_record->tsc) {
+                    oldest = ring;
+                    oldest_record = record;
+                }
+                break;
+            }
+            ring->tail += record->size;
+        }
+    }
+    if (NULL == oldest_record) {
+        return FALSE;
+    }
+    if (oldest_record->type == VMM_LOG_RECORD_TEXT) {
+        vmm_strcpy_s(log_line, VMM_LOG_LINE_MAX, (const char *) oldest_record->payload);
+        log_line_length = (UINT32) vmm_strlen(log_line);
+    }
+    else {
+        for (i = 0; i < VMM_LOG_MAX_ARGS; i++) {
+            args[i] = (i < oldest_record->num_args) ? oldest_record->payload[i + 1] : 0;
+        }
+        log_line_length = vmm_sprintf_s(log_line, VMM_LOG_LINE_MAX,
+                                 (const char *) oldest_record->payload[0],
+                                 args[0], args[1], args[2], args[3], args[4], args[5]);
+    }
+    // the record has been copied, give its space back to the writer
+    hw_store_fence();
+    oldest->tail += oldest_record->size;
+    return TRUE;
+}
+
+void vmm_log_drain(BOOLEAN flush)
+{
+    UINT32 written;
+
+    if (0 == log_num_cpus) {
+        return;
+    }
+    if (!flush && hw_rdtsc() < log_next_drain_tsc) {
+        return;
+    }
+    if (0 != hw_interlocked_compare_exchange((INT32 *) &log_drain_lock, 0, 1)) {
+        return;
+    }
+    for (;;) {
+        if (log_line_written == log_line_length) {
+            log_line_written = log_line_length = 0;
+            if (!log_next_line()) {
+                break;
+            }
+        }
+        written = vmm_debug_port_write(&log_line[log_line_written],
+                                       log_line_length - log_line_written, flush);
+        log_line_written += written;
+        if (log_line_written != log_line_length) {
+            // the UART is full, continue in the next burst
+            break;
+        }
+    }
+    log_next_drain_tsc = hw_rdtsc() + log_drain_period_tsc;
+    hw_store_fence();
+    log_drain_lock = 0;
+}
+
+#endif // VMM_LOG_BUFFER
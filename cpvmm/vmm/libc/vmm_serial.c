@@ -725,6 +725,37 @@ int vmm_serial_puts(void       *h_device,   // In:  Handle of the device
 }
 
 
+// Write as many characters of a buffer as the transmit FIFO takes, without
+// waiting for the UART.
+// Like vmm_serial_putc(), this function is for use where the serial device
+// has been previously locked, and it may be interrupted by
+// vmm_serial_put*_nolock().
+UINT32 vmm_serial_write_nowait(void       *h_device,   // In:  Handle of the device
+                               const char *buffer,     // In:  Characters to send
+                               UINT32      length)     // In:  Number of characters
+{
+    VMM_SERIAL_DEVICE *p_device;
+    UART_LSR           lsr;   // Line Status Register image
+    UINT32             written = 0;
+
+    p_device = h_device;
+    VMM_ASSERT(p_device->is_initialized);
+
+    lsr.data = hw_read_port_8(p_device->io_base + UART_REGISTER_LSR);
+    if (lsr.bits.THRE == 1)        // The Tx FIFO is empty
+        p_device->chars_in_tx_fifo = 0;
+    if (p_device->puts_lock || ! is_hw_tx_handshake_go(p_device))
+        return 0;
+    while (written < length && p_device->chars_in_tx_fifo < p_device->hw_fifo_size) {
+        hw_write_port_8(p_device->io_base + UART_REGISTER_THR, buffer[written]);
+        p_device->chars_in_tx_fifo++;
+        written++;
+    }
+    p_device->num_tx_chars_lock += written;
+    return written;
+}
+
+
 // Poll the serial device and read a single character if ready.
 // This function is not reentrant.  Calling it while it runs in another thread
 // may result in a junk character returned, but the s/w will not crash.
@@ -32,6 +32,7 @@
 #include "libc.h"
 #include "host_memory_manager_api.h"
 #include "ept_hw_layer.h"
+#include "ept_dirty_log.h"
 #include "ipc.h"
 #include "guest_cpu_vmenter_event.h"
 #include "lock.h"
@@ -196,6 +197,10 @@ BOOLEAN ept_violation_vmexit(GUEST_CPU_HANDLE gcpu, void *pv)
         }
     }
 
+    if (ept_dirty_log_handle_violation(gcpu, data)) {
+        return TRUE;
+    }
+
     if (!report_uvmm_event(UVMM_EVENT_EPT_VIOLATION, (VMM_IDENTIFICATION_DATA)gcpu, (const GUEST_VCPU*)vcpu_id, (void *)&violation_data)) {
         VMM_LOG(mask_anonymous, level_trace, "report_ept_violation failed\n");
     }
@@ -230,14 +235,14 @@ MAM_EPT_SUPER_PAGE_SUPPORT ept_get_mam_super_page_support(void)
     IA32_VMX_EPT_VPID_CAP ept_cap = hw_constraints->ept_vpid_capabilities;
     MAM_EPT_SUPER_PAGE_SUPPORT sp_support = MAM_EPT_NO_SUPER_PAGE_SUPPORT;
 
-// Currently we support 2MB pages in implementation
+// Currently we support 2MB and 1GB pages in implementation
     if(ept_cap.Bits.SP_21_bit) {
         sp_support |= MAM_EPT_SUPPORT_2MB_PAGE;
     }
-#if 0  // Support for different memory page sizes
     if(ept_cap.Bits.SP_30_bit) {
         sp_support |= MAM_EPT_SUPPORT_1GB_PAGE;
     }
+#if 0  // Support for different memory page sizes
     if(ept_cap.Bits.SP_39_bit)
     {
         sp_support |= MAM_EPT_SUPPORT_512_GB_PAGE;
@@ -343,6 +348,9 @@ BOOLEAN ept_end_gpm_modification_before_cpus_resume( GUEST_CPU_HANDLE gcpu, void
     guest = guest_handle(gpm_modification_data->guest_id);
     if (gpm_modification_data->operation == VMM_MEM_OP_UPDATE)
     {
+        // retract the ranges the update made uniform again; the INVEPT
+        // below drops the old tables from the paging-structure caches
+        mam_compact_mapping(ept_find_guest_state(gpm_modification_data->guest_id)->address_space);
         ept_get_default_ept(guest, &default_ept_root_table_hpa, &default_ept_gaw);
         invept_cmd.host_cpu_id = ANY_CPU_ID;
         invept_cmd.cmd = INVEPT_CONTEXT_WIDE;
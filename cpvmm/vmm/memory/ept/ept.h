@@ -62,6 +62,7 @@ typedef struct _EPT_GUEST_STATE
     GUEST_ID guest_id;
     UINT16 padding;
     EPT_GUEST_CPU_STATE **gcpu_state;
+    struct _EPT_DIRTY_LOG *dirty_log;  // NULL unless dirty page logging is on
     LIST_ELEMENT list[1];
 } EPT_GUEST_STATE;
 
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(EPT_DIRTY_LOG_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(EPT_DIRTY_LOG_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "common_libc.h"
+#include "memory_allocator.h"
+#include "heap.h"
+#include "hw_interlocked.h"
+#include "guest.h"
+#include "guest_cpu.h"
+#include "vmcs_init.h"
+#include "ipc.h"
+#include "ept.h"
+#include "ept_hw_layer.h"
+#include "ept_dirty_log.h"
+#ifdef JLMDEBUG
+#include "jlmdebug.h"
+#endif
+
+#define EPT_DIRTY_LOG_WORD(page)    ((UINT32)((page) / 32))
+#define EPT_DIRTY_LOG_MASK(page)    (1u << ((page) % 32))
+#define EPT_DIRTY_LOG_TEST(bitmap, page)                                      \
+    (((bitmap)[EPT_DIRTY_LOG_WORD(page)] & EPT_DIRTY_LOG_MASK(page)) != 0)
+
+typedef struct _EPT_DIRTY_LOG
+{
+    GPA base;
+    UINT64 num_pages;
+    UINT32 bitmap_size;
+    UINT32 padding;
+    // bitmaps of a bit per page, from the page heap: 32KB per GB logged
+    UINT32 *logged_pages;               // pages that were writable at start
+    UINT32 volatile *dirty_pages;       // logged pages written since harvest
+} EPT_DIRTY_LOG;
+
+
+static void ept_dirty_log_free(EPT_DIRTY_LOG *log)
+{
+    if (log->logged_pages != NULL) {
+        vmm_memory_free(log->logged_pages);
+    }
+    if (log->dirty_pages != NULL) {
+        vmm_memory_free((void *) log->dirty_pages);
+    }
+    vmm_mfree(log);
+}
+
+// Give or take the write permission of the pages set in the bitmap,
+// one MAM call per run of consecutive pages.
+static BOOLEAN ept_dirty_log_update_pages(EPT_GUEST_STATE *ept_guest,
+                    const EPT_DIRTY_LOG *log, const UINT32 *pages, BOOLEAN writable)
+{
+    MAM_ATTRIBUTES attrs;
+    UINT64 page = 0;
+    UINT64 first;
+    BOOLEAN status = TRUE;
+
+    attrs.uint32 = 0;
+    attrs.ept_attr.writable = 1;
+    while (page < log->num_pages) {
+        if (pages[EPT_DIRTY_LOG_WORD(page)] == 0) {
+            page = (page | 31) + 1;
+            continue;
+        }
+        if (!EPT_DIRTY_LOG_TEST(pages, page)) {
+            page++;
+            continue;
+        }
+        first = page;
+        while (page < log->num_pages && EPT_DIRTY_LOG_TEST(pages, page)) {
+            page++;
+        }
+        if (writable) {
+            status = mam_add_permissions_to_existing_mapping(ept_guest->address_space,
+                            log->base + first * PAGE_4KB_SIZE,
+                            (page - first) * PAGE_4KB_SIZE, attrs) && status;
+        }
+        else {
+            status = mam_remove_permissions_from_existing_mapping(ept_guest->address_space,
+                            log->base + first * PAGE_4KB_SIZE,
+                            (page - first) * PAGE_4KB_SIZE, attrs) && status;
+        }
+    }
+    return status;
+}
+
+// Resume the stopped CPUs, each of them flushing the default EPT context
+static void ept_dirty_log_resume_cpus(GUEST_HANDLE guest, EPT_GUEST_STATE *ept_guest)
+{
+    EPT_INVEPT_CMD invept_cmd;
+
+    vmm_zeromem(&invept_cmd, sizeof(invept_cmd));
+    invept_cmd.host_cpu_id = ANY_CPU_ID;
+    invept_cmd.cmd = INVEPT_CONTEXT_WIDE;
+    invept_cmd.eptp = ept_compute_eptp(guest, ept_guest->ept_root_table_hpa, ept_guest->gaw);
+    start_all_cpus(ept_invalidate_ept, (void *) &invept_cmd);
+    ept_hw_invept_context(invept_cmd.eptp);
+}
+
+BOOLEAN ept_dirty_log_start(GUEST_HANDLE guest, GPA base, UINT64 size)
+{
+    EPT_GUEST_STATE *ept_guest = NULL;
+    EPT_DIRTY_LOG *log = NULL;
+    MAM_ATTRIBUTES attrs;
+    UINT64 page;
+    HPA hpa;
+
+    VMM_ASSERT(guest);
+    if (size == 0 || (base & PAGE_4KB_MASK) != 0 || (size & PAGE_4KB_MASK) != 0 ||
+        size / PAGE_4KB_SIZE > (UINT64) 0xFFFFFFFF - 31) {
+        return FALSE;
+    }
+    ept_guest = ept_find_guest_state(guest_get_id(guest));
+    VMM_ASSERT(ept_guest);
+
+    log = (EPT_DIRTY_LOG *) vmm_malloc(sizeof(EPT_DIRTY_LOG));
+    if (log == NULL) {
+        return FALSE;
+    }
+    log->base = base;
+    log->num_pages = size / PAGE_4KB_SIZE;
+    log->bitmap_size = EPT_DIRTY_LOG_BITMAP_SIZE(size);
+    log->logged_pages = (UINT32 *) vmm_memory_alloc(log->bitmap_size);
+    log->dirty_pages = (UINT32 volatile *) vmm_memory_alloc(log->bitmap_size);
+    if (log->logged_pages == NULL || log->dirty_pages == NULL) {
+        VMM_LOG(mask_anonymous, level_error,
+                "%s: no memory for the %d byte dirty bitmaps of guest %d\n",
+                __FUNCTION__, log->bitmap_size, guest_get_id(guest));
+        ept_dirty_log_free(log);
+        return FALSE;
+    }
+
+    ept_acquire_lock();
+    if (ept_guest->dirty_log != NULL) {
+        ept_release_lock();
+        ept_dirty_log_free(log);
+        return FALSE;
+    }
+    stop_all_cpus();
+    // Read only and unmapped pages are not logged: a write to them is
+    // not ours to handle.
+    for (page = 0; page < log->num_pages; page++) {
+        if (mam_get_mapping(ept_guest->address_space, base + page * PAGE_4KB_SIZE,
+                            &hpa, &attrs) == MAM_MAPPING_SUCCESSFUL &&
+            attrs.ept_attr.writable) {
+            log->logged_pages[EPT_DIRTY_LOG_WORD(page)] |= EPT_DIRTY_LOG_MASK(page);
+        }
+    }
+    if (!ept_dirty_log_update_pages(ept_guest, log, log->logged_pages, FALSE)) {
+        ept_dirty_log_update_pages(ept_guest, log, log->logged_pages, TRUE);
+        ept_dirty_log_resume_cpus(guest, ept_guest);
+        ept_release_lock();
+        ept_dirty_log_free(log);
+        return FALSE;
+    }
+    ept_guest->dirty_log = log;
+    ept_dirty_log_resume_cpus(guest, ept_guest);
+    ept_release_lock();
+    return TRUE;
+}
+
+void ept_dirty_log_stop(GUEST_HANDLE guest)
+{
+    EPT_GUEST_STATE *ept_guest = NULL;
+    EPT_DIRTY_LOG *log = NULL;
+
+    VMM_ASSERT(guest);
+    ept_guest = ept_find_guest_state(guest_get_id(guest));
+    VMM_ASSERT(ept_guest);
+    ept_acquire_lock();
+    log = ept_guest->dirty_log;
+    if (log == NULL) {
+        ept_release_lock();
+        return;
+    }
+    stop_all_cpus();
+    ept_dirty_log_update_pages(ept_guest, log, log->logged_pages, TRUE);
+    ept_guest->dirty_log = NULL;
+    // no CPU may keep a read only translation once nobody handles the
+    // violations it would cause
+    ept_dirty_log_resume_cpus(guest, ept_guest);
+    ept_release_lock();
+    ept_dirty_log_free(log);
+}
+
+BOOLEAN ept_dirty_log_harvest(GUEST_HANDLE guest, UINT32 *dirty_bitmap,
+                              UINT32 *num_dirty_pages)
+{
+    EPT_GUEST_STATE *ept_guest = NULL;
+    EPT_DIRTY_LOG *log = NULL;
+    UINT32 num_words;
+    UINT32 word;
+    UINT32 bits;
+    UINT32 count = 0;
+    BOOLEAN status;
+
+    VMM_ASSERT(guest);
+    VMM_ASSERT(dirty_bitmap);
+    VMM_ASSERT(num_dirty_pages);
+    *num_dirty_pages = 0;
+    ept_guest = ept_find_guest_state(guest_get_id(guest));
+    VMM_ASSERT(ept_guest);
+    ept_acquire_lock();
+    log = ept_guest->dirty_log;
+    if (log == NULL) {
+        ept_release_lock();
+        return FALSE;
+    }
+    stop_all_cpus();
+    // Swap each word with 0 rather than copy then clear: a CPU still
+    // finishing a violation sets its bit after giving the write permission
+    // back, so the bit lands either in this harvest or in the next one.
+    num_words = log->bitmap_size / sizeof(UINT32);
+    for (word = 0; word < num_words; word++) {
+        bits = (UINT32) hw_interlocked_assign((INT32 volatile *) &log->dirty_pages[word], 0);
+        dirty_bitmap[word] = bits;
+        for (; bits != 0; bits &= bits - 1) {
+            count++;
+        }
+    }
+    status = ept_dirty_log_update_pages(ept_guest, log, dirty_bitmap, FALSE);
+    if (!status) {
+        // some pages may have stayed writable: report them all again
+        for (word = 0; word < num_words; word++) {
+            hw_interlocked_or((INT32 volatile *) &log->dirty_pages[word],
+                              (INT32) dirty_bitmap[word]);
+        }
+    }
+    ept_dirty_log_resume_cpus(guest, ept_guest);
+    ept_release_lock();
+    *num_dirty_pages = count;
+    return status;
+}
+
+BOOLEAN ept_dirty_log_handle_violation(GUEST_CPU_HANDLE gcpu,
+                                       EVENT_GCPU_EPT_VIOLATION_DATA *data)
+{
+    const VIRTUAL_CPU_ID *vcpu_id = NULL;
+    const VMCS_HW_CONSTRAINTS *hw_constraints = NULL;
+    EPT_GUEST_STATE *ept_guest = NULL;
+    EPT_DIRTY_LOG *log = NULL;
+    MAM_ATTRIBUTES attrs;
+    UINT64 eptp;
+    UINT64 page;
+    GPA gpa;
+
+    if (!data->qualification.EptViolation.W) {
+        return FALSE;
+    }
+    vcpu_id = guest_vcpu(gcpu);
+    VMM_ASSERT(vcpu_id);
+    ept_guest = ept_find_guest_state(vcpu_id->guest_id);
+    if (ept_guest == NULL || (log = ept_guest->dirty_log) == NULL) {
+        return FALSE;
+    }
+    gpa = ALIGN_BACKWARD(data->guest_physical_address, PAGE_4KB_SIZE);
+    if (gpa < log->base) {
+        return FALSE;
+    }
+    page = (gpa - log->base) / PAGE_4KB_SIZE;
+    if (page >= log->num_pages || !EPT_DIRTY_LOG_TEST(log->logged_pages, page)) {
+        return FALSE;
+    }
+    // only the default EPT is logged; a violation in another view is not ours
+    eptp = ept_get_eptp(gcpu);
+    if (ALIGN_BACKWARD(eptp, PAGE_4KB_SIZE) != ept_guest->ept_root_table_hpa) {
+        return FALSE;
+    }
+
+    // Permission first, bit second: see ept_dirty_log_harvest(). Another
+    // CPU may have given the permission back already, which is harmless.
+    attrs.uint32 = 0;
+    attrs.ept_attr.writable = 1;
+    if (!mam_add_permissions_to_existing_mapping(ept_guest->address_space, gpa,
+                                                 PAGE_4KB_SIZE, attrs)) {
+        return FALSE;
+    }
+    hw_interlocked_or((INT32 volatile *) &log->dirty_pages[EPT_DIRTY_LOG_WORD(page)],
+                      (INT32) EPT_DIRTY_LOG_MASK(page));
+
+    // Drop the read only translation of this CPU only; the other CPUs
+    // drop theirs on their own violation of the page.
+    hw_constraints = vmcs_hw_get_vmx_constraints();
+    if (hw_constraints->ept_vpid_capabilities.Bits.InveptIndividualAddress) {
+        ept_hw_invept_individual_address(eptp, gpa);
+    }
+    else {
+        ept_hw_invept_context(eptp);
+    }
+    data->processed = TRUE;
+    return TRUE;
+}
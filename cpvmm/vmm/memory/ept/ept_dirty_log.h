@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EPT_DIRTY_LOG_H
+#define _EPT_DIRTY_LOG_H
+
+#include "vmm_defs.h"
+#include "vmm_objects.h"
+#include "vmm_events_data.h"
+
+// Dirty page logging on the default EPT of a guest.
+// The writable pages of the logged range are write protected. The first
+// write to such a page causes an EPT violation that records the page in
+// the dirty bitmap and makes the page writable again, so every page costs
+// one VM exit per harvest period. ept_dirty_log_harvest() hands out the
+// bitmap and write protects the recorded pages again.
+
+// Size in bytes of the dirty bitmap of a range: one bit per 4KB page,
+// rounded up to whole UINT32 words.
+#define EPT_DIRTY_LOG_BITMAP_SIZE(range_size)                                 \
+    ((UINT32)(((((range_size) + PAGE_4KB_SIZE - 1) / PAGE_4KB_SIZE) + 31) / 32) * sizeof(UINT32))
+
+// Start logging writes to [base, base + size). Both must be 4KB aligned.
+// Only one range per guest can be logged at a time.
+BOOLEAN ept_dirty_log_start(GUEST_HANDLE guest, GPA base, UINT64 size);
+
+// Stop logging and give the write permission back to all logged pages.
+void ept_dirty_log_stop(GUEST_HANDLE guest);
+
+// Copy the pages written since the last harvest to dirty_bitmap (bit n is
+// page base + n * 4KB, EPT_DIRTY_LOG_BITMAP_SIZE bytes), reset the log and
+// write protect these pages again. num_dirty_pages gets the number of bits
+// set. Returns FALSE if logging is off, or if the pages could not be write
+// protected again; they are then reported again by the next harvest.
+BOOLEAN ept_dirty_log_harvest(GUEST_HANDLE guest, UINT32 *dirty_bitmap,
+                              UINT32 *num_dirty_pages);
+
+// Called on an EPT violation; returns TRUE if it was a write to a logged
+// page and was handled.
+BOOLEAN ept_dirty_log_handle_violation(GUEST_CPU_HANDLE gcpu,
+                                       EVENT_GCPU_EPT_VIOLATION_DATA *data);
+
+#endif
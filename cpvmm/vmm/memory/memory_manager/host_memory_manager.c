@@ -65,63 +65,292 @@ INLINE BOOLEAN hmm_is_page_available_for_allocation(MAM_MAPPING_RESULT result) {
     return ((result == MAM_UNKNOWN_MAPPING) || (result == HMM_INVALID_MEMORY_TYPE));
 }
 
-static
-BOOLEAN hmm_allocate_continuous_free_virtual_pages(UINT32 num_of_pages,
-                                                   UINT64* hva) {
-    UINT64 new_allocations_curr_ptr = hmm_get_new_allocations_curr_ptr(g_hmm);
-    UINT64 new_allocations_curr_ptr_tmp = new_allocations_curr_ptr;
-    UINT32 counter = 0;
-    UINT64 loop_counter = 0;
-    const UINT64 max_loop_counter = HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS - HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
-    HPA hpa;
-    MAM_ATTRIBUTES attrs;
-    MAM_HANDLE hva_to_hpa = hmm_get_hva_to_hpa_mapping(g_hmm);
-    MAM_MAPPING_RESULT result;
+// Free HVA ranges index, see host_memory_manager.h. Called with the update
+// lock held.
+//
+// The ranges are the nodes of a treap ordered by start address, in the
+// free_ranges pool of the HMM; node HMM_FREE_RANGE_NIL is the empty tree,
+// with max_size 0. The priority of a node is fixed by its place in the
+// pool, a multiplicative hash of its index.
+
+#define HMM_FREE_RANGE_NIL 0
+
+INLINE HMM_FREE_RANGE* hmm_free_range(UINT32 node) {
+    return &g_hmm->free_ranges[node];
+}
 
-    VMM_ASSERT(num_of_pages > 0);
+INLINE UINT64 hmm_free_range_size(UINT32 node) {
+    return hmm_free_range(node)->end - hmm_free_range(node)->start;
+}
 
-    do {
-        if (loop_counter >= max_loop_counter) {
-            return FALSE; // looked at all available ranges
+static void hmm_free_ranges_update(UINT32 node) {
+    HMM_FREE_RANGE* range = hmm_free_range(node);
+    UINT64 max_size = range->end - range->start;
+
+    if (hmm_free_range(range->left)->max_size > max_size) {
+        max_size = hmm_free_range(range->left)->max_size;
+    }
+    if (hmm_free_range(range->right)->max_size > max_size) {
+        max_size = hmm_free_range(range->right)->max_size;
+    }
+    range->max_size = max_size;
+}
+
+// splits the tree at node into the ranges that start below hva and the rest
+static void hmm_free_ranges_split(UINT32 node, HVA hva, UINT16* below, UINT16* rest) {
+    HMM_FREE_RANGE* range = hmm_free_range(node);
+
+    if (node == HMM_FREE_RANGE_NIL) {
+        *below = HMM_FREE_RANGE_NIL;
+        *rest = HMM_FREE_RANGE_NIL;
+        return;
+    }
+    if (range->start < hva) {
+        hmm_free_ranges_split(range->right, hva, &range->right, rest);
+        *below = (UINT16) node;
+    }
+    else {
+        hmm_free_ranges_split(range->left, hva, below, &range->left);
+        *rest = (UINT16) node;
+    }
+    hmm_free_ranges_update(node);
+}
+
+// joins two trees, all the ranges of low are below those of high
+static UINT16 hmm_free_ranges_join(UINT16 low, UINT16 high) {
+    if (low == HMM_FREE_RANGE_NIL) {
+        return high;
+    }
+    if (high == HMM_FREE_RANGE_NIL) {
+        return low;
+    }
+    if (hmm_free_range(low)->priority > hmm_free_range(high)->priority) {
+        hmm_free_range(low)->right = hmm_free_ranges_join(hmm_free_range(low)->right, high);
+        hmm_free_ranges_update(low);
+        return low;
+    }
+    hmm_free_range(high)->left = hmm_free_ranges_join(low, hmm_free_range(high)->left);
+    hmm_free_ranges_update(high);
+    return high;
+}
+
+static BOOLEAN hmm_free_ranges_insert(HVA start, HVA end) {
+    UINT16 node = g_hmm->free_ranges_pool;
+    HMM_FREE_RANGE* range = hmm_free_range(node);
+    UINT16 below;
+    UINT16 rest;
+
+    if (node == HMM_FREE_RANGE_NIL) {
+        return FALSE;
+    }
+    g_hmm->free_ranges_pool = range->right;
+    range->start = start;
+    range->end = end;
+    range->max_size = end - start;
+    range->left = HMM_FREE_RANGE_NIL;
+    range->right = HMM_FREE_RANGE_NIL;
+    hmm_free_ranges_split(g_hmm->free_ranges_root, start, &below, &rest);
+    g_hmm->free_ranges_root = hmm_free_ranges_join(hmm_free_ranges_join(below, node), rest);
+    return TRUE;
+}
+
+static void hmm_free_ranges_delete(UINT16 node) {
+    HVA start = hmm_free_range(node)->start;
+    UINT16 below;
+    UINT16 rest;
+    UINT16 above;
+
+    hmm_free_ranges_split(g_hmm->free_ranges_root, start, &below, &rest);
+    hmm_free_ranges_split(rest, start + 1, &rest, &above);
+    VMM_ASSERT(rest == node);
+    g_hmm->free_ranges_root = hmm_free_ranges_join(below, above);
+    hmm_free_range(node)->right = g_hmm->free_ranges_pool;
+    g_hmm->free_ranges_pool = node;
+}
+
+// returns the last range that starts below hva
+static UINT16 hmm_free_ranges_lookup(HVA hva) {
+    UINT16 node = g_hmm->free_ranges_root;
+    UINT16 found = HMM_FREE_RANGE_NIL;
+
+    while (node != HMM_FREE_RANGE_NIL) {
+        if (hmm_free_range(node)->start < hva) {
+            found = node;
+            node = hmm_free_range(node)->right;
+        }
+        else {
+            node = hmm_free_range(node)->left;
         }
+    }
+    return found;
+}
 
-        result = mam_get_mapping(hva_to_hpa, new_allocations_curr_ptr_tmp, &hpa, &attrs);
-        if (!hmm_is_page_available_for_allocation(result)) {
-            // HVA is occupied
+// returns the first range from hva on with size bytes; the max_size of the
+// subtrees leads the search, which backtracks only along the path to hva
+static UINT16 hmm_free_ranges_first_fit(UINT16 node, HVA hva, UINT64 size) {
+    UINT16 found;
 
-            new_allocations_curr_ptr = new_allocations_curr_ptr_tmp + PAGE_4KB_SIZE;
-            if (new_allocations_curr_ptr >= HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) {
-                new_allocations_curr_ptr = HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
-            }
-            new_allocations_curr_ptr_tmp = new_allocations_curr_ptr;
-            counter = 0;
-            loop_counter++;
+    while (hmm_free_range(node)->max_size >= size) {
+        if (hmm_free_range(node)->start < hva) {
+            node = hmm_free_range(node)->right;
             continue;
         }
-        counter++;
-        new_allocations_curr_ptr_tmp += PAGE_4KB_SIZE;
-        if ((new_allocations_curr_ptr_tmp >= HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) &&
-            (counter < num_of_pages)) {
-            new_allocations_curr_ptr = HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
-            new_allocations_curr_ptr_tmp = new_allocations_curr_ptr;
-            counter = 0;
-            loop_counter++;
-            continue;
+        found = hmm_free_ranges_first_fit(hmm_free_range(node)->left, hva, size);
+        if (found != HMM_FREE_RANGE_NIL) {
+            return found;
+        }
+        if (hmm_free_range_size(node) >= size) {
+            return node;
         }
-        loop_counter++;
-    } while (counter != num_of_pages);
+        node = hmm_free_range(node)->right;
+    }
+    return HMM_FREE_RANGE_NIL;
+}
+
+static void hmm_free_ranges_initialize(void) {
+    UINT32 node;
+
+    vmm_zeromem(g_hmm->free_ranges, sizeof(g_hmm->free_ranges));
+    g_hmm->free_ranges_root = HMM_FREE_RANGE_NIL;
+    g_hmm->free_ranges_pool = HMM_FREE_RANGE_NIL;
+    for (node = HMM_MAX_FREE_RANGES - 1; node > HMM_FREE_RANGE_NIL; node--) {
+        hmm_free_range(node)->priority = node * 0x9E3779B1;
+        hmm_free_range(node)->right = g_hmm->free_ranges_pool;
+        g_hmm->free_ranges_pool = (UINT16) node;
+    }
+    hmm_free_ranges_insert(HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS,
+                           HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS);
+}
+
+static void hmm_free_ranges_add(HVA start, HVA end) {
+    UINT16 node;
+
+    if (start < HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) {
+        start = HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
+    }
+    if (end > HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) {
+        end = HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
+    }
+    if (start >= end) {
+        return;
+    }
 
-    *hva = new_allocations_curr_ptr;
+    // merge with the ranges the new one overlaps or touches
+    for (node = hmm_free_ranges_lookup(end + 1);
+         (node != HMM_FREE_RANGE_NIL) && (hmm_free_range(node)->end >= start);
+         node = hmm_free_ranges_lookup(end + 1)) {
+        if (hmm_free_range(node)->start < start) {
+            start = hmm_free_range(node)->start;
+        }
+        if (hmm_free_range(node)->end > end) {
+            end = hmm_free_range(node)->end;
+        }
+        hmm_free_ranges_delete(node);
+    }
+    // a full pool drops the range, its pages stay unmapped and unused
+    hmm_free_ranges_insert(start, end);
+}
 
-    new_allocations_curr_ptr = new_allocations_curr_ptr_tmp;
-    if (new_allocations_curr_ptr >= HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) {
-        new_allocations_curr_ptr = HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
+static void hmm_free_ranges_remove(HVA start, HVA end) {
+    UINT16 node;
+    HVA range_start;
+    HVA range_end;
+
+    for (node = hmm_free_ranges_lookup(end);
+         (node != HMM_FREE_RANGE_NIL) && (hmm_free_range(node)->end > start);
+         node = hmm_free_ranges_lookup(end)) {
+        range_start = hmm_free_range(node)->start;
+        range_end = hmm_free_range(node)->end;
+        hmm_free_ranges_delete(node);
+        if (range_start >= start) {
+            range_start = start;
+        }
+        if (range_end <= end) {
+            range_end = end;
+        }
+        // a full pool has no room to split, keep the larger part
+        if (range_end - end > start - range_start) {
+            hmm_free_ranges_insert(end, range_end);
+            if (range_start < start) {
+                hmm_free_ranges_insert(range_start, start);
+            }
+        }
+        else {
+            if (range_start < start) {
+                hmm_free_ranges_insert(range_start, start);
+            }
+            if (range_end > end) {
+                hmm_free_ranges_insert(end, range_end);
+            }
+        }
     }
+}
+
+// next fit: the first range from hva on with size bytes, then from the
+// start of the window
+static BOOLEAN hmm_free_ranges_find(HVA hva, UINT64 size, HVA* start) {
+    UINT16 node = hmm_free_ranges_lookup(hva + 1);
 
-    hmm_set_new_allocations_curr_ptr(g_hmm, new_allocations_curr_ptr);
+    if ((node != HMM_FREE_RANGE_NIL) && (hmm_free_range(node)->end > hva) &&
+        (hmm_free_range(node)->end - hva >= size)) {
+        *start = hva;
+        return TRUE;
+    }
+    node = hmm_free_ranges_first_fit(g_hmm->free_ranges_root, hva, size);
+    if (node == HMM_FREE_RANGE_NIL) {
+        node = hmm_free_ranges_first_fit(g_hmm->free_ranges_root, 0, size);
+        if (node == HMM_FREE_RANGE_NIL) {
+            return FALSE;
+        }
+    }
+    *start = hmm_free_range(node)->start;
     return TRUE;
 }
 
+static
+BOOLEAN hmm_allocate_continuous_free_virtual_pages(UINT32 num_of_pages,
+                                                   UINT64* hva) {
+    const UINT64 size = (UINT64) num_of_pages * PAGE_4KB_SIZE;
+    MAM_HANDLE hva_to_hpa = hmm_get_hva_to_hpa_mapping(g_hmm);
+    HVA start;
+    HVA page;
+    HVA next;
+    HPA hpa;
+    MAM_ATTRIBUTES attrs;
+
+    VMM_ASSERT(num_of_pages > 0);
+
+    // every range that turns out to be mapped leaves the index, so this ends
+    while (hmm_free_ranges_find(hmm_get_new_allocations_curr_ptr(g_hmm), size, &start)) {
+        for (page = start; page < start + size; page += PAGE_4KB_SIZE) {
+            if (!hmm_is_page_available_for_allocation(
+                        mam_get_mapping(hva_to_hpa, page, &hpa, &attrs))) {
+                break;
+            }
+        }
+        if (page == start + size) {
+            hmm_free_ranges_remove(start, start + size);
+            next = start + size;
+            if (next >= HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) {
+                next = HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
+            }
+            hmm_set_new_allocations_curr_ptr(g_hmm, next);
+            *hva = start;
+            return TRUE;
+        }
+
+        // mapped without the allocator, e.g. 1-1; drop the mapped pages
+        for (next = page + PAGE_4KB_SIZE; next < start + size; next += PAGE_4KB_SIZE) {
+            if (hmm_is_page_available_for_allocation(
+                        mam_get_mapping(hva_to_hpa, next, &hpa, &attrs))) {
+                break;
+            }
+        }
+        hmm_free_ranges_remove(page, next);
+    }
+    return FALSE;
+}
+
 INLINE BOOLEAN hmm_allocate_free_virtual_page(UINT64* hva) {
     return hmm_allocate_continuous_free_virtual_pages(1, hva);
 }
@@ -392,11 +621,13 @@ BOOLEAN hmm_map_phys_page_full_attrs(IN HPA page_hpa, IN MAM_ATTRIBUTES attrs,
             }
             if (flash_all_tlbs_if_needed) {
                 IPC_DESTINATION dest;
+                IPC_BATCH batch;
 
                 dest.addr_shorthand = IPI_DST_ALL_EXCLUDING_SELF;
                 dest.addr = 0;
-                ipc_execute_handler(dest, hmm_flash_tlb_callback, NULL);
-                hw_flash_tlb();
+                ipc_batch_init(&batch, dest, TRUE);
+                ipc_batch_add_invlpg(&batch, hva_tmp, PAGE_4KB_SIZE);
+                ipc_batch_flush(&batch);
             }
         }
         *page_hva = hva_tmp;
@@ -418,6 +649,7 @@ BOOLEAN hmm_map_phys_page_full_attrs(IN HPA page_hpa, IN MAM_ATTRIBUTES attrs,
             result = FALSE;
             goto out;
         }
+        hmm_free_ranges_remove(page_hpa, page_hpa + PAGE_4KB_SIZE);
         *page_hva = page_hpa;
         result = TRUE;
         goto out;
@@ -755,6 +987,7 @@ static BOOLEAN hmm_map_continuous_virtual_buffer_for_pages_internal(
                 result = FALSE;
                 goto out;
             }
+            hmm_free_ranges_add(old_page_hva, old_page_hva + PAGE_4KB_SIZE);
 
             // Insert new HPA-->HVA mapping
             if (!mam_insert_range(hpa_to_hva, page_hpa, page_hva, PAGE_4KB_SIZE, MAM_NO_ATTRIBUTES)) {
@@ -848,6 +1081,7 @@ BOOLEAN hmm_initialize(const VMM_STARTUP_STRUCT* startup_struct) {
     hmm_set_hpa_to_hva_mapping(g_hmm, hpa_to_hva);
     hmm_set_current_vmm_page_tables(g_hmm, HMM_INVALID_VMM_PAGE_TABLES);
     hmm_set_new_allocations_curr_ptr(g_hmm, HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS);
+    hmm_free_ranges_initialize();
     hmm_set_final_mapped_virt_address(g_hmm, 0);
     hmm_set_wb_pat_index(g_hmm, curr_wb_index);
     hmm_set_uc_pat_index(g_hmm, curr_uc_index);
@@ -1186,6 +1420,13 @@ BOOLEAN hmm_unmap_hpa(IN HPA hpa, UINT64 size, BOOLEAN flush_tlbs_on_all_cpus) {
     HVA hva;
     BOOLEAN result = TRUE;
     HPA hpa_tmp;
+    IPC_DESTINATION dest;
+    IPC_BATCH batch;
+
+    // the unmapped pages are invalidated together once they are all unmapped
+    dest.addr_shorthand = flush_tlbs_on_all_cpus ? IPI_DST_ALL_EXCLUDING_SELF : IPI_DST_SELF;
+    dest.addr = 0;
+    ipc_batch_init(&batch, dest, TRUE);
 
     lock_acquire(hmm_get_update_lock(g_hmm));
     if ((ALIGN_BACKWARD(hpa, PAGE_4KB_SIZE) != hpa) ||
@@ -1211,6 +1452,8 @@ BOOLEAN hmm_unmap_hpa(IN HPA hpa, UINT64 size, BOOLEAN flush_tlbs_on_all_cpus) {
                 result = FALSE;
                 goto out;
             }
+            ipc_batch_add_invlpg(&batch, hva, PAGE_4KB_SIZE);
+            hmm_free_ranges_add(hva, hva + PAGE_4KB_SIZE);
         }
         size -= PAGE_4KB_SIZE;
         hpa += PAGE_4KB_SIZE;
@@ -1219,16 +1462,9 @@ BOOLEAN hmm_unmap_hpa(IN HPA hpa, UINT64 size, BOOLEAN flush_tlbs_on_all_cpus) {
     bprint("hmm_unmap_hpa after loop\n");
 #endif
 
-    hw_flash_tlb();
-    if (flush_tlbs_on_all_cpus) {
-        IPC_DESTINATION dest;
-
-        dest.addr_shorthand = IPI_DST_ALL_EXCLUDING_SELF;
-        dest.addr = 0;
-        ipc_execute_handler(dest, hmm_flash_tlb_callback, NULL);
-    }
-
 out:
+    // pages unmapped before a failure must be invalidated as well
+    ipc_batch_flush(&batch);
     lock_release(hmm_get_update_lock(g_hmm));
     return result;
 }
@@ -1456,6 +1692,7 @@ BOOLEAN hmm_free_continuous_virtual_buffer(UINT64 buffer_hva,
     BOOLEAN result = TRUE;
     UINT32 i;
     IPC_DESTINATION dest;
+    IPC_BATCH batch;
 
     MAM_HANDLE hpa_to_hva = hmm_get_hpa_to_hva_mapping(g_hmm);
     UINT64 page_hpa_tmp;
@@ -1483,8 +1720,10 @@ BOOLEAN hmm_free_continuous_virtual_buffer(UINT64 buffer_hva,
 
     dest.addr_shorthand = IPI_DST_ALL_EXCLUDING_SELF;
     dest.addr = 0;
-    ipc_execute_handler(dest, hmm_flash_tlb_callback, NULL);
-    hw_flash_tlb();
+    ipc_batch_init(&batch, dest, TRUE);
+    ipc_batch_add_invlpg(&batch, buffer_hva, (UINT64) i * PAGE_4KB_SIZE);
+    ipc_batch_flush(&batch);
+    hmm_free_ranges_add(buffer_hva, buffer_hva + (UINT64) i * PAGE_4KB_SIZE);
 
     lock_release(hmm_get_update_lock(g_hmm));
     return result;
@@ -1518,6 +1757,7 @@ BOOLEAN hmm_make_phys_page_uncachable(UINT64 page_hpa) {
     curr_uc_pat_index = hmm_get_uc_pat_index(g_hmm);
     if (attrs.paging_attr.pat_index != curr_uc_pat_index) {
         IPC_DESTINATION dest;
+        IPC_BATCH batch;
 
         attrs.paging_attr.pat_index = curr_uc_pat_index;
         if (!mam_insert_range(hva_to_hpa, page_hva, page_hpa, PAGE_4KB_SIZE, attrs)) {
@@ -1526,8 +1766,9 @@ BOOLEAN hmm_make_phys_page_uncachable(UINT64 page_hpa) {
         }
         dest.addr_shorthand = IPI_DST_ALL_EXCLUDING_SELF;
         dest.addr = 0;
-        ipc_execute_handler(dest, hmm_flash_tlb_callback, NULL);
-        hw_flash_tlb();
+        ipc_batch_init(&batch, dest, TRUE);
+        ipc_batch_add_invlpg(&batch, page_hva, PAGE_4KB_SIZE);
+        ipc_batch_flush(&batch);
     }
 
 out:
@@ -25,6 +25,22 @@
 
 #define HMM_WP_BIT_MASK ((UINT64)0x10000)
 
+// Free HVA ranges of the new allocations window, disjoint, in a tree ordered
+// by address where every node knows the largest range below it. The index
+// is a hint: a range may contain pages mapped behind its back, which the
+// allocator finds and removes. The tree lives in a fixed pool, since the
+// HMM cannot allocate; a range that finds the pool full is dropped.
+#define HMM_MAX_FREE_RANGES 512
+
+typedef struct HMM_FREE_RANGE_S {
+    HVA    start;
+    HVA    end;
+    UINT64 max_size;    // of the ranges of the subtree
+    UINT32 priority;
+    UINT16 left;
+    UINT16 right;       // next free node in the pool
+} HMM_FREE_RANGE;
+
 typedef struct HMM_S {
     MAM_HANDLE hva_to_hpa_mapping;
     MAM_HANDLE hpa_to_hva_mapping;
@@ -35,6 +51,9 @@ typedef struct HMM_S {
     UINT64 final_mapped_virt_address;
     UINT32 wb_pat_index;
     UINT32 uc_pat_index;
+    UINT16 free_ranges_root;
+    UINT16 free_ranges_pool;
+    HMM_FREE_RANGE free_ranges[HMM_MAX_FREE_RANGES];
 } HMM; // Host Memory Manager
 
 
@@ -1224,6 +1224,8 @@ static void mam_try_to_retract_inner_entry_to_leaf(IN MAM* mam,
     }
     else {
         mam_invalidate_entry(entry_to_retract, reason, mam_get_leaf_entry_type(entry_ops)); // virtual call
+        // keep #VE suppressed for the not present range, as for the entries it replaces
+        entry_to_retract->invalid_entry.high_part.suppress_ve = first_entry->invalid_entry.high_part.suppress_ve;
     }
 
     // Second: destroy the old (detached) table
@@ -1413,6 +1415,38 @@ static void mam_destroy_table(IN MAM_HVA table) {
     vmm_memory_free(table_ptr);
 }
 
+/* Function: mam_compact_table
+*  Description: The function recursively retracts to leaf entries all the
+*               lower level tables that map uniform, aligned ranges. The
+*               lower levels are compacted first, so that a whole 1GB range
+*               can be retracted once its 2MB tables were.
+*  Input:
+*         mam - main MAM structure
+*         level_ops - virtual table for relevant table operations
+*         table - HVA of the table to compact
+*/
+static void mam_compact_table(IN MAM* mam, IN const MAM_LEVEL_OPS* level_ops,
+                              IN MAM_HVA table) {
+    const MAM_LEVEL_OPS* lower_level_ops = mam_get_lower_level_ops(level_ops); // virtual call
+    const MAM_ENTRY_OPS* entry_ops;
+    MAM_HVA entry_hva;
+
+    if (lower_level_ops == NULL) {
+        // level 1 entries are always leaves
+        return;
+    }
+    entry_ops = mam_get_entry_ops(mam_hva_to_ptr(table));
+    for (entry_hva = table; entry_hva < (table + PAGE_4KB_SIZE); entry_hva += sizeof(MAM_ENTRY)) {
+        MAM_ENTRY* entry = mam_hva_to_ptr(entry_hva);
+
+        if (!mam_is_leaf_entry(entry)) {
+            mam_compact_table(mam, lower_level_ops,
+                              mam_get_table_pointed_by_entry(entry, entry_ops)); // virtual call
+            mam_try_to_retract_inner_entry_to_leaf(mam, entry, level_ops, entry_ops);
+        }
+    }
+}
+
 /* Function: mam_update_table
 *  Description: The function recursively finds the entries that must
 *               be updated and updates it according to provided information
@@ -2089,6 +2123,93 @@ static void mam_clear_reserved_bits_in_pdpt(IN MAM_HVA pdpt) {
 }
 
 
+/*
+ * Translation cache
+ *
+ * Every CPU has a direct mapped cache of the successful translations done
+ * by mam_get_mapping(), in front of the table walk. An entry holds the
+ * update_counter of its MAM at the time of the walk and is valid as long as
+ * the counter doesn't change: every update of a MAM bumps it, which
+ * invalidates all the entries of that MAM at once. Only the owner CPU fills
+ * and reads its cache; mam_destroy_mapping() empties the entries of the
+ * destroyed MAM on all CPUs, since a new MAM may be allocated at its address.
+ *
+ * The cache only pays off when few pages are translated over and over: once
+ * the working set is larger than the cache, the misses cost more than the
+ * walk. It's built only with MAM_TRANSLATION_CACHE defined.
+ */
+#ifdef MAM_TRANSLATION_CACHE
+#define MAM_TRANSLATION_CACHE_SIZE  (PAGE_4KB_SIZE / sizeof(MAM_TRANSLATION_CACHE_ENTRY))
+
+typedef struct _MAM_TRANSLATION_CACHE_ENTRY {
+    const MAM* mam;             // NULL for an empty entry
+    UINT64 src_page;
+    UINT64 tgt_page;
+    MAM_ATTRIBUTES attrs;
+    UINT32 update_counter;
+} MAM_TRANSLATION_CACHE_ENTRY;
+
+// Every MAM gets a color which is added to the page number to index the
+// cache, so that the translations of a page by the MAMs of an identity
+// mapping (gpa -> hpa -> hva) don't take the same entry. The stride is odd,
+// any MAMs created less than MAM_TRANSLATION_CACHE_SIZE apart have
+// different colors.
+#define MAM_TRANSLATION_CACHE_COLOR_STRIDE  0x9E3779B1
+
+static MAM_TRANSLATION_CACHE_ENTRY* mam_translation_caches[VMM_MAX_CPU_SUPPORTED];
+static UINT16 mam_translation_cache_num_cpus = 0;
+static UINT32 mam_translation_cache_next_color = 0;
+
+static MAM_TRANSLATION_CACHE_ENTRY* mam_translation_cache_entry(IN const MAM* mam,
+                                                                IN UINT64 src_addr) {
+    MAM_TRANSLATION_CACHE_ENTRY* cache;
+    CPU_ID cpu_id;
+    UINT64 index;
+
+    if (mam_translation_cache_num_cpus == 0) {
+        return NULL;
+    }
+    cpu_id = hw_cpu_id();
+    if (cpu_id >= mam_translation_cache_num_cpus) {
+        return NULL;
+    }
+    cache = mam_translation_caches[cpu_id];
+    index = (src_addr >> MAM_TABLE_ADDRESS_SHIFT) + mam->translation_cache_color;
+    return &cache[index & (MAM_TRANSLATION_CACHE_SIZE - 1)];
+}
+
+BOOLEAN mam_translation_cache_initialize(UINT16 num_of_cpus) {
+    UINT16 cpu_id;
+
+    if ((mam_translation_cache_num_cpus != 0) || (num_of_cpus > VMM_MAX_CPU_SUPPORTED)) {
+        return FALSE;
+    }
+    for (cpu_id = 0; cpu_id < num_of_cpus; cpu_id++) {
+        mam_translation_caches[cpu_id] = vmm_memory_alloc(PAGE_4KB_SIZE);
+        if (mam_translation_caches[cpu_id] == NULL) {
+            VMM_LOG(mask_anonymous, level_error,"MAM ERROR: %s: Failed to allocate the translation cache of CPU%d\n", __FUNCTION__, cpu_id);
+            return FALSE;
+        }
+        vmm_zeromem(mam_translation_caches[cpu_id], PAGE_4KB_SIZE);
+    }
+    mam_translation_cache_num_cpus = num_of_cpus;
+    return TRUE;
+}
+
+static void mam_translation_cache_remove_mam(IN const MAM* mam) {
+    UINT16 cpu_id;
+    UINT32 i;
+
+    for (cpu_id = 0; cpu_id < mam_translation_cache_num_cpus; cpu_id++) {
+        for (i = 0; i < MAM_TRANSLATION_CACHE_SIZE; i++) {
+            if (mam_translation_caches[cpu_id][i].mam == mam) {
+                mam_translation_caches[cpu_id][i].mam = NULL;
+            }
+        }
+    }
+}
+#endif
+
 
 MAM_HANDLE mam_create_mapping(MAM_ATTRIBUTES inner_level_attributes) {
     MAM* mam = vmm_memory_alloc(sizeof(MAM));
@@ -2122,6 +2243,11 @@ MAM_HANDLE mam_create_mapping(MAM_ATTRIBUTES inner_level_attributes) {
     mam->is_32bit_page_tables = FALSE;
     mam->last_iterator = MAM_INVALID_MEMORY_RANGES_ITERATOR;
     mam->last_range_size = 0;
+#ifdef MAM_TRANSLATION_CACHE
+    mam->translation_cache_color = (UINT32)hw_interlocked_add(
+                (INT32 volatile*)&mam_translation_cache_next_color,
+                (INT32)MAM_TRANSLATION_CACHE_COLOR_STRIDE);
+#endif
 
     return (MAM_HANDLE)mam;
 
@@ -2142,6 +2268,9 @@ void mam_destroy_mapping(IN MAM_HANDLE mam_handle) {
     lock_acquire(&(mam->update_lock));
     mam_destroy_table(first_table);
     lock_release(&(mam->update_lock));
+#ifdef MAM_TRANSLATION_CACHE
+    mam_translation_cache_remove_mam(mam);
+#endif
     vmm_memory_free(mam);
 }
 
@@ -2154,8 +2283,22 @@ MAM_MAPPING_RESULT mam_get_mapping(IN MAM_HANDLE mam_handle, IN UINT64 src_addr,
     MAM_MAPPING_RESULT res;
     UINT32 update_counter1;
     UINT32 update_counter2;
+#ifdef MAM_TRANSLATION_CACHE
+    MAM_TRANSLATION_CACHE_ENTRY* cache_entry;
+#endif
 
     VMM_ASSERT(mam_handle != MAM_INVALID_HANDLE);
+#ifdef MAM_TRANSLATION_CACHE
+    cache_entry = mam_translation_cache_entry(mam, src_addr);
+    if ((cache_entry != NULL) && (cache_entry->mam == mam) &&
+        (cache_entry->src_page == ALIGN_BACKWARD(src_addr, PAGE_4KB_SIZE)) &&
+        (cache_entry->update_counter == mam->update_counter)) {
+        *tgt_addr = cache_entry->tgt_page | (src_addr & PAGE_4KB_MASK);
+        *attrs = cache_entry->attrs;
+        return MAM_MAPPING_SUCCESSFUL;
+    }
+#endif
+
     first_table_ops = mam->first_table_ops;
     first_table = mam->first_table;
     // No range was inserted yet
@@ -2181,6 +2324,17 @@ MAM_MAPPING_RESULT mam_get_mapping(IN MAM_HANDLE mam_handle, IN UINT64 src_addr,
              (((update_counter2 & 0x1) != 0) && (hw_cpu_id() != mam->update_on_cpu )) // must be even number in order to exit or query on the same cpu as update
             );
 
+#ifdef MAM_TRANSLATION_CACHE
+    // don't cache what the update in progress on this CPU may still change
+    if ((cache_entry != NULL) && (res == MAM_MAPPING_SUCCESSFUL) &&
+        ((update_counter2 & 0x1) == 0)) {
+        cache_entry->src_page = ALIGN_BACKWARD(src_addr, PAGE_4KB_SIZE);
+        cache_entry->tgt_page = ALIGN_BACKWARD(*tgt_addr, PAGE_4KB_SIZE);
+        cache_entry->attrs = *attrs;
+        cache_entry->update_counter = update_counter2;
+        cache_entry->mam = mam;
+    }
+#endif
     return res;
 }
 
@@ -2438,6 +2592,7 @@ BOOLEAN mam_convert_to_64bit_page_tables(IN MAM_HANDLE mam_handle,
         res = FALSE;
         goto out;
     }
+    mam_compact_table(mam, mam->first_table_ops, mam->first_table);
     first_table_hpa = mam_hva_to_hpa(mam->first_table);
     *pml4t_hpa = (UINT64)first_table_hpa;
     res = TRUE;
@@ -2573,6 +2728,25 @@ UINT64 mam_get_range_start_address_from_iterator(IN MAM_HANDLE mam_handle UNUSED
     return (UINT64)iter;
 }
 
+void mam_compact_mapping(IN MAM_HANDLE mam_handle) {
+    MAM* mam = (MAM*)mam_handle;
+
+    if (mam_handle == MAM_INVALID_HANDLE) {
+        return;
+    }
+    lock_acquire(&(mam->update_lock));
+    mam->update_on_cpu = hw_cpu_id();
+    mam->update_counter++; // first update (becomes odd number)
+    VMM_ASSERT((mam->update_counter & 0x1) != 0);
+
+    mam_compact_table(mam, mam->first_table_ops, mam->first_table);
+
+    mam->update_counter++; // second update (becomes even number);
+    VMM_ASSERT((mam->update_counter & 0x1) == 0);
+    mam->update_on_cpu = MAM_INVALID_CPU_ID;
+    lock_release(&(mam->update_lock));
+}
+
 BOOLEAN mam_convert_to_ept(IN MAM_HANDLE mam_handle,
                            IN MAM_EPT_SUPER_PAGE_SUPPORT ept_super_page_support,
                            IN MAM_EPT_SUPPORTED_GAW ept_supported_gaw,
@@ -2626,9 +2800,10 @@ BOOLEAN mam_convert_to_ept(IN MAM_HANDLE mam_handle,
         res = FALSE;
         goto out;
     }
+    mam_compact_table(mam, mam->first_table_ops, mam->first_table);
 
-    // Update super page support to default lowest value
-    mam->ept_supper_page_support = 0;
+    // Super page support is kept, so later updates split super pages only
+    // where they change a sub range and retract them when it is uniform again
     *first_table_hpa = mam_hva_to_hpa(mam->first_table);
     res = TRUE;
 
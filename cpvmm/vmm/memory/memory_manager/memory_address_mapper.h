@@ -228,6 +228,9 @@ struct MAM_S {
     UINT8 ept_hw_ve_support;
     MAM_MEMORY_RANGES_ITERATOR last_iterator;
     UINT64 last_range_size;
+#ifdef MAM_TRANSLATION_CACHE
+    UINT32 translation_cache_color;
+#endif
 };
 
 
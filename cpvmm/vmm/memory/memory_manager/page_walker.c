@@ -24,6 +24,9 @@
 #include <guest_cpu.h>
 #include <hw_interlocked.h>
 #include <page_walker.h>
+#include <event_mgr.h>
+#include <vmm_events_data.h>
+#include <heap.h>
 #ifdef JLMDEBUG
 #include "jlmdebug.h"
 #endif
@@ -111,6 +114,56 @@ typedef union PW_PFEC_U {
 
 UINT32 pw_reserved_bits_high_mask;
 
+// Page walk cache
+//
+// Every gcpu keeps the results of its recent successful page walks, a small
+// software TLB of guest virtual to guest physical translations. An entry is
+// tagged with the CR3 it was walked from, PCID included, with the paging mode
+// and with the GPM, and keeps the access rights granted by all the levels,
+// so write, user and fetch accesses are checked without a walk. As in the
+// processor TLB, entries are dropped by the guest's MOV to CR3 (only these of
+// the new PCID if CR4.PCIDE is set) and INVLPG, and all by CR0 and CR4 writes.
+// Unless the VMM intercepts all the guest's ways to flush its TLB,
+// gcpu_vmexit_start() drops all the entries on every VMEXIT.
+#define PW_CACHE_SIZE               64      // entries, must be a power of 2
+
+// paging mode of a walk
+#define PW_CACHE_MODE_PAE           0x01
+#define PW_CACHE_MODE_LME           0x02
+#define PW_CACHE_MODE_PSE           0x04
+#define PW_CACHE_MODE_NXE           0x08
+#define PW_CACHE_MODE_PCIDE         0x10
+#define PW_CACHE_MODE_HOST_PT       0x20
+
+// accesses granted by all the levels
+#define PW_CACHE_ACCESS_WRITE       0x01
+#define PW_CACHE_ACCESS_USER        0x02
+#define PW_CACHE_ACCESS_FETCH       0x04
+#define PW_CACHE_ACCESS_AD_SET      0x08    // the walk set the accessed bits
+#define PW_CACHE_ACCESS_DIRTY       0x10    // and the dirty bit
+
+#define PW_CR4_PCIDE                BIT_VALUE64(17)
+#define PW_CR3_NO_FLUSH             BIT_VALUE64(63)  // MOV to CR3 with CR4.PCIDE
+#define PW_CR3_PCID_MASK            ((UINT64)0xfff)
+
+typedef struct _PW_CACHE_ENTRY {
+    UINT64      virt_page;      // 4KB page of the virtual address
+    UINT64      gpa_base;       // of the guest page, of any size
+    UINT64      offset_mask;    // guest page size - 1
+    UINT64      cr3;
+    GPM_HANDLE  gpm;
+    UINT32      generation;     // valid if equal to the cache generation
+    UINT8       mode;           // PW_CACHE_MODE_...
+    UINT8       access;         // PW_CACHE_ACCESS_...
+    UINT8       pad[2];
+} PW_CACHE_ENTRY;
+
+typedef struct _PW_CACHE {
+    UINT32          generation;
+    UINT32          pad;
+    PW_CACHE_ENTRY  entries[PW_CACHE_SIZE];
+} PW_CACHE;
+
 INLINE BOOLEAN pw_gpa_to_hpa(GPM_HANDLE gpm_handle, UINT64 gpa, UINT64* hpa) {
 	MAM_ATTRIBUTES attrs;
     return gpm_gpa_to_hpa(gpm_handle, gpa, hpa, &attrs);
@@ -522,6 +575,177 @@ static void pw_update_ad_bits(PW_PAGE_ENTRY* guest_space_pml4te,
 }
 
 
+static PW_CACHE_ENTRY* pw_cache_entry(PW_CACHE* cache, UINT64 virt_addr) {
+    return &cache->entries[(virt_addr >> PW_PTE_INDEX_SHIFT) & (PW_CACHE_SIZE - 1)];
+}
+
+static PW_CACHE_ENTRY* pw_cache_lookup(PW_CACHE* cache, UINT64 virt_addr,
+                    UINT64 cr3, UINT8 mode, GPM_HANDLE gpm_handle) {
+    PW_CACHE_ENTRY* entry = pw_cache_entry(cache, virt_addr);
+
+    if ((entry->generation != cache->generation) ||
+        (entry->virt_page != ALIGN_BACKWARD(virt_addr, PAGE_4KB_SIZE)) ||
+        (entry->cr3 != cr3) || (entry->mode != mode) || (entry->gpm != gpm_handle)) {
+        return NULL;
+    }
+    return entry;
+}
+
+// Same checks as the walk, on the access rights of all the levels
+static BOOLEAN pw_cache_is_access_permitted(PW_CACHE_ENTRY* entry, BOOLEAN is_write,
+                    BOOLEAN is_user, BOOLEAN is_fetch, BOOLEAN is_wp,
+                    BOOLEAN set_ad_bits) {
+    if (is_write && (is_user || is_wp) && !(entry->access & PW_CACHE_ACCESS_WRITE)) {
+        return FALSE;
+    }
+    if (is_user && !(entry->access & PW_CACHE_ACCESS_USER)) {
+        return FALSE;
+    }
+    if (is_fetch && !(entry->access & PW_CACHE_ACCESS_FETCH)) {
+        return FALSE;
+    }
+    // the walk has to set the A/D bits, as the processor does on a TLB miss
+    if (set_ad_bits && (!(entry->access & PW_CACHE_ACCESS_AD_SET) ||
+                        (is_write && !(entry->access & PW_CACHE_ACCESS_DIRTY)))) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void pw_cache_flush_pcid(PW_CACHE* cache, UINT64 pcid) {
+    UINT32 i;
+
+    for (i = 0; i < PW_CACHE_SIZE; i++) {
+        if ((cache->entries[i].mode & PW_CACHE_MODE_PCIDE) &&
+            ((cache->entries[i].cr3 & PW_CR3_PCID_MASK) == pcid)) {
+            cache->entries[i].generation = 0;
+        }
+    }
+}
+
+void pw_cache_flush(IN GUEST_CPU_HANDLE gcpu) {
+    PW_CACHE* cache = (PW_CACHE*)gcpu_get_page_walk_cache(gcpu);
+
+    if (cache == NULL) {
+        return;
+    }
+    // entries of older generations are invalid
+    if (++cache->generation == 0) {
+        vmm_zeromem(cache->entries, sizeof(cache->entries));
+        cache->generation = 1;
+    }
+}
+
+static BOOLEAN pw_cache_cr_update(GUEST_CPU_HANDLE gcpu, void* pv UNUSED) {
+    pw_cache_flush(gcpu);
+    return TRUE;
+}
+
+static BOOLEAN pw_cache_cr3_update(GUEST_CPU_HANDLE gcpu, void* pv) {
+    EVENT_GCPU_GUEST_CR_WRITE_DATA* data = (EVENT_GCPU_GUEST_CR_WRITE_DATA*)pv;
+    PW_CACHE* cache = (PW_CACHE*)gcpu_get_page_walk_cache(gcpu);
+    UINT64 cr4 = gcpu_get_guest_visible_control_reg(gcpu, IA32_CTRL_CR4);
+
+    if (!(cr4 & PW_CR4_PCIDE)) {
+        pw_cache_flush(gcpu);
+    }
+    else if (!(data->new_guest_visible_value & PW_CR3_NO_FLUSH)) {
+        pw_cache_flush_pcid(cache, data->new_guest_visible_value & PW_CR3_PCID_MASK);
+    }
+    return TRUE;
+}
+
+static BOOLEAN pw_cache_invalidate_page(GUEST_CPU_HANDLE gcpu, void* pv) {
+    EVENT_GCPU_INVALIDATE_PAGE_DATA* data = (EVENT_GCPU_INVALIDATE_PAGE_DATA*)pv;
+    PW_CACHE* cache = (PW_CACHE*)gcpu_get_page_walk_cache(gcpu);
+    PW_CACHE_ENTRY* entry;
+    UINT32 i;
+
+    // the whole guest page is invalidated, whatever its size
+    for (i = 0; i < PW_CACHE_SIZE; i++) {
+        entry = &cache->entries[i];
+        if (((entry->virt_page ^ data->invlpg_addr) & ~entry->offset_mask) == 0) {
+            entry->generation = 0;
+        }
+    }
+    return TRUE;
+}
+
+static BOOLEAN pw_cache_add_gcpu(GUEST_CPU_HANDLE gcpu, void* pv UNUSED) {
+    PW_CACHE* cache;
+
+    if (gcpu_get_page_walk_cache(gcpu) != NULL) {
+        return TRUE;
+    }
+    // larger than the vmm_malloc pools, a zeroed page of its own
+    VMM_ASSERT(sizeof(PW_CACHE) <= PAGE_4KB_SIZE);
+    cache = (PW_CACHE*)vmm_memory_alloc(sizeof(PW_CACHE));
+    if (cache == NULL) {
+        VMM_LOG(mask_anonymous, level_error,
+                "%s: page walks of guest %d CPU %d won't be cached\n", __FUNCTION__,
+                guest_vcpu(gcpu)->guest_id, guest_vcpu(gcpu)->guest_cpu_id);
+        return TRUE;
+    }
+    cache->generation = 1;
+    gcpu_set_page_walk_cache(gcpu, cache);
+    event_gcpu_register(EVENT_GCPU_AFTER_GUEST_CR0_WRITE, gcpu, pw_cache_cr_update);
+    event_gcpu_register(EVENT_GCPU_AFTER_GUEST_CR3_WRITE, gcpu, pw_cache_cr3_update);
+    event_gcpu_register(EVENT_GCPU_AFTER_GUEST_CR4_WRITE, gcpu, pw_cache_cr_update);
+    event_gcpu_register(EVENT_GCPU_INVALIDATE_PAGE, gcpu, pw_cache_invalidate_page);
+    return TRUE;
+}
+
+void pw_cache_initialize(void) {
+    GUEST_HANDLE guest;
+    GUEST_ECONTEXT guest_ctx;
+    GUEST_CPU_HANDLE gcpu;
+    GUEST_GCPU_ECONTEXT gcpu_ctx;
+
+    event_global_register(EVENT_GCPU_ADD, pw_cache_add_gcpu);
+    for (guest = guest_first(&guest_ctx); guest; guest = guest_next(&guest_ctx)) {
+        for (gcpu = guest_gcpu_first(guest, &gcpu_ctx); gcpu; gcpu = guest_gcpu_next(&gcpu_ctx)) {
+            pw_cache_add_gcpu(gcpu, NULL);
+        }
+    }
+}
+
+static void pw_cache_fill(PW_CACHE* cache, UINT64 virt_addr, UINT64 cr3, UINT8 mode,
+                    GPM_HANDLE gpm_handle, UINT64 gpa, UINT64 offset_mask,
+                    PW_PAGE_ENTRY* pml4te, PW_PAGE_ENTRY* pdpte, PW_PAGE_ENTRY* pde,
+                    PW_PAGE_ENTRY* pte, BOOLEAN is_write, BOOLEAN set_ad_bits) {
+    PW_CACHE_ENTRY* entry = pw_cache_entry(cache, virt_addr);
+    BOOLEAN is_lme = ((mode & PW_CACHE_MODE_LME) != 0);
+    BOOLEAN is_pae = ((mode & PW_CACHE_MODE_PAE) != 0);
+    BOOLEAN is_pse = ((mode & PW_CACHE_MODE_PSE) != 0);
+    UINT8 access = 0;
+
+    if (pw_is_write_access_permitted(pml4te, pdpte, pde, pte, TRUE, TRUE, is_lme, is_pae, is_pse)) {
+        access |= PW_CACHE_ACCESS_WRITE;
+    }
+    if (pw_is_user_access_permitted(pml4te, pdpte, pde, pte, is_lme, is_pae, is_pse)) {
+        access |= PW_CACHE_ACCESS_USER;
+    }
+    if (!(is_pae && (mode & PW_CACHE_MODE_NXE)) ||
+        pw_is_fetch_access_permitted(pml4te, pdpte, pde, pte, is_lme, is_pae, is_pse)) {
+        access |= PW_CACHE_ACCESS_FETCH;
+    }
+    if (set_ad_bits) {
+        access |= PW_CACHE_ACCESS_AD_SET;
+        if (is_write) {
+            access |= PW_CACHE_ACCESS_DIRTY;
+        }
+    }
+    entry->virt_page = ALIGN_BACKWARD(virt_addr, PAGE_4KB_SIZE);
+    entry->gpa_base = gpa & ~offset_mask;
+    entry->offset_mask = offset_mask;
+    entry->cr3 = cr3;
+    entry->gpm = gpm_handle;
+    entry->mode = mode;
+    entry->access = access;
+    entry->generation = cache->generation;
+}
+
+
 PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu, IN UINT64 virt_addr,
                      IN BOOLEAN is_write, IN BOOLEAN is_user, IN BOOLEAN is_fetch,
                      IN BOOLEAN set_ad_bits, OUT UINT64* gpa_out, OUT UINT64* pfec_out) {
@@ -557,6 +781,11 @@ PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu, IN UINT64 virt_addr,
     PW_PAGE_ENTRY* pte_ptr = NULL;
     PW_PAGE_ENTRY pte_val;
     BOOLEAN use_host_pt = gcpu_uses_host_page_tables(gcpu);
+    PW_CACHE* cache = (PW_CACHE*)gcpu_get_page_walk_cache(gcpu);
+    PW_CACHE_ENTRY* cache_entry = NULL;
+    UINT64 cache_cr3 = cr3 & ~PW_CR3_NO_FLUSH;
+    UINT64 offset_mask = PAGE_4KB_MASK;
+    UINT8 mode = 0;
 
     pml4te_val.pae_lme_entry.uint64 = 0;
     pdpte_val.pae_lme_entry.uint64 = 0;
@@ -567,6 +796,22 @@ PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu, IN UINT64 virt_addr,
     native_pfec.bits.is_user = (is_user) ? 1 : 0;
     native_pfec.bits.is_fetch = (is_pae && is_nxe && is_fetch) ? 1 : 0;
 
+    if (cache != NULL) {
+        mode = (UINT8)((is_pae ? PW_CACHE_MODE_PAE : 0) | (is_lme ? PW_CACHE_MODE_LME : 0) |
+                       (is_pse ? PW_CACHE_MODE_PSE : 0) | (is_nxe ? PW_CACHE_MODE_NXE : 0) |
+                       ((cr4 & PW_CR4_PCIDE) ? PW_CACHE_MODE_PCIDE : 0) |
+                       (use_host_pt ? PW_CACHE_MODE_HOST_PT : 0));
+        cache_entry = pw_cache_lookup(cache, virt_addr, cache_cr3, mode, gpm_handle);
+        if ((cache_entry != NULL) &&
+            pw_cache_is_access_permitted(cache_entry, is_write, is_user,
+                                         (BOOLEAN)native_pfec.bits.is_fetch, is_wp, set_ad_bits)) {
+            gpa = cache_entry->gpa_base | (virt_addr & cache_entry->offset_mask);
+            retval = PW_RETVAL_SUCCESS;
+            goto out;
+        }
+        cache_entry = NULL;
+    }
+
     pw_retrieve_indices(virt_addr, is_pae, is_lme, &pml4te_index, &pdpte_index, &pde_index, &pte_index);
 
     first_table = pw_retrieve_table_from_cr3(cr3, is_pae, is_lme);
@@ -629,6 +874,7 @@ PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu, IN UINT64 virt_addr,
         offset_in_big_page = pw_get_big_page_offset(virt_addr, is_pae, TRUE);
         // Calculate full guest accessed physical address
         gpa = big_page_addr + offset_in_big_page;
+        offset_mask = PAGE_1GB_MASK;
         if ((is_write) &&
             (!pw_is_write_access_permitted(&pml4te_val, &pdpte_val, NULL, NULL, is_user, is_wp, is_lme, is_pae, is_pse))) {
             native_pfec.bits.present = 1;
@@ -684,6 +930,7 @@ PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu, IN UINT64 virt_addr,
         offset_in_big_page = pw_get_big_page_offset(virt_addr, is_pae, FALSE);
         // Calculate full guest accessed physical address
         gpa = big_page_addr + offset_in_big_page;
+        offset_mask = (is_pae) ? PAGE_2MB_MASK : PAGE_4MB_MASK;
 
         if ((is_write) &&
             (!pw_is_write_access_permitted(&pml4te_val, &pdpte_val, &pde_val, NULL, is_user, is_wp, is_lme, is_pae, is_pse))) {
@@ -770,6 +1017,10 @@ PW_RETVAL pw_perform_page_walk(IN GUEST_CPU_HANDLE gcpu, IN UINT64 virt_addr,
     retval = PW_RETVAL_SUCCESS; // page walk succeeded
 
 out:
+    if ((retval == PW_RETVAL_SUCCESS) && (cache != NULL) && (cache_entry == NULL)) {
+        pw_cache_fill(cache, virt_addr, cache_cr3, mode, gpm_handle, gpa, offset_mask,
+                      &pml4te_val, &pdpte_val, &pde_val, &pte_val, is_write, set_ad_bits);
+    }
     if (gpa_out != NULL) {
         *gpa_out = gpa;
     }
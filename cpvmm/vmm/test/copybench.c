@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of vmm_memcpy, vmm_memmove, vmm_memset and
+// vmm_zero_page (libc/common_libc.c).
+//
+// The copies are first checked against the C library for all small
+// sizes, alignments and overlaps. Then a size sweep compares the loops
+// libc/common_libc.c used to have ("old"), the general purpose register
+// paths used before vmm_mem_ops_init() ("generic") and the paths it
+// selects from CPUID ("tuned").
+//
+//   copybench [-m max_size] [-b bytes_per_size]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MAX_CHECK_SIZE  300
+#define PAGE_SIZE       4096
+#define HEAP_SIZE       (256 << 20)     // larger than the last level cache
+
+// libc/common_libc.c, release build
+extern void*    vmm_memset(void *dest, int filler, size_t count);
+extern void*    vmm_memcpy(void *dest, const void* src, size_t count);
+extern void*    vmm_memmove(void *dest, const void* src, int count);
+extern void     vmm_zero_page(void *page);
+extern void     vmm_mem_ops_init(void);
+
+// must match CPUID_PARAMS in vmm/include/hw/hw_utils.h
+typedef struct {
+    uint64_t m_rax;
+    uint64_t m_rbx;
+    uint64_t m_rcx;
+    uint64_t m_rdx;
+} CPUID_PARAMS;
+
+void hw_cpuid(CPUID_PARAMS *cp)
+{
+    __asm__ volatile(
+        "\tcpuid\n"
+    : "=a" (cp->m_rax), "=b" (cp->m_rbx), "=c" (cp->m_rcx), "=d" (cp->m_rdx)
+    : "a" (cp->m_rax), "c" (cp->m_rcx));
+}
+
+
+// the loops libc/common_libc.c used before the tuned paths
+static __attribute__((noinline)) void* old_memset(void *dest, int filler, size_t count)
+{
+    uint8_t* p = (uint8_t*) dest;
+
+    while (count-- > 0)
+        *(p++) = (uint8_t) filler;
+    return dest;
+}
+
+static __attribute__((noinline)) void* old_memcpy_ascending(void *dest, const void* src, size_t count)
+{
+    size_t i = 0, j, cnt_64bit;
+
+    cnt_64bit = count >> 3;
+    for (i = 0; i < cnt_64bit; i++)
+        ((uint64_t*) dest)[i] = ((const uint64_t*) src)[i];
+    for (j = i << 3; j < count; j++)
+        ((uint8_t*) dest)[j] = ((const uint8_t*) src)[j];
+    return dest;
+}
+
+static __attribute__((noinline)) void* old_memcpy_descending(void *dest, const void* src, size_t count)
+{
+    size_t i, cnt = count >> 3, rem = count & 7;
+
+    for (i = 0; i < rem; i++)
+        ((uint8_t*) dest)[count - i - 1] = ((const uint8_t*) src)[count - i - 1];
+    for (i = cnt; i > 0; i--)
+        ((uint64_t*) dest)[i - 1] = ((const uint64_t*) src)[i - 1];
+    return dest;
+}
+
+static __attribute__((noinline)) void* old_memcpy(void *dest, const void* src, size_t count)
+{
+    if (dest >= src)
+        return old_memcpy_descending(dest, src, count);
+    return old_memcpy_ascending(dest, src, count);
+}
+
+
+static void fill_pattern(uint8_t *buf, size_t size, unsigned seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = (uint8_t)(seed + i * 131);
+    }
+}
+
+// compare vmm_memcpy, vmm_memmove and vmm_memset with the C library
+static int check_copies(const char *label)
+{
+    static uint8_t buf[3 * MAX_CHECK_SIZE + 64];
+    static uint8_t ref[sizeof(buf)];
+    size_t size;
+    int src_off, dst_off;
+    int errors = 0;
+
+    for (size = 0; size <= MAX_CHECK_SIZE; size++) {
+        for (src_off = 0; src_off < 16; src_off++) {
+            // separate buffers, then every overlap around the source
+            for (dst_off = -MAX_CHECK_SIZE; dst_off <= MAX_CHECK_SIZE;
+                 dst_off += (dst_off > -20 && dst_off < 20) ? 1 : 37) {
+                uint8_t *src = buf + MAX_CHECK_SIZE + src_off;
+                uint8_t *dst = src + dst_off;
+
+                fill_pattern(buf, sizeof(buf), (unsigned)(size + src_off));
+                memcpy(ref, buf, sizeof(buf));
+                memmove(ref + (dst - buf), ref + (src - buf), size);
+                if (dst_off & 1) {
+                    vmm_memmove(dst, src, (int) size);
+                }
+                else {
+                    vmm_memcpy(dst, src, size);
+                }
+                if (memcmp(buf, ref, sizeof(buf)) != 0) {
+                    if (errors++ < 10) {
+                        printf("%s: copy of %zu bytes, src +%d, dst %+d failed\n",
+                               label, size, src_off, dst_off);
+                    }
+                }
+            }
+            fill_pattern(buf, sizeof(buf), (unsigned) size);
+            memcpy(ref, buf, sizeof(buf));
+            memset(ref + src_off, 0xA5, size);
+            vmm_memset(buf + src_off, 0xA5, size);
+            if (memcmp(buf, ref, sizeof(buf)) != 0) {
+                if (errors++ < 10) {
+                    printf("%s: memset of %zu bytes at +%d failed\n", label, size, src_off);
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+typedef enum {
+    OP_COPY_OLD,
+    OP_COPY,
+    OP_SET_OLD,
+    OP_SET,
+    OP_ZERO_PAGE,
+} BENCH_OP;
+
+// ns per call of op on size bytes, repeated over about bytes_per_size bytes
+static double bench(BENCH_OP op, uint8_t *dst, const uint8_t *src, size_t size,
+                    size_t bytes_per_size)
+{
+    struct timespec start, end;
+    size_t iterations = bytes_per_size / size + 1;
+    size_t i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        switch (op) {
+        case OP_COPY_OLD:
+            old_memcpy(dst, src, size);
+            break;
+        case OP_COPY:
+            vmm_memcpy(dst, src, size);
+            break;
+        case OP_SET_OLD:
+            old_memset(dst, 0, size);
+            break;
+        case OP_SET:
+            vmm_memset(dst, 0, size);
+            break;
+        case OP_ZERO_PAGE:
+            vmm_zero_page(dst);
+            break;
+        }
+        __asm__ volatile("" : : "r" (dst) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_seconds(&start, &end) * 1e9 / iterations;
+}
+
+// ns per page to zero a heap larger than the caches page by page, as
+// vmm_memory_allocate() zeroes freshly allocated pages
+static double bench_heap_zero(BENCH_OP op, uint8_t *heap)
+{
+    struct timespec start, end;
+    size_t offset;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (offset = 0; offset < HEAP_SIZE; offset += PAGE_SIZE) {
+        if (op == OP_ZERO_PAGE) {
+            vmm_zero_page(heap + offset);
+        }
+        else if (op == OP_SET_OLD) {
+            old_memset(heap + offset, 0, PAGE_SIZE);
+        }
+        else {
+            vmm_memset(heap + offset, 0, PAGE_SIZE);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_seconds(&start, &end) * 1e9 / (HEAP_SIZE / PAGE_SIZE);
+}
+
+#define MAX_SIZES   32
+
+int main(int argc, char **argv)
+{
+    size_t max_size = 1 << 20;
+    size_t bytes_per_size = 256 << 20;
+    size_t sizes[MAX_SIZES];
+    double copy_ns[3][MAX_SIZES];
+    double set_ns[3][MAX_SIZES];
+    double page_ns[3];
+    uint8_t *src;
+    uint8_t *dst;
+    uint8_t *heap;
+    size_t size;
+    int num_sizes = 0;
+    int errors;
+    int pass;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            max_size = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            bytes_per_size = strtoul(argv[++i], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-m max_size] [-b bytes_per_size]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_size < PAGE_SIZE) {
+        max_size = PAGE_SIZE;
+    }
+    if (posix_memalign((void**) &src, PAGE_SIZE, max_size) != 0 ||
+        posix_memalign((void**) &dst, PAGE_SIZE, max_size) != 0 ||
+        posix_memalign((void**) &heap, PAGE_SIZE, HEAP_SIZE) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fill_pattern(src, max_size, 1);
+    memset(dst, 0, max_size);
+    memset(heap, 0xFF, HEAP_SIZE);
+
+    for (size = 16; size <= max_size && num_sizes < MAX_SIZES; size <<= 1) {
+        sizes[num_sizes++] = size;
+    }
+
+    // generic paths, before vmm_mem_ops_init()
+    errors = check_copies("generic");
+    for (i = 0; i < num_sizes; i++) {
+        copy_ns[0][i] = bench(OP_COPY_OLD, dst, src, sizes[i], bytes_per_size);
+        copy_ns[1][i] = bench(OP_COPY, dst, src, sizes[i], bytes_per_size);
+        set_ns[0][i] = bench(OP_SET_OLD, dst, src, sizes[i], bytes_per_size);
+        set_ns[1][i] = bench(OP_SET, dst, src, sizes[i], bytes_per_size);
+    }
+    page_ns[0] = bench_heap_zero(OP_SET_OLD, heap);
+
+    vmm_mem_ops_init();
+    errors += check_copies("tuned");
+    for (i = 0; i < num_sizes; i++) {
+        copy_ns[2][i] = bench(OP_COPY, dst, src, sizes[i], bytes_per_size);
+        set_ns[2][i] = bench(OP_SET, dst, src, sizes[i], bytes_per_size);
+    }
+    page_ns[1] = bench_heap_zero(OP_SET, heap);
+    page_ns[2] = bench_heap_zero(OP_ZERO_PAGE, heap);
+
+    printf("check: %s\n", errors ? "FAILED" : "passed");
+    for (pass = 0; pass < 2; pass++) {
+        double (*ns)[MAX_SIZES] = (pass == 0) ? copy_ns : set_ns;
+
+        printf("\n%-8s %10s %10s %10s %8s   (ns per call)\n",
+               pass == 0 ? "memcpy" : "memset", "old", "generic", "tuned", "speedup");
+        for (i = 0; i < num_sizes; i++) {
+            printf("%-8zu %10.1f %10.1f %10.1f %7.2fx\n", sizes[i],
+                   ns[0][i], ns[1][i], ns[2][i], ns[0][i] / ns[2][i]);
+        }
+    }
+    printf("\n%-8s %10s %10s %10s %8s   (ns per page, %d MB heap)\n", "zeroing",
+           "old", "memset", "zero_page", "speedup", HEAP_SIZE >> 20);
+    printf("%-8d %10.1f %10.1f %10.1f %7.2fx\n", PAGE_SIZE,
+           page_ns[0], page_ns[1], page_ns[2], page_ns[0] / page_ns[2]);
+    free(heap);
+    free(src);
+    free(dst);
+    return errors ? 1 : 0;
+}
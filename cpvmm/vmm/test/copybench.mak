@@ -0,0 +1,64 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the libc copy and fill routines (common_libc.c) with a
+# correctness check and a size sweep benchmark.
+#   make -f copybench.mak && copybench.exe [-m max_size]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g -fno-tree-loop-distribute-patterns
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/common_libc.o $(B)/em64t_mem2.o $(B)/copybench.o
+
+all: $(E)/copybench.exe
+ 
+$(E)/copybench.exe: $(dobjs)
+	@echo "copybench.exe"
+	$(LINK) -o $(E)/copybench.exe $(dobjs)
+
+$(B)/common_libc.o: $(mainsrc)/libc/common_libc.c
+	echo "common_libc.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/common_libc.o $(mainsrc)/libc/common_libc.c
+
+$(B)/em64t_mem2.o: $(mainsrc)/libc/em64t_mem2.c
+	echo "em64t_mem2.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/em64t_mem2.o $(mainsrc)/libc/em64t_mem2.c
+
+$(B)/copybench.o: $(mainsrc)/test/copybench.c
+	echo "copybench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/copybench.o $(mainsrc)/test/copybench.c
+
+clean:
+	rm -f $(E)/copybench.exe
+	rm -f $(dobjs)
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of the EPT dirty page log
+// (memory/ept/ept_dirty_log.c) on a simulated default EPT.
+//
+// The check logs a 1GB range holding read only and unmapped pages: guest
+// writes to logged pages exit once per harvest period and are set in the
+// harvested bitmap, the others are not logged, and stopping the log gives
+// the write permission back. Start and stop are repeated to check the
+// bitmaps go back to the heap.
+//
+// The benchmark times a harvest of a range of which a share of the pages,
+// random ones, were written.
+//
+//   dirtylogbench [-g range_gb] [-d dirty_per_thousand]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+// memory/ept/ept_dirty_log.c, release build
+extern int      ept_dirty_log_start(void* guest, uint64_t base, uint64_t size);
+extern void     ept_dirty_log_stop(void* guest);
+extern int      ept_dirty_log_harvest(void* guest, uint32_t* dirty_bitmap,
+                    uint32_t* num_dirty_pages);
+// test/dirtylogstubs.c
+extern void*    dirtylogbench_guest(void);
+extern void     dirtylogbench_set_pages(uint8_t* pages, uint64_t num_of_pages);
+extern uint64_t dirtylogbench_mam_updates(void);
+extern uint64_t dirtylogbench_invepts(void);
+extern uint32_t dirtylogbench_errors(void);
+extern int      dirtylogbench_write(uint64_t gpa);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+
+#define HEAP_SIZE       (4 << 20)
+#define PAGE_SIZE       4096ULL
+#define GB              (1ULL << 30)
+#define CHECK_PAGES     (GB / PAGE_SIZE)
+
+// as in dirtylogstubs.c
+#define PAGE_UNMAPPED   0
+#define PAGE_READ_ONLY  1
+#define PAGE_WRITABLE   2
+
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static int test_bit(const uint32_t* bitmap, uint64_t page)
+{
+    return (bitmap[page / 32] >> (page % 32)) & 1;
+}
+
+static void check(void)
+{
+    static const uint64_t written[] = { 1, 2, 5, 200000, CHECK_PAGES - 1 };
+    uint64_t num_of_pages = CHECK_PAGES + 1;
+    uint8_t* pages = malloc(num_of_pages);
+    uint32_t* bitmap = calloc(1, CHECK_PAGES / 8);
+    void* guest = dirtylogbench_guest();
+    uint32_t count, i;
+    uint64_t page;
+    int bits;
+
+    if (pages == NULL || bitmap == NULL) {
+        CHECK(0, "out of memory");
+        return;
+    }
+    memset(pages, PAGE_WRITABLE, num_of_pages);
+    pages[3] = PAGE_READ_ONLY;
+    memset(pages + 100, PAGE_UNMAPPED, 100);
+    pages[CHECK_PAGES] = PAGE_READ_ONLY;
+    dirtylogbench_set_pages(pages, num_of_pages);
+
+    CHECK(!ept_dirty_log_start(guest, 0, 0), "empty range");
+    CHECK(!ept_dirty_log_start(guest, 0x800, GB), "unaligned base");
+    CHECK(!ept_dirty_log_harvest(guest, bitmap, &count), "harvest without log");
+
+    // a 1GB range needs 32KB bitmaps
+    CHECK(ept_dirty_log_start(guest, 0, GB), "start");
+    CHECK(!ept_dirty_log_start(guest, 0, GB), "second start");
+    CHECK(pages[0] == PAGE_READ_ONLY && pages[CHECK_PAGES - 1] == PAGE_READ_ONLY,
+          "logged pages write protected");
+    CHECK(pages[150] == PAGE_UNMAPPED, "unmapped page left alone");
+
+    for (i = 0; i < sizeof(written) / sizeof(written[0]); i++) {
+        CHECK(dirtylogbench_write(written[i] * PAGE_SIZE + 8) == 1, "first write exits");
+        CHECK(dirtylogbench_write(written[i] * PAGE_SIZE + 16) == 0, "second write does not");
+    }
+    CHECK(dirtylogbench_write(3 * PAGE_SIZE) == -1, "read only page not logged");
+    CHECK(dirtylogbench_write(150 * PAGE_SIZE) == -1, "unmapped page not logged");
+    CHECK(dirtylogbench_write(CHECK_PAGES * PAGE_SIZE) == -1, "page out of the range not logged");
+
+    // harvest hands out the written pages and protects them again
+    memset(bitmap, 0xff, CHECK_PAGES / 8);
+    CHECK(ept_dirty_log_harvest(guest, bitmap, &count), "harvest");
+    CHECK(count == sizeof(written) / sizeof(written[0]), "harvested count");
+    for (page = 0, bits = 0; page < CHECK_PAGES; page++) {
+        bits += test_bit(bitmap, page);
+    }
+    CHECK(bits == (int) count, "bits set");
+    for (i = 0; i < sizeof(written) / sizeof(written[0]); i++) {
+        CHECK(test_bit(bitmap, written[i]), "written page harvested");
+        CHECK(pages[written[i]] == PAGE_READ_ONLY, "harvested page write protected");
+    }
+    CHECK(ept_dirty_log_harvest(guest, bitmap, &count) && count == 0, "harvest cleared");
+    CHECK(dirtylogbench_write(written[0] * PAGE_SIZE) == 1, "write after harvest exits");
+    CHECK(ept_dirty_log_harvest(guest, bitmap, &count) && count == 1 &&
+          test_bit(bitmap, written[0]), "write after harvest harvested");
+    CHECK(dirtylogbench_write(written[1] * PAGE_SIZE) == 1, "write before stop exits");
+
+    // stop gives the write permission back to the logged pages only
+    ept_dirty_log_stop(guest);
+    CHECK(pages[0] == PAGE_WRITABLE && pages[written[0]] == PAGE_WRITABLE &&
+          pages[CHECK_PAGES - 1] == PAGE_WRITABLE, "logged pages writable");
+    CHECK(pages[3] == PAGE_READ_ONLY && pages[150] == PAGE_UNMAPPED, "other pages unchanged");
+    CHECK(!ept_dirty_log_harvest(guest, bitmap, &count), "harvest after stop");
+
+    // 64KB of bitmaps each time in a 4MB heap
+    for (i = 0; i < 256; i++) {
+        if (!ept_dirty_log_start(guest, 0, GB)) {
+            CHECK(0, "bitmaps not freed");
+            break;
+        }
+        ept_dirty_log_stop(guest);
+    }
+    CHECK(dirtylogbench_errors() == 0, "EPT updated with CPUs running");
+    free(bitmap);
+    free(pages);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t range_gb = 4;
+    uint32_t dirty_per_thousand = 10;
+    uint64_t num_of_pages, page, i, mam_updates, invepts;
+    uint32_t* bitmap;
+    uint8_t* pages;
+    void* heap;
+    uint32_t count;
+    double start, seconds;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-g") == 0 && a + 1 < argc) {
+            range_gb = strtoull(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "-d") == 0 && a + 1 < argc) {
+            dirty_per_thousand = (uint32_t) strtoul(argv[++a], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-g range_gb] [-d dirty_per_thousand]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (range_gb == 0 || range_gb > 16 || dirty_per_thousand > 1000) {
+        fprintf(stderr, "1 to 16 GB, 0 to 1000 dirty per thousand\n");
+        return 1;
+    }
+    if (posix_memalign(&heap, PAGE_SIZE, HEAP_SIZE) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+
+    check();
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+
+    num_of_pages = range_gb * GB / PAGE_SIZE;
+    pages = malloc(num_of_pages);
+    bitmap = malloc(num_of_pages / 8);
+    if (pages == NULL || bitmap == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(pages, PAGE_WRITABLE, num_of_pages);
+    dirtylogbench_set_pages(pages, num_of_pages);
+    if (!ept_dirty_log_start(dirtylogbench_guest(), 0, range_gb * GB)) {
+        fprintf(stderr, "ept_dirty_log_start failed\n");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < num_of_pages * dirty_per_thousand / 1000; i++) {
+        page = (((uint64_t) rand() << 16) ^ (uint64_t) rand()) % num_of_pages;
+        dirtylogbench_write(page * PAGE_SIZE);
+    }
+    mam_updates = dirtylogbench_mam_updates();
+    invepts = dirtylogbench_invepts();
+    start = now();
+    ept_dirty_log_harvest(dirtylogbench_guest(), bitmap, &count);
+    seconds = now() - start;
+    printf("\nharvest of %llu GB, %u dirty pages: %.3f ms, %llu MAM updates, %llu INVEPTs\n",
+           (unsigned long long) range_gb, count, seconds * 1e3,
+           (unsigned long long)(dirtylogbench_mam_updates() - mam_updates),
+           (unsigned long long)(dirtylogbench_invepts() - invepts));
+    ept_dirty_log_stop(dirtylogbench_guest());
+    free(bitmap);
+    free(pages);
+    free(heap);
+    return g_errors ? 1 : 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the EPT, MAM, IPC and VMX services the EPT dirty
+// page log (memory/ept/ept_dirty_log.c) depends on: one guest on one CPU
+// whose default EPT maps guest physical page n with the state pages[n]
+// of dirtylogbench.c, and counts of the MAM updates and INVEPTs. Built
+// with the VMM include paths.
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(EPT_DIRTY_LOG_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(EPT_DIRTY_LOG_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "common_libc.h"
+#include "hw_interlocked.h"
+#include "guest.h"
+#include "guest_cpu.h"
+#include "vmcs_init.h"
+#include "ipc.h"
+#include "ept.h"
+#include "ept_hw_layer.h"
+#include "ept_dirty_log.h"
+
+
+// page states in dirtylogbench.c
+#define DL_PAGE_UNMAPPED    0
+#define DL_PAGE_READ_ONLY   1
+#define DL_PAGE_WRITABLE    2
+
+#define DL_EPT_ROOT         0x1000
+
+static UINT8                dl_guest_object;
+static UINT8                dl_gcpu_object;
+static UINT8                dl_mam_object;
+static VIRTUAL_CPU_ID       dl_vcpu = { 0, 0 };
+static EPT_GUEST_STATE      dl_ept_guest;
+static VMCS_HW_CONSTRAINTS  dl_constraints;
+static UINT8*               dl_pages;
+static UINT64               dl_num_of_pages;
+static UINT64               dl_mam_updates;
+static UINT64               dl_invepts;
+static BOOLEAN              dl_cpus_stopped;
+static UINT32               dl_errors;
+
+#define DL_GCPU     ((GUEST_CPU_HANDLE) &dl_gcpu_object)
+#define DL_GUEST    ((GUEST_HANDLE) &dl_guest_object)
+
+
+// dirtylogbench.c interface
+void* dirtylogbench_guest(void)
+{
+    return DL_GUEST;
+}
+
+void dirtylogbench_set_pages(UINT8* pages, UINT64 num_of_pages)
+{
+    dl_pages = pages;
+    dl_num_of_pages = num_of_pages;
+    dl_ept_guest.address_space = (MAM_HANDLE) &dl_mam_object;
+    dl_ept_guest.ept_root_table_hpa = DL_EPT_ROOT;
+    dl_constraints.ept_vpid_capabilities.Bits.InveptIndividualAddress = 1;
+}
+
+UINT64 dirtylogbench_mam_updates(void)
+{
+    return dl_mam_updates;
+}
+
+UINT64 dirtylogbench_invepts(void)
+{
+    return dl_invepts;
+}
+
+// EPT updates made while other CPUs could use the EPT
+UINT32 dirtylogbench_errors(void)
+{
+    return dl_errors;
+}
+
+// A guest write to gpa: 0 if the page is writable, else the EPT
+// violation is raised, 1 if the dirty log handled it, -1 if not.
+int dirtylogbench_write(UINT64 gpa)
+{
+    EVENT_GCPU_EPT_VIOLATION_DATA data;
+    UINT64 page = gpa / PAGE_4KB_SIZE;
+
+    if (page < dl_num_of_pages && dl_pages[page] == DL_PAGE_WRITABLE) {
+        return 0;
+    }
+    vmm_zeromem(&data, sizeof(data));
+    data.qualification.EptViolation.W = 1;
+    data.guest_physical_address = gpa;
+    if (!ept_dirty_log_handle_violation(DL_GCPU, &data) || !data.processed) {
+        return -1;
+    }
+    return 1;
+}
+
+
+GUEST_ID guest_get_id(GUEST_HANDLE guest)
+{
+    (void) guest;
+    return 0;
+}
+
+const VIRTUAL_CPU_ID* guest_vcpu(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return &dl_vcpu;
+}
+
+EPT_GUEST_STATE *ept_find_guest_state(GUEST_ID guest_id)
+{
+    return (guest_id == 0) ? &dl_ept_guest : NULL;
+}
+
+// one CPU: the EPT lock is not needed
+void ept_acquire_lock(void)
+{
+}
+
+void ept_release_lock(void)
+{
+}
+
+BOOLEAN stop_all_cpus(void)
+{
+    if (dl_cpus_stopped) {
+        dl_errors++;
+    }
+    dl_cpus_stopped = TRUE;
+    return TRUE;
+}
+
+UINT32 start_all_cpus(IPC_HANDLER_FN handler, void* arg)
+{
+    (void) handler;
+    (void) arg;
+    dl_cpus_stopped = FALSE;
+    return 0;
+}
+
+void ept_invalidate_ept(CPU_ID from, void* arg)
+{
+    (void) from;
+    (void) arg;
+}
+
+UINT64 ept_compute_eptp(GUEST_HANDLE guest, UINT64 ept_root_table_hpa, UINT32 gaw)
+{
+    (void) guest;
+    (void) gaw;
+    return ept_root_table_hpa;
+}
+
+UINT64 ept_get_eptp(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return DL_EPT_ROOT;
+}
+
+BOOLEAN ept_hw_invept_context(UINT64 eptp)
+{
+    (void) eptp;
+    dl_invepts++;
+    return TRUE;
+}
+
+BOOLEAN ept_hw_invept_individual_address(UINT64 eptp, ADDRESS gpa)
+{
+    (void) eptp;
+    (void) gpa;
+    dl_invepts++;
+    return TRUE;
+}
+
+const VMCS_HW_CONSTRAINTS* vmcs_hw_get_vmx_constraints(void)
+{
+    return &dl_constraints;
+}
+
+MAM_MAPPING_RESULT mam_get_mapping(IN MAM_HANDLE mam_handle, IN UINT64 src_addr,
+                    OUT UINT64* tgt_addr, OUT MAM_ATTRIBUTES* attrs)
+{
+    UINT64 page = src_addr / PAGE_4KB_SIZE;
+
+    (void) mam_handle;
+    if (page >= dl_num_of_pages || dl_pages[page] == DL_PAGE_UNMAPPED) {
+        return MAM_UNKNOWN_MAPPING;
+    }
+    *tgt_addr = src_addr;
+    attrs->uint32 = 0;
+    attrs->ept_attr.readable = 1;
+    attrs->ept_attr.writable = (dl_pages[page] == DL_PAGE_WRITABLE);
+    return MAM_MAPPING_SUCCESSFUL;
+}
+
+static BOOLEAN dl_update(UINT64 src_addr, UINT64 size, MAM_ATTRIBUTES attrs, UINT8 state)
+{
+    UINT64 page;
+
+    // only the violation handler updates one page of running CPUs
+    if (!dl_cpus_stopped && size != PAGE_4KB_SIZE) {
+        dl_errors++;
+    }
+    dl_mam_updates++;
+    if (!attrs.ept_attr.writable) {
+        return TRUE;
+    }
+    for (page = src_addr / PAGE_4KB_SIZE; page < (src_addr + size) / PAGE_4KB_SIZE; page++) {
+        if (page < dl_num_of_pages && dl_pages[page] != DL_PAGE_UNMAPPED) {
+            dl_pages[page] = state;
+        }
+    }
+    return TRUE;
+}
+
+BOOLEAN mam_add_permissions_to_existing_mapping(IN MAM_HANDLE mam_handle,
+                    IN UINT64 src_addr, IN UINT64 size, IN MAM_ATTRIBUTES attrs)
+{
+    (void) mam_handle;
+    return dl_update(src_addr, size, attrs, DL_PAGE_WRITABLE);
+}
+
+BOOLEAN mam_remove_permissions_from_existing_mapping(IN MAM_HANDLE mam_handle,
+                    IN UINT64 src_addr, IN UINT64 size, IN MAM_ATTRIBUTES attrs)
+{
+    (void) mam_handle;
+    return dl_update(src_addr, size, attrs, DL_PAGE_READ_ONLY);
+}
+
+INT32 hw_interlocked_assign(INT32 volatile * target, INT32 new_value)
+{
+    // a full barrier and the previous value, as xchg in machinesupport.c
+    return __atomic_exchange_n(target, new_value, __ATOMIC_SEQ_CST);
+}
+
+INT32 hw_interlocked_or(INT32 volatile * value, INT32 mask)
+{
+    return __sync_fetch_and_or(value, mask);
+}
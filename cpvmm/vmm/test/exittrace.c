@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host side decoder of VM exit trace dumps (dbg/exit_trace.c).
+//
+// Reads one or more rings, as copied by VMCALL_EXIT_TRACE_DUMP and
+// concatenated in any order, and prints the handler latency of every
+// exit reason: count, mean, median, 99th percentile and maximum, and
+// with -H a log2 histogram. Latencies are in TSC cycles, or in
+// microseconds when the TSC frequency is given with -f.
+//
+//   exittrace [-f tsc_mhz] [-H] [-v] dump_file...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// must match include/exit_trace.h
+#define EXIT_TRACE_MAGIC    0x52545845
+#define EXIT_TRACE_VERSION  1
+
+typedef struct {
+    uint64_t tsc;
+    uint64_t guest_rip;
+    uint32_t handler_cycles;
+    uint16_t exit_reason;
+    uint16_t guest_id;
+    uint16_t guest_cpu_id;
+    uint16_t reserved0;
+    uint32_t reserved1;
+} EXIT_TRACE_RECORD;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t cpu_id;
+    uint32_t num_records;
+    uint32_t reserved;
+    uint64_t head;
+    uint64_t dump_overrun;
+} EXIT_TRACE_RING_HEADER;
+
+#define NUM_REASONS     65
+#define NUM_BUCKETS     33
+
+static const char *reason_names[NUM_REASONS] = {
+    "exception/NMI", "external interrupt", "triple fault", "INIT", "SIPI",
+    "I/O SMI", "other SMI", "interrupt window", "NMI window", "task switch",
+    "CPUID", "GETSEC", "HLT", "INVD", "INVLPG", "RDPMC", "RDTSC", "RSM",
+    "VMCALL", "VMCLEAR", "VMLAUNCH", "VMPTRLD", "VMPTRST", "VMREAD",
+    "VMRESUME", "VMWRITE", "VMXOFF", "VMXON", "CR access", "DR access",
+    "I/O", "RDMSR", "WRMSR", "bad guest state", "bad MSR loading", "35",
+    "MWAIT", "monitor trap flag", "38", "MONITOR", "PAUSE",
+    "machine check", "42", "TPR below threshold", "APIC access",
+    "virtualized EOI", "GDTR/IDTR access", "LDTR/TR access",
+    "EPT violation", "EPT misconfig", "INVEPT", "RDTSCP",
+    "preemption timer", "INVVPID", "WBINVD", "XSETBV", "APIC write",
+    "RDRAND", "INVPCID", "VMFUNC", "60", "RDSEED", "62", "XSAVES",
+    "XRSTORS",
+};
+
+typedef struct {
+    uint32_t *cycles;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t sum;
+    uint64_t buckets[NUM_BUCKETS];
+} REASON_STATS;
+
+static REASON_STATS stats[NUM_REASONS];
+static uint64_t num_unknown = 0;
+static int verbose = 0;
+
+
+static void add_record(const EXIT_TRACE_RECORD *record)
+{
+    REASON_STATS *s;
+    uint32_t bucket = 0;
+
+    if (record->exit_reason >= NUM_REASONS) {
+        num_unknown++;
+        return;
+    }
+    s = &stats[record->exit_reason];
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? 2 * s->capacity : 1024;
+        s->cycles = realloc(s->cycles, s->capacity * sizeof(uint32_t));
+        if (s->cycles == NULL) {
+            printf("out of memory\n");
+            exit(1);
+        }
+    }
+    s->cycles[s->count++] = record->handler_cycles;
+    s->sum += record->handler_cycles;
+    while (bucket < NUM_BUCKETS - 1 && (record->handler_cycles >> bucket) > 1)
+        bucket++;
+    s->buckets[record->handler_cycles == 0 ? 0 : bucket]++;
+}
+
+// returns the number of rings read, -1 if the file is not a dump
+static int read_dump(const char *file_name)
+{
+    EXIT_TRACE_RING_HEADER header;
+    EXIT_TRACE_RECORD *records;
+    uint64_t first, n;
+    int num_rings = 0;
+    FILE *f;
+
+    f = fopen(file_name, "rb");
+    if (f == NULL) {
+        printf("can't open %s\n", file_name);
+        return -1;
+    }
+    while (fread(&header, sizeof(header), 1, f) == 1) {
+        if (header.magic != EXIT_TRACE_MAGIC || header.version != EXIT_TRACE_VERSION ||
+            header.num_records == 0 ||
+            (header.num_records & (header.num_records - 1)) != 0) {
+            printf("%s: bad ring header at offset %ld\n", file_name,
+                   ftell(f) - (long) sizeof(header));
+            fclose(f);
+            return -1;
+        }
+        records = malloc(header.num_records * sizeof(EXIT_TRACE_RECORD));
+        if (records == NULL ||
+            fread(records, sizeof(EXIT_TRACE_RECORD), header.num_records, f) != header.num_records) {
+            printf("%s: truncated ring of CPU%u\n", file_name, header.cpu_id);
+            free(records);
+            fclose(f);
+            return -1;
+        }
+        // the ring holds the last num_records records, minus the ones the
+        // CPU may have overwritten while the dump was taken
+        first = header.head > header.num_records ? header.head - header.num_records : 0;
+        first += header.dump_overrun;
+        if (verbose) {
+            printf("CPU%u: %llu exits, %llu in the ring, %llu overrun\n",
+                   header.cpu_id, (unsigned long long) header.head,
+                   (unsigned long long) (first < header.head ? header.head - first : 0),
+                   (unsigned long long) header.dump_overrun);
+        }
+        for (n = first; n < header.head; n++)
+            add_record(&records[n & (header.num_records - 1)]);
+        free(records);
+        num_rings++;
+    }
+    fclose(f);
+    return num_rings;
+}
+
+static int compare_cycles(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static double scale(double cycles, double tsc_mhz)
+{
+    return tsc_mhz > 0 ? cycles / tsc_mhz : cycles;
+}
+
+static void print_stats(double tsc_mhz, int histograms)
+{
+    REASON_STATS *s;
+    uint64_t total = 0;
+    uint32_t reason, bucket;
+
+    for (reason = 0; reason < NUM_REASONS; reason++)
+        total += stats[reason].count;
+    printf("%llu exits, latency in %s\n", (unsigned long long) total,
+           tsc_mhz > 0 ? "us" : "TSC cycles");
+    printf("%-20s %10s %6s %10s %10s %10s %10s\n", "reason", "count", "%",
+           "mean", "p50", "p99", "max");
+    for (reason = 0; reason < NUM_REASONS; reason++) {
+        s = &stats[reason];
+        if (s->count == 0)
+            continue;
+        qsort(s->cycles, s->count, sizeof(uint32_t), compare_cycles);
+        printf("%-20s %10llu %6.2f %10.1f %10.1f %10.1f %10.1f\n",
+               reason_names[reason], (unsigned long long) s->count,
+               100.0 * s->count / total,
+               scale((double) s->sum / s->count, tsc_mhz),
+               scale(s->cycles[s->count / 2], tsc_mhz),
+               scale(s->cycles[(s->count * 99) / 100], tsc_mhz),
+               scale(s->cycles[s->count - 1], tsc_mhz));
+    }
+    if (num_unknown != 0)
+        printf("%llu records with unknown exit reasons\n", (unsigned long long) num_unknown);
+    if (!histograms)
+        return;
+    for (reason = 0; reason < NUM_REASONS; reason++) {
+        s = &stats[reason];
+        if (s->count == 0)
+            continue;
+        printf("\n%s\n", reason_names[reason]);
+        for (bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+            if (s->buckets[bucket] == 0)
+                continue;
+            printf("  < %12.1f %10llu %6.2f%%\n",
+                   scale((double) (2ULL << bucket), tsc_mhz),
+                   (unsigned long long) s->buckets[bucket],
+                   100.0 * s->buckets[bucket] / s->count);
+        }
+    }
+}
+
+
+int main(int an, char **av)
+{
+    double tsc_mhz = 0;
+    int histograms = 0;
+    int num_rings = 0;
+    int n;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-f") == 0 && j + 1 < an)
+            tsc_mhz = atof(av[++j]);
+        else if (strcmp(av[j], "-H") == 0)
+            histograms = 1;
+        else if (strcmp(av[j], "-v") == 0)
+            verbose = 1;
+        else if (av[j][0] == '-')
+            break;
+        else {
+            n = read_dump(av[j]);
+            if (n < 0)
+                return 1;
+            num_rings += n;
+        }
+    }
+    if (j < an || num_rings == 0) {
+        printf("exittrace [-f tsc_mhz] [-H] [-v] dump_file...\n");
+        return 1;
+    }
+    print_stats(tsc_mhz, histograms);
+    return 0;
+}
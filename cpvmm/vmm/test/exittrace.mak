@@ -0,0 +1,54 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Host side decoder of VM exit trace dumps (dbg/exit_trace.c).
+#   make -f exittrace.mak && exittrace.exe [-f tsc_mhz] [-H] [-v] dump_file...
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/exittrace.o
+
+all: $(E)/exittrace.exe
+ 
+$(E)/exittrace.exe: $(dobjs)
+	@echo "exittrace.exe"
+	$(LINK) -o $(E)/exittrace.exe $(dobjs)
+
+$(B)/exittrace.o: $(mainsrc)/test/exittrace.c
+	echo "exittrace.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/exittrace.o $(mainsrc)/test/exittrace.c
+
+clean:
+	rm -f $(E)/exittrace.exe
+	rm -f $(dobjs)
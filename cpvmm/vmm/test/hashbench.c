@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted benchmark for the 1-1 hash in utils/hash64.c.
+//
+// Runs the same key sequence through the VMM hash and through the
+// chained table it replaced, hashing page numbers like pool_hash_func
+// and growing both the way pool.c does (start small, ask for a 4x bigger table whenever there are 4
+// elements per cell). Keys are page addresses, like the ones pool.c
+// and the guest memory maps hash. Every lookup result is checked
+// against the value the key was inserted with.
+//
+//   hashbench [-n keys] [-s initial_size] [-r rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PAGE_SIZE       4096
+#define REHASH_THRESHOLD 4
+
+// utils/hash64.c and utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+extern void*    hash64_create_default_hash(uint32_t hash_size);
+extern void     hash64_destroy_hash(void* hash_handle);
+extern int      hash64_lookup(void* hash_handle, uint64_t key, uint64_t* value);
+extern int      hash64_insert(void* hash_handle, uint64_t key, uint64_t value);
+extern int      hash64_remove(void* hash_handle, uint64_t key);
+extern int      hash64_change_size_and_rehash(void* hash_handle, uint32_t hash_size);
+extern uint32_t hash64_get_num_of_elements(void* hash_handle);
+
+
+// the chained table hash64.c used to be, with the hash function of pool.c
+typedef struct REF_NODE_S {
+    struct REF_NODE_S *next;
+    uint64_t          key;
+    uint64_t          value;
+} REF_NODE;
+
+typedef struct {
+    REF_NODE **array;
+    REF_NODE *free_nodes;
+    uint32_t size;
+    uint32_t element_count;
+} REF_HASH;
+
+static uint32_t ref_hash_func(uint64_t key, uint32_t size)
+{
+    return (uint32_t)((key >> 12) % size);
+}
+
+static void *ref_create(uint32_t size)
+{
+    REF_HASH *hash = calloc(1, sizeof(REF_HASH));
+
+    hash->array = calloc(size, sizeof(REF_NODE *));
+    hash->size = size;
+    return hash;
+}
+
+static void ref_destroy(void *handle)
+{
+    REF_HASH *hash = handle;
+    REF_NODE *node;
+    uint32_t i;
+
+    for (i = 0; i < hash->size; i++) {
+        while ((node = hash->array[i]) != NULL) {
+            hash->array[i] = node->next;
+            free(node);
+        }
+    }
+    while ((node = hash->free_nodes) != NULL) {
+        hash->free_nodes = node->next;
+        free(node);
+    }
+    free(hash->array);
+    free(hash);
+}
+
+static int ref_lookup(void *handle, uint64_t key, uint64_t *value)
+{
+    REF_HASH *hash = handle;
+    REF_NODE *node;
+
+    for (node = hash->array[ref_hash_func(key, hash->size)]; node != NULL; node = node->next) {
+        if (node->key == key) {
+            *value = node->value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ref_insert(void *handle, uint64_t key, uint64_t value)
+{
+    REF_HASH *hash = handle;
+    REF_NODE **cell = &hash->array[ref_hash_func(key, hash->size)];
+    REF_NODE *node = hash->free_nodes;
+
+    // nodes are recycled, like the pool.c nodes
+    if (node != NULL)
+        hash->free_nodes = node->next;
+    else
+        node = malloc(sizeof(REF_NODE));
+    node->key = key;
+    node->value = value;
+    node->next = *cell;
+    *cell = node;
+    hash->element_count++;
+    return 1;
+}
+
+static int ref_remove(void *handle, uint64_t key)
+{
+    REF_HASH *hash = handle;
+    REF_NODE **link = &hash->array[ref_hash_func(key, hash->size)];
+    REF_NODE *node;
+
+    for (node = *link; node != NULL; link = &node->next, node = *link) {
+        if (node->key == key) {
+            *link = node->next;
+            node->next = hash->free_nodes;
+            hash->free_nodes = node;
+            hash->element_count--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ref_change_size_and_rehash(void *handle, uint32_t size)
+{
+    REF_HASH *hash = handle;
+    REF_NODE **array = calloc(size, sizeof(REF_NODE *));
+    REF_NODE *node;
+    uint32_t i;
+
+    for (i = 0; i < hash->size; i++) {
+        while ((node = hash->array[i]) != NULL) {
+            hash->array[i] = node->next;
+            node->next = array[ref_hash_func(node->key, size)];
+            array[ref_hash_func(node->key, size)] = node;
+        }
+    }
+    free(hash->array);
+    hash->array = array;
+    hash->size = size;
+    return 1;
+}
+
+static uint32_t ref_get_num_of_elements(void *handle)
+{
+    return ((REF_HASH *) handle)->element_count;
+}
+
+
+typedef struct {
+    const char *name;
+    void     *(*create)(uint32_t size);
+    void      (*destroy)(void *hash);
+    int       (*lookup)(void *hash, uint64_t key, uint64_t *value);
+    int       (*insert)(void *hash, uint64_t key, uint64_t value);
+    int       (*remove)(void *hash, uint64_t key);
+    int       (*change_size_and_rehash)(void *hash, uint32_t size);
+    uint32_t  (*get_num_of_elements)(void *hash);
+} HASH_IMPL;
+
+static HASH_IMPL impls[] = {
+    { "chained", ref_create, ref_destroy, ref_lookup, ref_insert,
+      ref_remove, ref_change_size_and_rehash, ref_get_num_of_elements },
+    { "hash64", hash64_create_default_hash, hash64_destroy_hash,
+      hash64_lookup, hash64_insert, hash64_remove,
+      hash64_change_size_and_rehash, hash64_get_num_of_elements },
+};
+
+static uint64_t *keys = NULL;
+static uint64_t *lookup_keys = NULL;
+static uint64_t *miss_keys = NULL;
+
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void shuffle(uint64_t *array, uint32_t num, uint64_t seed)
+{
+    uint32_t i;
+
+    for (i = num - 1; i > 0; i--) {
+        uint64_t tmp = array[i];
+        uint32_t j;
+
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        j = (uint32_t)(seed % (i + 1));
+        array[i] = array[j];
+        array[j] = tmp;
+    }
+}
+
+static void generate_keys(uint32_t num_keys)
+{
+    uint32_t i;
+
+    keys = malloc(num_keys * sizeof(uint64_t));
+    lookup_keys = malloc(num_keys * sizeof(uint64_t));
+    miss_keys = malloc(num_keys * sizeof(uint64_t));
+    // distinct page addresses, inserted and looked up in different random
+    // orders; the missing keys are pages of the next range
+    for (i = 0; i < num_keys; i++) {
+        keys[i] = (uint64_t) i * PAGE_SIZE;
+        lookup_keys[i] = keys[i];
+        miss_keys[i] = keys[i] + (uint64_t) num_keys * PAGE_SIZE;
+    }
+    shuffle(keys, num_keys, 0x2545f4914f6cdd1dULL);
+    shuffle(lookup_keys, num_keys, 0x9e3779b97f4a7c15ULL);
+    shuffle(miss_keys, num_keys, 0xd1b54a32d192ed03ULL);
+}
+
+// the growth policy of pool.c
+static void insert_and_grow(HASH_IMPL *impl, void *hash, uint32_t *size,
+                            uint64_t key, uint64_t *errors)
+{
+    if (!impl->insert(hash, key, ~key))
+        (*errors)++;
+    if (impl->get_num_of_elements(hash) >= *size * REHASH_THRESHOLD) {
+        *size *= REHASH_THRESHOLD;
+        if (!impl->change_size_and_rehash(hash, *size))
+            (*errors)++;
+    }
+}
+
+static void run(HASH_IMPL *impl, uint32_t num_keys, uint32_t initial_size,
+                int rounds)
+{
+    struct timespec start, end;
+    double insert_seconds, hit_seconds, miss_seconds, churn_seconds;
+    double worst_insert = 0;
+    uint64_t errors = 0;
+    uint64_t value;
+    uint32_t size = initial_size;
+    uint32_t i;
+    void *hash;
+    int r;
+
+    hash = impl->create(size);
+    if (hash == NULL) {
+        printf("%-8s cannot create the hash\n", impl->name);
+        return;
+    }
+
+    // every insertion is timed, to catch the ones which rehash
+    insert_seconds = 0;
+    for (i = 0; i < num_keys; i++) {
+        double seconds;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        insert_and_grow(impl, hash, &size, keys[i], &errors);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = elapsed_seconds(&start, &end);
+        insert_seconds += seconds;
+        if (seconds > worst_insert)
+            worst_insert = seconds;
+    }
+
+    // lookups on the VM exit paths are not overlapped with each other,
+    // so wait for every lookup to finish: these are latencies, not the
+    // memory parallelism of a tight loop
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < num_keys; i++) {
+            if (!impl->lookup(hash, lookup_keys[i], &value) ||
+                value != ~lookup_keys[i])
+                errors++;
+            __builtin_ia32_lfence();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    hit_seconds = elapsed_seconds(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < num_keys; i++) {
+            if (impl->lookup(hash, miss_keys[i], &value))
+                errors++;
+            __builtin_ia32_lfence();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    miss_seconds = elapsed_seconds(&start, &end);
+
+    // remove and insert back, as pools release and reuse pages
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < num_keys; i += 2) {
+            if (!impl->remove(hash, lookup_keys[i]))
+                errors++;
+        }
+        for (i = 0; i < num_keys; i += 2) {
+            if (!impl->insert(hash, lookup_keys[i], ~lookup_keys[i]))
+                errors++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    churn_seconds = elapsed_seconds(&start, &end);
+
+    for (i = 0; i < num_keys; i++) {
+        if (!impl->lookup(hash, keys[i], &value) || value != ~keys[i])
+            errors++;
+    }
+    if (impl->get_num_of_elements(hash) != num_keys)
+        errors++;
+    impl->destroy(hash);
+
+    printf("%-8s insert %6.1f ns (worst %8.1f us), hit %6.1f ns, "
+           "miss %6.1f ns, remove+insert %6.1f ns, %llu errors\n",
+           impl->name,
+           insert_seconds * 1e9 / num_keys, worst_insert * 1e6,
+           hit_seconds * 1e9 / ((double) num_keys * rounds),
+           miss_seconds * 1e9 / ((double) num_keys * rounds),
+           churn_seconds * 1e9 / ((double) num_keys * rounds),
+           (unsigned long long) errors);
+}
+
+
+int main(int an, char **av)
+{
+    uint32_t num_keys = 1000000;
+    uint32_t initial_size = 512;    // POOL_HASH_NUM_OF_CELLS
+    int rounds = 4;
+    size_t size = 256 << 20;
+    uint8_t *buffer;
+    unsigned i;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-n") == 0 && j + 1 < an)
+            num_keys = (uint32_t) atoi(av[++j]);
+        else if (strcmp(av[j], "-s") == 0 && j + 1 < an)
+            initial_size = (uint32_t) atoi(av[++j]);
+        else if (strcmp(av[j], "-r") == 0 && j + 1 < an)
+            rounds = atoi(av[++j]);
+        else {
+            printf("hashbench [-n keys] [-s initial_size] [-r rounds]\n");
+            return 1;
+        }
+    }
+    if (num_keys < 2 || initial_size < 1 || rounds < 1)
+        return 1;
+
+    if (posix_memalign((void **) &buffer, PAGE_SIZE, size) != 0)
+        return 1;
+    // fault the heap in, the VMM heap is always present
+    memset(buffer, 0, size);
+    vmm_heap_initialize((uint64_t)(uintptr_t) buffer, size);
+    generate_keys(num_keys);
+
+    printf("%u keys, initial size %u, %d rounds\n", num_keys, initial_size, rounds);
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+        run(&impls[i], num_keys, initial_size, rounds);
+
+    free(keys);
+    free(lookup_keys);
+    free(miss_keys);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the 1-1 hash (hash64.c on top of heap.c) with a
+# benchmark against the chained table it replaced.
+#   make -f hashbench.mak && hashbench.exe [-n keys]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/hash64.o $(B)/heap.o $(B)/hoststubs.o $(B)/hashbench.o
+
+all: $(E)/hashbench.exe
+ 
+$(E)/hashbench.exe: $(dobjs)
+	@echo "hashbench.exe"
+	$(LINK) -o $(E)/hashbench.exe $(dobjs)
+
+$(B)/hash64.o: $(mainsrc)/utils/hash64.c
+	echo "hash64.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hash64.o $(mainsrc)/utils/hash64.c
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/hashbench.o: $(mainsrc)/test/hashbench.c
+	echo "hashbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/hashbench.o $(mainsrc)/test/hashbench.c
+
+clean:
+	rm -f $(E)/hashbench.exe
+	rm -f $(dobjs)
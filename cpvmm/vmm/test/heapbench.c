@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted benchmark for the page heap in utils/heap.c.
+//
+// Replays an allocation trace against the VMM heap and against the
+// first-fit scan it replaced, then runs a multi-threaded single page
+// churn to exercise the per-CPU page caches.  Before anything is timed
+// the trace is replayed once more under a page ownership map, checking
+// that no two live blocks overlap and that every freed page can be
+// allocated again.
+//
+// A trace is captured by building the VMM with -DHEAP_TRACE and saving
+// the serial log; every "HEAP TRACE: a <pages> <address>" and
+// "HEAP TRACE: f <address>" line is replayed, other lines are skipped.
+// Without a trace file a synthetic boot-like trace is generated.
+//
+//   heapbench [-t trace_file] [-r repeat] [-c threads] [-m heap_mb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define PAGE_SIZE       4096
+
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+extern void*    vmm_page_allocate(uint32_t number_of_pages);
+extern void     vmm_page_free(void *p_buffer);
+extern uint32_t vmm_heap_get_max_used_pages(void);
+// hoststubs.c
+extern void     heapbench_set_cpu_id(uint32_t cpu_id);
+
+
+typedef struct {
+    int      alloc;         // 1=allocate, 0=free
+    uint32_t pages;
+    uint32_t id;            // index of the buffer in the live table
+} HEAP_OP;
+
+static HEAP_OP  *ops = NULL;
+static uint32_t num_ops = 0;
+static uint32_t num_ids = 0;
+
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void add_op(int alloc, uint32_t pages, uint32_t id)
+{
+    static uint32_t capacity = 0;
+
+    if (num_ops == capacity) {
+        capacity = capacity ? 2 * capacity : 4096;
+        ops = realloc(ops, capacity * sizeof(HEAP_OP));
+        if (ops == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    ops[num_ops].alloc = alloc;
+    ops[num_ops].pages = pages;
+    ops[num_ops].id = id;
+    num_ops++;
+}
+
+
+// Boot allocates many small, long lived structures (mostly single
+// pages), some multi-page tables, and frees a fraction of them along
+// the way.
+static void generate_trace(uint32_t num_allocs)
+{
+    uint32_t *live = malloc(num_allocs * sizeof(uint32_t));
+    uint32_t num_live = 0;
+    uint32_t seed = 12345;
+    uint32_t i;
+    uint32_t r;
+    uint32_t pages;
+
+    for (i = 0; i < num_allocs; i++) {
+        seed = seed * 1103515245 + 12345;
+        r = (seed >> 16) % 100;
+        if (r < 70)
+            pages = 1;
+        else if (r < 90)
+            pages = 2 + (seed >> 8) % 7;
+        else
+            pages = 9 + (seed >> 4) % 56;
+        add_op(1, pages, num_ids);
+        live[num_live++] = num_ids++;
+
+        seed = seed * 1103515245 + 12345;
+        if (((seed >> 16) % 100) < 45 && num_live > 0) {
+            r = (seed >> 4) % num_live;
+            add_op(0, 0, live[r]);
+            live[r] = live[--num_live];
+        }
+    }
+    free(live);
+}
+
+typedef struct {
+    uint64_t address;
+    uint32_t id;
+} TRACE_ADDRESS;
+
+static int read_trace(const char *file_name)
+{
+    FILE *f = fopen(file_name, "r");
+    TRACE_ADDRESS *live = NULL;
+    uint32_t num_live = 0;
+    uint32_t capacity = 0;
+    char line[256];
+    char *p;
+    uint32_t pages;
+    uint64_t address;
+    uint32_t i;
+
+    if (f == NULL) {
+        fprintf(stderr, "can't open %s\n", file_name);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        p = strstr(line, "HEAP TRACE: ");
+        if (p == NULL)
+            continue;
+        p += strlen("HEAP TRACE: ");
+        if (sscanf(p, "a %u %llx", &pages, (unsigned long long *)&address) == 2) {
+            if (address == 0)
+                continue;
+            if (num_live == capacity) {
+                capacity = capacity ? 2 * capacity : 1024;
+                live = realloc(live, capacity * sizeof(TRACE_ADDRESS));
+            }
+            live[num_live].address = address;
+            live[num_live].id = num_ids;
+            num_live++;
+            add_op(1, pages, num_ids++);
+        }
+        else if (sscanf(p, "f %llx", (unsigned long long *)&address) == 1) {
+            for (i = 0; i < num_live; i++) {
+                if (live[i].address == address)
+                    break;
+            }
+            if (i == num_live)
+                continue;
+            add_op(0, 0, live[i].id);
+            live[i] = live[--num_live];
+        }
+    }
+    fclose(f);
+    free(live);
+    return 1;
+}
+
+
+// The allocator heap.c used before: one descriptor per page, first-fit
+// scan from page 0, backward scan to coalesce on free.
+typedef struct {
+    uint32_t number_of_pages:31;
+    uint32_t in_use:1;
+} REF_PAGE_DESCRIPTOR;
+
+static REF_PAGE_DESCRIPTOR *ref_array;
+static uint8_t  *ref_base;
+static uint32_t ref_total_pages;
+
+static void ref_initialize(uint8_t *buffer, size_t size)
+{
+    uint32_t i;
+
+    ref_total_pages = (uint32_t)(size / (PAGE_SIZE + sizeof(REF_PAGE_DESCRIPTOR)));
+    ref_array = (REF_PAGE_DESCRIPTOR *) buffer;
+    ref_base = buffer + ((ref_total_pages * sizeof(REF_PAGE_DESCRIPTOR) + PAGE_SIZE - 1) &
+                         ~(PAGE_SIZE - 1));
+    ref_total_pages = (uint32_t)((buffer + size - ref_base) / PAGE_SIZE);
+    for (i = 0; i < ref_total_pages; i++) {
+        ref_array[i].in_use = 0;
+        ref_array[i].number_of_pages = ref_total_pages - i;
+    }
+}
+
+static void *ref_page_allocate(uint32_t number_of_pages)
+{
+    uint32_t i;
+    uint32_t j;
+
+    for (i = 0; i < ref_total_pages; ++i) {
+        if (ref_array[i].in_use == 0 && number_of_pages <= ref_array[i].number_of_pages) {
+            ref_array[i].in_use = 1;
+            ref_array[i].number_of_pages = number_of_pages;
+            for (j = i + 1; j < i + number_of_pages; ++j) {
+                ref_array[j].in_use = 1;
+                ref_array[j].number_of_pages = 0;
+            }
+            return ref_base + (uint64_t) i * PAGE_SIZE;
+        }
+    }
+    return NULL;
+}
+
+static void ref_page_free(void *p_buffer)
+{
+    uint32_t from = (uint32_t)(((uint8_t *) p_buffer - ref_base) / PAGE_SIZE);
+    uint32_t pages = ref_array[from].number_of_pages;
+    uint32_t to = from + pages;
+    uint32_t i;
+
+    if (to < ref_total_pages && ref_array[to].in_use == 0)
+        pages += ref_array[to].number_of_pages;
+    while (from > 0 && ref_array[from - 1].in_use == 0 &&
+           ref_array[from - 1].number_of_pages != 0) {
+        from--;
+        pages++;
+    }
+    for (i = from; i < to; ++i) {
+        ref_array[i].in_use = 0;
+        ref_array[i].number_of_pages = pages - (i - from);
+    }
+}
+
+
+typedef struct {
+    const char *name;
+    void  (*initialize)(uint8_t *buffer, size_t size);
+    void* (*allocate)(uint32_t number_of_pages);
+    void  (*free)(void *p_buffer);
+} HEAP_IMPL;
+
+static void vmm_initialize(uint8_t *buffer, size_t size)
+{
+    vmm_heap_initialize((uint64_t)(uintptr_t) buffer, size);
+}
+
+static HEAP_IMPL impls[] = {
+    { "first-fit scan", ref_initialize, ref_page_allocate, ref_page_free },
+    { "vmm heap", vmm_initialize, vmm_page_allocate, vmm_page_free },
+};
+
+// Allocate single pages until the heap is exhausted, then free them.
+static uint32_t count_free_pages(HEAP_IMPL *impl, void **pages, uint32_t max_pages)
+{
+    uint32_t count = 0;
+    uint32_t i;
+
+    while (count < max_pages && (pages[count] = impl->allocate(1)) != NULL)
+        count++;
+    for (i = 0; i < count; i++)
+        impl->free(pages[i]);
+    return count;
+}
+
+// Replay the trace keeping the owner of every page; returns the number
+// of errors found.
+static int check_heap(HEAP_IMPL *impl, uint8_t *buffer, size_t size)
+{
+    uint32_t total_pages = (uint32_t)(size / PAGE_SIZE);
+    uint32_t *owner = calloc(total_pages, sizeof(uint32_t));
+    void **live = calloc(num_ids, sizeof(void *));
+    void **pages = calloc(total_pages, sizeof(void *));
+    uint32_t free_pages;
+    uint32_t first;
+    uint32_t i;
+    uint32_t j;
+    int errors = 0;
+
+    impl->initialize(buffer, size);
+    free_pages = count_free_pages(impl, pages, total_pages);
+    if (free_pages == 0) {
+        printf("%s: empty heap\n", impl->name);
+        errors++;
+    }
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].alloc) {
+            uint8_t *p = impl->allocate(ops[i].pages);
+
+            live[ops[i].id] = p;
+            if (p == NULL)
+                continue;
+            if (p < buffer || p + (uint64_t) ops[i].pages * PAGE_SIZE > buffer + size ||
+                ((uint8_t *) p - buffer) % PAGE_SIZE != 0) {
+                if (errors++ < 10)
+                    printf("%s: %u pages at %p outside the heap\n", impl->name,
+                           ops[i].pages, p);
+                live[ops[i].id] = NULL;
+                continue;
+            }
+            first = (uint32_t)((p - buffer) / PAGE_SIZE);
+            for (j = first; j < first + ops[i].pages; j++) {
+                if (owner[j] != 0 && errors++ < 10)
+                    printf("%s: %u pages at %p overlap block %u\n", impl->name,
+                           ops[i].pages, p, owner[j] - 1);
+                owner[j] = ops[i].id + 1;
+            }
+        }
+        else if (live[ops[i].id] != NULL) {
+            first = (uint32_t)(((uint8_t *) live[ops[i].id] - buffer) / PAGE_SIZE);
+            for (j = first; j < total_pages && owner[j] == ops[i].id + 1; j++)
+                owner[j] = 0;
+            impl->free(live[ops[i].id]);
+            live[ops[i].id] = NULL;
+        }
+    }
+    for (i = 0; i < num_ids; i++) {
+        if (live[i] != NULL)
+            impl->free(live[i]);
+    }
+    // everything is free again, so every page must come back
+    if (count_free_pages(impl, pages, total_pages) != free_pages) {
+        printf("%s: %u free pages after the trace, %u before\n", impl->name,
+               count_free_pages(impl, pages, total_pages), free_pages);
+        errors++;
+    }
+    free(pages);
+    free(live);
+    free(owner);
+    return errors;
+}
+
+static void replay(HEAP_IMPL *impl, uint8_t *buffer, size_t size, int repeat)
+{
+    void **live = calloc(num_ids, sizeof(void *));
+    struct timespec start, end;
+    uint32_t failures = 0;
+    double seconds = 0.0;
+    uint32_t i;
+    int r;
+
+    for (r = 0; r < repeat; r++) {
+        impl->initialize(buffer, size);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < num_ops; i++) {
+            if (ops[i].alloc) {
+                live[ops[i].id] = impl->allocate(ops[i].pages);
+                if (live[ops[i].id] == NULL)
+                    failures++;
+            }
+            else if (live[ops[i].id] != NULL) {
+                impl->free(live[ops[i].id]);
+                live[ops[i].id] = NULL;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds += elapsed_seconds(&start, &end);
+        for (i = 0; i < num_ids; i++) {
+            if (live[i] != NULL) {
+                impl->free(live[i]);
+                live[i] = NULL;
+            }
+        }
+    }
+    printf("%-16s %10.1f ns/op %10.0f ops/sec, %u failed allocations\n",
+           impl->name, 1e9 * seconds / ((double) num_ops * repeat),
+           ((double) num_ops * repeat) / seconds, failures / repeat);
+    free(live);
+}
+
+
+#define CHURN_BATCH     32
+#define CHURN_ROUNDS    20000
+
+static void *churn_thread(void *arg)
+{
+    void *pages[CHURN_BATCH];
+    int r;
+    int i;
+
+    heapbench_set_cpu_id((uint32_t)(uintptr_t) arg);
+    for (r = 0; r < CHURN_ROUNDS; r++) {
+        for (i = 0; i < CHURN_BATCH; i++)
+            pages[i] = vmm_page_allocate(1);
+        for (i = 0; i < CHURN_BATCH; i++) {
+            if (pages[i] != NULL)
+                vmm_page_free(pages[i]);
+        }
+    }
+    return NULL;
+}
+
+static void churn(uint8_t *buffer, size_t size, int num_threads)
+{
+    pthread_t threads[64];
+    struct timespec start, end;
+    double seconds;
+    int i;
+
+    vmm_heap_initialize((uint64_t)(uintptr_t) buffer, size);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, churn_thread, (void *)(uintptr_t) i);
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = elapsed_seconds(&start, &end);
+    printf("single page churn, %d threads: %.0f ops/sec\n", num_threads,
+           2.0 * CHURN_BATCH * CHURN_ROUNDS * num_threads / seconds);
+}
+
+
+int main(int an, char **av)
+{
+    const char *trace_file = NULL;
+    int repeat = 10;
+    int num_threads = 4;
+    size_t heap_mb = 256;
+    size_t size;
+    uint8_t *buffer;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-t") == 0 && j + 1 < an)
+            trace_file = av[++j];
+        else if (strcmp(av[j], "-r") == 0 && j + 1 < an)
+            repeat = atoi(av[++j]);
+        else if (strcmp(av[j], "-c") == 0 && j + 1 < an)
+            num_threads = atoi(av[++j]);
+        else if (strcmp(av[j], "-m") == 0 && j + 1 < an)
+            heap_mb = (size_t) atoi(av[++j]);
+        else {
+            printf("heapbench [-t trace_file] [-r repeat] [-c threads] [-m heap_mb]\n");
+            return 1;
+        }
+    }
+    if (num_threads < 1 || num_threads > 64 || repeat < 1)
+        return 1;
+
+    if (trace_file != NULL) {
+        if (!read_trace(trace_file))
+            return 1;
+    }
+    else {
+        generate_trace(10000);
+    }
+    printf("%u operations, %u allocations\n", num_ops, num_ids);
+
+    size = heap_mb << 20;
+    if (posix_memalign((void **) &buffer, PAGE_SIZE, size) != 0)
+        return 1;
+
+    for (j = 0; j < (int)(sizeof(impls) / sizeof(impls[0])); j++) {
+        if (check_heap(&impls[j], buffer, size) != 0) {
+            printf("%s: check failed\n", impls[j].name);
+            free(buffer);
+            return 1;
+        }
+        printf("%-16s check passed\n", impls[j].name);
+    }
+    for (j = 0; j < (int)(sizeof(impls) / sizeof(impls[0])); j++)
+        replay(&impls[j], buffer, size, repeat);
+    churn(buffer, size, num_threads);
+    printf("max used pages: %u\n", vmm_heap_get_max_used_pages());
+
+    free(buffer);
+    return 0;
+}
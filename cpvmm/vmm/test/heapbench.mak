@@ -0,0 +1,63 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of utils/heap.c with a trace replay benchmark.
+#   make -f heapbench.mak && heapbench.exe [-t serial_log]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/heap.o $(B)/hoststubs.o $(B)/heapbench.o
+
+all: $(E)/heapbench.exe
+ 
+$(E)/heapbench.exe: $(dobjs)
+	@echo "heapbench.exe"
+	$(LINK) -o $(E)/heapbench.exe $(dobjs) -lpthread
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/heapbench.o: $(mainsrc)/test/heapbench.c
+	echo "heapbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/heapbench.o $(mainsrc)/test/heapbench.c
+
+clean:
+	rm -f $(E)/heapbench.exe
+	rm -f $(B)/heap.o $(B)/hoststubs.o $(B)/heapbench.o
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of the free HVA ranges index of the HMM
+// (memory/memory_manager/host_memory_manager.c), built with the MAM on a
+// 4GB e820 map whose memory is mapped 1-1. A range of the new allocations
+// window is in the e820 map as well, so hmm_initialize() maps it 1-1
+// without the index knowing of it. Buffers are allocated by remapping
+// physical pages of the upper 2GB to continuous virtual pages and freed by
+// unmapping the physical pages, as the VMM does; the heap is in the lower
+// 2GB.
+//
+// The check allocates buffers around the 1-1 range and a 1-1 mapped page,
+// frees them, and fragments the window into more holes than the index
+// holds; the buffers must not overlap and their pages must keep their
+// mappings. Every mam_get_mapping() of the window the HMM makes is
+// counted: an allocation from a range of the index tests its pages once.
+//
+// The benchmark times allocations of 1 to 16 pages into an empty window
+// (fresh) and random frees and allocations of a fragmented window (churn).
+//
+//   hmmbench [-n allocations]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// memory/memory_manager/host_memory_manager.c, release build
+extern int      hmm_remap_physical_pages_to_continuous_wb_virtal_addr(uint64_t* hpas_array,
+                    uint32_t num_of_pages, int is_writable, int is_executable, uint64_t* hva);
+extern int      hmm_map_uc_physical_page(uint64_t page_hpa, int is_writable, int is_executable,
+                    int flash_all_tlbs_if_needed, uint64_t* page_hva);
+extern int      hmm_unmap_hpa(uint64_t hpa, uint64_t size, int flush_tlbs_on_all_cpus);
+extern int      hmm_hva_to_hpa(uint64_t hva, uint64_t* hpa);
+// test/hmmstubs.c
+extern int      hmmbench_initialize(uint64_t identity_base, uint64_t identity_size);
+extern uint64_t hmmbench_first_address(void);
+extern uint32_t hmmbench_max_free_ranges(void);
+extern uint64_t hmmbench_window_lookups(void);
+extern uint64_t hmmbench_invlpgs(void);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+
+// the MAM keeps 40 bit table addresses
+#define HEAP_SIZE           (128 << 20)
+#define PAGE_SIZE           4096ULL
+#define MAX_BUFFER_PAGES    16
+#define FIRST_HPA           0x80000000ULL
+#define LAST_HPA            0x100000000ULL
+// pages of the window mapped 1-1 from the e820 map
+#define IDENTITY_PAGE       16
+#define IDENTITY_PAGES      64
+
+typedef struct {
+    uint64_t hva;
+    uint64_t hpa;
+    uint32_t num_pages;
+} BUFFER;
+
+static uint64_t first_address;
+static uint64_t next_hpa = FIRST_HPA;
+static uint64_t hpas[MAX_BUFFER_PAGES];
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static uint64_t window_page(uint64_t page)
+{
+    return first_address + page * PAGE_SIZE;
+}
+
+// maps num_pages physical pages that were not mapped to the window yet
+static int allocate(BUFFER* buffer, uint32_t num_pages)
+{
+    uint32_t i;
+
+    if (next_hpa + num_pages * PAGE_SIZE > LAST_HPA) {
+        return 0;
+    }
+    for (i = 0; i < num_pages; i++) {
+        hpas[i] = next_hpa + i * PAGE_SIZE;
+    }
+    buffer->hpa = next_hpa;
+    buffer->num_pages = num_pages;
+    next_hpa += num_pages * PAGE_SIZE;
+    return hmm_remap_physical_pages_to_continuous_wb_virtal_addr(hpas, num_pages, 1, 0,
+                                                                 &buffer->hva);
+}
+
+static void release(BUFFER* buffer)
+{
+    hmm_unmap_hpa(buffer->hpa, buffer->num_pages * PAGE_SIZE, 1);
+    buffer->num_pages = 0;
+}
+
+static int is_mapped_to(const BUFFER* buffer)
+{
+    uint64_t hpa;
+    uint32_t i;
+
+    for (i = 0; i < buffer->num_pages; i++) {
+        if (!hmm_hva_to_hpa(buffer->hva + i * PAGE_SIZE, &hpa) ||
+            hpa != buffer->hpa + i * PAGE_SIZE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void check(void)
+{
+    uint32_t num_holes = hmmbench_max_free_ranges() + 64;
+    BUFFER a, b, c, d, *buffers;
+    uint64_t lookups, invlpgs, hva, hpa;
+    uint32_t i;
+    int mapped = 1;
+
+    buffers = calloc(2 * num_holes, sizeof(BUFFER));
+    if (buffers == NULL) {
+        CHECK(0, "out of memory");
+        return;
+    }
+
+    // hmm_initialize() took the first page of the window; the first buffer
+    // runs into the 1-1 range, which is dropped from the index
+    CHECK(allocate(&a, 16), "allocate");
+    CHECK(a.hva == window_page(IDENTITY_PAGE + IDENTITY_PAGES), "1-1 range skipped");
+    CHECK(is_mapped_to(&a), "buffer mapped");
+    CHECK(hmm_hva_to_hpa(window_page(IDENTITY_PAGE), &hpa) &&
+          hpa == window_page(IDENTITY_PAGE), "1-1 range kept");
+
+    // the index now knows the window
+    lookups = hmmbench_window_lookups();
+    CHECK(allocate(&b, 16), "allocate");
+    CHECK(b.hva == a.hva + 16 * PAGE_SIZE, "next buffer");
+    CHECK(hmmbench_window_lookups() - lookups == 16, "one lookup per page");
+
+    // next fit: a freed buffer is not handed out again right away
+    invlpgs = hmmbench_invlpgs();
+    release(&a);
+    CHECK(hmmbench_invlpgs() - invlpgs == 16, "freed pages invalidated");
+    CHECK(!hmm_hva_to_hpa(window_page(IDENTITY_PAGE + IDENTITY_PAGES), &hpa), "buffer unmapped");
+    CHECK(allocate(&c, 16), "allocate");
+    CHECK(c.hva == b.hva + 16 * PAGE_SIZE, "next fit");
+
+    // a page mapped 1-1 by the HMM is taken out of the index
+    CHECK(hmm_map_uc_physical_page(c.hva + 17 * PAGE_SIZE, 1, 0, 1, &hva) &&
+          hva == c.hva + 17 * PAGE_SIZE, "1-1 page");
+    lookups = hmmbench_window_lookups();
+    CHECK(allocate(&d, 4), "allocate");
+    CHECK(d.hva == c.hva + 18 * PAGE_SIZE, "1-1 page skipped");
+    CHECK(hmmbench_window_lookups() - lookups == 4, "1-1 page not tested");
+    CHECK(hmm_unmap_hpa(c.hva + 17 * PAGE_SIZE, PAGE_SIZE, 1) &&
+          !hmm_hva_to_hpa(c.hva + 17 * PAGE_SIZE, &hpa), "1-1 page unmapped");
+    CHECK(is_mapped_to(&b) && is_mapped_to(&c) && is_mapped_to(&d), "buffers kept");
+    release(&b);
+    release(&c);
+    release(&d);
+
+    // more holes than the index holds: the ranges it drops stay unused, and
+    // no buffer may land on a mapped page
+    for (i = 0; i < 2 * num_holes; i++) {
+        if (!allocate(&buffers[i], 1)) {
+            CHECK(0, "allocate");
+            break;
+        }
+    }
+    for (i = 0; i < 2 * num_holes; i += 2) {
+        release(&buffers[i]);
+    }
+    for (i = 0; i < 2 * num_holes; i += 2) {
+        if (!allocate(&buffers[i], 1 + i % 3)) {
+            CHECK(0, "allocate");
+            break;
+        }
+    }
+    for (i = 0; i < 2 * num_holes; i++) {
+        mapped = mapped && is_mapped_to(&buffers[i]);
+    }
+    CHECK(mapped, "buffers do not overlap");
+    for (i = 0; i < 2 * num_holes; i++) {
+        release(&buffers[i]);
+    }
+    free(buffers);
+}
+
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static uint64_t next_random(uint64_t* seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *seed >> 33;
+}
+
+// returns 0 if an allocation failed
+static int run(const char *scenario, uint32_t num_allocations, BUFFER *buffers,
+               double *rate, double *lookups, double *pages)
+{
+    struct timespec start, end;
+    uint64_t seed = 12345, num_pages = 0, first_lookups;
+    uint32_t i, num_buffers = 0;
+    BUFFER *buffer;
+    int churn = (strcmp(scenario, "churn") == 0);
+
+    if (churn) {
+        // a window of buffers of 1 to 8 pages with the odd ones freed
+        while (num_buffers < num_allocations) {
+            if (!allocate(&buffers[num_buffers], 1 + (uint32_t) next_random(&seed) % 8)) {
+                return 0;
+            }
+            num_buffers++;
+        }
+        for (i = 1; i < num_buffers; i += 2) {
+            release(&buffers[i]);
+        }
+    }
+
+    first_lookups = hmmbench_window_lookups();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_allocations; i++) {
+        if (churn) {
+            // free a random buffer and allocate one of another size
+            buffer = &buffers[next_random(&seed) % num_buffers];
+            if (buffer->num_pages != 0) {
+                release(buffer);
+            }
+        }
+        else {
+            buffer = &buffers[num_buffers++];
+        }
+        if (!allocate(buffer, 1 + (uint32_t) next_random(&seed) % MAX_BUFFER_PAGES)) {
+            return 0;
+        }
+        num_pages += buffer->num_pages;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *rate = num_allocations / elapsed_seconds(&start, &end);
+    *lookups = (double)(hmmbench_window_lookups() - first_lookups) / num_allocations;
+    *pages = (double) num_pages / num_allocations;
+
+    for (i = 0; i < num_buffers; i++) {
+        if (buffers[i].num_pages != 0) {
+            release(&buffers[i]);
+        }
+    }
+    return 1;
+}
+
+
+int main(int an, char **av)
+{
+    static const char *scenarios[] = { "fresh", "churn" };
+    uint32_t num_allocations = 10000;
+    double rate, lookups, pages;
+    BUFFER *buffers;
+    void *heap;
+    unsigned i;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-n") == 0 && j + 1 < an)
+            num_allocations = (uint32_t) strtoul(av[++j], NULL, 0);
+        else
+            break;
+    }
+    if (j < an || num_allocations == 0 || num_allocations > 20000) {
+        printf("hmmbench [-n allocations]\n");
+        return 1;
+    }
+    heap = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    buffers = calloc(num_allocations, sizeof(BUFFER));
+    if (heap == MAP_FAILED || buffers == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+    first_address = hmmbench_first_address();
+    if (!hmmbench_initialize(window_page(IDENTITY_PAGE), IDENTITY_PAGES * PAGE_SIZE)) {
+        fprintf(stderr, "hmm_initialize failed\n");
+        return 1;
+    }
+
+    check();
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+
+    printf("\n%u allocations\n", num_allocations);
+    printf("%-9s %12s %14s %12s\n", "scenario", "allocs/s", "lookups/alloc", "pages/alloc");
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (!run(scenarios[i], num_allocations, buffers, &rate, &lookups, &pages)) {
+            printf("%s: allocation failed\n", scenarios[i]);
+            return 1;
+        }
+        printf("%-9s %12.0f %14.1f %12.1f\n", scenarios[i], rate, lookups, pages);
+    }
+    free(buffers);
+    munmap(heap, HEAP_SIZE);
+    return g_errors ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the HMM (host_memory_manager.c) and the MAM with a check
+# and a benchmark of the free HVA ranges index.
+#   make -f hmmbench.mak && hmmbench.exe [-n allocations]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+# the HMM's lookups of the window go through hmmstubs.c
+LDFLAGS=    -Wl,--wrap=mam_get_mapping
+
+dobjs=      $(B)/host_memory_manager.o $(B)/memory_address_mapper.o $(B)/heap.o \
+            $(B)/hmmstubs.o $(B)/hoststubs.o $(B)/hmmbench.o
+
+all: $(E)/hmmbench.exe
+ 
+$(E)/hmmbench.exe: $(dobjs)
+	@echo "hmmbench.exe"
+	$(LINK) $(LDFLAGS) -o $(E)/hmmbench.exe $(dobjs)
+
+$(B)/host_memory_manager.o: $(mainsrc)/memory/memory_manager/host_memory_manager.c
+	echo "host_memory_manager.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/memory/memory_manager -c -o $(B)/host_memory_manager.o $(mainsrc)/memory/memory_manager/host_memory_manager.c
+
+$(B)/memory_address_mapper.o: $(mainsrc)/memory/memory_manager/memory_address_mapper.c
+	echo "memory_address_mapper.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/memory/memory_manager -c -o $(B)/memory_address_mapper.o $(mainsrc)/memory/memory_manager/memory_address_mapper.c
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/hmmstubs.o: $(mainsrc)/test/hmmstubs.c
+	echo "hmmstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/memory/memory_manager -c -o $(B)/hmmstubs.o $(mainsrc)/test/hmmstubs.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/hmmbench.o: $(mainsrc)/test/hmmbench.c
+	echo "hmmbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/hmmbench.o $(mainsrc)/test/hmmbench.c
+
+clean:
+	rm -f $(E)/hmmbench.exe
+	rm -f $(dobjs)
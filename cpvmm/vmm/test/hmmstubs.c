@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the e820, MTRR, PAT, EFER, IPC and hw_* services the
+// HMM (memory/memory_manager/host_memory_manager.c) depends on, besides the
+// MAM and the heap and locks of hoststubs.c. The e820 map holds 4GB of
+// memory and one range of hmmbench.c, which hmm_initialize() maps 1-1; a
+// range in the new allocations window is mapped without the free HVA
+// ranges index knowing of it. hmmbench.mak links with
+// --wrap=mam_get_mapping so the lookups of the window the HMM makes are
+// counted. Built with the VMM include paths.
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(HOST_MEMORY_MANAGER_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(HOST_MEMORY_MANAGER_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "common_libc.h"
+#include "vmm_arch_defs.h"
+#include "vmm_startup.h"
+#include "hw_interlocked.h"
+#include "hw_utils.h"
+#include "e820_abstraction.h"
+#include "efer_msr_abstraction.h"
+#include "mtrrs_abstraction.h"
+#include "pat_manager.h"
+#include "vmm_stack_api.h"
+#include "ipc.h"
+#include "memory_address_mapper_api.h"
+#include "host_memory_manager_api.h"
+#include "host_memory_manager.h"
+
+
+#define HMMSTUBS_WB_PAT_INDEX   0
+#define HMMSTUBS_UC_PAT_INDEX   3
+
+UINT64 g_additional_heap_pa = 0;
+UINT64 g_additional_heap_base = 0;
+UINT32 g_is_post_launch = 0;
+
+static INT15_E820_MEMORY_MAP_ENTRY_EXT hmm_e820[2];
+static UINT32   hmm_num_of_e820_entries;
+static UINT64   hmm_cr3;
+static UINT64   hmm_window_lookups;
+static UINT64   hmm_invlpgs;
+
+extern MAM_MAPPING_RESULT __real_mam_get_mapping(IN MAM_HANDLE mam_handle,
+                    IN UINT64 src_addr, OUT UINT64* tgt_addr, OUT MAM_ATTRIBUTES* attrs);
+
+
+// hmmbench.c interface
+BOOLEAN hmmbench_initialize(UINT64 identity_base, UINT64 identity_size)
+{
+    VMM_STARTUP_STRUCT startup_struct;
+
+    vmm_zeromem(&startup_struct, sizeof(startup_struct));
+    startup_struct.number_of_processors_at_boot_time = 1;
+    hmm_e820[0].basic_entry.base_address = 0;
+    hmm_e820[0].basic_entry.length = 0x100000000;
+    hmm_e820[0].basic_entry.address_range_type = INT15_E820_ADDRESS_RANGE_TYPE_MEMORY;
+    hmm_num_of_e820_entries = 1;
+    if (identity_size != 0) {
+        hmm_e820[1].basic_entry.base_address = identity_base;
+        hmm_e820[1].basic_entry.length = identity_size;
+        hmm_e820[1].basic_entry.address_range_type = INT15_E820_ADDRESS_RANGE_TYPE_MEMORY;
+        hmm_num_of_e820_entries = 2;
+    }
+    return hmm_initialize(&startup_struct);
+}
+
+UINT64 hmmbench_first_address(void)
+{
+    return HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS;
+}
+
+UINT32 hmmbench_max_free_ranges(void)
+{
+    return HMM_MAX_FREE_RANGES;
+}
+
+// mam_get_mapping() calls on the new allocations window
+UINT64 hmmbench_window_lookups(void)
+{
+    return hmm_window_lookups;
+}
+
+UINT64 hmmbench_invlpgs(void)
+{
+    return hmm_invlpgs;
+}
+
+
+MAM_MAPPING_RESULT __wrap_mam_get_mapping(IN MAM_HANDLE mam_handle,
+                    IN UINT64 src_addr, OUT UINT64* tgt_addr, OUT MAM_ATTRIBUTES* attrs)
+{
+    if (src_addr >= HMM_FIRST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS &&
+        src_addr < HMM_LAST_VIRTUAL_ADDRESS_FOR_NEW_ALLOCATIONS) {
+        hmm_window_lookups++;
+    }
+    return __real_mam_get_mapping(mam_handle, src_addr, tgt_addr, attrs);
+}
+
+E820_ABSTRACTION_RANGE_ITERATOR e820_abstraction_iterator_get_first(E820_HANDLE e820_handle)
+{
+    (void) e820_handle;
+    return (E820_ABSTRACTION_RANGE_ITERATOR) &hmm_e820[0];
+}
+
+E820_ABSTRACTION_RANGE_ITERATOR e820_abstraction_iterator_get_next(E820_HANDLE e820_handle,
+                    E820_ABSTRACTION_RANGE_ITERATOR iter)
+{
+    INT15_E820_MEMORY_MAP_ENTRY_EXT* entry = (INT15_E820_MEMORY_MAP_ENTRY_EXT*) iter;
+
+    (void) e820_handle;
+    if (entry + 1 >= &hmm_e820[hmm_num_of_e820_entries]) {
+        return E820_ABSTRACTION_NULL_ITERATOR;
+    }
+    return (E820_ABSTRACTION_RANGE_ITERATOR)(entry + 1);
+}
+
+const INT15_E820_MEMORY_MAP_ENTRY_EXT*
+e820_abstraction_iterator_get_range_details(IN E820_ABSTRACTION_RANGE_ITERATOR iter)
+{
+    return (const INT15_E820_MEMORY_MAP_ENTRY_EXT*) iter;
+}
+
+VMM_PHYS_MEM_TYPE mtrrs_abstraction_get_memory_type(HPA address)
+{
+    (void) address;
+    return VMM_PHYS_MEM_WRITE_BACK;
+}
+
+UINT32 pat_mngr_retrieve_current_earliest_pat_index_for_mem_type(VMM_PHYS_MEM_TYPE mem_type)
+{
+    return (mem_type == VMM_PHYS_MEM_WRITE_BACK) ? HMMSTUBS_WB_PAT_INDEX : HMMSTUBS_UC_PAT_INDEX;
+}
+
+UINT32 pat_mngr_get_earliest_pat_index_for_mem_type(VMM_PHYS_MEM_TYPE mem_type,
+                    UINT64 pat_msr_value)
+{
+    (void) pat_msr_value;
+    return pat_mngr_retrieve_current_earliest_pat_index_for_mem_type(mem_type);
+}
+
+BOOLEAN vmm_stack_is_initialized(void)
+{
+    return TRUE;
+}
+
+UINT64 efer_msr_read_reg(void)
+{
+    return 0;
+}
+
+BOOLEAN efer_msr_is_nxe_bit_set(IN UINT64 efer_msr_value)
+{
+    (void) efer_msr_value;
+    return TRUE;
+}
+
+void efer_msr_set_nxe(void)
+{
+}
+
+UINT64 hw_read_cr0(void)
+{
+    return 0;
+}
+
+void hw_write_cr0(UINT64 value)
+{
+    (void) value;
+}
+
+UINT64 hw_read_cr3(void)
+{
+    return hmm_cr3;
+}
+
+void hw_write_cr3(UINT64 value)
+{
+    hmm_cr3 = value;
+}
+
+// one CPU: there are no other CPUs to run the handlers
+UINT32 ipc_execute_handler(IPC_DESTINATION dst, IPC_HANDLER_FN handler, void* arg)
+{
+    (void) dst;
+    (void) handler;
+    (void) arg;
+    return 0;
+}
+
+void ipc_batch_init(IPC_BATCH *batch, IPC_DESTINATION dst, BOOLEAN include_self)
+{
+    (void) batch;
+    (void) dst;
+    (void) include_self;
+}
+
+void ipc_batch_add_invlpg(IPC_BATCH *batch, HVA start, UINT64 size)
+{
+    (void) batch;
+    (void) start;
+    hmm_invlpgs += size / PAGE_4KB_SIZE;
+}
+
+UINT32 ipc_batch_flush(IPC_BATCH *batch)
+{
+    (void) batch;
+    return 0;
+}
+
+void * vmm_memmove(void *dest, const void* src, int count)
+{
+    return __builtin_memmove(dest, src, (size_t) count);
+}
+
+INT32 hw_interlocked_add(INT32 volatile * addend, INT32 value)
+{
+    return __sync_fetch_and_add(addend, value);
+}
+
+void hw_store_fence(void)
+{
+    __sync_synchronize();
+}
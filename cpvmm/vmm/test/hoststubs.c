@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the few VMM services the heap and the memory
+// allocator (utils/heap.c, utils/memory_allocator.c, pool.c, hash64.c)
+// depend on, so they can be built and benchmarked as user-space
+// programs. Built with the VMM include paths; the benchmarks only see
+// plain C prototypes.
+
+#include "vmm_defs.h"
+#include "common_libc.h"
+#include "lock.h"
+#include "hw_utils.h"
+#include "vmm_dbg.h"
+
+
+UINT32 g_heap_pa_num = 0;
+
+// set by each benchmark thread
+static __thread CPU_ID bench_cpu_id = 0;
+
+void heapbench_set_cpu_id(UINT32 cpu_id)
+{
+    bench_cpu_id = (CPU_ID) cpu_id;
+}
+
+CPU_ID hw_cpu_id()
+{
+    return bench_cpu_id;
+}
+
+void lock_initialize(VMM_LOCK* lock)
+{
+    lock->u.uint32_lock = 0;
+    lock->owner_cpu_id = (CPU_ID) -1;
+}
+
+void lock_acquire(VMM_LOCK* lock)
+{
+    while (__sync_lock_test_and_set(&lock->u.uint32_lock, 1)) {
+        while (lock->u.uint32_lock)
+            __asm__ volatile("pause");
+    }
+    lock->owner_cpu_id = bench_cpu_id;
+}
+
+void lock_release(VMM_LOCK* lock)
+{
+    lock->owner_cpu_id = (CPU_ID) -1;
+    __sync_lock_release(&lock->u.uint32_lock);
+}
+
+BOOLEAN hw_scan_bit_forward(UINT32 *bit_number_ptr, UINT32 bitset)
+{
+    if (bitset == 0)
+        return FALSE;
+    *bit_number_ptr = (UINT32) __builtin_ctz(bitset);
+    return TRUE;
+}
+
+BOOLEAN hw_scan_bit_backward(UINT32 *bit_number_ptr, UINT32 bitset)
+{
+    if (bitset == 0)
+        return FALSE;
+    *bit_number_ptr = 31 - (UINT32) __builtin_clz(bitset);
+    return TRUE;
+}
+
+BOOLEAN hw_scan_bit_forward64(UINT32 *bit_number_ptr, UINT64 bitset)
+{
+    if (bitset == 0)
+        return FALSE;
+    *bit_number_ptr = (UINT32) __builtin_ctzll(bitset);
+    return TRUE;
+}
+
+void vmm_deadloop_dump(UINT32 file_code, UINT32 line_num)
+{
+    (void) file_code;
+    (void) line_num;
+    __builtin_trap();
+}
+
+int vmm_printf(const char *format, ...)
+{
+    (void) format;
+    return 0;
+}
+
+void * vmm_memset(void *dest, int filler, size_t count)
+{
+    return __builtin_memset(dest, filler, count);
+}
+
+void vmm_zero_page(void *page)
+{
+    __builtin_memset(page, 0, PAGE_4KB_SIZE);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for what the IO port VM exit handling
+// (vmexit/vmexit_io.c) depends on: one guest whose IO instruction exits
+// are described by iotest.c, heap allocations from the C library, and
+// ports that read as 0. Built with the VMM include paths.
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(VMEXIT_IO_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(VMEXIT_IO_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "common_libc.h"
+#include "heap.h"
+#include "memory_allocator.h"
+#include "hw_utils.h"
+#include "address.h"
+#include "guest.h"
+#include "guest_cpu.h"
+#include "vmcs_api.h"
+#include "vmexit.h"
+#include "host_memory_manager_api.h"
+
+
+// iotest.c
+extern UINT64 iotest_exit_qualification(void);
+extern void   iotest_skip_instruction(void);
+extern void*  iotest_alloc(UINT32 size);
+extern void   iotest_abort(void);
+
+static VMEXIT_HANDLER io_exit_handler = NULL;
+static HVA io_bitmap[2];
+
+
+VMM_STATUS vmexit_install_handler(GUEST_ID guest_id, VMEXIT_HANDLER handler,
+                                  UINT32 reason)
+{
+    (void) guest_id;
+    (void) reason;
+    io_exit_handler = handler;
+    return VMM_OK;
+}
+
+VMEXIT_HANDLER iostubs_exit_handler(void)
+{
+    return io_exit_handler;
+}
+
+UINT8* iostubs_io_bitmap(void)
+{
+    return (UINT8*) io_bitmap[0];
+}
+
+void* vmm_memory_allocate(
+#ifdef DEBUG
+    char *file_name,
+    INT32 line_number,
+#endif
+    IN UINT32 size)
+{
+    return iotest_alloc(size);
+}
+
+void* vmm_mem_allocate(char *file_name, INT32 line_number, IN UINT32 size)
+{
+    (void) file_name;
+    (void) line_number;
+    return iotest_alloc(size);
+}
+
+void* vmm_memset(void *dest, int filler, size_t count)
+{
+    UINT8 *p = (UINT8 *) dest;
+
+    while (count-- > 0)
+        *p++ = (UINT8) filler;
+    return dest;
+}
+
+BOOLEAN hmm_hva_to_hpa(IN HVA hva, OUT HPA* hpa)
+{
+    *hpa = hva;
+    return TRUE;
+}
+
+GUEST_HANDLE gcpu_guest_handle(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return NULL;
+}
+
+GUEST_ID guest_get_id(GUEST_HANDLE guest)
+{
+    (void) guest;
+    return 0;
+}
+
+VMCS_OBJECT* gcpu_get_vmcs(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return NULL;
+}
+
+UINT64 vmcs_read(const struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id)
+{
+    (void) vmcs;
+    if (VMCS_EXIT_INFO_QUALIFICATION == field_id)
+        return iotest_exit_qualification();
+    return 0;
+}
+
+void vmcs_write(struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id, UINT64 value)
+{
+    (void) vmcs;
+    if (VMCS_IO_BITMAP_ADDRESS_A == field_id)
+        io_bitmap[0] = value;
+    else if (VMCS_IO_BITMAP_ADDRESS_B == field_id)
+        io_bitmap[1] = value;
+}
+
+void gcpu_skip_guest_instruction(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    iotest_skip_instruction();
+}
+
+void gcpu_control_setup_only(GUEST_CPU_HANDLE gcpu, const VMEXIT_CONTROL* request)
+{
+    (void) gcpu;
+    (void) request;
+}
+
+void gcpu_control_apply_only(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+}
+
+UINT64 gcpu_get_native_gp_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                                      VMM_IA32_GP_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) reg;
+    (void) level;
+    return 0;
+}
+
+// string IO is not exercised
+UINT64 gcpu_get_guest_visible_control_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                        VMM_IA32_CONTROL_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) reg;
+    (void) level;
+    iotest_abort();
+    return 0;
+}
+
+BOOLEAN gcpu_gva_to_hva(GUEST_CPU_HANDLE gcpu, GVA gva, HVA* hva)
+{
+    (void) gcpu;
+    (void) gva;
+    (void) hva;
+    iotest_abort();
+    return 0;
+}
+
+BOOLEAN gcpu_inject_gp0(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    iotest_abort();
+    return 0;
+}
+
+BOOLEAN addr_is_canonical(ADDRESS address)
+{
+    (void) address;
+    iotest_abort();
+    return 0;
+}
+
+UINT8 hw_read_port_8(UINT16 port)
+{
+    (void) port;
+    return 0;
+}
+
+UINT16 hw_read_port_16(UINT16 port)
+{
+    (void) port;
+    return 0;
+}
+
+UINT32 hw_read_port_32(UINT16 port)
+{
+    (void) port;
+    return 0;
+}
+
+void hw_write_port_8(UINT16 port, UINT8 val8)
+{
+    (void) port;
+    (void) val8;
+}
+
+void hw_write_port_16(UINT16 port, UINT16 val16)
+{
+    (void) port;
+    (void) val16;
+}
+
+void hw_write_port_32(UINT16 port, UINT32 val32)
+{
+    (void) port;
+    (void) val32;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check of the IO port handler table in vmexit/vmexit_io.c.
+//
+// Registers overlapping, adjacent and nested port ranges for one guest,
+// then sends an OUT instruction VM exit on every port around them and
+// checks which handler, with which context, sees it, and which ports
+// have their bit set in the IO bitmap.
+//
+//   make -f iotest.mak && iotest.exe
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define PAGE_SIZE           4096
+#define MAX_DESCRIPTORS     64      // IO_VMEXIT_MAX_COUNT
+#define VMM_OK              0
+#define NO_HANDLER          0       // context seen for the blocking handler
+
+typedef int32_t (*IO_HANDLER)(void *gcpu, uint16_t port_id, unsigned port_size,
+                              int access, int32_t string_intr, int32_t rep_prefix,
+                              uint32_t rep_count, void *p_value, void *context);
+
+// vmexit/vmexit_io.c, release build
+extern void    io_vmexit_initialize(void);
+extern void    io_vmexit_guest_initialize(uint16_t guest_id);
+extern void    io_vmexit_activate(void *gcpu);
+extern int     io_vmexit_handler_register(uint16_t guest_id, uint16_t port_id,
+                                          IO_HANDLER handler, void *context);
+extern int     io_vmexit_handler_register_range(uint16_t guest_id, uint16_t port_from,
+                                                uint16_t port_to, IO_HANDLER handler,
+                                                void *context);
+extern int     io_vmexit_handler_unregister(uint16_t guest_id, uint16_t port_id);
+extern void    io_vmexit_block_port(uint16_t guest_id, uint16_t port_from,
+                                    uint16_t port_to);
+// iostubs.c
+typedef int    (*EXIT_HANDLER)(void *gcpu);
+extern EXIT_HANDLER iostubs_exit_handler(void);
+extern uint8_t *iostubs_io_bitmap(void);
+
+
+static uint64_t exit_qualification;
+static int      skipped;
+static uintptr_t seen_context;
+static uint16_t seen_port;
+static int      g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+
+uint64_t iotest_exit_qualification(void)
+{
+    return exit_qualification;
+}
+
+void iotest_skip_instruction(void)
+{
+    skipped++;
+}
+
+void *iotest_alloc(uint32_t size)
+{
+    void *p = NULL;
+
+    if (posix_memalign(&p, PAGE_SIZE, size) != 0)
+        return NULL;
+    memset(p, 0, size);
+    return p;
+}
+
+void iotest_abort(void)
+{
+    abort();
+}
+
+static int32_t record_handler(void *gcpu, uint16_t port_id, unsigned port_size,
+                              int access, int32_t string_intr, int32_t rep_prefix,
+                              uint32_t rep_count, void *p_value, void *context)
+{
+    (void) gcpu;
+    (void) port_size;
+    (void) access;
+    (void) string_intr;
+    (void) rep_prefix;
+    (void) rep_count;
+    (void) p_value;
+    seen_port = port_id;
+    seen_context = (uintptr_t) context;
+    return 1;
+}
+
+// one byte OUT to an immediate port; returns the context of the handler
+// that ran, NO_HANDLER for the blocking handler
+static uintptr_t exit_on(uint16_t port)
+{
+    exit_qualification = (1 << 6) | ((uint64_t) port << 16);
+    seen_context = NO_HANDLER;
+    seen_port = 0;
+    skipped = 0;
+    iostubs_exit_handler()(NULL);
+    if (skipped != 1)
+        return (uintptr_t) -1;
+    if (seen_context != NO_HANDLER && seen_port != port)
+        return (uintptr_t) -1;
+    return seen_context;
+}
+
+static int exits(uint16_t port)
+{
+    uint8_t *bitmap = iostubs_io_bitmap();
+
+    return (bitmap[port / 8] >> (port % 8)) & 1;
+}
+
+static int register_range(uint16_t from, uint16_t to, uintptr_t context)
+{
+    return io_vmexit_handler_register_range(0, from, to, record_handler,
+                                            (void *) context);
+}
+
+// every port of [from, to] exits, to the handler with "context"
+static int range_is(uint16_t from, uint16_t to, uintptr_t context)
+{
+    uint32_t port;
+
+    for (port = from; port <= to; port++) {
+        if (exit_on((uint16_t) port) != context)
+            return 0;
+        if (!exits((uint16_t) port))
+            return 0;
+    }
+    return 1;
+}
+
+// number of single port ranges that can still be registered, from port
+// 0x8000 on; they are unregistered again
+static int free_descriptors(void)
+{
+    int count = 0;
+    int i;
+
+    while (count < 2 * MAX_DESCRIPTORS &&
+           register_range((uint16_t)(0x8000 + count), (uint16_t)(0x8000 + count),
+                          1000 + count) == VMM_OK)
+        count++;
+    for (i = 0; i < count; i++)
+        io_vmexit_handler_unregister(0, (uint16_t)(0x8000 + i));
+    return count;
+}
+
+
+int main(void)
+{
+    int descriptors;
+
+    io_vmexit_initialize();
+    io_vmexit_guest_initialize(0);
+    io_vmexit_activate(NULL);
+    if (iostubs_exit_handler() == NULL || iostubs_io_bitmap() == NULL) {
+        printf("IO exits not set up\n");
+        return 1;
+    }
+    descriptors = free_descriptors();
+    CHECK(descriptors == MAX_DESCRIPTORS, "all descriptors free");
+
+    // a range, and the ports around it
+    CHECK(register_range(0x3f8, 0x3ff, 1) == VMM_OK, "register 3f8-3ff");
+    CHECK(range_is(0x3f8, 0x3ff, 1), "3f8-3ff handled");
+    CHECK(exit_on(0x3f7) == NO_HANDLER && !exits(0x3f7), "3f7 not registered");
+    CHECK(exit_on(0x400) == NO_HANDLER && !exits(0x400), "400 not registered");
+
+    // adjacent ranges keep their own handlers
+    CHECK(register_range(0x400, 0x407, 2) == VMM_OK, "register 400-407");
+    CHECK(range_is(0x3f8, 0x3ff, 1), "3f8-3ff kept");
+    CHECK(range_is(0x400, 0x407, 2), "400-407 handled");
+    CHECK(register_range(0x3f0, 0x3f7, 3) == VMM_OK, "register 3f0-3f7");
+    CHECK(range_is(0x3f0, 0x3f7, 3), "3f0-3f7 handled");
+    CHECK(range_is(0x3f8, 0x3ff, 1), "3f8-3ff kept");
+    CHECK(free_descriptors() == MAX_DESCRIPTORS - 3, "one descriptor per range");
+
+    // a range overlapping two others takes their ports over
+    CHECK(register_range(0x3fc, 0x403, 4) == VMM_OK, "register 3fc-403");
+    CHECK(range_is(0x3f8, 0x3fb, 1), "3f8-3fb kept");
+    CHECK(range_is(0x3fc, 0x403, 4), "3fc-403 handled");
+    CHECK(range_is(0x404, 0x407, 2), "404-407 kept");
+    CHECK(free_descriptors() == MAX_DESCRIPTORS - 4, "overlapped ranges keep their descriptors");
+
+    // the exact same range is updated in place
+    CHECK(register_range(0x3fc, 0x403, 5) == VMM_OK, "update 3fc-403");
+    CHECK(range_is(0x3fc, 0x403, 5), "3fc-403 updated");
+    CHECK(free_descriptors() == MAX_DESCRIPTORS - 4, "update takes no descriptor");
+
+    // a range covering another one releases its descriptor
+    CHECK(register_range(0x3ef, 0x3f8, 6) == VMM_OK, "register 3ef-3f8");
+    CHECK(range_is(0x3ef, 0x3f8, 6), "3ef-3f8 handled");
+    CHECK(range_is(0x3f9, 0x3fb, 1), "3f9-3fb kept");
+    CHECK(free_descriptors() == MAX_DESCRIPTORS - 4, "covered range released");
+
+    // a nested range splits its host in two
+    CHECK(register_range(0x3fe, 0x3ff, 7) == VMM_OK, "register 3fe-3ff");
+    CHECK(range_is(0x3fc, 0x3fd, 5) && range_is(0x3fe, 0x3ff, 7) &&
+          range_is(0x400, 0x403, 5), "3fe-3ff inside 3fc-403");
+
+    // unregistering the last port of a range releases its descriptor
+    io_vmexit_handler_unregister(0, 0x3f9);
+    io_vmexit_handler_unregister(0, 0x3fa);
+    CHECK(free_descriptors() == MAX_DESCRIPTORS - 5, "partly unregistered range kept");
+    io_vmexit_handler_unregister(0, 0x3fb);
+    CHECK(free_descriptors() == MAX_DESCRIPTORS - 4, "unregistered range released");
+    CHECK(exit_on(0x3fa) == NO_HANDLER && !exits(0x3fa), "3fa unregistered");
+
+    // a range across two pages of the port table
+    CHECK(register_range(0x1fe, 0x201, 8) == VMM_OK, "register 1fe-201");
+    CHECK(range_is(0x1fe, 0x201, 8), "1fe-201 handled");
+    CHECK(register_range(0xfffe, 0xffff, 9) == VMM_OK, "register fffe-ffff");
+    CHECK(range_is(0xfffe, 0xffff, 9), "fffe-ffff handled");
+    CHECK(register_range(0x10, 0x0f, 10) != VMM_OK, "empty range refused");
+
+    // blocked ports exit to the blocking handler
+    io_vmexit_block_port(0, 0x3fd, 0x400);
+    CHECK(range_is(0x3fc, 0x3fc, 5), "3fc kept");
+    CHECK(range_is(0x3fd, 0x400, NO_HANDLER), "3fd-400 blocked");
+    CHECK(exits(0x3fd) && exits(0x400), "blocked ports exit");
+    CHECK(range_is(0x401, 0x403, 5), "401-403 kept");
+
+    // out of descriptors, a single port can't be registered, and
+    // blocking still works
+    descriptors = free_descriptors();
+    {
+        int i;
+
+        for (i = 0; i < descriptors; i++)
+            register_range((uint16_t)(0x9000 + i), (uint16_t)(0x9000 + i), 1);
+        CHECK(io_vmexit_handler_register(0, 0xa000, record_handler, (void *) 11) != VMM_OK,
+              "no descriptor left");
+        io_vmexit_block_port(0, 0x401, 0x402);
+        CHECK(range_is(0x401, 0x402, NO_HANDLER), "401-402 blocked");
+        CHECK(exits(0x401) && exits(0x402), "blocked ports exit");
+        CHECK(range_is(0x403, 0x403, 5), "403 kept");
+    }
+
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+    return g_errors ? 1 : 0;
+}
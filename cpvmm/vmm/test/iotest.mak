@@ -0,0 +1,64 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the IO port VM exit handling (vmexit_io.c) with a check
+# of overlapping, adjacent and nested handler ranges.
+#   make -f iotest.mak && iotest.exe
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/vmexit_io.o $(B)/iostubs.o $(B)/iotest.o
+
+all: $(E)/iotest.exe
+ 
+$(E)/iotest.exe: $(dobjs)
+	@echo "iotest.exe"
+	$(LINK) -o $(E)/iotest.exe $(dobjs)
+
+$(B)/vmexit_io.o: $(mainsrc)/vmexit/vmexit_io.c
+	echo "vmexit_io.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/vmexit_io.o $(mainsrc)/vmexit/vmexit_io.c
+
+$(B)/iostubs.o: $(mainsrc)/test/iostubs.c
+	echo "iostubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/iostubs.o $(mainsrc)/test/iostubs.c
+
+$(B)/iotest.o: $(mainsrc)/test/iotest.c
+	echo "iotest.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/iotest.o $(mainsrc)/test/iotest.c
+
+clean:
+	rm -f $(E)/iotest.exe
+	rm -f $(dobjs)
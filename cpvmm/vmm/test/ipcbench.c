@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of the IPC batches (ipc/ipc_batch.c) on a
+// simulated IPC transport (ipc/ipc.c).
+//
+// Threads stand in for CPUs. Every destination CPU has a message queue and
+// is signaled, as with an NMI, when a message is put in its empty queue; it
+// then drains the queue and acknowledges every message.
+//
+// The check applies batches on this CPU: ranges given out of order and
+// overlapping are merged, large ones end in a single TLB flush or context
+// wide INVEPT, and a full batch is sent before the next entry is added.
+//
+// The benchmark unmaps pages and invalidates them on all the other CPUs,
+// either with one synchronous IPC per page, as hmm_invlpg_callback is
+// used, or with one batch per unmap. For both it prints the round trips
+// the sender waited for, the signals and messages sent, and the INVLPGs
+// and full TLB flushes done by the destinations.
+//
+//   ipcbench [-c cpus] [-r rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+// ipc/ipc_batch.c through test/ipcstubs.c
+extern void     ipcbench_set_invept_address(int supported);
+extern void     ipcbench_batch_init(int self_only);
+extern void     ipcbench_batch_invlpg(uint64_t start, uint64_t size);
+extern void     ipcbench_batch_flush_tlb(void);
+extern void     ipcbench_batch_invept(uint64_t eptp, uint64_t start, uint64_t size);
+extern void     ipcbench_batch_invept_context(uint64_t eptp);
+extern uint32_t ipcbench_batch_flush(void);
+extern uint32_t ipcbench_invlpg_sync(uint64_t address);
+extern void     ipcbench_invepts(uint64_t* address, uint64_t* context, uint64_t* all);
+
+#define MAX_CPUS                    64
+#define QUEUE_SIZE                  MAX_CPUS
+#define PAGE_SIZE                   4096
+#define NUM_PAGES                   1024
+
+#define cpu_relax()                 __asm__ __volatile__("pause" ::: "memory")
+
+typedef void (*HANDLER_FN)(void *arg);
+
+typedef struct {
+    HANDLER_FN handler;
+    void *arg;
+    volatile uint32_t *ack;
+} MESSAGE;
+
+typedef struct {
+    pthread_mutex_t lock;
+    MESSAGE queue[QUEUE_SIZE];
+    uint32_t head, count;
+    volatile uint32_t signals;          // NMIs sent
+    uint32_t signals_seen;
+    uint64_t invlpgs;                   // done by this CPU
+    uint64_t full_flushes;
+    // pages invalidated in the current round, to check the merged ranges
+    uint8_t invalidated[NUM_PAGES];
+} __attribute__((aligned(64))) CPU;
+
+static CPU cpus[MAX_CPUS];
+static uint32_t num_cpus = 8;
+static volatile int stop_cpus = 0;
+static __thread CPU *this_cpu;
+
+static uint64_t num_round_trips;
+static uint64_t num_messages;
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+
+// ipc_execute_handler_sync, as ipc_execute_send: queue to every other CPU,
+// signal the ones whose queue was empty and wait until all acknowledged
+uint32_t ipcbench_send_sync(HANDLER_FN handler, void *arg)
+{
+    volatile uint32_t acks = 0;
+    uint32_t i, empty;
+    CPU *cpu;
+
+    for (i = 1; i < num_cpus; i++) {
+        cpu = &cpus[i];
+        pthread_mutex_lock(&cpu->lock);
+        empty = (cpu->count == 0);
+        cpu->queue[(cpu->head + cpu->count++) % QUEUE_SIZE] =
+            (MESSAGE) { handler, arg, &acks };
+        if (empty)
+            __sync_fetch_and_add(&cpu->signals, 1);
+        pthread_mutex_unlock(&cpu->lock);
+        num_messages++;
+    }
+    num_round_trips++;
+    while (acks != num_cpus - 1)
+        sched_yield();
+    return num_cpus - 1;
+}
+
+static void *cpu_thread(void *arg)
+{
+    CPU *cpu = (CPU *) arg;
+    MESSAGE msg;
+
+    this_cpu = cpu;
+    while (!stop_cpus) {
+        if (cpu->signals == cpu->signals_seen) {
+            sched_yield();
+            continue;
+        }
+        cpu->signals_seen = cpu->signals;
+        // drain the queue in one pass
+        pthread_mutex_lock(&cpu->lock);
+        while (cpu->count > 0) {
+            msg = cpu->queue[cpu->head];
+            cpu->head = (cpu->head + 1) % QUEUE_SIZE;
+            cpu->count--;
+            pthread_mutex_unlock(&cpu->lock);
+            msg.handler(msg.arg);
+            __sync_fetch_and_add(msg.ack, 1);
+            pthread_mutex_lock(&cpu->lock);
+        }
+        pthread_mutex_unlock(&cpu->lock);
+    }
+    return NULL;
+}
+
+
+uint32_t ipcbench_cpu_id(void)
+{
+    return (uint32_t)(this_cpu - cpus);
+}
+
+// hw_invlpg and hw_flash_tlb of this CPU
+void ipcbench_invlpg(uint64_t address)
+{
+    this_cpu->invlpgs++;
+    if (address / PAGE_SIZE < NUM_PAGES)
+        this_cpu->invalidated[address / PAGE_SIZE] = 1;
+}
+
+void ipcbench_flush_tlb(void)
+{
+    this_cpu->full_flushes++;
+    memset(this_cpu->invalidated, 1, sizeof(this_cpu->invalidated));
+}
+
+
+// 1 if exactly pages first to last - 1 of this CPU were invalidated
+static int invalidated(uint32_t first, uint32_t last)
+{
+    uint32_t page;
+
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (this_cpu->invalidated[page] != (first <= page && page < last))
+            return 0;
+    }
+    return 1;
+}
+
+static void reset_cpu(CPU *cpu)
+{
+    cpu->invlpgs = 0;
+    cpu->full_flushes = 0;
+    memset(cpu->invalidated, 0, sizeof(cpu->invalidated));
+}
+
+// batches applied on this CPU only
+static void check(void)
+{
+    uint64_t address, context, all;
+    uint32_t i;
+
+    // out of order and overlapping ranges, pages 1 to 9
+    reset_cpu(this_cpu);
+    ipcbench_batch_init(1);
+    ipcbench_batch_invlpg(5 * PAGE_SIZE, 3 * PAGE_SIZE);
+    ipcbench_batch_invlpg(1 * PAGE_SIZE, 2 * PAGE_SIZE);
+    ipcbench_batch_invlpg(2 * PAGE_SIZE + 16, 3 * PAGE_SIZE);
+    ipcbench_batch_invlpg(8 * PAGE_SIZE, 1 * PAGE_SIZE);
+    ipcbench_batch_invlpg(6 * PAGE_SIZE, 8);
+    CHECK(ipcbench_batch_flush() == 0, "no other CPU");
+    CHECK(this_cpu->invlpgs == 8 && this_cpu->full_flushes == 0, "ranges merged");
+    CHECK(invalidated(1, 9), "pages of the merged ranges");
+    CHECK(ipcbench_batch_flush() == 0 && this_cpu->invlpgs == 8, "flushed batch emptied");
+
+    // more than 32 pages, or a TLB flush, flush the TLB
+    reset_cpu(this_cpu);
+    ipcbench_batch_invlpg(0, 33 * PAGE_SIZE);
+    ipcbench_batch_flush();
+    CHECK(this_cpu->invlpgs == 0 && this_cpu->full_flushes == 1, "33 pages flush");
+    reset_cpu(this_cpu);
+    ipcbench_batch_invlpg(0, 32 * PAGE_SIZE);
+    ipcbench_batch_flush();
+    CHECK(this_cpu->invlpgs == 32 && this_cpu->full_flushes == 0, "32 pages invalidated");
+    reset_cpu(this_cpu);
+    ipcbench_batch_invlpg(0, PAGE_SIZE);
+    ipcbench_batch_flush_tlb();
+    ipcbench_batch_flush();
+    CHECK(this_cpu->invlpgs == 0 && this_cpu->full_flushes == 1, "TLB flush entry");
+
+    // a full batch is sent before the next entry
+    reset_cpu(this_cpu);
+    for (i = 0; i < 33; i++)
+        ipcbench_batch_invlpg(2 * i * PAGE_SIZE, PAGE_SIZE);
+    CHECK(this_cpu->invlpgs == 32, "full batch sent");
+    ipcbench_batch_flush();
+    CHECK(this_cpu->invlpgs == 33 && this_cpu->full_flushes == 0, "rest of the batch");
+
+    // INVEPT page by page, of whole contexts when too large, unsupported
+    // or asked for
+    ipcbench_set_invept_address(1);
+    ipcbench_batch_invept(0x1000, 0, 3 * PAGE_SIZE);
+    ipcbench_batch_invept(0x2000, 0, 40 * PAGE_SIZE);
+    ipcbench_batch_invept(0x3000, 0, 3 * PAGE_SIZE);
+    ipcbench_batch_invept_context(0x3000);
+    ipcbench_batch_flush();
+    ipcbench_invepts(&address, &context, &all);
+    CHECK(address == 3 && context == 2 && all == 0, "INVEPT by address and context");
+    ipcbench_set_invept_address(0);
+    ipcbench_batch_invept(0x1000, 0, PAGE_SIZE);
+    ipcbench_batch_flush();
+    ipcbench_invepts(&address, &context, &all);
+    CHECK(address == 3 && context == 3 && all == 0, "INVEPT without individual address");
+    ipcbench_batch_invept(0x1000, 0, PAGE_SIZE);
+    ipcbench_batch_invept_context(0);
+    ipcbench_batch_flush();
+    ipcbench_invepts(&address, &context, &all);
+    CHECK(address == 3 && context == 3 && all == 1, "INVEPT of all contexts");
+}
+
+
+// the pages one unmap invalidates: runs of contiguous pages, and single
+// pages that overlap them
+static uint32_t make_unmap(uint64_t *pages, uint32_t round)
+{
+    uint32_t seed = round * 2654435761u + 1;
+    uint32_t num_pages = 0, run, i, first;
+
+    while (num_pages < 24) {
+        seed = seed * 1103515245 + 12345;
+        first = (seed >> 8) % 1000;
+        run = 1 + (seed >> 20) % 8;
+        for (i = 0; i < run && first + i < NUM_PAGES && num_pages < 48; i++)
+            pages[num_pages++] = (uint64_t)(first + i) * PAGE_SIZE;
+    }
+    return num_pages;
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+// returns 0 if a destination missed a page
+static int run(const char *name, int batched, uint32_t num_rounds)
+{
+    struct timespec start, end;
+    uint64_t pages[64];
+    uint64_t signals = 0, invlpgs = 0, full_flushes = 0;
+    uint32_t round, num_pages, i, j;
+
+    num_round_trips = 0;
+    num_messages = 0;
+    for (i = 1; i < num_cpus; i++) {
+        cpus[i].invlpgs = 0;
+        cpus[i].full_flushes = 0;
+        cpus[i].signals = cpus[i].signals_seen = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < num_rounds; round++) {
+        for (i = 1; i < num_cpus; i++)
+            memset(cpus[i].invalidated, 0, sizeof(cpus[i].invalidated));
+        num_pages = make_unmap(pages, round);
+        if (batched)
+            ipcbench_batch_init(0);
+        for (i = 0; i < num_pages; i++) {
+            if (batched)
+                ipcbench_batch_invlpg(pages[i], PAGE_SIZE);
+            else
+                ipcbench_invlpg_sync(pages[i]);
+        }
+        if (batched)
+            ipcbench_batch_flush();
+        for (i = 1; i < num_cpus; i++) {
+            for (j = 0; j < num_pages; j++) {
+                if (!cpus[i].invalidated[pages[j] / PAGE_SIZE])
+                    return 0;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (i = 1; i < num_cpus; i++) {
+        signals += cpus[i].signals;
+        invlpgs += cpus[i].invlpgs;
+        full_flushes += cpus[i].full_flushes;
+    }
+    printf("%-8s %10.2f %10.2f %10.2f %10.2f %8.3f %10.1f\n", name,
+           (double) num_round_trips / num_rounds,
+           (double) signals / num_rounds,
+           (double) num_messages / num_rounds,
+           (double) invlpgs / num_rounds,
+           (double) full_flushes / num_rounds,
+           elapsed_seconds(&start, &end) * 1e6 / num_rounds);
+    return 1;
+}
+
+
+int main(int an, char **av)
+{
+    pthread_t threads[MAX_CPUS];
+    uint32_t num_rounds = 200;
+    uint32_t i;
+    int j, ok;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-c") == 0 && j + 1 < an)
+            num_cpus = (uint32_t) atoi(av[++j]);
+        else if (strcmp(av[j], "-r") == 0 && j + 1 < an)
+            num_rounds = (uint32_t) atoi(av[++j]);
+        else
+            break;
+    }
+    if (j < an || num_cpus < 2 || num_cpus > MAX_CPUS || num_rounds == 0) {
+        printf("ipcbench [-c cpus] [-r rounds]\n");
+        return 1;
+    }
+
+    for (i = 0; i < num_cpus; i++)
+        pthread_mutex_init(&cpus[i].lock, NULL);
+    this_cpu = &cpus[0];
+    for (i = 1; i < num_cpus; i++)
+        pthread_create(&threads[i], NULL, cpu_thread, &cpus[i]);
+
+    check();
+    printf("check: %s\n\n", g_errors ? "FAILED" : "passed");
+
+    printf("%u CPUs, per unmap:\n", num_cpus);
+    printf("%-8s %10s %10s %10s %10s %8s %10s\n", "mode", "roundtrips",
+           "signals", "messages", "invlpgs", "flushes", "us");
+    ok = run("per-page", 0, num_rounds) && run("batched", 1, num_rounds);
+
+    stop_cpus = 1;
+    for (i = 1; i < num_cpus; i++)
+        pthread_join(threads[i], NULL);
+    if (!ok) {
+        printf("a CPU missed an invalidation\n");
+        return 1;
+    }
+    return g_errors ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the IPC batches (ipc_batch.c) with a check of the merged
+# invalidations and a simulation of TLB shootdowns over IPC.
+#   make -f ipcbench.mak && ipcbench.exe [-c cpus] [-r rounds]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-pthread -Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc -pthread
+
+dobjs=      $(B)/ipc_batch.o $(B)/ipcstubs.o $(B)/ipcbench.o
+
+all: $(E)/ipcbench.exe
+ 
+$(E)/ipcbench.exe: $(dobjs)
+	@echo "ipcbench.exe"
+	$(LINK) -o $(E)/ipcbench.exe $(dobjs)
+
+$(B)/ipc_batch.o: $(mainsrc)/ipc/ipc_batch.c
+	echo "ipc_batch.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/memory/ept -c -o $(B)/ipc_batch.o $(mainsrc)/ipc/ipc_batch.c
+
+$(B)/ipcstubs.o: $(mainsrc)/test/ipcstubs.c
+	echo "ipcstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/memory/ept -c -o $(B)/ipcstubs.o $(mainsrc)/test/ipcstubs.c
+
+$(B)/ipcbench.o: $(mainsrc)/test/ipcbench.c
+	echo "ipcbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/ipcbench.o $(mainsrc)/test/ipcbench.c
+
+clean:
+	rm -f $(E)/ipcbench.exe
+	rm -f $(dobjs)
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the IPC transport, TLB and EPT instructions the IPC
+// batches (ipc/ipc_batch.c) depend on. ipc_execute_handler_sync hands the
+// handler to the CPU threads of ipcbench.c, and the INVLPGs and TLB
+// flushes are done on the simulated TLB of the calling thread. INVEPTs
+// are counted. Built with the VMM include paths.
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(IPC_BATCH_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(IPC_BATCH_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "hw_utils.h"
+#include "ipc.h"
+#include "vmcs_init.h"
+#include "ept_hw_layer.h"
+
+
+typedef struct {
+    IPC_HANDLER_FN  handler;
+    void*           arg;
+    CPU_ID          from;
+} IPCSTUBS_CALL;
+
+// ipcbench.c
+extern UINT32 ipcbench_send_sync(void (*handler)(void* arg), void* arg);
+extern UINT32 ipcbench_cpu_id(void);
+extern void   ipcbench_invlpg(UINT64 address);
+extern void   ipcbench_flush_tlb(void);
+
+static IPC_BATCH            ipc_batch;
+static VMCS_HW_CONSTRAINTS  ipc_constraints;
+static UINT64               ipc_invepts_address;
+static UINT64               ipc_invepts_context;
+static UINT64               ipc_invepts_all;
+
+
+static void ipcstubs_invlpg_handler(CPU_ID from, void* arg)
+{
+    (void) from;
+    hw_invlpg(arg);
+}
+
+static IPC_DESTINATION ipcstubs_all_others(void)
+{
+    static const IPC_DESTINATION none;
+    IPC_DESTINATION dst = none;
+
+    dst.addr_shorthand = IPI_DST_ALL_EXCLUDING_SELF;
+    return dst;
+}
+
+
+// ipcbench.c interface
+void ipcbench_set_invept_address(int supported)
+{
+    ipc_constraints.ept_vpid_capabilities.Bits.InveptIndividualAddress = supported ? 1 : 0;
+}
+
+// A batch for all the other CPUs, or for this CPU only
+void ipcbench_batch_init(int self_only)
+{
+    IPC_DESTINATION dst = ipcstubs_all_others();
+
+    if (self_only) {
+        dst.addr_shorthand = IPI_DST_SELF;
+    }
+    ipc_batch_init(&ipc_batch, dst, self_only ? TRUE : FALSE);
+}
+
+void ipcbench_batch_invlpg(UINT64 start, UINT64 size)
+{
+    ipc_batch_add_invlpg(&ipc_batch, start, size);
+}
+
+void ipcbench_batch_flush_tlb(void)
+{
+    ipc_batch_add_flush_tlb(&ipc_batch);
+}
+
+void ipcbench_batch_invept(UINT64 eptp, UINT64 start, UINT64 size)
+{
+    ipc_batch_add_invept(&ipc_batch, eptp, start, size);
+}
+
+void ipcbench_batch_invept_context(UINT64 eptp)
+{
+    ipc_batch_add_invept_context(&ipc_batch, eptp);
+}
+
+UINT32 ipcbench_batch_flush(void)
+{
+    return ipc_batch_flush(&ipc_batch);
+}
+
+// one synchronous IPC of a single INVLPG, as hmm_invlpg_callback is sent
+UINT32 ipcbench_invlpg_sync(UINT64 address)
+{
+    return ipc_execute_handler_sync(ipcstubs_all_others(), ipcstubs_invlpg_handler,
+                (void*) address);
+}
+
+void ipcbench_invepts(UINT64* address, UINT64* context, UINT64* all)
+{
+    *address = ipc_invepts_address;
+    *context = ipc_invepts_context;
+    *all = ipc_invepts_all;
+}
+
+
+static void ipcstubs_call(void* arg)
+{
+    IPCSTUBS_CALL* call = (IPCSTUBS_CALL*) arg;
+
+    call->handler(call->from, call->arg);
+}
+
+UINT32 ipc_execute_handler_sync(IPC_DESTINATION dst, IPC_HANDLER_FN handler, void* arg)
+{
+    IPCSTUBS_CALL call;
+
+    // all the other CPUs
+    (void) dst;
+    call.handler = handler;
+    call.arg = arg;
+    call.from = hw_cpu_id();
+    return ipcbench_send_sync(ipcstubs_call, &call);
+}
+
+CPU_ID hw_cpu_id(void)
+{
+    return (CPU_ID) ipcbench_cpu_id();
+}
+
+void hw_invlpg(void *address)
+{
+    ipcbench_invlpg((UINT64) address);
+}
+
+UINT64 hw_read_cr3(void)
+{
+    return 0;
+}
+
+// hw_flash_tlb
+void hw_write_cr3(UINT64 data)
+{
+    (void) data;
+    ipcbench_flush_tlb();
+}
+
+const VMCS_HW_CONSTRAINTS* vmcs_hw_get_vmx_constraints(void)
+{
+    return &ipc_constraints;
+}
+
+BOOLEAN ept_hw_invept_all_contexts(void)
+{
+    ipc_invepts_all++;
+    return TRUE;
+}
+
+BOOLEAN ept_hw_invept_context(UINT64 eptp)
+{
+    (void) eptp;
+    ipc_invepts_context++;
+    return TRUE;
+}
+
+BOOLEAN ept_hw_invept_individual_address(UINT64 eptp, ADDRESS gpa)
+{
+    (void) eptp;
+    (void) gpa;
+    ipc_invepts_address++;
+    return TRUE;
+}
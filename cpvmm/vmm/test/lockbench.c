@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stress benchmark of the VMM spin locks (utils/lock.c).
+//
+// The ticket lock and the read/write lock are the ones of lock.c, built
+// with the hosted primitives of lockstubs.c. They are compared with the
+// test-and-set lock lock.c used to be and an MCS queue lock, and with a
+// read/write lock whose readers go through the inner lock, as they used
+// to. Every thread takes the lock in a loop for a fixed time; the
+// throughput is the total number of acquisitions per second and the
+// fairness is the spread of the per thread counts (min/max, and Jain's
+// index, 1.0 when all are equal).
+//
+// With more threads than CPUs a waiter that is preempted holds up the ones
+// behind it in the queue, so the waiters yield after a while of spinning.
+//
+//   lockbench [-t max_threads] [-d ms] [-r read_percent]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_THREADS         64
+#define SPINS_BEFORE_YIELD  1024
+
+// utils/lock.c, release build
+extern void     lock_acquire(void* lock);
+extern void     lock_release(void* lock);
+extern void     lock_acquire_readlock(void* lock);
+extern void     lock_release_readlock(void* lock);
+extern void     lock_acquire_writelock(void* lock);
+extern void     lock_release_writelock(void* lock);
+// test/lockstubs.c
+extern void     lockbench_set_cpu_id(uint32_t cpu_id);
+extern void*    lockbench_static_lock(void);
+extern void*    lockbench_alloc_lock(void);
+extern void*    lockbench_alloc_rw_lock(void);
+
+#define cpu_relax()         __asm__ __volatile__("pause" ::: "memory")
+#define compiler_barrier()  __asm__ __volatile__("" ::: "memory")
+
+// hooks called by lockstubs.c
+// each lock in a cache line of its own
+void* lockbench_alloc(uint32_t size)
+{
+    void *p = NULL;
+
+    if (posix_memalign(&p, 64, size) != 0)
+        return NULL;
+    return p;
+}
+
+void lockbench_yield(void)
+{
+    sched_yield();
+}
+
+static inline void spin_wait(uint32_t *spins)
+{
+    if (++*spins % SPINS_BEFORE_YIELD == 0)
+        sched_yield();
+    else
+        cpu_relax();
+}
+
+
+// the test-and-set lock
+typedef struct {
+    volatile uint32_t value;
+} TAS_LOCK;
+
+static void tas_acquire(TAS_LOCK *lock)
+{
+    uint32_t spins = 0;
+
+    while (!__sync_bool_compare_and_swap(&lock->value, 0, 1))
+        spin_wait(&spins);
+}
+
+static void tas_release(TAS_LOCK *lock)
+{
+    compiler_barrier();
+    lock->value = 0;
+}
+
+
+// the MCS lock, every waiter spins on its own node
+typedef struct MCS_NODE_S {
+    struct MCS_NODE_S * volatile next;
+    volatile uint32_t locked;
+} __attribute__((aligned(64))) MCS_NODE;
+
+typedef struct {
+    MCS_NODE * volatile tail;
+} MCS_LOCK;
+
+static void mcs_acquire(MCS_LOCK *lock, MCS_NODE *node)
+{
+    MCS_NODE *prev;
+    uint32_t spins = 0;
+
+    node->next = NULL;
+    node->locked = 1;
+    prev = __sync_lock_test_and_set(&lock->tail, node);
+    if (prev == NULL)
+        return;
+    prev->next = node;
+    while (node->locked)
+        spin_wait(&spins);
+}
+
+static void mcs_release(MCS_LOCK *lock, MCS_NODE *node)
+{
+    uint32_t spins = 0;
+
+    if (node->next == NULL) {
+        if (__sync_bool_compare_and_swap(&lock->tail, node, NULL))
+            return;
+        // a waiter swapped the tail but isn't linked yet
+        while (node->next == NULL)
+            spin_wait(&spins);
+    }
+    compiler_barrier();
+    node->next->locked = 0;
+}
+
+
+// readers serialize through the inner lock, a lock.c ticket lock
+typedef struct {
+    void *lock;
+    volatile int32_t readers;
+} OLD_RW_LOCK;
+
+static void old_read_acquire(OLD_RW_LOCK *lock)
+{
+    lock_acquire(lock->lock);
+    __sync_fetch_and_add(&lock->readers, 1);
+    lock_release(lock->lock);
+}
+
+static void old_read_release(OLD_RW_LOCK *lock)
+{
+    __sync_fetch_and_sub(&lock->readers, 1);
+}
+
+static void old_write_acquire(OLD_RW_LOCK *lock)
+{
+    uint32_t spins = 0;
+
+    lock_acquire(lock->lock);
+    while (lock->readers)
+        spin_wait(&spins);
+}
+
+static void old_write_release(OLD_RW_LOCK *lock)
+{
+    lock_release(lock->lock);
+}
+
+
+typedef enum {
+    BENCH_TAS, BENCH_TICKET, BENCH_MCS, BENCH_OLD_RW, BENCH_NEW_RW
+} BENCH_KIND;
+
+static const char *bench_names[] = { "tas", "ticket", "mcs", "rw-old", "rw-new" };
+
+static TAS_LOCK tas_lock;
+static void *ticket_lock;
+static MCS_LOCK mcs_lock;
+static OLD_RW_LOCK old_rw_lock;
+static void *rw_lock;
+static MCS_NODE mcs_nodes[MAX_THREADS];
+
+static volatile int bench_stop;
+static volatile int bench_go;
+static BENCH_KIND bench_kind;
+static uint32_t read_percent = 90;
+
+// the data the lock protects, checked for lost updates
+static volatile uint64_t shared_counter;
+static volatile uint64_t shared_data[8];
+
+typedef struct {
+    uint32_t id;
+    uint64_t acquisitions;
+    uint64_t writes;
+} __attribute__((aligned(64))) THREAD_STATE;
+
+static THREAD_STATE thread_states[MAX_THREADS];
+
+
+static inline uint32_t next_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+static void critical_section(void)
+{
+    uint32_t i;
+
+    shared_counter++;
+    for (i = 0; i < 8; i++)
+        shared_data[i] += i;
+}
+
+static void read_section(void)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < 8; i++)
+        sum += shared_data[i];
+    (void) sum;
+}
+
+static void *bench_thread(void *arg)
+{
+    THREAD_STATE *state = (THREAD_STATE *) arg;
+    uint32_t seed = state->id + 1;
+    uint32_t delay, i;
+
+    lockbench_set_cpu_id(state->id);
+    while (!bench_go)
+        cpu_relax();
+    while (!bench_stop) {
+        switch (bench_kind) {
+        case BENCH_TAS:
+            tas_acquire(&tas_lock);
+            critical_section();
+            tas_release(&tas_lock);
+            break;
+        case BENCH_TICKET:
+            lock_acquire(ticket_lock);
+            critical_section();
+            lock_release(ticket_lock);
+            break;
+        case BENCH_MCS:
+            mcs_acquire(&mcs_lock, &mcs_nodes[state->id]);
+            critical_section();
+            mcs_release(&mcs_lock, &mcs_nodes[state->id]);
+            break;
+        case BENCH_OLD_RW:
+        case BENCH_NEW_RW:
+            if (next_random(&seed) % 100 < read_percent) {
+                if (bench_kind == BENCH_OLD_RW) {
+                    old_read_acquire(&old_rw_lock);
+                    read_section();
+                    old_read_release(&old_rw_lock);
+                }
+                else {
+                    lock_acquire_readlock(rw_lock);
+                    read_section();
+                    lock_release_readlock(rw_lock);
+                }
+            }
+            else {
+                if (bench_kind == BENCH_OLD_RW) {
+                    old_write_acquire(&old_rw_lock);
+                    critical_section();
+                    old_write_release(&old_rw_lock);
+                }
+                else {
+                    lock_acquire_writelock(rw_lock);
+                    critical_section();
+                    lock_release_writelock(rw_lock);
+                }
+                state->writes++;
+            }
+            break;
+        }
+        state->acquisitions++;
+        // some work outside of the lock
+        delay = next_random(&seed) % 64;
+        for (i = 0; i < delay; i++)
+            cpu_relax();
+    }
+    return NULL;
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+// returns 0 if the lock lost an update
+static int run(BENCH_KIND kind, uint32_t num_threads, uint32_t duration_ms)
+{
+    pthread_t threads[MAX_THREADS];
+    struct timespec start, end, wait;
+    uint64_t total = 0, writes = 0, min = UINT64_MAX, max = 0;
+    double sum_squares = 0, seconds;
+    uint32_t i;
+
+    memset(&tas_lock, 0, sizeof(tas_lock));
+    memset(&mcs_lock, 0, sizeof(mcs_lock));
+    old_rw_lock.readers = 0;
+    memset(thread_states, 0, sizeof(thread_states));
+    shared_counter = 0;
+    bench_kind = kind;
+    bench_stop = 0;
+    bench_go = 0;
+    for (i = 0; i < num_threads; i++) {
+        thread_states[i].id = i;
+        if (pthread_create(&threads[i], NULL, bench_thread, &thread_states[i]) != 0) {
+            printf("can't create thread %u\n", i);
+            exit(1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bench_go = 1;
+    wait.tv_sec = duration_ms / 1000;
+    wait.tv_nsec = (long)(duration_ms % 1000) * 1000000;
+    nanosleep(&wait, NULL);
+    bench_stop = 1;
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = elapsed_seconds(&start, &end);
+
+    for (i = 0; i < num_threads; i++) {
+        total += thread_states[i].acquisitions;
+        writes += thread_states[i].writes;
+        if (thread_states[i].acquisitions < min)
+            min = thread_states[i].acquisitions;
+        if (thread_states[i].acquisitions > max)
+            max = thread_states[i].acquisitions;
+        sum_squares += (double) thread_states[i].acquisitions *
+                       (double) thread_states[i].acquisitions;
+    }
+    printf("%-7s %3u %12.0f %9.3f %8.3f\n", bench_names[kind], num_threads,
+           total / seconds, max ? (double) min / max : 0.0,
+           sum_squares > 0 ? (double) total * total / (num_threads * sum_squares) : 0.0);
+    if (kind == BENCH_OLD_RW || kind == BENCH_NEW_RW)
+        return shared_counter == writes;
+    return shared_counter == total;
+}
+
+
+int main(int an, char **av)
+{
+    uint32_t max_threads = MAX_THREADS;
+    uint32_t duration_ms = 200;
+    uint32_t num_threads;
+    BENCH_KIND kind;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-t") == 0 && j + 1 < an)
+            max_threads = (uint32_t) atoi(av[++j]);
+        else if (strcmp(av[j], "-d") == 0 && j + 1 < an)
+            duration_ms = (uint32_t) atoi(av[++j]);
+        else if (strcmp(av[j], "-r") == 0 && j + 1 < an)
+            read_percent = (uint32_t) atoi(av[++j]);
+        else
+            break;
+    }
+    if (j < an || max_threads < 2 || max_threads > MAX_THREADS || read_percent > 100) {
+        printf("lockbench [-t max_threads] [-d ms] [-r read_percent]\n");
+        return 1;
+    }
+
+    // the ticket lock is the static one, left as the previous run leaves it
+    ticket_lock = lockbench_static_lock();
+    old_rw_lock.lock = lockbench_alloc_lock();
+    rw_lock = lockbench_alloc_rw_lock();
+    if (old_rw_lock.lock == NULL || rw_lock == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+    printf("%-7s %3s %12s %9s %8s\n", "lock", "thr", "acq/s", "min/max", "jain");
+    for (kind = BENCH_TAS; kind <= BENCH_NEW_RW; kind++) {
+        for (num_threads = 2; num_threads <= max_threads; num_threads *= 2) {
+            if (!run(kind, num_threads, duration_ms)) {
+                printf("%s lost updates with %u threads\n", bench_names[kind], num_threads);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
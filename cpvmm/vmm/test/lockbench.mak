@@ -0,0 +1,63 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the VMM spin locks (lock.c) with a stress benchmark.
+#   make -f lockbench.mak && lockbench.exe [-t max_threads] [-d ms] [-r read_percent]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-pthread -Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc -pthread
+
+dobjs=      $(B)/lock.o $(B)/lockstubs.o $(B)/lockbench.o
+
+all: $(E)/lockbench.exe
+ 
+$(E)/lockbench.exe: $(dobjs)
+	@echo "lockbench.exe"
+	$(LINK) -o $(E)/lockbench.exe $(dobjs)
+
+$(B)/lock.o: $(mainsrc)/utils/lock.c
+	echo "lock.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/lock.o $(mainsrc)/utils/lock.c
+
+$(B)/lockstubs.o: $(mainsrc)/test/lockstubs.c
+	echo "lockstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/lockstubs.o $(mainsrc)/test/lockstubs.c
+
+$(B)/lockbench.o: $(mainsrc)/test/lockbench.c
+	echo "lockbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/lockbench.o $(mainsrc)/test/lockbench.c
+
+clean:
+	rm -f $(E)/lockbench.exe
+	rm -f $(dobjs)
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the hw_* primitives and the IPC hook the VMM locks
+// (utils/lock.c) depend on, and the lock objects lockbench.c runs them on.
+// Every benchmark thread is a host CPU. With more threads than CPUs a
+// waiter that is preempted holds up the ones behind it in the ticket
+// queue, so hw_pause() yields after a while of spinning. Built with the
+// VMM include paths.
+
+#include "vmm_defs.h"
+#include "hw_interlocked.h"
+#include "hw_utils.h"
+#include "lock.h"
+
+
+#define LOCKSTUBS_SPINS_BEFORE_YIELD    1024
+
+// lockbench.c
+extern void* lockbench_alloc(UINT32 size);
+extern void  lockbench_yield(void);
+
+static __thread CPU_ID lockstubs_cpu_id = 0;
+static __thread UINT32 lockstubs_spins = 0;
+
+// a lock set up as the VMM's static locks are
+static VMM_LOCK lockstubs_static_lock = LOCK_INIT_STATE;
+
+
+// lockbench.c interface
+void lockbench_set_cpu_id(UINT32 cpu_id)
+{
+    lockstubs_cpu_id = (CPU_ID) cpu_id;
+}
+
+void* lockbench_static_lock(void)
+{
+    return &lockstubs_static_lock;
+}
+
+void* lockbench_alloc_lock(void)
+{
+    VMM_LOCK *lock = (VMM_LOCK*) lockbench_alloc(sizeof(VMM_LOCK));
+
+    if (lock != NULL) {
+        lock_initialize(lock);
+    }
+    return lock;
+}
+
+void* lockbench_alloc_rw_lock(void)
+{
+    VMM_READ_WRITE_LOCK *lock =
+        (VMM_READ_WRITE_LOCK*) lockbench_alloc(sizeof(VMM_READ_WRITE_LOCK));
+
+    if (lock != NULL) {
+        lock_initialize_read_write_lock(lock);
+    }
+    return lock;
+}
+
+
+CPU_ID hw_cpu_id(void)
+{
+    return lockstubs_cpu_id;
+}
+
+void hw_pause(void)
+{
+    if (++lockstubs_spins % LOCKSTUBS_SPINS_BEFORE_YIELD == 0) {
+        lockbench_yield();
+    }
+    else {
+        __asm__ volatile("pause" ::: "memory");
+    }
+}
+
+UINT64 hw_rdtsc(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+
+INT32 hw_interlocked_add(INT32 volatile * addend, INT32 value)
+{
+    return __sync_fetch_and_add(addend, value);
+}
+
+INT32 hw_interlocked_compare_exchange(INT32 volatile * destination,
+                                      INT32 expected, INT32 comperand)
+{
+    return __sync_val_compare_and_swap(destination, expected, comperand);
+}
+
+// no IPCs are sent to the benchmark threads
+BOOLEAN ipc_process_one_ipc(void)
+{
+    return FALSE;
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of the buffered log (libc/vmm_log_buffer.c).
+//
+// The check runs one thread per simulated host CPU. Each logs numbered
+// text and binary records and drains the log now and then, as VM exits
+// do, into a simulated 115200 baud UART with a 16 byte transmit FIFO.
+// Every record must come out once and in order per CPU, or be counted in
+// a drop report. A record logged from inside a log call, as an exception
+// handler would, must be printed directly.
+//
+// The benchmark compares what a log call costs the caller: a binary
+// record, a text record, and the synchronous print it replaces, which
+// formats the line and then waits for the UART once its FIFO is full.
+//
+//   logbench [-c cpus] [-n records_per_cpu]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MAX_CPUS        16
+#define UART_BAUD       115200
+#define UART_FIFO       16
+#define OUTPUT_SIZE     (64 << 20)
+#define BENCH_CALLS     1000000
+#define BENCH_BATCH     256
+
+// libc/vmm_log_buffer.c, release build
+extern uint8_t  vmm_log_initialize(uint16_t num_of_cpus);
+extern int      vmm_log_printf(const char *format, ...);
+extern int      vmm_log_binary(uint32_t num_args, const char *format, ...);
+extern void     vmm_log_drain(uint8_t flush);
+extern uint64_t vmm_log_dropped(uint16_t cpu_id);
+extern uint64_t hw_rdtsc(void);
+extern int      vmm_sprintf_s(char *buffer, size_t size_of_buffer, const char *format, ...);
+// test/hoststubs.c
+extern void     heapbench_set_cpu_id(uint32_t cpu_id);
+
+static uint64_t g_tsc_hz;
+static uint64_t g_char_tsc;         // TSC ticks per character on the wire
+static int      g_uart_unlimited;   // the benchmark does not simulate the UART
+static uint64_t g_uart_tsc;         // when g_uart_level was computed
+static uint32_t g_uart_level;       // characters in the transmit FIFO
+static char*    g_output;
+static size_t   g_output_length;
+static int      g_interrupt_armed;  // log from inside the next log call
+static char     g_direct[256];      // last direct print
+
+
+// hooks called by logstubs.c
+uint64_t logbench_tsc_hz(void)
+{
+    return g_tsc_hz;
+}
+
+void* logbench_alloc(uint32_t size)
+{
+    return calloc(1, size);
+}
+
+// called with the drain lock held
+uint32_t logbench_port_write(const char *string, uint32_t length, uint8_t wait)
+{
+    uint64_t now = hw_rdtsc();
+    uint64_t sent = (now - g_uart_tsc) / g_char_tsc;
+    uint32_t room;
+
+    if (!g_uart_unlimited && !wait) {
+        g_uart_level = (sent >= g_uart_level) ? 0 : g_uart_level - (uint32_t) sent;
+        g_uart_tsc = now;
+        room = UART_FIFO - g_uart_level;
+        if (length > room) {
+            length = room;
+        }
+        g_uart_level += length;
+    }
+    if (g_output_length + length <= OUTPUT_SIZE) {
+        memcpy(g_output + g_output_length, string, length);
+        g_output_length += length;
+    }
+    return length;
+}
+
+int logbench_vprintf(const char *format, va_list args)
+{
+    return vsnprintf(g_direct, sizeof(g_direct), format, args);
+}
+
+void logbench_interrupt(void)
+{
+    if (g_interrupt_armed) {
+        g_interrupt_armed = 0;
+        vmm_log_printf("nested %d\n", 42);
+    }
+}
+
+
+static uint64_t measure_tsc_hz(void)
+{
+    struct timespec start, end;
+    uint64_t tsc_start, tsc_end;
+    double seconds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tsc_start = hw_rdtsc();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (double)(end.tv_sec - start.tv_sec) +
+                  (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    } while (seconds < 0.1);
+    tsc_end = hw_rdtsc();
+    return (uint64_t)((double)(tsc_end - tsc_start) / seconds);
+}
+
+static uint32_t g_records_per_cpu = 200000;
+
+// one simulated host CPU: log numbered records, drain now and then
+static void* cpu_thread(void *arg)
+{
+    uint32_t cpu_id = (uint32_t)(uintptr_t) arg;
+    uint32_t seq;
+
+    heapbench_set_cpu_id(cpu_id);
+    for (seq = 0; seq < g_records_per_cpu; seq++) {
+        if (seq & 1) {
+            vmm_log_binary(3, "cpu %d seq %d bin %x\n", cpu_id, seq, seq * 7);
+        }
+        else {
+            vmm_log_printf("cpu %d seq %d txt %x\n", cpu_id, seq, seq * 7);
+        }
+        if ((seq & 63) == 0) {
+            vmm_log_drain(0);
+        }
+    }
+    return NULL;
+}
+
+// every record is printed once, in order, or counted as dropped
+static int check_output(uint32_t num_cpus)
+{
+    uint64_t received[MAX_CPUS] = { 0 };
+    uint64_t reported[MAX_CPUS] = { 0 };
+    int64_t  last_seq[MAX_CPUS];
+    char    *line = g_output;
+    char    *end = g_output + g_output_length;
+    uint32_t cpu_id, seq, value, count;
+    char     kind[4];
+    int      errors = 0;
+
+    for (cpu_id = 0; cpu_id < MAX_CPUS; cpu_id++) {
+        last_seq[cpu_id] = -1;
+    }
+    *end = '\0';
+    while (line < end) {
+        char *next = strchr(line, '\n');
+
+        if (next == NULL) {
+            next = end;
+        }
+        *next = '\0';
+        if (sscanf(line, "cpu %u seq %u %3s %x", &cpu_id, &seq, kind, &value) == 4 &&
+            cpu_id < num_cpus) {
+            if ((int64_t) seq <= last_seq[cpu_id] || value != seq * 7 ||
+                strcmp(kind, (seq & 1) ? "bin" : "txt") != 0) {
+                if (errors++ < 10) {
+                    printf("bad line \"%s\" after seq %lld\n", line, (long long) last_seq[cpu_id]);
+                }
+            }
+            last_seq[cpu_id] = seq;
+            received[cpu_id]++;
+        }
+        else if (sscanf(line, "CPU%u: %u log records dropped", &cpu_id, &count) == 2 &&
+                 cpu_id < num_cpus) {
+            reported[cpu_id] += count;
+        }
+        else if (line[0] != '\0' && line[0] != '\r') {
+            if (errors++ < 10) {
+                printf("unexpected line \"%s\"\n", line);
+            }
+        }
+        line = next + 1;
+    }
+    for (cpu_id = 0; cpu_id < num_cpus; cpu_id++) {
+        printf("CPU%u: %llu printed, %llu dropped, %llu reported dropped\n", cpu_id,
+               (unsigned long long) received[cpu_id],
+               (unsigned long long) vmm_log_dropped((uint16_t) cpu_id),
+               (unsigned long long) reported[cpu_id]);
+        if (received[cpu_id] + reported[cpu_id] != g_records_per_cpu ||
+            reported[cpu_id] != vmm_log_dropped((uint16_t) cpu_id)) {
+            printf("CPU%u: records lost\n", cpu_id);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+// a record logged while the ring is busy goes out directly, and the
+// interrupted record still goes to the ring
+static int check_nesting(void)
+{
+    int errors = 0;
+
+    heapbench_set_cpu_id(0);
+    g_output_length = 0;
+    g_direct[0] = '\0';
+    g_interrupt_armed = 1;
+    vmm_log_printf("outer %d\n", 7);
+    vmm_log_drain(1);
+    if (strcmp(g_direct, "nested 42\n") != 0) {
+        printf("nested record not printed directly: \"%s\"\n", g_direct);
+        errors++;
+    }
+    if (g_output_length != strlen("outer 7\r\n") ||
+        memcmp(g_output, "outer 7\r\n", g_output_length) != 0) {
+        printf("outer record not buffered\n");
+        errors++;
+    }
+    return errors;
+}
+
+typedef enum {
+    LOG_BINARY,
+    LOG_TEXT,
+    LOG_SYNC,
+} BENCH_OP;
+
+// TSC ticks the caller spends per log call
+static double bench(BENCH_OP op)
+{
+    char line[256];
+    uint64_t start, ticks = 0;
+    uint32_t i, j;
+    int length;
+
+    g_uart_unlimited = 1;
+    for (i = 0; i < BENCH_CALLS; i += BENCH_BATCH) {
+        start = hw_rdtsc();
+        for (j = i; j < i + BENCH_BATCH; j++) {
+            switch (op) {
+            case LOG_BINARY:
+                vmm_log_binary(3, "vmexit reason %d rip %llx qual %llx\n", j, 0xfffff80001234567ULL, (uint64_t) j);
+                break;
+            case LOG_TEXT:
+                vmm_log_printf("vmexit reason %d rip %llx qual %llx\n", j, 0xfffff80001234567ULL, (uint64_t) j);
+                break;
+            case LOG_SYNC:
+                // the line is formatted, then the caller polls the UART
+                // for every character that does not fit in the FIFO
+                length = vmm_sprintf_s(line, sizeof(line),
+                                       "vmexit reason %d rip %llx qual %llx\n", j, 0xfffff80001234567ULL, (uint64_t) j);
+                if (length > UART_FIFO) {
+                    ticks += (uint64_t)(length - UART_FIFO) * g_char_tsc;
+                }
+                __asm__ volatile("" : : "r" (line) : "memory");
+                break;
+            }
+        }
+        ticks += hw_rdtsc() - start;
+        // empty the ring between batches, not timed
+        g_output_length = 0;
+        vmm_log_drain(1);
+    }
+    g_uart_unlimited = 0;
+    return (double) ticks / BENCH_CALLS;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[MAX_CPUS];
+    uint32_t num_cpus = 4;
+    uint32_t cpu_id;
+    double ns_per_tick;
+    double ns[3];
+    int errors;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            num_cpus = (uint32_t) strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            g_records_per_cpu = (uint32_t) strtoul(argv[++i], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-c cpus] [-n records_per_cpu]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_cpus == 0 || num_cpus > MAX_CPUS) {
+        fprintf(stderr, "1 to %d cpus\n", MAX_CPUS);
+        return 1;
+    }
+    g_tsc_hz = measure_tsc_hz();
+    g_char_tsc = g_tsc_hz * 10 / UART_BAUD;
+    ns_per_tick = 1e9 / (double) g_tsc_hz;
+    g_output = malloc(OUTPUT_SIZE + 1);
+    if (g_output == NULL || !vmm_log_initialize((uint16_t) num_cpus)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    // the UART takes about 11 characters per ms, most records are dropped
+    g_uart_tsc = hw_rdtsc();
+    for (cpu_id = 0; cpu_id < num_cpus; cpu_id++) {
+        pthread_create(&threads[cpu_id], NULL, cpu_thread, (void*)(uintptr_t) cpu_id);
+    }
+    for (cpu_id = 0; cpu_id < num_cpus; cpu_id++) {
+        pthread_join(threads[cpu_id], NULL);
+    }
+    vmm_log_drain(1);
+    errors = check_output(num_cpus);
+    errors += check_nesting();
+    printf("check: %s\n", errors ? "FAILED" : "passed");
+
+    heapbench_set_cpu_id(0);
+    ns[0] = bench(LOG_BINARY) * ns_per_tick;
+    ns[1] = bench(LOG_TEXT) * ns_per_tick;
+    ns[2] = bench(LOG_SYNC) * ns_per_tick;
+    printf("\n%-10s %12s\n", "log call", "ns per call");
+    printf("%-10s %12.1f\n", "binary", ns[0]);
+    printf("%-10s %12.1f\n", "text", ns[1]);
+    printf("%-10s %12.1f   (%d baud UART, %d byte FIFO)\n", "sync", ns[2],
+           UART_BAUD, UART_FIFO);
+    free(g_output);
+    return errors ? 1 : 0;
+}
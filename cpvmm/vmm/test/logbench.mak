@@ -0,0 +1,72 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the buffered log (vmm_log_buffer.c) with a simulated
+# UART, one thread per host CPU.
+#   make -f logbench.mak && logbench.exe [-c cpus] [-n records_per_cpu]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g -DVMM_LOG_BUFFER
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/vmm_log_buffer.o $(B)/sprintf.o $(B)/logstubs.o $(B)/hoststubs.o $(B)/logbench.o
+
+all: $(E)/logbench.exe
+ 
+$(E)/logbench.exe: $(dobjs)
+	@echo "logbench.exe"
+	$(LINK) -o $(E)/logbench.exe $(dobjs) -lpthread
+
+$(B)/vmm_log_buffer.o: $(mainsrc)/libc/vmm_log_buffer.c
+	echo "vmm_log_buffer.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/vmm_log_buffer.o $(mainsrc)/libc/vmm_log_buffer.c
+
+$(B)/sprintf.o: $(mainsrc)/libc/sprintf.c
+	echo "sprintf.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/sprintf.o $(mainsrc)/libc/sprintf.c
+
+$(B)/logstubs.o: $(mainsrc)/test/logstubs.c
+	echo "logstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/logstubs.o $(mainsrc)/test/logstubs.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/logbench.o: $(mainsrc)/test/logbench.c
+	echo "logbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/logbench.o $(mainsrc)/test/logbench.c
+
+clean:
+	rm -f $(E)/logbench.exe
+	rm -f $(dobjs)
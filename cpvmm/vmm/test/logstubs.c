@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the services the buffered log
+// (libc/vmm_log_buffer.c) depends on. The debug port forwards to the
+// simulated UART in logbench.c. Records are formatted by libc/sprintf.c,
+// which is linked in. Built with the VMM include paths.
+
+#include "vmm_defs.h"
+#include "common_libc.h"
+#include "hw_utils.h"
+#include "hw_interlocked.h"
+#include "heap.h"
+
+
+// logbench.c
+extern UINT64 logbench_tsc_hz(void);
+extern void*  logbench_alloc(UINT32 size);
+extern UINT32 logbench_port_write(const char *string, UINT32 length, BOOLEAN wait);
+extern int    logbench_vprintf(const char *format, va_list args);
+extern void   logbench_interrupt(void);
+extern void*  memcpy(void *dest, const void *src, size_t count);
+
+UINT64 hw_rdtsc(void)
+{
+    UINT32 lo, hi;
+
+    // a log call reads the TSC with its ring busy, a good place to nest
+    logbench_interrupt();
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((UINT64) hi << 32) | lo;
+}
+
+UINT64 hw_get_tsc_ticks_per_second(void)
+{
+    return logbench_tsc_hz();
+}
+
+void hw_store_fence(void)
+{
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+INT32 hw_interlocked_compare_exchange(INT32 volatile * destination,
+                                      INT32 expected, INT32 comperand)
+{
+    return __sync_val_compare_and_swap(destination, expected, comperand);
+}
+
+void* vmm_memory_allocate(UINT32 size)
+{
+    return logbench_alloc(size);
+}
+
+UINT32 vmm_debug_port_write(const char *string, UINT32 length, BOOLEAN wait)
+{
+    return logbench_port_write(string, length, wait);
+}
+
+int vmm_vprintf(const char *format, va_list args)
+{
+    return logbench_vprintf(format, args);
+}
+
+size_t vmm_strlen(const char* string)
+{
+    size_t length = 0;
+
+    while (string[length] != '\0')
+        length++;
+    return length;
+}
+
+char* vmm_strcpy_s(char* dst, size_t dst_length, const char* src)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < dst_length && src[i] != '\0'; i++)
+        dst[i] = src[i];
+    if (dst_length != 0)
+        dst[i] = '\0';
+    return dst;
+}
+
+void* vmm_memcpy(void *dest, const void* src, size_t count)
+{
+    return memcpy(dest, src, count);
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of the MAM translation cache
+// (memory/memory_manager/memory_address_mapper.c).
+//
+// The check translates through the cache while the mappings are updated,
+// on two CPUs, and checks every translation sees the update. It also
+// checks a MAM created where a destroyed one was doesn't hit its entries.
+//
+// The benchmark builds a gpa -> hpa and an hpa -> hva mapping, identity
+// mapped as for the primary guest, and translates guest pages the way
+// gpm_gpa_to_hva() does: with the table walk only, before the caches are
+// allocated, and with the per CPU cache in front of it. The working set is
+// the number of distinct guest pages translated; with -u the mappings are
+// updated every that many translations, which invalidates the cache.
+//
+//   mambench [-n translations] [-u update_interval]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// memory/memory_manager/memory_address_mapper.c, release build
+extern void*    mam_create_mapping(uint32_t inner_level_attributes);
+extern void     mam_destroy_mapping(void* mam_handle);
+extern int      mam_translation_cache_initialize(uint16_t num_of_cpus);
+extern uint32_t mam_get_mapping(void* mam_handle, uint64_t src_addr,
+                    uint64_t* tgt_addr, uint32_t* attrs);
+extern int      mam_insert_range(void* mam_handle, uint64_t src_addr,
+                    uint64_t tgt_addr, uint64_t size, uint32_t attrs);
+extern int      mam_insert_not_existing_range(void* mam_handle, uint64_t src_addr,
+                    uint64_t size, uint32_t reason);
+extern int      mam_remove_permissions_from_existing_mapping(void* mam_handle,
+                    uint64_t src_addr, uint64_t size, uint32_t attrs);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+// test/hoststubs.c
+extern void     heapbench_set_cpu_id(uint32_t cpu_id);
+
+#define HEAP_SIZE           (64 << 20)
+#define PAGE_SIZE           4096ULL
+#define HVA_BASE            0x4000000000ULL         // MAM targets are 40 bits
+#define MAX_PAGES           65536
+#define NUM_CPUS            2
+
+// MAM_ATTRIBUTES and MAM_MAPPING_RESULT of memory_address_mapper_api.h
+#define ATTR_NONE           0x0
+#define ATTR_RWX            0x7
+#define ATTR_WRITABLE       0x2
+#define MAPPING_SUCCESSFUL  0x0
+#define INVALID_MAPPING     0x1                     // as GPM_INVALID_MAPPING
+
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// 1 if src translates to tgt
+static int maps_to(void* mam, uint64_t src, uint64_t tgt)
+{
+    uint64_t addr = 0;
+    uint32_t attrs;
+
+    return mam_get_mapping(mam, src, &addr, &attrs) == MAPPING_SUCCESSFUL && addr == tgt;
+}
+
+static int unmapped(void* mam, uint64_t src)
+{
+    uint64_t addr;
+    uint32_t attrs;
+
+    return mam_get_mapping(mam, src, &addr, &attrs) != MAPPING_SUCCESSFUL;
+}
+
+static void check(void)
+{
+    void *mam, *gpa_to_hpa, *hpa_to_hva;
+    uint64_t addr, page;
+    uint32_t attrs;
+
+    mam = mam_create_mapping(ATTR_RWX);
+    CHECK(mam_insert_range(mam, 0x5000, 0x100000, PAGE_SIZE, ATTR_RWX), "insert");
+    CHECK(maps_to(mam, 0x5123, 0x100123), "first translation");
+    CHECK(maps_to(mam, 0x5456, 0x100456), "cached translation");
+
+    // every update is seen by the next translation
+    CHECK(mam_insert_range(mam, 0x5000, 0x200000, PAGE_SIZE, ATTR_RWX), "remap");
+    CHECK(maps_to(mam, 0x5123, 0x200123), "translation after remap");
+    CHECK(mam_remove_permissions_from_existing_mapping(mam, 0x5000, PAGE_SIZE, ATTR_WRITABLE),
+          "write protect");
+    CHECK(mam_get_mapping(mam, 0x5000, &addr, &attrs) == MAPPING_SUCCESSFUL &&
+          (attrs & ATTR_WRITABLE) == 0, "attributes after write protection");
+    CHECK(mam_insert_not_existing_range(mam, 0x5000, PAGE_SIZE, INVALID_MAPPING), "unmap");
+    CHECK(unmapped(mam, 0x5123), "translation after unmap");
+
+    // an update on another CPU
+    CHECK(mam_insert_range(mam, 0x6000, 0x300000, PAGE_SIZE, ATTR_RWX), "insert");
+    heapbench_set_cpu_id(1);
+    CHECK(maps_to(mam, 0x6010, 0x300010), "translation on CPU1");
+    heapbench_set_cpu_id(0);
+    CHECK(maps_to(mam, 0x6010, 0x300010), "translation on CPU0");
+    CHECK(mam_insert_range(mam, 0x6000, 0x400000, PAGE_SIZE, ATTR_RWX), "remap on CPU0");
+    heapbench_set_cpu_id(1);
+    CHECK(maps_to(mam, 0x6010, 0x400010), "translation on CPU1 after remap on CPU0");
+    // a CPU without a cache walks the tables
+    heapbench_set_cpu_id(NUM_CPUS);
+    CHECK(maps_to(mam, 0x6010, 0x400010), "translation on a CPU without cache");
+    heapbench_set_cpu_id(0);
+
+    // a MAM created where the destroyed one was
+    mam_destroy_mapping(mam);
+    mam = mam_create_mapping(ATTR_RWX);
+    CHECK(unmapped(mam, 0x6010), "no entry of the destroyed MAM");
+    mam_destroy_mapping(mam);
+
+    // the translations of a page by both MAMs of an identity mapping
+    gpa_to_hpa = mam_create_mapping(ATTR_NONE);
+    hpa_to_hva = mam_create_mapping(ATTR_NONE);
+    for (page = 0; page < 256; page++) {
+        mam_insert_range(gpa_to_hpa, page * PAGE_SIZE, page * PAGE_SIZE, PAGE_SIZE, ATTR_RWX);
+        mam_insert_range(hpa_to_hva, page * PAGE_SIZE, HVA_BASE + page * PAGE_SIZE,
+                         PAGE_SIZE, ATTR_RWX);
+    }
+    for (page = 0; page < 256; page++) {
+        if (!maps_to(gpa_to_hpa, page * PAGE_SIZE, page * PAGE_SIZE) ||
+            !maps_to(hpa_to_hva, page * PAGE_SIZE, HVA_BASE + page * PAGE_SIZE)) {
+            CHECK(0, "identity mapped page");
+            break;
+        }
+    }
+    mam_destroy_mapping(gpa_to_hpa);
+    mam_destroy_mapping(hpa_to_hva);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// gpa -> hpa -> hva, as gpm_gpa_to_hva() and hmm_hpa_to_hva(), in
+// translations per second
+static double run(void* gpa_to_hpa, void* hpa_to_hva, uint64_t num_pages,
+                  uint64_t num_translations, uint64_t update_interval, uint64_t* checksum)
+{
+    uint64_t seed = 12345, gpa, hpa, hva, sum = 0, n;
+    uint32_t attrs;
+    double start = now();
+
+    for (n = 0; n < num_translations; n++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        gpa = ((seed >> 33) % num_pages) * PAGE_SIZE + (seed & 0xff8);
+        if (update_interval != 0 && n % update_interval == 0) {
+            // remap a page to itself, bumps the update counter
+            mam_insert_range(gpa_to_hpa, gpa & ~(PAGE_SIZE - 1), gpa & ~(PAGE_SIZE - 1),
+                             PAGE_SIZE, ATTR_RWX);
+        }
+        if (mam_get_mapping(gpa_to_hpa, gpa, &hpa, &attrs) != MAPPING_SUCCESSFUL ||
+            mam_get_mapping(hpa_to_hva, hpa, &hva, &attrs) != MAPPING_SUCCESSFUL) {
+            printf("no mapping for %llx\n", (unsigned long long) gpa);
+            exit(1);
+        }
+        sum += hva;
+    }
+    *checksum = sum;
+    return (double) num_translations / (now() - start);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint64_t working_sets[] = { 8, 32, 128, 1024, 65536 };
+    enum { NUM_SETS = sizeof(working_sets) / sizeof(working_sets[0]) };
+    uint64_t num_translations = 10000000;
+    uint64_t update_interval = 0;
+    uint64_t page, sum_walk[NUM_SETS], sum_cached;
+    double walk_rate[NUM_SETS], cached_rate;
+    void *gpa_to_hpa, *hpa_to_hva;
+    void* heap;
+    unsigned i;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-n") == 0 && a + 1 < argc) {
+            num_translations = strtoull(argv[++a], NULL, 0);
+        }
+        else if (strcmp(argv[a], "-u") == 0 && a + 1 < argc) {
+            update_interval = strtoull(argv[++a], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n translations] [-u update_interval]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_translations == 0) {
+        num_translations = 1;
+    }
+    // the MAM tables point to each other with 40 bit physical addresses
+    heap = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (heap == MAP_FAILED) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+
+    // the host mapping is created first, as in the VMM; page by page, as
+    // guest memory is added
+    hpa_to_hva = mam_create_mapping(ATTR_NONE);
+    gpa_to_hpa = mam_create_mapping(ATTR_NONE);
+    for (page = 0; page < MAX_PAGES; page++) {
+        if (!mam_insert_range(gpa_to_hpa, page * PAGE_SIZE, page * PAGE_SIZE,
+                              PAGE_SIZE, ATTR_RWX) ||
+            !mam_insert_range(hpa_to_hva, page * PAGE_SIZE, HVA_BASE + page * PAGE_SIZE,
+                              PAGE_SIZE, ATTR_RWX)) {
+            fprintf(stderr, "mam_insert_range failed\n");
+            return 1;
+        }
+    }
+
+    // no translation cache until it is initialized
+    for (i = 0; i < NUM_SETS; i++) {
+        walk_rate[i] = run(gpa_to_hpa, hpa_to_hva, working_sets[i],
+                           num_translations, update_interval, &sum_walk[i]);
+    }
+    CHECK(mam_translation_cache_initialize(NUM_CPUS), "cache initialization");
+    CHECK(!mam_translation_cache_initialize(NUM_CPUS), "second cache initialization");
+    check();
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+
+    printf("\n%llu gpa -> hva translations%s\n", (unsigned long long) num_translations,
+           update_interval ? ", with updates" : "");
+    printf("%8s %14s %14s %8s\n", "pages", "walk/s", "cached/s", "speedup");
+    for (i = 0; i < NUM_SETS; i++) {
+        cached_rate = run(gpa_to_hpa, hpa_to_hva, working_sets[i],
+                          num_translations, update_interval, &sum_cached);
+        CHECK(sum_cached == sum_walk[i], "cached translations");
+        printf("%8llu %14.0f %14.0f %8.2f\n", (unsigned long long) working_sets[i],
+               walk_rate[i], cached_rate, cached_rate / walk_rate[i]);
+    }
+    munmap(heap, HEAP_SIZE);
+    return g_errors ? 1 : 0;
+}
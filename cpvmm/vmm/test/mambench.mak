@@ -0,0 +1,73 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the MAM (memory_address_mapper.c) with a check and a
+# benchmark of its translation cache, which is built with MAM_TRANSLATION_CACHE.
+#   make -f mambench.mak && mambench.exe [-n translations] [-u update_interval]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/memory_address_mapper.o $(B)/heap.o $(B)/mamstubs.o $(B)/hoststubs.o \
+            $(B)/mambench.o
+
+all: $(E)/mambench.exe
+ 
+$(E)/mambench.exe: $(dobjs)
+	@echo "mambench.exe"
+	$(LINK) -o $(E)/mambench.exe $(dobjs)
+
+$(B)/memory_address_mapper.o: $(mainsrc)/memory/memory_manager/memory_address_mapper.c
+	echo "memory_address_mapper.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -DMAM_TRANSLATION_CACHE -I$(mainsrc)/memory/memory_manager -c -o $(B)/memory_address_mapper.o $(mainsrc)/memory/memory_manager/memory_address_mapper.c
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/mamstubs.o: $(mainsrc)/test/mamstubs.c
+	echo "mamstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/mamstubs.o $(mainsrc)/test/mamstubs.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/mambench.o: $(mainsrc)/test/mambench.c
+	echo "mambench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/mambench.o $(mainsrc)/test/mambench.c
+
+clean:
+	rm -f $(E)/mambench.exe
+	rm -f $(dobjs)
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted test of large page promotion in the MAM
+// (memory/memory_manager/memory_address_mapper.c).
+//
+// Builds the EPT of a PC guest the way ept_create_guest_address_space()
+// does, with mam_insert_range() and mam_convert_to_ept(). Pages inside 2MB
+// and 1GB leaves are then inserted again with their own mapping, as
+// ept_add_mapping() does for a page that is mapped already: the leaves are
+// split and the update leaves the uniform tables behind, which
+// mam_compact_mapping() must retract. Single pages are write protected and
+// restored, and a 2MB range is removed and mapped back, with a compaction
+// after each step as at the end of a GPM update.
+//
+// After every step the EPT the hardware walks is compared, page by page,
+// with a flat reference map, and so is mam_get_mapping(). The number of
+// tables and the average number of levels walked per translation are
+// printed.
+//
+//   mamcompact [-g guest_gigabytes] [-s 2m|1g]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// memory/memory_manager/memory_address_mapper.c, release build
+extern void*    mam_create_mapping(uint32_t inner_level_attributes);
+extern uint32_t mam_get_mapping(void* mam_handle, uint64_t src_addr,
+                    uint64_t* tgt_addr, uint32_t* attrs);
+extern int      mam_insert_range(void* mam_handle, uint64_t src_addr,
+                    uint64_t tgt_addr, uint64_t size, uint32_t attrs);
+extern int      mam_insert_not_existing_range(void* mam_handle, uint64_t src_addr,
+                    uint64_t size, uint32_t reason);
+extern int      mam_add_permissions_to_existing_mapping(void* mam_handle,
+                    uint64_t src_addr, uint64_t size, uint32_t attrs);
+extern int      mam_remove_permissions_from_existing_mapping(void* mam_handle,
+                    uint64_t src_addr, uint64_t size, uint32_t attrs);
+extern void     mam_compact_mapping(void* mam_handle);
+extern int      mam_convert_to_ept(void* mam_handle, uint32_t ept_super_page_support,
+                    uint32_t ept_supported_gaw, int ept_hw_ve_support,
+                    uint64_t* first_table_hpa);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+
+// the MAM keeps 40 bit table addresses; test/mamstubs.c maps HPA == HVA
+#define HEAP_SIZE           (64 << 20)
+#define PAGE_SIZE           4096ULL
+#define ENTRIES_PER_TABLE   512
+#define SIZE_2MB            (PAGE_SIZE * ENTRIES_PER_TABLE)
+#define SIZE_1GB            (SIZE_2MB * ENTRIES_PER_TABLE)
+
+// memory_address_mapper_api.h
+#define SUPPORT_2MB_PAGE    0x1     // MAM_EPT_SUPPORT_2MB_PAGE
+#define SUPPORT_1GB_PAGE    0x2     // MAM_EPT_SUPPORT_1GB_PAGE
+#define EPT_48_BITS_GAW     3       // MAM_EPT_48_BITS_GAW
+#define MAPPING_SUCCESSFUL  0x0     // MAM_MAPPING_SUCCESSFUL
+#define INVALID_MAPPING     0x1     // as GPM_INVALID_MAPPING
+
+// MAM_ATTRIBUTES ept_attr: RWX, then the memory type from bit 4
+#define ATTR_RWX            0x07
+#define ATTR_WB_RWX         0x67
+#define ATTR_UC_RW          0x03
+#define ATTR_WRITABLE       0x02
+
+// hardware EPT entries
+#define EPT_RWX             0x7ULL
+#define EPT_MEMORY_TYPE(e)  (((e) >> 3) & 0x7)
+#define EPT_LARGE_PAGE      0x80ULL
+#define EPT_ADDRESS         0xfffffff000ULL
+
+typedef struct {
+    uint8_t present;
+    uint32_t attrs;
+    uint64_t tgt;
+} REFERENCE;
+
+static void *mam;
+static uint64_t *root;
+static REFERENCE *reference;
+static uint64_t num_guest_pages;
+static uint64_t num_tables;
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+
+static uint64_t size_covered_by_entry(int level)
+{
+    return PAGE_SIZE << (9 * (level - 1));
+}
+
+static uint64_t *table_at(uint64_t hpa)
+{
+    return (uint64_t*)(uintptr_t) hpa;
+}
+
+static void map(uint64_t gpa, uint64_t hpa, uint64_t size, uint32_t attrs)
+{
+    uint64_t page;
+
+    CHECK(mam_insert_range(mam, gpa, hpa, size, attrs), "mam_insert_range");
+    for (page = gpa / PAGE_SIZE; page < (gpa + size) / PAGE_SIZE; page++) {
+        reference[page].present = 1;
+        reference[page].tgt = hpa + page * PAGE_SIZE - gpa;
+        reference[page].attrs = attrs;
+    }
+}
+
+static void unmap(uint64_t gpa, uint64_t size)
+{
+    uint64_t page;
+
+    CHECK(mam_insert_not_existing_range(mam, gpa, size, INVALID_MAPPING),
+          "mam_insert_not_existing_range");
+    for (page = gpa / PAGE_SIZE; page < (gpa + size) / PAGE_SIZE; page++) {
+        reference[page].present = 0;
+    }
+}
+
+static void set_writable(uint64_t gpa, int writable)
+{
+    REFERENCE *page = &reference[gpa / PAGE_SIZE];
+
+    if (writable) {
+        CHECK(mam_add_permissions_to_existing_mapping(mam, gpa, PAGE_SIZE, ATTR_WRITABLE),
+              "mam_add_permissions_to_existing_mapping");
+        page->attrs |= ATTR_WRITABLE;
+    }
+    else {
+        CHECK(mam_remove_permissions_from_existing_mapping(mam, gpa, PAGE_SIZE, ATTR_WRITABLE),
+              "mam_remove_permissions_from_existing_mapping");
+        page->attrs &= ~ATTR_WRITABLE;
+    }
+}
+
+// the walk of the processor; returns the number of levels walked
+static int translate(uint64_t gpa, int *present, uint64_t *hpa, uint32_t *attrs)
+{
+    uint64_t *table = root, entry;
+    int level;
+
+    for (level = 4; ; level--) {
+        entry = table[(gpa / size_covered_by_entry(level)) % ENTRIES_PER_TABLE];
+        if ((entry & EPT_RWX) == 0) {
+            *present = 0;
+            return 5 - level;
+        }
+        if (level == 1 || (entry & EPT_LARGE_PAGE)) {
+            break;
+        }
+        table = table_at(entry & EPT_ADDRESS);
+    }
+    *present = 1;
+    *hpa = (entry & EPT_ADDRESS & ~(size_covered_by_entry(level) - 1)) +
+           (gpa & (size_covered_by_entry(level) - 1));
+    *attrs = (uint32_t)((entry & EPT_RWX) | (EPT_MEMORY_TYPE(entry) << 4));
+    return 5 - level;
+}
+
+static uint64_t count_tables(uint64_t *table, int level)
+{
+    uint64_t count = 1;
+    uint32_t i;
+
+    if (level == 1) {
+        return count;
+    }
+    for (i = 0; i < ENTRIES_PER_TABLE; i++) {
+        if ((table[i] & EPT_RWX) != 0 && !(table[i] & EPT_LARGE_PAGE)) {
+            count += count_tables(table_at(table[i] & EPT_ADDRESS), level - 1);
+        }
+    }
+    return count;
+}
+
+// compares every guest page with the reference; returns the number of
+// tables
+static uint64_t check(const char *step)
+{
+    uint64_t page, hpa, tgt, levels = 0;
+    uint32_t attrs, mam_attrs;
+    int present, mam_present;
+
+    for (page = 0; page < num_guest_pages; page++) {
+        levels += translate(page * PAGE_SIZE + 0x123, &present, &hpa, &attrs);
+        mam_present = (mam_get_mapping(mam, page * PAGE_SIZE + 0x123, &tgt, &mam_attrs) ==
+                       MAPPING_SUCCESSFUL);
+        if (present != reference[page].present || mam_present != present ||
+            (present && (hpa != reference[page].tgt + 0x123 || attrs != reference[page].attrs ||
+                         tgt != hpa || mam_attrs != attrs))) {
+            printf("%s: page %llx translated differently\n", step,
+                   (unsigned long long) page * PAGE_SIZE);
+            g_errors++;
+            return 0;
+        }
+    }
+    num_tables = count_tables(root, 4);
+    printf("%-24s %10llu %10.2f\n", step, (unsigned long long) num_tables,
+           (double) levels / num_guest_pages);
+    return num_tables;
+}
+
+
+int main(int an, char **av)
+{
+    uint64_t guest_size = 8 * SIZE_1GB, hpa_base = 0x100000000ULL, root_hpa, tables;
+    uint32_t support = SUPPORT_2MB_PAGE | SUPPORT_1GB_PAGE;
+    // inside a 2MB leaf below 1GB, 1GB leaves and the uncached MMIO range
+    uint64_t pages[] = { 0x1000000, 0x1003000, 0x40200000, 0x1c0000000, 0xc0000000 };
+    void *heap;
+    unsigned i;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-g") == 0 && j + 1 < an)
+            guest_size = strtoull(av[++j], NULL, 0) * SIZE_1GB;
+        else if (strcmp(av[j], "-s") == 0 && j + 1 < an) {
+            j++;
+            if (strcmp(av[j], "2m") == 0)
+                support = SUPPORT_2MB_PAGE;
+            else if (strcmp(av[j], "1g") == 0)
+                support = SUPPORT_2MB_PAGE | SUPPORT_1GB_PAGE;
+            else
+                break;
+        }
+        else
+            break;
+    }
+    if (j < an || guest_size < 8 * SIZE_1GB || guest_size > 64 * SIZE_1GB) {
+        printf("mamcompact [-g guest_gigabytes] [-s 2m|1g]\n");
+        return 1;
+    }
+    num_guest_pages = guest_size / PAGE_SIZE;
+    reference = calloc(num_guest_pages, sizeof(REFERENCE));
+    heap = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (reference == NULL || heap == MAP_FAILED) {
+        printf("out of memory\n");
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+    mam = mam_create_mapping(ATTR_RWX);
+
+    // a PC guest: low memory, the legacy hole, memory up to 3GB, uncached
+    // MMIO up to 4GB and memory above 4GB relocated by 4GB in host memory
+    map(0, hpa_base, 0xa0000, ATTR_WB_RWX);
+    map(0x100000, hpa_base + 0x100000, 0xc0000000 - 0x100000, ATTR_WB_RWX);
+    map(0xc0000000, 0xc0000000, 0x40000000, ATTR_UC_RW);
+    map(0x100000000ULL, hpa_base + 0x100000000ULL, guest_size - 0x100000000ULL, ATTR_WB_RWX);
+    if (!mam_convert_to_ept(mam, support, EPT_48_BITS_GAW, 0, &root_hpa)) {
+        printf("mam_convert_to_ept failed\n");
+        return 1;
+    }
+    root = table_at(root_hpa);
+
+    printf("%llu GB guest, %s pages\n", (unsigned long long)(guest_size / SIZE_1GB),
+           (support & SUPPORT_1GB_PAGE) ? "2MB and 1GB" : "2MB");
+    printf("%-24s %10s %10s\n", "step", "tables", "levels");
+    tables = check("converted");
+
+    // the same mapping again splits the leaves and leaves uniform tables
+    for (i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+        map(pages[i], reference[pages[i] / PAGE_SIZE].tgt, PAGE_SIZE,
+            reference[pages[i] / PAGE_SIZE].attrs);
+    }
+    CHECK(check("pages mapped again") > tables, "leaves split");
+    mam_compact_mapping(mam);
+    CHECK(check("compacted") == tables, "tables retracted");
+
+    for (i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+        set_writable(pages[i], 0);
+    }
+    mam_compact_mapping(mam);
+    CHECK(check("pages write protected") > tables, "protected pages split the leaves");
+    for (i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+        set_writable(pages[i], 1);
+    }
+    mam_compact_mapping(mam);
+    CHECK(check("pages restored") == tables, "restored pages retracted");
+
+    // removing and mapping back a 2MB range inside a 1GB leaf
+    unmap(0x80000000, SIZE_2MB);
+    mam_compact_mapping(mam);
+    check("2MB removed");
+    map(0x80000000, hpa_base + 0x80000000, SIZE_2MB, ATTR_WB_RWX);
+    mam_compact_mapping(mam);
+    CHECK(check("2MB mapped back") == tables, "2MB range retracted");
+
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+    return g_errors ? 1 : 0;
+}
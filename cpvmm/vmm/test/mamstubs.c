@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the HMM and hw_* services the MAM
+// (memory/memory_manager/memory_address_mapper.c) depends on, besides the
+// heap and the locks of hoststubs.c. The MAM tables are allocated from the
+// heap of the benchmark, whose host physical and virtual addresses are the
+// same. Built with the VMM include paths.
+
+#include "vmm_defs.h"
+#include "hw_interlocked.h"
+#include "host_memory_manager_api.h"
+
+
+BOOLEAN hmm_hva_to_hpa(IN HVA hva, OUT HPA* hpa)
+{
+    *hpa = hva;
+    return TRUE;
+}
+
+BOOLEAN hmm_hpa_to_hva(IN HPA hpa, OUT HVA* hva)
+{
+    *hva = hpa;
+    return TRUE;
+}
+
+INT32 hw_interlocked_add(INT32 volatile * addend, INT32 value)
+{
+    return __sync_fetch_and_add(addend, value);
+}
+
+void hw_store_fence(void)
+{
+    __sync_synchronize();
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted multi-threaded stress and benchmark for vmm_malloc
+// (utils/memory_allocator.c on top of pool.c and utils/heap.c).
+//
+// Every thread plays a host CPU. It allocates buffers of random sizes,
+// fills them with a pattern, frees most of them itself and hands the
+// rest to the next thread, which checks the pattern and frees them
+// remotely. The run is done first through the pools lock only and then
+// with the per-CPU magazines enabled.
+//
+//   membench [-c threads] [-n operations_per_thread]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define PAGE_SIZE       4096
+#define MAX_THREADS     64
+#define LIVE_PER_THREAD 256
+#define HANDOFF_SLOTS   1024
+
+// utils/heap.c and utils/memory_allocator.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+extern void*    vmm_mem_allocate(char *file_name, int32_t line_number, uint32_t size);
+extern void     vmm_mem_free(char *file_name, int32_t line_number, void *buff);
+extern void     vmm_mem_allocator_enable_cpu_cache(uint32_t cpu_id);
+// hoststubs.c
+extern void     heapbench_set_cpu_id(uint32_t cpu_id);
+
+
+// single producer, single consumer ring from thread i to thread i+1
+typedef struct {
+    void*             slots[HANDOFF_SLOTS];
+    volatile uint32_t head;     // written by the consumer
+    volatile uint32_t tail;     // written by the producer
+} HANDOFF;
+
+typedef struct {
+    uint32_t cpu_id;
+    uint32_t num_ops;
+    HANDOFF* to_next;
+    HANDOFF* from_prev;
+    uint64_t remote_frees;
+    uint64_t errors;
+} THREAD_ARGS;
+
+static int num_threads = 4;
+static volatile int producers_done = 0;
+static int use_magazines = 0;
+
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+// the first byte of a buffer holds its size class, the rest a pattern
+static void fill(uint8_t *buffer, uint32_t size)
+{
+    buffer[0] = (uint8_t) size;
+    memset(buffer + 1, (uint8_t)(size * 7), size - 1);
+}
+
+static int check(uint8_t *buffer)
+{
+    uint32_t size = buffer[0];
+    uint32_t i;
+
+    for (i = 1; i < size; i++) {
+        if (buffer[i] != (uint8_t)(size * 7))
+            return 0;
+    }
+    return 1;
+}
+
+static void drain_handoff(THREAD_ARGS *args)
+{
+    HANDOFF *h = args->from_prev;
+    uint8_t *buffer;
+
+    while (h->head != h->tail) {
+        __sync_synchronize();
+        buffer = h->slots[h->head % HANDOFF_SLOTS];
+        if (!check(buffer))
+            args->errors++;
+        vmm_mem_free(NULL, 0, buffer);
+        args->remote_frees++;
+        __sync_synchronize();
+        h->head++;
+    }
+}
+
+static void *stress_thread(void *arg)
+{
+    THREAD_ARGS *args = arg;
+    uint8_t *live[LIVE_PER_THREAD];
+    uint32_t seed = 17 + args->cpu_id;
+    uint32_t size;
+    uint32_t i;
+    uint32_t n;
+
+    heapbench_set_cpu_id(args->cpu_id);
+    if (use_magazines)
+        vmm_mem_allocator_enable_cpu_cache(args->cpu_id);
+    memset(live, 0, sizeof(live));
+    for (n = 0; n < args->num_ops; n++) {
+        seed = seed * 1103515245 + 12345;
+        i = (seed >> 8) % LIVE_PER_THREAD;
+        if (live[i] != NULL) {
+            if (!check(live[i]))
+                args->errors++;
+            // hand one in eight buffers to the next thread
+            if (((seed >> 20) & 7) == 0 &&
+                args->to_next->tail - args->to_next->head < HANDOFF_SLOTS) {
+                args->to_next->slots[args->to_next->tail % HANDOFF_SLOTS] = live[i];
+                __sync_synchronize();
+                args->to_next->tail++;
+            }
+            else {
+                vmm_mem_free(NULL, 0, live[i]);
+            }
+            live[i] = NULL;
+        }
+        else {
+            // mostly small objects, like the ones allocated on VM exits
+            size = 8 + ((seed >> 16) % (((seed >> 4) & 3) == 0 ? 248 : 56));
+            live[i] = vmm_mem_allocate(NULL, 0, size);
+            if (live[i] == NULL) {
+                args->errors++;
+                continue;
+            }
+            fill(live[i], size);
+        }
+        if ((n & 63) == 0)
+            drain_handoff(args);
+    }
+    for (i = 0; i < LIVE_PER_THREAD; i++) {
+        if (live[i] != NULL)
+            vmm_mem_free(NULL, 0, live[i]);
+    }
+    __sync_fetch_and_add(&producers_done, 1);
+    while (producers_done < num_threads)
+        drain_handoff(args);
+    drain_handoff(args);
+    return NULL;
+}
+
+static void run(const char *name, uint32_t ops_per_thread)
+{
+    pthread_t threads[MAX_THREADS];
+    THREAD_ARGS args[MAX_THREADS];
+    HANDOFF *handoffs;
+    struct timespec start, end;
+    uint64_t remote_frees = 0;
+    uint64_t errors = 0;
+    double seconds;
+    int i;
+
+    handoffs = calloc(num_threads, sizeof(HANDOFF));
+    producers_done = 0;
+    for (i = 0; i < num_threads; i++) {
+        args[i].cpu_id = i;
+        args[i].num_ops = ops_per_thread;
+        args[i].to_next = &handoffs[(i + 1) % num_threads];
+        args[i].from_prev = &handoffs[i];
+        args[i].remote_frees = 0;
+        args[i].errors = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, stress_thread, &args[i]);
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = elapsed_seconds(&start, &end);
+    for (i = 0; i < num_threads; i++) {
+        remote_frees += args[i].remote_frees;
+        errors += args[i].errors;
+    }
+    printf("%-16s %d threads: %10.0f ops/sec, %llu remote frees, %llu errors\n",
+           name, num_threads, (double) ops_per_thread * num_threads / seconds,
+           (unsigned long long) remote_frees, (unsigned long long) errors);
+    free(handoffs);
+}
+
+
+int main(int an, char **av)
+{
+    uint32_t ops_per_thread = 2000000;
+    size_t size = 256 << 20;
+    uint8_t *buffer;
+    int j;
+
+    for (j = 1; j < an; j++) {
+        if (strcmp(av[j], "-c") == 0 && j + 1 < an)
+            num_threads = atoi(av[++j]);
+        else if (strcmp(av[j], "-n") == 0 && j + 1 < an)
+            ops_per_thread = (uint32_t) atoi(av[++j]);
+        else {
+            printf("membench [-c threads] [-n operations_per_thread]\n");
+            return 1;
+        }
+    }
+    if (num_threads < 1 || num_threads > MAX_THREADS)
+        return 1;
+
+    if (posix_memalign((void **) &buffer, PAGE_SIZE, size) != 0)
+        return 1;
+    vmm_heap_initialize((uint64_t)(uintptr_t) buffer, size);
+
+    run("pools lock", ops_per_thread);
+    use_magazines = 1;
+    run("cpu magazines", ops_per_thread);
+
+    free(buffer);
+    return 0;
+}
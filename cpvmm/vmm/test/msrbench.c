@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and micro-benchmark of the MSR VMEXIT handlers
+// (vmexit/vmexit_msr.c) of a guest set up by msr_vmexit_guest_setup.
+//
+// The check registers and unregisters read and write handlers in both
+// MSR ranges and checks the MSR bitmap and which handler, if any, each
+// RDMSR and WRMSR exit ends in. It fills up the descriptor table and
+// checks a freed descriptor is taken again.
+//
+// The benchmark times RDMSR exits of a guest mix of PAT, EFER, MTRR,
+// x2APIC and TSC deadline accesses, most of which have no handler.
+//
+//   msrbench [-n exits]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+// vmexit/vmexit_msr.c through test/msrstubs.c
+extern void     msrbench_guest_setup(void);
+extern int      msrbench_register(uint32_t msr_id, uint32_t access, uint64_t context);
+extern int      msrbench_unregister(uint32_t msr_id, uint32_t access);
+extern int      msrbench_exits(uint32_t msr_id, uint32_t access);
+extern int      msrbench_rdmsr(uint32_t msr_id, uint64_t* value);
+extern int      msrbench_wrmsr(uint32_t msr_id, uint64_t value);
+extern uint64_t msrbench_handler_calls(void);
+extern uint64_t msrbench_hw_accesses(void);
+extern uint64_t msrbench_mtrr_updates(void);
+extern uint64_t msrbench_injected(void);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+
+#define HEAP_SIZE       (1 << 20)
+#define PAGE_SIZE       4096
+
+// RW_ACCESS of vmm_defs.h
+#define WRITE_ACCESS    1
+#define READ_ACCESS     2
+
+#define MSR_VMX_BASIC   0x480
+#define MSR_PAT         0x277
+#define MSR_MTRR_DEF    0x2FF
+#define MSR_STAR        0xC0000081
+#define MSR_HYPER_V     0x40000000
+#define MSR_OUT_OF_MAP  0x40001000
+#define MSR_FREE_FIRST  0x1000
+
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// 1 if RDMSR of msr_id went to the hardware
+static int read_from_hw(uint32_t msr_id)
+{
+    uint64_t hw_accesses = msrbench_hw_accesses();
+    uint64_t value = 0;
+
+    return msrbench_rdmsr(msr_id, &value) && value == msr_id &&
+           msrbench_hw_accesses() == hw_accesses + 1;
+}
+
+// 1 if RDMSR of msr_id went to the registered handler of context
+static int read_from_handler(uint32_t msr_id, uint64_t context)
+{
+    uint64_t handler_calls = msrbench_handler_calls();
+    uint64_t value = 0;
+
+    return msrbench_rdmsr(msr_id, &value) && value == context &&
+           msrbench_handler_calls() == handler_calls + 1;
+}
+
+static void check(void)
+{
+    uint64_t value, calls, injected;
+    uint32_t msr_id, num_free;
+
+    // the handlers of the guest setup
+    CHECK(msrbench_exits(MSR_MTRR_DEF, WRITE_ACCESS) &&
+          !msrbench_exits(MSR_MTRR_DEF, READ_ACCESS), "MTRR write exits");
+    value = msrbench_mtrr_updates();
+    CHECK(msrbench_wrmsr(MSR_MTRR_DEF, 0xC06), "MTRR write");
+    CHECK(msrbench_mtrr_updates() == value + 1, "MTRR write handled");
+    injected = msrbench_injected();
+    CHECK(!msrbench_rdmsr(MSR_VMX_BASIC, &value) && msrbench_injected() == injected + 1,
+          "VMX capability read faults");
+    CHECK(!msrbench_rdmsr(MSR_HYPER_V, &value) && msrbench_injected() == injected + 2,
+          "Hyper-V MSR read faults");
+
+    // read and write handlers of one MSR
+    CHECK(!msrbench_exits(MSR_PAT, READ_ACCESS), "PAT not in the bitmap");
+    CHECK(read_from_hw(MSR_PAT), "PAT read without handler");
+    CHECK(msrbench_register(MSR_PAT, READ_ACCESS, 0x1234), "register PAT read");
+    CHECK(msrbench_exits(MSR_PAT, READ_ACCESS) &&
+          !msrbench_exits(MSR_PAT, WRITE_ACCESS), "PAT read exits");
+    CHECK(read_from_handler(MSR_PAT, 0x1234), "PAT read handled");
+    calls = msrbench_handler_calls();
+    CHECK(msrbench_wrmsr(MSR_PAT, 6) && msrbench_handler_calls() == calls,
+          "PAT write without handler");
+    CHECK(msrbench_register(MSR_PAT, WRITE_ACCESS, 0x5678), "register PAT write");
+    // one context per MSR, the last one registered
+    CHECK(read_from_handler(MSR_PAT, 0x5678), "PAT read after write registration");
+    CHECK(msrbench_register(MSR_PAT, READ_ACCESS, 0x4321), "update PAT read");
+    CHECK(read_from_handler(MSR_PAT, 0x4321), "PAT read updated");
+    CHECK(msrbench_unregister(MSR_PAT, READ_ACCESS), "unregister PAT read");
+    CHECK(!msrbench_exits(MSR_PAT, READ_ACCESS) &&
+          msrbench_exits(MSR_PAT, WRITE_ACCESS), "PAT write still exits");
+    CHECK(read_from_hw(MSR_PAT), "PAT read unregistered");
+    calls = msrbench_handler_calls();
+    CHECK(msrbench_wrmsr(MSR_PAT, 6) && msrbench_handler_calls() == calls + 1,
+          "PAT write still handled");
+    CHECK(msrbench_unregister(MSR_PAT, WRITE_ACCESS), "unregister PAT write");
+    CHECK(!msrbench_unregister(MSR_PAT, WRITE_ACCESS), "PAT descriptor freed");
+
+    // the high range, and MSRs the bitmap does not cover
+    CHECK(msrbench_register(MSR_STAR, READ_ACCESS, 0xABCD), "register STAR read");
+    CHECK(msrbench_exits(MSR_STAR, READ_ACCESS), "STAR read exits");
+    CHECK(read_from_handler(MSR_STAR, 0xABCD), "STAR read handled");
+    CHECK(msrbench_unregister(MSR_STAR, READ_ACCESS), "unregister STAR read");
+    CHECK(read_from_hw(MSR_STAR), "STAR read unregistered");
+    CHECK(!msrbench_register(MSR_OUT_OF_MAP, READ_ACCESS, 1), "MSR outside of the bitmap");
+    CHECK(read_from_hw(MSR_OUT_OF_MAP), "MSR outside of the bitmap read");
+
+    // fill up the descriptors, then free one and take it again
+    for (num_free = 0; msrbench_register(MSR_FREE_FIRST + num_free, READ_ACCESS,
+                MSR_FREE_FIRST + num_free); num_free++) {
+    }
+    CHECK(num_free > 0, "free descriptors");
+    for (msr_id = MSR_FREE_FIRST; msr_id < MSR_FREE_FIRST + num_free; msr_id++) {
+        if (!read_from_handler(msr_id, msr_id)) {
+            CHECK(0, "read with all descriptors in use");
+            break;
+        }
+    }
+    CHECK(read_from_hw(MSR_FREE_FIRST + num_free), "registration failed");
+    CHECK(msrbench_unregister(MSR_FREE_FIRST + 1, READ_ACCESS), "unregister one");
+    CHECK(msrbench_register(MSR_PAT, READ_ACCESS, 0x1234), "freed descriptor taken");
+    CHECK(read_from_handler(MSR_PAT, 0x1234) && read_from_hw(MSR_FREE_FIRST + 1) &&
+          read_from_handler(MSR_FREE_FIRST + 2, MSR_FREE_FIRST + 2),
+          "reads after the descriptor was taken again");
+    CHECK(msrbench_unregister(MSR_PAT, READ_ACCESS), "unregister PAT");
+    for (msr_id = MSR_FREE_FIRST; msr_id < MSR_FREE_FIRST + num_free; msr_id++) {
+        msrbench_unregister(msr_id, READ_ACCESS);
+    }
+    CHECK(read_from_hw(MSR_FREE_FIRST + 2), "descriptors freed");
+    printf("%u descriptors free after the guest setup\n", num_free);
+}
+
+// MSRs a running guest reads
+static const uint32_t guest_mix[] = {
+    0x277,              // PAT, no handler
+    0xC0000080,         // EFER
+    0x802, 0x80B,       // x2APIC ID and EOI, no handler
+    0x830, 0x838,       // x2APIC ICR and timer, no handler
+    0x6E0,              // TSC deadline, no handler
+    0x2FF, 0x200, 0x201,// MTRRs, write handlers only
+    0xC0000102,         // kernel GS base, no handler
+    0x1B,               // APIC base, write handler only
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num_exits = 20000000;
+    uint32_t num_mix = sizeof(guest_mix) / sizeof(guest_mix[0]);
+    uint64_t value;
+    uint32_t i;
+    double start, seconds;
+    void* heap;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-n") == 0 && a + 1 < argc) {
+            num_exits = (uint32_t) strtoul(argv[++a], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n exits]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_exits == 0) {
+        num_exits = 1;
+    }
+    if (posix_memalign(&heap, PAGE_SIZE, HEAP_SIZE) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+    msrbench_guest_setup();
+
+    check();
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+
+    start = now();
+    for (i = 0; i < num_exits; i++) {
+        msrbench_rdmsr(guest_mix[i % num_mix], &value);
+        // one exit at a time, not overlapped with the next one
+        __builtin_ia32_lfence();
+    }
+    seconds = now() - start;
+    printf("\n%u RDMSR exits: %.1f ns per exit\n", num_exits, seconds * 1e9 / num_exits);
+    free(heap);
+    return g_errors ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the MSR VMEXIT handlers (vmexit_msr.c) with a check of
+# handler registration and dispatch and a benchmark of RDMSR exits.
+#   make -f msrbench.mak && msrbench.exe [-n exits]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/vmexit_msr.o $(B)/heap.o $(B)/msrstubs.o $(B)/hoststubs.o \
+            $(B)/msrbench.o
+
+all: $(E)/msrbench.exe
+ 
+$(E)/msrbench.exe: $(dobjs)
+	@echo "msrbench.exe"
+	$(LINK) -o $(E)/msrbench.exe $(dobjs)
+
+$(B)/vmexit_msr.o: $(mainsrc)/vmexit/vmexit_msr.c
+	echo "vmexit_msr.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/guest/guest_cpu -c -o $(B)/vmexit_msr.o $(mainsrc)/vmexit/vmexit_msr.c
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/msrstubs.o: $(mainsrc)/test/msrstubs.c
+	echo "msrstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/msrstubs.o $(mainsrc)/test/msrstubs.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/msrbench.o: $(mainsrc)/test/msrbench.c
+	echo "msrbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/msrbench.o $(mainsrc)/test/msrbench.c
+
+clean:
+	rm -f $(E)/msrbench.exe
+	rm -f $(dobjs)
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the guest, guest CPU, VMCS, VMEXIT and hardware
+// services the MSR VMEXIT handlers (vmexit/vmexit_msr.c) depend on: one
+// guest with one guest CPU, whose RDMSR and WRMSR exits msrbench.c
+// raises through the handlers vmexit_msr.c installs. MSRs without a
+// handler read back their MSR ID from the hardware. Built with the VMM
+// include paths.
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(VMEXIT_MSR_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(VMEXIT_MSR_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "common_libc.h"
+#include "guest.h"
+#include "guest_cpu.h"
+#include "guest_cpu_vmenter_event.h"
+#include "vmcs_api.h"
+#include "vmcs_init.h"
+#include "vmexit.h"
+#include "vmexit_msr.h"
+#include "mtrrs_abstraction.h"
+#include "host_memory_manager_api.h"
+#include "local_apic.h"
+#include "vmm_callback.h"
+#include "isr.h"
+#include "event_mgr.h"
+#include "memory_dump.h"
+
+
+#define MSR_NUM_OF_VARIABLE_MTRRS   10
+
+static UINT8                msr_guest_object;
+static UINT8                msr_gcpu_object;
+static UINT8                msr_vmcs_object;
+static VIRTUAL_CPU_ID       msr_vcpu = { 0, 0 };
+static MSR_VMEXIT_CONTROL   msr_control;
+static VMCS_HW_CONSTRAINTS  msr_constraints;
+static VMEXIT_HANDLER       msr_read_exit;
+static VMEXIT_HANDLER       msr_write_exit;
+static UINT64               msr_gp_regs[IA32_REG_GP_COUNT];
+static UINT64               msr_msr_regs[IA32_VMM_MSR_COUNT];
+static UINT64               msr_vmcs_fields[VMCS_FIELD_COUNT];
+static UINT64               msr_handler_calls;
+static UINT64               msr_hw_accesses;
+static UINT64               msr_mtrr_updates;
+static UINT64               msr_skipped;
+static UINT64               msr_injected;
+
+#define MSR_GCPU    ((GUEST_CPU_HANDLE) &msr_gcpu_object)
+#define MSR_GUEST   ((GUEST_HANDLE) &msr_guest_object)
+
+
+// the handler msrbench.c registers, it reads the context
+static BOOLEAN msrbench_handler(GUEST_CPU_HANDLE gcpu, MSR_ID msr_id,
+                    UINT64 *msr_value, void *context)
+{
+    (void) gcpu;
+    (void) msr_id;
+    msr_handler_calls++;
+    *msr_value = (UINT64)(ADDRESS) context;
+    return TRUE;
+}
+
+
+// msrbench.c interface
+void msrbench_guest_setup(void)
+{
+    msr_vmexit_guest_setup(MSR_GUEST);
+}
+
+int msrbench_register(UINT32 msr_id, UINT32 access, UINT64 context)
+{
+    return msr_vmexit_handler_register(MSR_GUEST, msr_id, msrbench_handler,
+                (RW_ACCESS) access, (void*)(ADDRESS) context) == VMM_OK;
+}
+
+int msrbench_unregister(UINT32 msr_id, UINT32 access)
+{
+    return msr_vmexit_handler_unregister(MSR_GUEST, msr_id, (RW_ACCESS) access) == VMM_OK;
+}
+
+// TRUE if the access of MSR exits, as set in the MSR bitmap
+int msrbench_exits(UINT32 msr_id, UINT32 access)
+{
+    UINT8 *p_bitarray = msr_control.msr_bitmap + ((access == READ_ACCESS) ? 0 : 2048);
+    UINT32 bitno = msr_id;
+
+    if (MSR_HIGH_FIRST <= msr_id && msr_id <= MSR_HIGH_LAST) {
+        p_bitarray += 1024;
+        bitno = msr_id - MSR_HIGH_FIRST;
+    }
+    return (BITARRAY_GET(p_bitarray, bitno)) != 0;
+}
+
+// The guest's RDMSR: 1 if it was executed, 0 if a fault was injected
+int msrbench_rdmsr(UINT32 msr_id, UINT64* value)
+{
+    UINT64 skipped = msr_skipped;
+
+    msr_gp_regs[IA32_REG_RCX] = msr_id;
+    msr_read_exit(MSR_GCPU);
+    *value = (msr_gp_regs[IA32_REG_RDX] << 32) | msr_gp_regs[IA32_REG_RAX];
+    return msr_skipped != skipped;
+}
+
+// The guest's WRMSR: 1 if it was executed, 0 if a fault was injected
+int msrbench_wrmsr(UINT32 msr_id, UINT64 value)
+{
+    UINT64 skipped = msr_skipped;
+
+    msr_gp_regs[IA32_REG_RCX] = msr_id;
+    msr_gp_regs[IA32_REG_RDX] = value >> 32;
+    msr_gp_regs[IA32_REG_RAX] = value & 0xFFFFFFFF;
+    msr_write_exit(MSR_GCPU);
+    return msr_skipped != skipped;
+}
+
+UINT64 msrbench_handler_calls(void)
+{
+    return msr_handler_calls;
+}
+
+UINT64 msrbench_hw_accesses(void)
+{
+    return msr_hw_accesses;
+}
+
+UINT64 msrbench_mtrr_updates(void)
+{
+    return msr_mtrr_updates;
+}
+
+UINT64 msrbench_injected(void)
+{
+    return msr_injected;
+}
+
+
+GUEST_ID guest_get_id(GUEST_HANDLE guest)
+{
+    (void) guest;
+    return 0;
+}
+
+MSR_VMEXIT_CONTROL* guest_get_msr_control(GUEST_HANDLE guest)
+{
+    (void) guest;
+    return &msr_control;
+}
+
+const VIRTUAL_CPU_ID* guest_vcpu(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return &msr_vcpu;
+}
+
+GUEST_HANDLE gcpu_guest_handle(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return MSR_GUEST;
+}
+
+VMCS_OBJECT* gcpu_get_vmcs(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return (VMCS_OBJECT*) &msr_vmcs_object;
+}
+
+VMM_STATUS vmexit_install_handler(GUEST_ID guest_id, VMEXIT_HANDLER handler, UINT32 reason)
+{
+    (void) guest_id;
+    if (reason == Ia32VmxExitBasicReasonMsrRead) {
+        msr_read_exit = handler;
+    }
+    else if (reason == Ia32VmxExitBasicReasonMsrWrite) {
+        msr_write_exit = handler;
+    }
+    return VMM_OK;
+}
+
+UINT64 gcpu_get_native_gp_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_GP_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    return msr_gp_regs[reg];
+}
+
+void gcpu_set_native_gp_reg_layered(GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_GP_REGISTERS reg, UINT64 value, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    msr_gp_regs[reg] = value;
+}
+
+UINT64 gcpu_get_gp_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_GP_REGISTERS reg, VMCS_LEVEL level)
+{
+    return gcpu_get_native_gp_reg_layered(gcpu, reg, level);
+}
+
+void gcpu_set_gp_reg_layered(GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_GP_REGISTERS reg, UINT64 value, VMCS_LEVEL level)
+{
+    gcpu_set_native_gp_reg_layered(gcpu, reg, value, level);
+}
+
+UINT64 gcpu_get_msr_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_MODEL_SPECIFIC_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    return msr_msr_regs[reg];
+}
+
+void gcpu_set_msr_reg_layered(GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_MODEL_SPECIFIC_REGISTERS reg, UINT64 value, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    msr_msr_regs[reg] = value;
+}
+
+UINT64 gcpu_get_guest_visible_control_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_CONTROL_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) reg;
+    (void) level;
+    return 0;
+}
+
+UINT32 gcpu_get_interruptibility_state_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    return 0;
+}
+
+void gcpu_set_interruptibility_state_layered(const GUEST_CPU_HANDLE gcpu,
+                    UINT32 value, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) value;
+    (void) level;
+}
+
+void gcpu_skip_guest_instruction(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    msr_skipped++;
+}
+
+BOOLEAN gcpu_inject_gp0(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    msr_injected++;
+    return TRUE;
+}
+
+BOOLEAN gcpu_inject_event(GUEST_CPU_HANDLE gcpu, VMENTER_EVENT *p_event)
+{
+    (void) gcpu;
+    (void) p_event;
+    msr_injected++;
+    return TRUE;
+}
+
+void gcpu_control_setup_only(GUEST_CPU_HANDLE gcpu, const VMEXIT_CONTROL* request)
+{
+    (void) gcpu;
+    (void) request;
+}
+
+void gcpu_control_apply_only(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+}
+
+void gcpu_resume(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+}
+
+UINT64 vmcs_read(const struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id)
+{
+    (void) vmcs;
+    return msr_vmcs_fields[field_id];
+}
+
+void vmcs_write(struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id, UINT64 value)
+{
+    (void) vmcs;
+    msr_vmcs_fields[field_id] = value;
+}
+
+BOOLEAN vmcs_field_is_supported(VMCS_FIELD field_id)
+{
+    (void) field_id;
+    return TRUE;
+}
+
+// no unrestricted guest: the EFER handlers are registered
+const VMCS_HW_CONSTRAINTS* vmcs_hw_get_vmx_constraints(void)
+{
+    return &msr_constraints;
+}
+
+BOOLEAN hmm_hva_to_hpa(IN HVA hva, OUT HPA* hpa)
+{
+    *hpa = hva;
+    return TRUE;
+}
+
+BOOLEAN hw_rdmsr_safe(UINT32 msr_id, UINT64 *value, VECTOR_ID *fault_vector, UINT32 *error_code)
+{
+    (void) fault_vector;
+    (void) error_code;
+    msr_hw_accesses++;
+    *value = msr_id;
+    return TRUE;
+}
+
+BOOLEAN hw_wrmsr_safe(UINT32 msr_id, UINT64 value, VECTOR_ID *fault_vector, UINT32 *error_code)
+{
+    (void) msr_id;
+    (void) value;
+    (void) fault_vector;
+    (void) error_code;
+    msr_hw_accesses++;
+    return TRUE;
+}
+
+void hw_write_msr(UINT32 msr_id, UINT64 value)
+{
+    (void) msr_id;
+    (void) value;
+    msr_hw_accesses++;
+}
+
+UINT32 mtrrs_abstraction_get_num_of_variable_range_regs(void)
+{
+    return MSR_NUM_OF_VARIABLE_MTRRS;
+}
+
+BOOLEAN mtrrs_abstraction_track_mtrr_update(UINT32 mtrr_index, UINT64 value)
+{
+    (void) mtrr_index;
+    (void) value;
+    msr_mtrr_updates++;
+    return TRUE;
+}
+
+void local_apic_setup_changed(void)
+{
+}
+
+BOOLEAN validate_APIC_BASE_change(UINT64 value)
+{
+    (void) value;
+    return TRUE;
+}
+
+BOOLEAN report_uvmm_event(UVMM_EVENT event, VMM_IDENTIFICATION_DATA gcpu,
+                    const GUEST_VCPU *vcpu_id, void *event_specific_data)
+{
+    (void) event;
+    (void) gcpu;
+    (void) vcpu_id;
+    (void) event_specific_data;
+    return TRUE;
+}
+
+BOOLEAN event_raise(UVMM_EVENT_INTERNAL e, GUEST_CPU_HANDLE gcpu, void *p)
+{
+    (void) e;
+    (void) gcpu;
+    (void) p;
+    return TRUE;
+}
+
+void vmm_deadloop_internal(UINT32 file_code, UINT32 line_num, GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    vmm_printf("deadloop in file %d line %d\n", file_code, line_num);
+    for (;;) {
+    }
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted check and benchmark of the page walk cache of the page walker
+// (memory/memory_manager/page_walker.c) on 64-bit guest page tables.
+//
+// The check walks 4KB and 2MB pages and tells a cache hit from a walk by
+// the guest table entries read. Like the processor TLB, a hit keeps the
+// translation the guest has since changed in its tables, until the guest
+// invalidates it with INVLPG or a MOV to CR3, CR0 or CR4.
+//
+// The benchmark compares a walk that hits the cache with one that misses,
+// cycling over more pages than the cache holds.
+//
+//   pwbench [-n walks]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+// memory/memory_manager/page_walker.c, release build
+#define PW_RETVAL_SUCCESS   0
+#define PW_RETVAL_PF        1
+
+extern void     pw_cache_initialize(void);
+extern int      pw_perform_page_walk(void* gcpu, uint64_t virt_addr, int is_write,
+                    int is_user, int is_fetch, int set_ad_bits,
+                    uint64_t* gpa, uint64_t* pfec);
+// test/pwstubs.c
+extern void*    pwbench_gcpu(void);
+extern void     pwbench_set_memory(void* memory, uint64_t size);
+extern uint64_t pwbench_table_reads(void);
+extern void     pwbench_set_efer(uint64_t efer);
+extern void     pwbench_write_cr(uint32_t cr, uint64_t value);
+extern void     pwbench_invlpg(uint64_t virt_addr);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+
+#define HEAP_SIZE       (1 << 20)
+#define PAGE_SIZE       4096
+
+// VMM_IA32_CONTROL_REGISTERS
+#define CTRL_CR0        0
+#define CTRL_CR3        2
+#define CTRL_CR4        3
+
+#define CR0_PG          (1ULL << 31)
+#define CR0_WP          (1ULL << 16)
+#define CR4_PAE         (1ULL << 5)
+#define CR4_PCIDE       (1ULL << 17)
+#define CR3_NO_FLUSH    (1ULL << 63)
+#define EFER_LME        (1ULL << 8)
+#define EFER_NXE        (1ULL << 11)
+
+#define PTE_P           0x001ULL
+#define PTE_RW          0x002ULL
+#define PTE_US          0x004ULL
+#define PTE_A           0x020ULL
+#define PTE_D           0x040ULL
+#define PTE_PS          0x080ULL
+#define PTE_NX          (1ULL << 63)
+
+// Guest physical memory: PML4 in page 0, PDPT in page 1, PD in page 2,
+// NUM_OF_PTS page tables from page 4. VA_BASE is mapped by 4KB pages
+// to DATA_GPA, the 2MB page at VA_2MB to GPA_2MB.
+#define NUM_OF_PTS      8
+#define NUM_OF_PAGES    (NUM_OF_PTS * 512)
+#define MEMORY_PAGES    (4 + NUM_OF_PTS)
+#define VA_BASE         0x40000000ULL
+#define VA_2MB          (VA_BASE + NUM_OF_PTS * 0x200000ULL)
+#define DATA_GPA        0x80000000ULL
+#define GPA_2MB         0xc0000000ULL
+
+static uint64_t* g_memory;
+
+static uint64_t* table(uint32_t page)
+{
+    return g_memory + page * (PAGE_SIZE / sizeof(uint64_t));
+}
+
+static uint64_t* pte_of(uint32_t page_no)
+{
+    return &table(4 + page_no / 512)[page_no % 512];
+}
+
+static void build_tables(void)
+{
+    uint32_t i;
+
+    memset(g_memory, 0, MEMORY_PAGES * PAGE_SIZE);
+    table(0)[0] = (1 * PAGE_SIZE) | PTE_P | PTE_RW | PTE_US;
+    table(1)[1] = (2 * PAGE_SIZE) | PTE_P | PTE_RW | PTE_US;
+    for (i = 0; i < NUM_OF_PTS; i++) {
+        table(2)[i] = ((4 + i) * PAGE_SIZE) | PTE_P | PTE_RW | PTE_US;
+    }
+    table(2)[NUM_OF_PTS] = GPA_2MB | PTE_P | PTE_RW | PTE_PS;
+    for (i = 0; i < NUM_OF_PAGES; i++) {
+        *pte_of(i) = (DATA_GPA + (uint64_t) i * PAGE_SIZE) | PTE_P | PTE_RW | PTE_US;
+    }
+}
+
+static int g_errors;
+
+#define CHECK(__condition, __what)                                          \
+    do {                                                                    \
+        if (!(__condition)) {                                               \
+            printf("line %d: %s\n", __LINE__, __what);                      \
+            g_errors++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// walks virt_addr, returns the table entries read, 0 on a cache hit
+static uint64_t walk(uint64_t virt_addr, int is_write, int is_user, int set_ad_bits,
+                     int* retval, uint64_t* gpa)
+{
+    uint64_t reads = pwbench_table_reads();
+    uint64_t pfec = 0;
+
+    *retval = pw_perform_page_walk(pwbench_gcpu(), virt_addr, is_write, is_user,
+                                   0, set_ad_bits, gpa, &pfec);
+    return pwbench_table_reads() - reads;
+}
+
+static void check(void)
+{
+    uint64_t va = VA_BASE + 5 * PAGE_SIZE;
+    uint64_t gpa;
+    int retval;
+
+    // a walk, then a hit for any offset in the page and any access allowed
+    CHECK(walk(va + 0x10, 0, 0, 0, &retval, &gpa) == 4, "4KB walk reads 4 entries");
+    CHECK(retval == PW_RETVAL_SUCCESS && gpa == DATA_GPA + 5 * PAGE_SIZE + 0x10, "4KB walk");
+    CHECK(walk(va + 0x234, 1, 1, 0, &retval, &gpa) == 0, "4KB hit");
+    CHECK(retval == PW_RETVAL_SUCCESS && gpa == DATA_GPA + 5 * PAGE_SIZE + 0x234, "4KB hit gpa");
+
+    // a hit keeps the old translation until INVLPG
+    *pte_of(5) = (DATA_GPA + 0x100000) | PTE_P | PTE_US;
+    CHECK(walk(va, 0, 0, 0, &retval, &gpa) == 0, "hit before INVLPG");
+    CHECK(gpa == DATA_GPA + 5 * PAGE_SIZE, "old translation before INVLPG");
+    pwbench_invlpg(va + 0x800);
+    CHECK(walk(va, 0, 0, 0, &retval, &gpa) == 4, "walk after INVLPG");
+    CHECK(retval == PW_RETVAL_SUCCESS && gpa == DATA_GPA + 0x100000, "new translation");
+    // INVLPG of another page leaves the entry
+    pwbench_invlpg(va + PAGE_SIZE);
+    CHECK(walk(va, 0, 0, 0, &retval, &gpa) == 0, "hit after INVLPG of another page");
+
+    // the page is now read only: a write walks the tables and faults
+    CHECK(walk(va, 1, 1, 0, &retval, &gpa) == 4, "write to read only page walks");
+    CHECK(retval == PW_RETVAL_PF, "write to read only page faults");
+
+    // a hit must not skip setting the A/D bits, the walk after sets them
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "walk without A/D");
+    CHECK(walk(VA_BASE, 1, 0, 1, &retval, &gpa) == 4, "walk setting A/D");
+    CHECK((*pte_of(0) & (PTE_A | PTE_D)) == (PTE_A | PTE_D), "A/D bits set");
+    CHECK(walk(VA_BASE, 1, 0, 1, &retval, &gpa) == 0, "hit with A/D set");
+
+    // INVLPG anywhere in a 2MB page invalidates it
+    CHECK(walk(VA_2MB + 0x1234, 0, 0, 0, &retval, &gpa) == 3, "2MB walk reads 3 entries");
+    CHECK(retval == PW_RETVAL_SUCCESS && gpa == GPA_2MB + 0x1234, "2MB walk");
+    CHECK(walk(VA_2MB + 0x1ff000, 0, 0, 0, &retval, &gpa) == 3, "other 4KB of the 2MB page walks");
+    CHECK(walk(VA_2MB + 0x1ff008, 0, 0, 0, &retval, &gpa) == 0, "2MB hit");
+    CHECK(gpa == GPA_2MB + 0x1ff008, "2MB hit gpa");
+    pwbench_invlpg(VA_2MB + 0x100000);
+    CHECK(walk(VA_2MB + 0x1234, 0, 0, 0, &retval, &gpa) == 3, "2MB walk after INVLPG");
+    CHECK(walk(VA_2MB + 0x1ff008, 0, 0, 0, &retval, &gpa) == 3, "2MB walk after INVLPG");
+    // user access to a supervisor 2MB page faults, from the cache or not
+    CHECK(walk(VA_2MB, 0, 1, 0, &retval, &gpa) == 3 && retval == PW_RETVAL_PF, "user access faults");
+
+    // MOV to CR3 flushes everything
+    pwbench_write_cr(CTRL_CR3, 0);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "walk after MOV to CR3");
+    // and so do MOV to CR0 and CR4
+    pwbench_write_cr(CTRL_CR0, CR0_PG | CR0_WP);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "walk after MOV to CR0");
+    pwbench_write_cr(CTRL_CR4, CR4_PAE | CR4_PCIDE);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "walk after MOV to CR4");
+
+    // with CR4.PCIDE, MOV to CR3 flushes the new PCID unless bit 63 is set
+    pwbench_write_cr(CTRL_CR3, 1);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "walk with PCID 1");
+    pwbench_write_cr(CTRL_CR3, 2);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "walk with PCID 2");
+    pwbench_write_cr(CTRL_CR3, 1 | CR3_NO_FLUSH);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 0, "PCID 1 kept");
+    pwbench_write_cr(CTRL_CR3, 2 | CR3_NO_FLUSH);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 0, "PCID 2 kept");
+    pwbench_write_cr(CTRL_CR3, 1);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 4, "PCID 1 flushed");
+    pwbench_write_cr(CTRL_CR3, 2 | CR3_NO_FLUSH);
+    CHECK(walk(VA_BASE, 0, 0, 0, &retval, &gpa) == 0, "PCID 2 not flushed");
+    pwbench_write_cr(CTRL_CR4, CR4_PAE);
+    pwbench_write_cr(CTRL_CR3, 0);
+}
+
+// ns per walk of num_of_pages pages in turn
+static double bench(uint32_t num_of_pages, uint32_t walks)
+{
+    struct timespec start, end;
+    uint64_t gpa, pfec, sum = 0;
+    uint32_t i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < walks; i++) {
+        pw_perform_page_walk(pwbench_gcpu(), VA_BASE + (uint64_t)(i % num_of_pages) * PAGE_SIZE,
+                             0, 0, 0, 0, &gpa, &pfec);
+        sum += gpa;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    __asm__ volatile("" : : "r" (sum));
+    return ((double)(end.tv_sec - start.tv_sec) * 1e9 +
+            (double)(end.tv_nsec - start.tv_nsec)) / walks;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t walks = 10000000;
+    void* heap;
+    uint64_t reads;
+    double hit, miss;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            walks = (uint32_t) strtoul(argv[++i], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n walks]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (walks == 0 ||
+        posix_memalign(&heap, PAGE_SIZE, HEAP_SIZE) != 0 ||
+        posix_memalign((void**) &g_memory, PAGE_SIZE, MEMORY_PAGES * PAGE_SIZE) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+    build_tables();
+    pwbench_set_memory(g_memory, MEMORY_PAGES * PAGE_SIZE);
+    pwbench_set_efer(EFER_LME | EFER_NXE);
+    pwbench_write_cr(CTRL_CR0, CR0_PG | CR0_WP);
+    pwbench_write_cr(CTRL_CR4, CR4_PAE);
+    pwbench_write_cr(CTRL_CR3, 0);
+
+    pw_cache_initialize();
+    check();
+    printf("check: %s\n", g_errors ? "FAILED" : "passed");
+
+    build_tables();
+    pwbench_write_cr(CTRL_CR3, 0);
+    reads = pwbench_table_reads();
+    hit = bench(16, walks);
+    reads = pwbench_table_reads() - reads;
+    miss = bench(NUM_OF_PAGES, walks);
+    printf("\n%-6s %12s\n", "walk", "ns per walk");
+    printf("%-6s %12.1f   (%llu table reads)\n", "hit", hit, (unsigned long long) reads);
+    printf("%-6s %12.1f\n", "miss", miss);
+    free(g_memory);
+    free(heap);
+    return g_errors ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the page walker (page_walker.c) with a check of its
+# page walk cache and a benchmark of cache hits and misses.
+#   make -f pwbench.mak && pwbench.exe [-n walks]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/page_walker.o $(B)/heap.o $(B)/pwstubs.o $(B)/hoststubs.o \
+            $(B)/pwbench.o
+
+all: $(E)/pwbench.exe
+ 
+$(E)/pwbench.exe: $(dobjs)
+	@echo "pwbench.exe"
+	$(LINK) -o $(E)/pwbench.exe $(dobjs)
+
+$(B)/page_walker.o: $(mainsrc)/memory/memory_manager/page_walker.c
+	echo "page_walker.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/page_walker.o $(mainsrc)/memory/memory_manager/page_walker.c
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/pwstubs.o: $(mainsrc)/test/pwstubs.c
+	echo "pwstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/pwstubs.o $(mainsrc)/test/pwstubs.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/pwbench.o: $(mainsrc)/test/pwbench.c
+	echo "pwbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/pwbench.o $(mainsrc)/test/pwbench.c
+
+clean:
+	rm -f $(E)/pwbench.exe
+	rm -f $(dobjs)
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the guest, guest CPU, event, GPM and HMM services
+// the page walker (memory/memory_manager/page_walker.c) depends on: one
+// guest with one guest CPU whose control registers and EFER are set by
+// pwbench.c, and a guest physical memory of pwbench.c where GPA == HPA
+// and the HVA is the address in the buffer. Built with the VMM include
+// paths.
+
+#include "file_codes.h"
+#define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(PAGE_WALKER_C)
+#define VMM_ASSERT(__condition) VMM_ASSERT_LOG(PAGE_WALKER_C, __condition)
+#include "vmm_defs.h"
+#include "vmm_dbg.h"
+#include "common_libc.h"
+#include "hw_interlocked.h"
+#include "guest.h"
+#include "guest_cpu.h"
+#include "gpm_api.h"
+#include "host_memory_manager_api.h"
+#include "event_mgr.h"
+#include "vmm_events_data.h"
+
+
+#define PWSTUBS_MAX_CALLBACKS   8
+
+typedef struct {
+    UVMM_EVENT_INTERNAL event;
+    event_callback      call;
+} PWSTUBS_CALLBACK;
+
+static UINT8            pw_guest_object;
+static UINT8            pw_gcpu_object;
+static UINT8            pw_gpm_object;
+static VIRTUAL_CPU_ID   pw_vcpu = { 0, 0 };
+static void*            pw_cache;
+static UINT64           pw_ctrl_regs[IA32_CTRL_COUNT];
+static UINT64           pw_efer;
+static UINT8*           pw_memory;
+static UINT64           pw_memory_size;
+static UINT64           pw_table_reads;
+static PWSTUBS_CALLBACK pw_callbacks[PWSTUBS_MAX_CALLBACKS];
+static UINT32           pw_num_of_callbacks;
+
+#define PW_GCPU     ((GUEST_CPU_HANDLE) &pw_gcpu_object)
+#define PW_GUEST    ((GUEST_HANDLE) &pw_guest_object)
+
+
+// pwbench.c interface
+void* pwbench_gcpu(void)
+{
+    return PW_GCPU;
+}
+
+void pwbench_set_memory(void* memory, UINT64 size)
+{
+    pw_memory = (UINT8*) memory;
+    pw_memory_size = size;
+}
+
+// guest page table entries read by the walks
+UINT64 pwbench_table_reads(void)
+{
+    return pw_table_reads;
+}
+
+void pwbench_set_efer(UINT64 efer)
+{
+    pw_efer = efer;
+}
+
+static void pw_raise(UVMM_EVENT_INTERNAL event, void* data)
+{
+    UINT32 i;
+
+    for (i = 0; i < pw_num_of_callbacks; i++) {
+        if (pw_callbacks[i].event == event) {
+            pw_callbacks[i].call(PW_GCPU, data);
+        }
+    }
+}
+
+// the guest's MOV to CR0, CR3 or CR4
+void pwbench_write_cr(UINT32 cr, UINT64 value)
+{
+    EVENT_GCPU_GUEST_CR_WRITE_DATA data;
+
+    pw_ctrl_regs[cr] = value;
+    data.new_guest_visible_value = value;
+    switch (cr) {
+    case IA32_CTRL_CR0:
+        pw_raise(EVENT_GCPU_AFTER_GUEST_CR0_WRITE, &data);
+        break;
+    case IA32_CTRL_CR3:
+        pw_raise(EVENT_GCPU_AFTER_GUEST_CR3_WRITE, &data);
+        break;
+    case IA32_CTRL_CR4:
+        pw_raise(EVENT_GCPU_AFTER_GUEST_CR4_WRITE, &data);
+        break;
+    default:
+        break;
+    }
+}
+
+// the guest's INVLPG
+void pwbench_invlpg(UINT64 virt_addr)
+{
+    EVENT_GCPU_INVALIDATE_PAGE_DATA data;
+
+    data.invlpg_addr = virt_addr;
+    pw_raise(EVENT_GCPU_INVALIDATE_PAGE, &data);
+}
+
+
+// one guest of one guest CPU
+GUEST_HANDLE guest_first(GUEST_ECONTEXT* context)
+{
+    *context = PW_GUEST;
+    return PW_GUEST;
+}
+
+GUEST_HANDLE guest_next(GUEST_ECONTEXT* context)
+{
+    *context = NULL;
+    return NULL;
+}
+
+GUEST_CPU_HANDLE guest_gcpu_first(const GUEST_HANDLE guest, GUEST_GCPU_ECONTEXT* context)
+{
+    (void) guest;
+    (void) context;
+    return PW_GCPU;
+}
+
+GUEST_CPU_HANDLE guest_gcpu_next(GUEST_GCPU_ECONTEXT* context)
+{
+    (void) context;
+    return NULL;
+}
+
+const VIRTUAL_CPU_ID* guest_vcpu(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return &pw_vcpu;
+}
+
+GUEST_HANDLE gcpu_guest_handle(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return PW_GUEST;
+}
+
+GPM_HANDLE gcpu_get_current_gpm(GUEST_HANDLE guest)
+{
+    (void) guest;
+    return (GPM_HANDLE) &pw_gpm_object;
+}
+
+BOOLEAN gcpu_uses_host_page_tables(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return FALSE;
+}
+
+UINT64 gcpu_get_guest_visible_control_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_CONTROL_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    return pw_ctrl_regs[reg];
+}
+
+UINT64 gcpu_get_msr_reg_layered(const GUEST_CPU_HANDLE gcpu,
+                    VMM_IA32_MODEL_SPECIFIC_REGISTERS reg, VMCS_LEVEL level)
+{
+    (void) gcpu;
+    (void) level;
+    return (reg == IA32_VMM_MSR_EFER) ? pw_efer : 0;
+}
+
+void* gcpu_get_page_walk_cache(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return pw_cache;
+}
+
+void gcpu_set_page_walk_cache(GUEST_CPU_HANDLE gcpu, void* cache)
+{
+    (void) gcpu;
+    pw_cache = cache;
+}
+
+BOOLEAN event_global_register(UVMM_EVENT_INTERNAL e, event_callback call)
+{
+    (void) e;
+    (void) call;
+    return TRUE;
+}
+
+BOOLEAN event_gcpu_register(UVMM_EVENT_INTERNAL e, GUEST_CPU_HANDLE gcpu,
+                    event_callback call)
+{
+    (void) gcpu;
+    if (pw_num_of_callbacks == PWSTUBS_MAX_CALLBACKS) {
+        return FALSE;
+    }
+    pw_callbacks[pw_num_of_callbacks].event = e;
+    pw_callbacks[pw_num_of_callbacks].call = call;
+    pw_num_of_callbacks++;
+    return TRUE;
+}
+
+BOOLEAN gpm_gpa_to_hpa(IN GPM_HANDLE gpm_handle, IN GPA gpa, OUT HPA* hpa,
+                    OUT MAM_ATTRIBUTES *hpa_attrs)
+{
+    (void) gpm_handle;
+    (void) hpa_attrs;
+    if (gpa >= pw_memory_size) {
+        return FALSE;
+    }
+    *hpa = gpa;
+    return TRUE;
+}
+
+BOOLEAN hmm_hpa_to_hva(IN HPA hpa, OUT HVA* hva)
+{
+    if (hpa >= pw_memory_size) {
+        return FALSE;
+    }
+    pw_table_reads++;
+    *hva = (HVA)(pw_memory + hpa);
+    return TRUE;
+}
+
+INT32 hw_interlocked_compare_exchange(INT32 volatile * destination,
+                                      INT32 expected, INT32 comperand)
+{
+    return __sync_val_compare_and_swap(destination, expected, comperand);
+}
@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted simulation of the guest scheduler (guest/scheduler/scheduler.c)
+// on one host CPU shared by several vCPUs.
+//
+// Time is a virtual TSC. Each vCPU runs a workload that makes a VM exit
+// at a fixed interval and may halt for a while after running for a while.
+// Every VM exit and every vCPU state swap costs a fixed number of ticks.
+// The scheduler is compared with the policy it replaces ("old"), which
+// swapped to the next ready vCPU after every VM exit and did not see HLT.
+//
+//   schedbench [-s seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define TSC_HZ          1000000000ULL           // 1 tick per ns
+#define EXIT_COST       1000ULL                 // ticks per VM exit
+#define SWAP_COST       4000ULL                 // ticks per swap out + swap in
+#define MAX_VCPUS       8
+#define TIMER_RATE      5                       // must match schedstubs.c
+#define HLT_EXITING     0x80                    // processor based control bit
+#define VMX_TIMER       0x40                    // pin based control bit
+#define NEVER           UINT64_MAX
+
+// guest/scheduler/scheduler.c, a GUEST_CPU_HANDLE is a VCPU*
+extern void  scheduler_init(uint16_t number_of_host_cpus);
+extern void  scheduler_register_gcpu(void* gcpu_handle, uint16_t host_cpu_id,
+                                     uint8_t schedule_immediately);
+extern void* scheduler_select_initial_gcpu(void);
+extern void* scheduler_select_next_gcpu(void);
+extern uint8_t scheduler_halt_gcpu(void* gcpu);
+
+// vCPU workload
+typedef struct {
+    uint64_t exit_interval;     // run time between VM exits
+    uint64_t run_len;           // run time before HLT, 0 for never
+    uint64_t sleep_len;         // how long a HLT lasts
+    uint32_t weight;
+} WORKLOAD;
+
+typedef struct {
+    WORKLOAD w;
+    uint64_t to_exit;           // run time left to the next VM exit
+    uint64_t to_hlt;            // run time left to the next HLT
+    uint64_t sleep_until;       // end of the current HLT, 0 if running
+    uint64_t timer_ticks;       // VMX preemption timer value
+    int      parked;            // scheduler_halt_gcpu() took it off the CPU
+    int      in_hlt;            // halted in the guest
+    uint64_t pin_ctrls;
+    uint64_t proc_ctrls;
+    uint64_t work;              // ticks of guest work done
+} VCPU;
+
+static uint64_t g_now;
+static uint64_t g_swap_ticks;
+static uint64_t g_swaps;
+static VCPU*    g_swapped_in;
+
+
+// hooks called by schedstubs.c
+uint64_t schedbench_now(void)
+{
+    return g_now;
+}
+
+uint64_t schedbench_tsc_hz(void)
+{
+    return TSC_HZ;
+}
+
+void* schedbench_alloc(uint32_t size)
+{
+    return calloc(1, size);
+}
+
+void schedbench_swap_out(void* vcpu)
+{
+    if (g_swapped_in != (VCPU*) vcpu) {
+        fprintf(stderr, "swap out of a vCPU that is not swapped in\n");
+        exit(1);
+    }
+    g_swapped_in = NULL;
+    g_now += SWAP_COST / 2;
+    g_swap_ticks += SWAP_COST / 2;
+}
+
+void schedbench_swap_in(void* vcpu)
+{
+    g_swapped_in = (VCPU*) vcpu;
+    g_now += SWAP_COST / 2;
+    g_swap_ticks += SWAP_COST / 2;
+    g_swaps++;
+}
+
+void schedbench_request_exits(void* vcpu, uint64_t pin_ctrls, uint64_t proc_ctrls)
+{
+    ((VCPU*) vcpu)->pin_ctrls |= pin_ctrls;
+    ((VCPU*) vcpu)->proc_ctrls |= proc_ctrls;
+}
+
+void schedbench_arm_timer(void* vcpu, uint64_t timer_ticks)
+{
+    ((VCPU*) vcpu)->timer_ticks = timer_ticks;
+}
+
+void schedbench_guest_hlt(void* vcpu)
+{
+    ((VCPU*) vcpu)->in_hlt = 1;
+}
+
+
+typedef struct {
+    const char* name;
+    int         num_vcpus;
+    WORKLOAD    w[MAX_VCPUS];
+} SCENARIO;
+
+static const SCENARIO g_scenarios[] = {
+    { "3 busy vCPUs", 3, {
+        { 50000, 0, 0, 1024 },
+        { 50000, 0, 0, 1024 },
+        { 50000, 0, 0, 1024 } } },
+    { "uneven exits", 3, {
+        { 50000, 0, 0, 1024 },
+        { 20000, 0, 0, 1024 },
+        { 80000, 0, 0, 1024 } } },
+    { "busy + idle", 2, {
+        { 50000, 0, 0, 1024 },
+        { 50000, 1000000, 20000000, 1024 } } },
+    { "4 mostly idle", 4, {
+        { 30000, 2000000, 6000000, 1024 },
+        { 30000, 2000000, 6000000, 1024 },
+        { 30000, 2000000, 6000000, 1024 },
+        { 30000, 2000000, 6000000, 1024 } } },
+};
+
+typedef struct {
+    uint64_t work[MAX_VCPUS];
+    uint64_t total_work;
+    uint64_t swaps;
+    uint64_t swap_ticks;
+    uint64_t exits;
+} RESULT;
+
+static void reset_vcpus(VCPU* vcpus, const SCENARIO* sc)
+{
+    int i;
+
+    memset(vcpus, 0, sizeof(VCPU) * MAX_VCPUS);
+    for (i = 0; i < sc->num_vcpus; i++) {
+        vcpus[i].w = sc->w[i];
+        vcpus[i].to_exit = sc->w[i].exit_interval;
+        vcpus[i].to_hlt = sc->w[i].run_len;
+    }
+    g_now = 0;
+    g_swap_ticks = 0;
+    g_swaps = 0;
+    g_swapped_in = NULL;
+}
+
+static void collect(RESULT* r, const VCPU* vcpus, int num_vcpus, uint64_t exits)
+{
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    for (i = 0; i < num_vcpus; i++) {
+        r->work[i] = vcpus[i].work;
+        r->total_work += vcpus[i].work;
+    }
+    r->swaps = g_swaps;
+    r->swap_ticks = g_swap_ticks;
+    r->exits = exits;
+}
+
+static uint64_t min64(uint64_t a, uint64_t b)
+{
+    return a < b ? a : b;
+}
+
+// Old policy: round-robin after every VM exit. HLT does not exit, the
+// vCPU stays halted on the host CPU until the interrupt that ends it.
+static void run_old(const SCENARIO* sc, uint64_t duration, RESULT* r)
+{
+    VCPU vcpus[MAX_VCPUS];
+    int cur = 0;
+    uint64_t exits = 0;
+
+    reset_vcpus(vcpus, sc);
+    schedbench_swap_in(&vcpus[cur]);
+    while (g_now < duration) {
+        VCPU* v = &vcpus[cur];
+        uint64_t run;
+
+        if (v->sleep_until != 0) {
+            // halted in the guest, the interrupt that ends the halt exits
+            if (v->sleep_until > g_now) {
+                g_now = v->sleep_until;
+            }
+            v->sleep_until = 0;
+            v->to_hlt = v->w.run_len;
+        }
+        else {
+            run = v->to_exit;
+            if (v->w.run_len != 0) {
+                run = min64(run, v->to_hlt);
+            }
+            g_now += run;
+            v->work += run;
+            v->to_exit -= run;
+            if (v->to_exit == 0) {
+                v->to_exit = v->w.exit_interval;
+            }
+            if (v->w.run_len != 0 && (v->to_hlt -= run) == 0) {
+                v->sleep_until = g_now + v->w.sleep_len;
+                continue;               // HLT, no exit
+            }
+        }
+        g_now += EXIT_COST;
+        exits++;
+        schedbench_swap_out(v);
+        cur = (cur + 1) % sc->num_vcpus;
+        schedbench_swap_in(&vcpus[cur]);
+    }
+    collect(r, vcpus, sc->num_vcpus, exits);
+}
+
+// The scheduler in guest/scheduler/scheduler.c
+static void run_new(const SCENARIO* sc, uint64_t duration, RESULT* r)
+{
+    VCPU vcpus[MAX_VCPUS];
+    VCPU* v;
+    uint64_t exits = 0;
+    uint64_t entry;
+    int i;
+
+    reset_vcpus(vcpus, sc);
+    scheduler_init(1);
+    for (i = 0; i < sc->num_vcpus; i++) {
+        scheduler_register_gcpu(&vcpus[i], 0, 1);
+    }
+    v = (VCPU*) scheduler_select_initial_gcpu();
+    while (g_now < duration) {
+        uint64_t timer_end = NEVER;
+        uint64_t run;
+        int hlt = 0;
+
+        if (v == NULL) {
+            fprintf(stderr, "%s: no vCPU to run\n", sc->name);
+            exit(1);
+        }
+        entry = g_now;
+        if (v->pin_ctrls & VMX_TIMER) {
+            timer_end = entry + (v->timer_ticks << TIMER_RATE);
+        }
+        if (v->parked && v->sleep_until <= g_now) {
+            // woken by the scheduler after the halt ended
+            v->parked = 0;
+            v->sleep_until = 0;
+            v->to_hlt = v->w.run_len;
+        }
+        if (v->parked || v->in_hlt) {
+            // still halted: a parked vCPU resumes after HLT and halts again
+            if (v->parked) {
+                v->parked = 0;
+                v->in_hlt = 0;
+                hlt = 1;
+            }
+            else if (v->sleep_until <= timer_end) {
+                g_now = v->sleep_until;
+                v->in_hlt = 0;
+                v->sleep_until = 0;
+                v->to_hlt = v->w.run_len;
+                continue;               // the interrupt is delivered in the guest
+            }
+            else {
+                g_now = timer_end;
+            }
+        }
+        else {
+            run = v->to_exit;
+            if (v->w.run_len != 0) {
+                run = min64(run, v->to_hlt);
+            }
+            if (timer_end != NEVER) {
+                run = min64(run, timer_end > g_now ? timer_end - g_now : 0);
+            }
+            g_now += run;
+            v->work += run;
+            v->to_exit -= run;
+            if (v->to_exit == 0) {
+                v->to_exit = v->w.exit_interval;
+            }
+            if (v->w.run_len != 0 && (v->to_hlt -= run) == 0) {
+                v->sleep_until = g_now + v->w.sleep_len;
+                hlt = 1;
+            }
+        }
+        g_now += EXIT_COST;
+        exits++;
+        if (hlt) {
+            if (!(v->proc_ctrls & HLT_EXITING)) {
+                fprintf(stderr, "%s: HLT exit not requested\n", sc->name);
+                exit(1);
+            }
+            if (!scheduler_halt_gcpu(v)) {
+                fprintf(stderr, "%s: HLT not handled\n", sc->name);
+                exit(1);
+            }
+            if (!v->in_hlt) {
+                v->parked = 1;
+            }
+        }
+        v = (VCPU*) scheduler_select_next_gcpu();
+        if (v != g_swapped_in) {
+            fprintf(stderr, "%s: selected vCPU is not swapped in\n", sc->name);
+            exit(1);
+        }
+    }
+    collect(r, vcpus, sc->num_vcpus, exits);
+}
+
+// largest deviation from the work share the vCPU weights ask for, among
+// vCPUs that are busy all the time
+static double max_unfairness(const SCENARIO* sc, const RESULT* r)
+{
+    uint64_t busy_work = 0;
+    uint32_t busy_weight = 0;
+    double worst = 0.0;
+    int i;
+
+    for (i = 0; i < sc->num_vcpus; i++) {
+        if (sc->w[i].run_len == 0) {
+            busy_work += r->work[i];
+            busy_weight += sc->w[i].weight;
+        }
+    }
+    for (i = 0; i < sc->num_vcpus && busy_work != 0; i++) {
+        if (sc->w[i].run_len == 0) {
+            double want = (double) sc->w[i].weight / busy_weight;
+            double got = (double) r->work[i] / busy_work;
+            double dev = got > want ? got - want : want - got;
+
+            if (dev > worst) {
+                worst = dev;
+            }
+        }
+    }
+    return worst;
+}
+
+static void print_result(const char* policy, const SCENARIO* sc, const RESULT* r,
+                         uint64_t duration)
+{
+    double seconds = (double) duration / TSC_HZ;
+    int i;
+
+    printf("  %-4s %6.1f%% %9.0f %7.2f%% %8.2f%%  ", policy,
+           100.0 * r->total_work / duration, r->swaps / seconds,
+           100.0 * r->swap_ticks / duration, 100.0 * max_unfairness(sc, r));
+    for (i = 0; i < sc->num_vcpus; i++) {
+        printf(" %5.1f", 100.0 * r->work[i] / duration);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t duration = 2 * TSC_HZ;
+    RESULT old_result, new_result;
+    size_t s;
+    int errors = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            duration = strtoull(argv[++i], NULL, 0) * TSC_HZ;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-s seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+    printf("%d us exit, %d us swap; work and swaps in %% of the host CPU\n",
+           (int)(EXIT_COST / 1000), (int)(SWAP_COST / 1000));
+    printf("  %-4s %7s %9s %8s %9s   %s\n", "", "work", "swaps/s", "swapping",
+           "unfair", "work per vCPU");
+    for (s = 0; s < sizeof(g_scenarios) / sizeof(g_scenarios[0]); s++) {
+        const SCENARIO* sc = &g_scenarios[s];
+
+        printf("%s\n", sc->name);
+        run_old(sc, duration, &old_result);
+        print_result("old", sc, &old_result, duration);
+        run_new(sc, duration, &new_result);
+        print_result("new", sc, &new_result, duration);
+        // busy vCPUs get their weighted share within 2% of the CPU
+        if (max_unfairness(sc, &new_result) > 0.02) {
+            printf("  FAILED: unfair\n");
+            errors++;
+        }
+        if (new_result.total_work < old_result.total_work) {
+            printf("  FAILED: less work done\n");
+            errors++;
+        }
+    }
+    printf("check: %s\n", errors ? "FAILED" : "passed");
+    return errors ? 1 : 0;
+}
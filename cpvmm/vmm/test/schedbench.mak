@@ -0,0 +1,68 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the guest scheduler (scheduler.c) with a simulation of
+# one host CPU shared by several vCPUs.
+#   make -f schedbench.mak && schedbench.exe [-s seconds]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/scheduler.o $(B)/schedstubs.o $(B)/hoststubs.o $(B)/schedbench.o
+
+all: $(E)/schedbench.exe
+ 
+$(E)/schedbench.exe: $(dobjs)
+	@echo "schedbench.exe"
+	$(LINK) -o $(E)/schedbench.exe $(dobjs)
+
+$(B)/scheduler.o: $(mainsrc)/guest/scheduler/scheduler.c
+	echo "scheduler.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/scheduler.o $(mainsrc)/guest/scheduler/scheduler.c
+
+$(B)/schedstubs.o: $(mainsrc)/test/schedstubs.c
+	echo "schedstubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/schedstubs.o $(mainsrc)/test/schedstubs.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/schedbench.o: $(mainsrc)/test/schedbench.c
+	echo "schedbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/schedbench.o $(mainsrc)/test/schedbench.c
+
+clean:
+	rm -f $(E)/schedbench.exe
+	rm -f $(dobjs)
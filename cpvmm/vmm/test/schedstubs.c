@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted stand-ins for the guest CPU, VMCS and timing services the guest
+// scheduler (guest/scheduler/scheduler.c) depends on. They forward to the
+// simulated host CPU in schedbench.c; a GUEST_CPU_HANDLE is a pointer to
+// one of its simulated vCPUs. Built with the VMM include paths.
+
+#include "vmm_defs.h"
+#include "common_libc.h"
+#include "lock.h"
+#include "hw_utils.h"
+#include "hw_interlocked.h"
+#include "guest_cpu.h"
+#include "vmcs_api.h"
+#include "vmcs_init.h"
+#include "vmexit.h"
+#include "memory_allocator.h"
+
+
+// schedbench.c
+extern UINT64 schedbench_now(void);
+extern UINT64 schedbench_tsc_hz(void);
+extern void*  schedbench_alloc(UINT32 size);
+extern void   schedbench_swap_in(void* vcpu);
+extern void   schedbench_swap_out(void* vcpu);
+extern void   schedbench_request_exits(void* vcpu, UINT64 pin_ctrls, UINT64 proc_ctrls);
+extern void   schedbench_arm_timer(void* vcpu, UINT64 timer_ticks);
+extern void   schedbench_guest_hlt(void* vcpu);
+
+#define SCHEDBENCH_VMX_TIMER_RATE   5
+
+UINT64 hw_rdtsc(void)
+{
+    return schedbench_now();
+}
+
+UINT64 hw_get_tsc_ticks_per_second(void)
+{
+    return schedbench_tsc_hz();
+}
+
+INT32 hw_interlocked_increment(INT32 * addend)
+{
+    return ++(*addend);
+}
+
+// the benchmark runs one host CPU in one thread
+void lock_initialize_read_write_lock(VMM_READ_WRITE_LOCK * lock)
+{
+    (void) lock;
+}
+
+void interruptible_lock_acquire_readlock(VMM_READ_WRITE_LOCK * lock)
+{
+    (void) lock;
+}
+
+void lock_release_readlock(VMM_READ_WRITE_LOCK * lock)
+{
+    (void) lock;
+}
+
+void interruptible_lock_acquire_writelock(VMM_READ_WRITE_LOCK * lock)
+{
+    (void) lock;
+}
+
+void lock_release_writelock(VMM_READ_WRITE_LOCK * lock)
+{
+    (void) lock;
+}
+
+void* vmm_mem_allocate(char *file_name, INT32 line_number, IN UINT32 size)
+{
+    (void) file_name;
+    (void) line_number;
+    return schedbench_alloc(size);
+}
+
+const VMCS_HW_CONSTRAINTS* vmcs_hw_get_vmx_constraints(void)
+{
+    static VMCS_HW_CONSTRAINTS constraints;
+
+    constraints.may1_pin_based_exec_ctrl.Bits.VmxTimer = 1;
+    constraints.vmx_timer_length = SCHEDBENCH_VMX_TIMER_RATE;
+    return &constraints;
+}
+
+const VIRTUAL_CPU_ID* guest_vcpu(const GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+    return NULL;
+}
+
+void gcpu_swap_in(const GUEST_CPU_HANDLE gcpu)
+{
+    schedbench_swap_in((void*) gcpu);
+}
+
+void gcpu_swap_out(GUEST_CPU_HANDLE gcpu)
+{
+    schedbench_swap_out((void*) gcpu);
+}
+
+void gcpu_control_setup_only(GUEST_CPU_HANDLE gcpu, const VMEXIT_CONTROL* request)
+{
+    schedbench_request_exits((void*) gcpu, request->pin_ctrls.bit_request,
+                             request->proc_ctrls.bit_request);
+}
+
+void gcpu_control_apply_only(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+}
+
+// the VMCS of a simulated vCPU is the vCPU itself
+VMCS_OBJECT* gcpu_get_vmcs_layered(GUEST_CPU_HANDLE gcpu, VMCS_LEVEL level)
+{
+    (void) level;
+    return (VMCS_OBJECT*) gcpu;
+}
+
+void vmcs_write(struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id, UINT64 value)
+{
+    if (field_id == VMCS_PREEMPTION_TIMER) {
+        schedbench_arm_timer((void*) vmcs, value);
+    }
+}
+
+void gcpu_skip_guest_instruction(GUEST_CPU_HANDLE gcpu)
+{
+    (void) gcpu;
+}
+
+void gcpu_set_activity_state_layered(GUEST_CPU_HANDLE gcpu,
+                                     IA32_VMX_VMCS_GUEST_SLEEP_STATE value,
+                                     VMCS_LEVEL level)
+{
+    (void) level;
+    if (value == Ia32VmxVmcsGuestSleepStateHlt) {
+        schedbench_guest_hlt((void*) gcpu);
+    }
+}
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2013 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hosted benchmark of the VMCS shadow cache (utils/cache64.c) as
+// vmx/vmcs_actual.c drives it, on a mock VMREAD/VMWRITE backend that
+// counts the hardware accesses.
+//
+// Every simulated VM exit invalidates the cache (gcpu_vmexit_start),
+// makes the VMCS accesses of one exit handler and flushes the dirty
+// fields before VM entry. The exit mix is CPUID, I/O, EPT violation,
+// CR access, external interrupt and interrupt window exits. Three ways
+// of driving the backend are compared:
+//   direct      every vmcs_read/vmcs_write is a VMREAD/VMWRITE
+//   writeback   a cache miss stores the value read as dirty, so every
+//               field read is written back at VM entry, as before
+//   cache       a cache miss stores the value read as clean, only the
+//               fields written with a new value are written back
+// The access lists are the ones of the handlers; the hardware values
+// are random, so an exit may write back a value the field already has.
+//
+//   vmcsbench [-n exits] [-s seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+// utils/cache64.c, release build; must match include/cache64.h
+#define CACHE_ALL_ENTRIES   ((uint32_t) -1)
+#define CACHE64_MAX_ENTRIES 192
+
+typedef struct {
+    uint8_t slot_of_entry[CACHE64_MAX_ENTRIES];
+    uint8_t entry_of_slot[CACHE64_MAX_ENTRIES];
+} CACHE64_LAYOUT;
+
+typedef void* CACHE64_OBJECT;
+typedef void (*CACHE64_FIELD_PROCESS_FUNCTION)(uint32_t entry_no, uint64_t value, void *arg);
+
+extern void     cache64_layout_init(CACHE64_LAYOUT *layout, uint32_t num_of_entries,
+                    const uint32_t *hot_entries, uint32_t num_of_hot_entries);
+extern CACHE64_OBJECT cache64_create(uint32_t num_of_entries, const CACHE64_LAYOUT *layout);
+extern void     cache64_write(CACHE64_OBJECT cache, uint64_t value, uint32_t entry_no);
+extern int      cache64_read(CACHE64_OBJECT cache, uint64_t *p_value, uint32_t entry_no);
+extern void     cache64_fill(CACHE64_OBJECT cache, uint64_t value, uint32_t entry_no);
+extern void     cache64_invalidate(CACHE64_OBJECT cache, uint32_t entry_no);
+extern void     cache64_flush_dirty(CACHE64_OBJECT cache, uint32_t entry_no,
+                    CACHE64_FIELD_PROCESS_FUNCTION function, void *arg);
+extern int      cache64_is_dirty(CACHE64_OBJECT cache);
+extern void     cache64_destroy(CACHE64_OBJECT cache);
+// utils/heap.c, release build
+extern uint64_t vmm_heap_initialize(uint64_t heap_buffer_address, size_t heap_buffer_size);
+
+#define HEAP_SIZE       (1 << 20)
+#define HEAP_PAGE_SIZE  4096
+
+// The VMCS fields the handlers use, in VMCS_FIELD order; only the order
+// and the number of fields (VMCS_FIELD_COUNT of the release build)
+// matter to the cache.
+enum {
+    VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS = 3,
+    VMCS_EXCEPTION_BITMAP = 5,
+    VMCS_CR0_READ_SHADOW = 9,
+    VMCS_ENTER_CONTROL_VECTOR = 16,
+    VMCS_ENTER_INTERRUPT_INFO,
+    VMCS_ENTER_EXCEPTION_ERROR_CODE,
+    VMCS_ENTER_INSTRUCTION_LENGTH,
+    VMCS_EXIT_INFO_GUEST_PHYSICAL_ADDRESS = 29,
+    VMCS_EXIT_INFO_REASON = 31,
+    VMCS_EXIT_INFO_EXCEPTION_INFO,
+    VMCS_EXIT_INFO_IDT_VECTORING = 34,
+    VMCS_EXIT_INFO_INSTRUCTION_LENGTH = 36,
+    VMCS_EXIT_INFO_INSTRUCTION_INFO,
+    VMCS_EXIT_INFO_QUALIFICATION,
+    VMCS_EXIT_INFO_GUEST_LINEAR_ADDRESS = 43,
+    VMCS_GUEST_CR0 = 49,
+    VMCS_GUEST_CR3,
+    VMCS_GUEST_CR4,
+    VMCS_GUEST_CS_AR = 60,
+    VMCS_GUEST_RSP = 89,
+    VMCS_GUEST_RIP,
+    VMCS_GUEST_RFLAGS,
+    VMCS_GUEST_INTERRUPTIBILITY = 95,
+    VMCS_GUEST_SLEEP_STATE,
+    VMCS_GUEST_EFER = 102,
+    VMCS_FIELD_COUNT = 136
+};
+
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+
+// must match g_hot_fields in vmx/vmcs.c
+static const UINT32 hot_fields[] = {
+    VMCS_EXIT_INFO_REASON,
+    VMCS_EXIT_INFO_QUALIFICATION,
+    VMCS_EXIT_INFO_INSTRUCTION_LENGTH,
+    VMCS_EXIT_INFO_INSTRUCTION_INFO,
+    VMCS_EXIT_INFO_IDT_VECTORING,
+    VMCS_EXIT_INFO_EXCEPTION_INFO,
+    VMCS_EXIT_INFO_GUEST_PHYSICAL_ADDRESS,
+    VMCS_EXIT_INFO_GUEST_LINEAR_ADDRESS,
+    VMCS_GUEST_RIP,
+    VMCS_GUEST_RSP,
+    VMCS_GUEST_RFLAGS,
+    VMCS_GUEST_INTERRUPTIBILITY,
+    VMCS_GUEST_SLEEP_STATE,
+    VMCS_GUEST_CR0,
+    VMCS_GUEST_CR3,
+    VMCS_GUEST_CR4,
+    VMCS_GUEST_CS_AR,
+    VMCS_GUEST_EFER,
+    VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS,
+    VMCS_ENTER_INTERRUPT_INFO,
+    VMCS_ENTER_EXCEPTION_ERROR_CODE,
+    VMCS_ENTER_INSTRUCTION_LENGTH,
+    VMCS_ENTER_CONTROL_VECTOR,
+    VMCS_EXCEPTION_BITMAP,
+};
+
+typedef enum {
+    MODE_DIRECT,
+    MODE_WRITEBACK,
+    MODE_CACHE,
+    NUM_OF_MODES
+} BENCH_MODE;
+
+static const char *mode_names[NUM_OF_MODES] = { "direct", "writeback", "cache" };
+
+// one access of an exit handler; a write of -1 writes back the value read
+#define ACCESS_READ     0
+#define ACCESS_WRITE    1
+#define SAME_VALUE      ((UINT64) -1)
+
+typedef struct {
+    int     type;
+    UINT32  field;
+    UINT64  value;
+} ACCESS;
+
+typedef struct {
+    const char *name;
+    ACCESS      accesses[16];
+} EXIT_HANDLER;
+
+#define R(f)        { ACCESS_READ, f, 0 }
+#define W(f, v)     { ACCESS_WRITE, f, v }
+#define END         { -1, 0, 0 }
+
+// common prologue of vmexit_common_handler: reason and RIP for the
+// initial check, RIP again in the handlers, so the second read hits
+static const EXIT_HANDLER handlers[] = {
+    { "cpuid", { R(VMCS_EXIT_INFO_REASON), R(VMCS_GUEST_RIP),
+        R(VMCS_EXIT_INFO_INSTRUCTION_LENGTH), R(VMCS_GUEST_RIP),
+        W(VMCS_GUEST_RIP, 2), R(VMCS_GUEST_INTERRUPTIBILITY),
+        W(VMCS_GUEST_INTERRUPTIBILITY, SAME_VALUE), END } },
+    { "io", { R(VMCS_EXIT_INFO_REASON), R(VMCS_GUEST_RIP),
+        R(VMCS_EXIT_INFO_QUALIFICATION), R(VMCS_EXIT_INFO_INSTRUCTION_LENGTH),
+        R(VMCS_GUEST_RFLAGS), R(VMCS_GUEST_RIP), W(VMCS_GUEST_RIP, 1),
+        R(VMCS_GUEST_INTERRUPTIBILITY), W(VMCS_GUEST_INTERRUPTIBILITY, SAME_VALUE),
+        END } },
+    { "ept", { R(VMCS_EXIT_INFO_REASON), R(VMCS_GUEST_RIP),
+        R(VMCS_EXIT_INFO_QUALIFICATION), R(VMCS_EXIT_INFO_GUEST_PHYSICAL_ADDRESS),
+        R(VMCS_EXIT_INFO_GUEST_LINEAR_ADDRESS), R(VMCS_EXIT_INFO_IDT_VECTORING),
+        R(VMCS_GUEST_INTERRUPTIBILITY), END } },
+    { "cr", { R(VMCS_EXIT_INFO_REASON), R(VMCS_GUEST_RIP),
+        R(VMCS_EXIT_INFO_QUALIFICATION), R(VMCS_EXIT_INFO_INSTRUCTION_LENGTH),
+        R(VMCS_GUEST_CR0), R(VMCS_GUEST_CR4), R(VMCS_GUEST_CS_AR),
+        R(VMCS_GUEST_EFER), R(VMCS_CR0_READ_SHADOW), W(VMCS_GUEST_CR0, 0x80050033),
+        W(VMCS_CR0_READ_SHADOW, 0x80050033), R(VMCS_GUEST_RIP), W(VMCS_GUEST_RIP, 3),
+        END } },
+    { "interrupt", { R(VMCS_EXIT_INFO_REASON), R(VMCS_GUEST_RIP),
+        R(VMCS_EXIT_INFO_EXCEPTION_INFO), R(VMCS_EXIT_INFO_IDT_VECTORING),
+        R(VMCS_GUEST_INTERRUPTIBILITY), R(VMCS_GUEST_RFLAGS),
+        R(VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS),
+        W(VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS, SAME_VALUE),
+        W(VMCS_ENTER_INTERRUPT_INFO, 0x80000030), END } },
+    { "window", { R(VMCS_EXIT_INFO_REASON), R(VMCS_GUEST_RIP),
+        R(VMCS_GUEST_RFLAGS), R(VMCS_GUEST_INTERRUPTIBILITY),
+        R(VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS),
+        W(VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS, 0x84006172),
+        W(VMCS_ENTER_INTERRUPT_INFO, 0x80000031), END } },
+};
+
+#define NUM_OF_HANDLERS (sizeof(handlers) / sizeof(handlers[0]))
+
+// mock hardware VMCS
+static UINT64 hw_vmcs[VMCS_FIELD_COUNT];
+static UINT64 num_vmreads;
+static UINT64 num_vmwrites;
+
+static UINT64 mock_vmread(UINT32 field)
+{
+    num_vmreads++;
+    return hw_vmcs[field];
+}
+
+static void mock_vmwrite(UINT32 field, UINT64 value)
+{
+    num_vmwrites++;
+    hw_vmcs[field] = value;
+}
+
+static void flush_field(UINT32 field, UINT64 value, void *arg)
+{
+    (void) arg;
+    mock_vmwrite(field, value);
+}
+
+static UINT64 bench_read(BENCH_MODE mode, CACHE64_OBJECT cache, UINT32 field)
+{
+    UINT64 value;
+
+    if (mode == MODE_DIRECT) {
+        return mock_vmread(field);
+    }
+    if (!cache64_read(cache, &value, field)) {
+        value = mock_vmread(field);
+        if (mode == MODE_WRITEBACK) {
+            cache64_write(cache, value, field);
+        }
+        else {
+            cache64_fill(cache, value, field);
+        }
+    }
+    return value;
+}
+
+static void bench_write(BENCH_MODE mode, CACHE64_OBJECT cache, UINT32 field, UINT64 value)
+{
+    if (mode == MODE_DIRECT) {
+        mock_vmwrite(field, value);
+    }
+    else {
+        cache64_write(cache, value, field);
+    }
+}
+
+// the guest runs: the hardware changes the exit information and the
+// guest state
+static void guest_run(unsigned *seed)
+{
+    UINT32 field;
+
+    for (field = 0; field < VMCS_FIELD_COUNT; field += 7) {
+        hw_vmcs[field] = rand_r(seed);
+    }
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    CACHE64_LAYOUT layout;
+    CACHE64_OBJECT cache;
+    uint8_t *heap;
+    struct timespec start, end;
+    unsigned seed_arg = 1;
+    unsigned seed;
+    UINT64 num_exits = 1000000;
+    UINT64 exit_no;
+    UINT64 direct_accesses = 0;
+    UINT64 accesses;
+    UINT64 value = 0;
+    const ACCESS *access;
+    int mode;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            num_exits = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed_arg = (unsigned) strtoul(argv[++i], NULL, 0);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n exits] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // cache64.c allocates from the VMM heap, as in the VMM
+    if (posix_memalign((void **) &heap, HEAP_PAGE_SIZE, HEAP_SIZE) != 0) {
+        return 1;
+    }
+    vmm_heap_initialize((uint64_t)(uintptr_t) heap, HEAP_SIZE);
+
+    cache64_layout_init(&layout, VMCS_FIELD_COUNT, hot_fields,
+                        sizeof(hot_fields) / sizeof(hot_fields[0]));
+    cache = cache64_create(VMCS_FIELD_COUNT, &layout);
+    if (cache == NULL) {
+        fprintf(stderr, "cache64_create failed\n");
+        return 1;
+    }
+
+    printf("%llu exits, %d fields\n", (unsigned long long) num_exits, VMCS_FIELD_COUNT);
+    printf("%-10s %10s %10s %10s %10s %10s\n", "mode", "vmread/ex", "vmwrite/ex",
+           "hw/exit", "avoided", "ns/exit");
+    for (mode = 0; mode < NUM_OF_MODES; mode++) {
+        seed = seed_arg;
+        memset(hw_vmcs, 0, sizeof(hw_vmcs));
+        num_vmreads = 0;
+        num_vmwrites = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (exit_no = 0; exit_no < num_exits; exit_no++) {
+            guest_run(&seed);
+            if (mode != MODE_DIRECT) {
+                cache64_invalidate(cache, CACHE_ALL_ENTRIES);
+            }
+            for (access = handlers[rand_r(&seed) % NUM_OF_HANDLERS].accesses;
+                 access->type >= 0; access++) {
+                if (access->type == ACCESS_READ) {
+                    value = bench_read(mode, cache, access->field);
+                }
+                else {
+                    bench_write(mode, cache, access->field,
+                                access->value == SAME_VALUE ? value : access->value);
+                }
+            }
+            if (mode != MODE_DIRECT && cache64_is_dirty(cache)) {
+                cache64_flush_dirty(cache, CACHE_ALL_ENTRIES, flush_field, NULL);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        accesses = num_vmreads + num_vmwrites;
+        if (mode == MODE_DIRECT) {
+            direct_accesses = accesses;
+        }
+        printf("%-10s %10.2f %10.2f %10.2f %10.2f %10.1f\n", mode_names[mode],
+               (double) num_vmreads / num_exits, (double) num_vmwrites / num_exits,
+               (double) accesses / num_exits,
+               ((double) direct_accesses - (double) accesses) / num_exits,
+               elapsed_seconds(&start, &end) * 1e9 / num_exits);
+    }
+    cache64_destroy(cache);
+    free(heap);
+    return 0;
+}
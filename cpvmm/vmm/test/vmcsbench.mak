@@ -0,0 +1,81 @@
+#############################################################################
+# Copyright (c) 2013 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# Hosted build of the VMCS shadow cache (cache64.c) with a benchmark
+# counting the VMREAD/VMWRITEs it saves on a mock backend.
+#   make -f vmcsbench.mak && vmcsbench.exe [-n exits]
+
+ifndef CPProgramDirectory
+E=		/home/jlm/jlmcrypt
+else
+E=      	$(CPProgramDirectory)
+endif
+ifndef VMSourceDirectory
+S=		/home/jlm/fpDev/fileProxy/cpvmm
+else
+S=      	$(VMSourceDirectory)
+endif
+
+mainsrc=    $(S)/vmm
+
+B=		$(E)/vmmobjects/test
+INCLUDES=	-I$(S)/common/hw -I$(S)/common/include -I$(S)/common/include/arch -I$(S)/common/include/platform -I$(S)/vmm -I$(S)/vmm/include -I$(S)/vmm/include/hw
+
+CFLAGS=     	-Wall -std=gnu99 -Wno-unknown-pragmas -Wno-format -O2 -g
+
+CC=         gcc
+LINK=       gcc
+
+dobjs=      $(B)/cache64.o $(B)/memory_allocator.o $(B)/pool.o $(B)/hash64.o \
+            $(B)/heap.o $(B)/hoststubs.o $(B)/vmcsbench.o
+
+all: $(E)/vmcsbench.exe
+ 
+$(E)/vmcsbench.exe: $(dobjs)
+	@echo "vmcsbench.exe"
+	$(LINK) -o $(E)/vmcsbench.exe $(dobjs)
+
+$(B)/cache64.o: $(mainsrc)/utils/cache64.c
+	echo "cache64.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/cache64.o $(mainsrc)/utils/cache64.c
+
+$(B)/memory_allocator.o: $(mainsrc)/utils/memory_allocator.c
+	echo "memory_allocator.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/memory_allocator.o $(mainsrc)/utils/memory_allocator.c
+
+$(B)/pool.o: $(mainsrc)/memory/memory_manager/pool.c
+	echo "pool.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -I$(mainsrc)/memory/memory_manager -c -o $(B)/pool.o $(mainsrc)/memory/memory_manager/pool.c
+
+$(B)/hash64.o: $(mainsrc)/utils/hash64.c
+	echo "hash64.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hash64.o $(mainsrc)/utils/hash64.c
+
+$(B)/heap.o: $(mainsrc)/utils/heap.c
+	echo "heap.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/heap.o $(mainsrc)/utils/heap.c
+
+$(B)/hoststubs.o: $(mainsrc)/test/hoststubs.c
+	echo "hoststubs.o" 
+	$(CC) $(CFLAGS) $(INCLUDES) -c -o $(B)/hoststubs.o $(mainsrc)/test/hoststubs.c
+
+$(B)/vmcsbench.o: $(mainsrc)/test/vmcsbench.c
+	echo "vmcsbench.o" 
+	$(CC) $(CFLAGS) -c -o $(B)/vmcsbench.o $(mainsrc)/test/vmcsbench.c
+
+clean:
+	rm -f $(E)/vmcsbench.exe
+	rm -f $(dobjs)
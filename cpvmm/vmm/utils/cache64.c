@@ -15,98 +15,114 @@
 #include "vmm_defs.h"
 #include "vmm_dbg.h"
 #include "common_libc.h"
-#include "memory_allocator.h"
+#include "heap.h"
+#include "hw_utils.h"
 #include "cache64.h"
 #include "file_codes.h"
 
 #define VMM_DEADLOOP()          VMM_DEADLOOP_LOG(CACHE64_C)
 #define VMM_ASSERT(__condition) VMM_ASSERT_LOG(CACHE64_C, __condition)
 
+// One block per cache: the dirty and valid words fill the first cache
+// line, the values follow in slot order. A full table is larger than
+// what vmm_malloc() serves with cache line alignment, so the block is a
+// page of its own.
 struct CACHE64_STRUCT {
-    UINT32  num_of_entries;
-    UINT16  bitmap_size; // in bytes
-    UINT16  flags;
-    UINT64 *table;
-    UINT8  *dirty_bits;
-    UINT8  *valid_bits;
+    UINT64  dirty_bits[CACHE64_MAX_WORDS];  // one bit per slot
+    UINT64  valid_bits[CACHE64_MAX_WORDS];
+    const CACHE64_LAYOUT *layout;
+    UINT16  num_of_entries;
+    UINT8   num_of_words;
+    UINT8   flags;
+    UINT32  pad;
+    UINT64  table[CACHE64_MAX_ENTRIES];     // only num_of_entries allocated
 };
 
 //
 // Helper macros
 //
-#define CACHE_FIELD_IS_VALID(__cache, __entry_no)   BITARRAY_GET((__cache)->valid_bits, __entry_no )
-#define CACHE_FIELD_SET_VALID(__cache, __entry_no)  BITARRAY_SET((__cache)->valid_bits, __entry_no )
-#define CACHE_FIELD_CLR_VALID(__cache, __entry_no)  BITARRAY_CLR((__cache)->valid_bits, __entry_no )
-
-#define CACHE_FIELD_IS_DIRTY(__cache, __entry_no)   BITARRAY_GET((__cache)->dirty_bits, __entry_no )
-#define CACHE_FIELD_SET_DIRTY(__cache, __entry_no)  BITARRAY_SET((__cache)->dirty_bits, __entry_no )
-#define CACHE_FIELD_CLR_DIRTY(__cache, __entry_no)  BITARRAY_CLR((__cache)->dirty_bits, __entry_no )
-
-#define ENUMERATE_DIRTY_ENTRIES(__cache, __func, __arg)                        \
-    BITARRAY_ENUMERATE( (__cache)->dirty_bits,                                 \
-                        (__cache)->num_of_entries,                             \
-                        __func, __arg)
-
+#define CACHE_SLOT(__cache, __entry_no)     ((__cache)->layout->slot_of_entry[__entry_no])
+#define CACHE_SLOT_WORD(__slot)             ((__slot) >> 6)
+#define CACHE_SLOT_BIT(__slot)              BIT_VALUE64((__slot) & 63)
+
+#define CACHE_FIELD_IS_VALID(__cache, __slot)                                  \
+    (0 != ((__cache)->valid_bits[CACHE_SLOT_WORD(__slot)] & CACHE_SLOT_BIT(__slot)))
+#define CACHE_FIELD_SET_VALID(__cache, __slot)                                 \
+    ((__cache)->valid_bits[CACHE_SLOT_WORD(__slot)] |= CACHE_SLOT_BIT(__slot))
+#define CACHE_FIELD_CLR_VALID(__cache, __slot)                                 \
+    ((__cache)->valid_bits[CACHE_SLOT_WORD(__slot)] &= ~CACHE_SLOT_BIT(__slot))
+
+#define CACHE_FIELD_IS_DIRTY(__cache, __slot)                                  \
+    (0 != ((__cache)->dirty_bits[CACHE_SLOT_WORD(__slot)] & CACHE_SLOT_BIT(__slot)))
+#define CACHE_FIELD_SET_DIRTY(__cache, __slot)                                 \
+    ((__cache)->dirty_bits[CACHE_SLOT_WORD(__slot)] |= CACHE_SLOT_BIT(__slot))
+#define CACHE_FIELD_CLR_DIRTY(__cache, __slot)                                 \
+    ((__cache)->dirty_bits[CACHE_SLOT_WORD(__slot)] &= ~CACHE_SLOT_BIT(__slot))
+
+
+void cache64_layout_init(CACHE64_LAYOUT *layout, UINT32 num_of_entries,
+                         const UINT32 *hot_entries, UINT32 num_of_hot_entries)
+{
+    UINT32 entry_no;
+    UINT32 slot = 0;
+    UINT32 i;
+
+    VMM_ASSERT(layout);
+    VMM_ASSERT(num_of_entries <= CACHE64_MAX_ENTRIES);
+    vmm_memset(layout->slot_of_entry, 0xFF, sizeof(layout->slot_of_entry));
+    for (i = 0; i < num_of_hot_entries; i++) {
+        entry_no = hot_entries[i];
+        VMM_ASSERT(entry_no < num_of_entries);
+        if (entry_no < num_of_entries && layout->slot_of_entry[entry_no] == 0xFF) {
+            layout->slot_of_entry[entry_no] = (UINT8) slot;
+            layout->entry_of_slot[slot++] = (UINT8) entry_no;
+        }
+    }
+    // the other entries keep their order
+    for (entry_no = 0; entry_no < num_of_entries; entry_no++) {
+        if (layout->slot_of_entry[entry_no] == 0xFF) {
+            layout->slot_of_entry[entry_no] = (UINT8) slot;
+            layout->entry_of_slot[slot++] = (UINT8) entry_no;
+        }
+    }
+}
 
-CACHE64_OBJECT cache64_create(UINT32 num_of_entries)
+CACHE64_OBJECT cache64_create(UINT32 num_of_entries, const CACHE64_LAYOUT *layout)
 {
     struct CACHE64_STRUCT *cache;
-    UINT64 *table;
-    UINT8  *dirty_bits;
-    UINT8  *valid_bits;
-    UINT16 bitmap_size = (UINT16) BITARRAY_SIZE_IN_BYTES(num_of_entries);
-
-
-    cache = vmm_malloc(sizeof(struct CACHE64_STRUCT));
-    table = vmm_malloc(sizeof(UINT64) * num_of_entries);
-    dirty_bits = vmm_malloc(bitmap_size);
-    valid_bits = vmm_malloc(bitmap_size);
-
-    if (NULL != cache && NULL != table && NULL != dirty_bits && NULL != valid_bits) {
-        // everything is OK. fill the fields
-        cache->num_of_entries = num_of_entries;
-        cache->bitmap_size    = bitmap_size;
-        cache->flags          = 0;
-        cache->table          = table;
-        cache->dirty_bits     = dirty_bits;
-        cache->valid_bits     = valid_bits;
-
-        vmm_memset(table, 0, sizeof(*table) * num_of_entries);
-        vmm_memset(dirty_bits, 0, bitmap_size);
-        vmm_memset(valid_bits, 0, bitmap_size);
+    UINT32 size;
+
+    VMM_ASSERT(layout);
+    VMM_ASSERT(num_of_entries <= CACHE64_MAX_ENTRIES);
+    if (num_of_entries > CACHE64_MAX_ENTRIES) {
+        return NULL;
     }
-    else {
+    size = (UINT32) OFFSET_OF(struct CACHE64_STRUCT, table) + sizeof(UINT64) * num_of_entries;
+    VMM_ASSERT(size <= PAGE_4KB_SIZE);
+    cache = vmm_memory_alloc(size);
+    if (NULL == cache) {
         VMM_LOG(mask_anonymous, level_trace,"[cache64] %s: Allocation failed\n", __FUNCTION__);
-        if (NULL != cache) {
-            vmm_mfree(cache);
-        }
-        if (NULL != table) {
-            vmm_mfree(table);
-        }
-        if (NULL != dirty_bits) {
-            vmm_mfree(dirty_bits);
-        }
-        if (NULL != valid_bits) {
-            vmm_mfree(valid_bits);
-        }
-        cache = NULL;
+        return NULL;
     }
-
+    cache->layout         = layout;
+    cache->num_of_entries = (UINT16) num_of_entries;
+    cache->num_of_words   = (UINT8) ((num_of_entries + 63) / 64);
+    cache->flags          = 0;
     return cache;
 }
-extern BOOLEAN vmcs_sw_shadow_disable[];
 
 void cache64_write(CACHE64_OBJECT cache, UINT64 value, UINT32 entry_no)
 {
-    if (vmcs_sw_shadow_disable[hw_cpu_id()])
-        return;
+    UINT32 slot;
+
     VMM_ASSERT(cache);
     VMM_ASSERT(entry_no < cache->num_of_entries);
     if (entry_no < cache->num_of_entries) {
-        if (!(cache->table[entry_no]==value && CACHE_FIELD_IS_VALID(cache, entry_no))) {
-            cache->table[entry_no] = value;
-            CACHE_FIELD_SET_DIRTY(cache, entry_no);
-            CACHE_FIELD_SET_VALID(cache, entry_no);
+        slot = CACHE_SLOT(cache, entry_no);
+        if (!(cache->table[slot]==value && CACHE_FIELD_IS_VALID(cache, slot))) {
+            cache->table[slot] = value;
+            CACHE_FIELD_SET_DIRTY(cache, slot);
+            CACHE_FIELD_SET_VALID(cache, slot);
             BITMAP_SET(cache->flags, CACHE_DIRTY_FLAG);
         }
     }
@@ -116,35 +132,50 @@ void cache64_write(CACHE64_OBJECT cache, UINT64 value, UINT32 entry_no)
 BOOLEAN cache64_read(CACHE64_OBJECT cache, UINT64 *p_value, UINT32 entry_no)
 {
     BOOLEAN is_valid = FALSE;
+    UINT32 slot;
 
-    if (vmcs_sw_shadow_disable[hw_cpu_id()])
-                return FALSE;
     VMM_ASSERT(cache);
     VMM_ASSERT(entry_no < cache->num_of_entries);
     VMM_ASSERT(p_value);
     if (entry_no < cache->num_of_entries) {
-        if (CACHE_FIELD_IS_VALID(cache, entry_no)) {
-            *p_value = cache->table[entry_no];
+        slot = CACHE_SLOT(cache, entry_no);
+        if (CACHE_FIELD_IS_VALID(cache, slot)) {
+            *p_value = cache->table[slot];
             is_valid = TRUE;
         }
     }
     return is_valid;
 }
 
+void cache64_fill(CACHE64_OBJECT cache, UINT64 value, UINT32 entry_no)
+{
+    UINT32 slot;
+
+    VMM_ASSERT(cache);
+    VMM_ASSERT(entry_no < cache->num_of_entries);
+    if (entry_no < cache->num_of_entries) {
+        slot = CACHE_SLOT(cache, entry_no);
+        cache->table[slot] = value;
+        CACHE_FIELD_SET_VALID(cache, slot);
+    }
+}
+
 #ifdef INCLUDE_UNUSED_CODE
 UINT32 cache64_read_raw(CACHE64_OBJECT cache, UINT64 *p_value, UINT32 entry_no)
 {
     UINT32 cache_flags = 0;
+    UINT32 slot;
 
     VMM_ASSERT(cache);
     VMM_ASSERT(entry_no < cache->num_of_entries);
     VMM_ASSERT(p_value);
 
     if (entry_no < cache->num_of_entries) {
-        if (CACHE_FIELD_IS_VALID(cache, entry_no)) {
-            *p_value = cache->table[entry_no];
+        slot = CACHE_SLOT(cache, entry_no);
+        if (CACHE_FIELD_IS_VALID(cache, slot)) {
+            *p_value = cache->table[slot];
             cache_flags = CACHE_VALID_FLAG;
-            if (CACHE_FIELD_IS_DIRTY(cache, entry_no)) {
+            if (CACHE_FIELD_IS_DIRTY(cache, slot)) {
                 cache_flags |= CACHE_DIRTY_FLAG;
             }
         }
@@ -156,17 +187,21 @@ UINT32 cache64_read_raw(CACHE64_OBJECT cache, UINT64 *p_value, UINT32 entry_no)
 // clean valid bits
 void cache64_invalidate(CACHE64_OBJECT cache, UINT32 entry_no)
 {
+    UINT32 i;
+
     VMM_ASSERT(cache);
 
     if (entry_no < cache->num_of_entries) {
         // invalidate specific entry
-        CACHE_FIELD_CLR_VALID(cache, entry_no);
+        CACHE_FIELD_CLR_VALID(cache, CACHE_SLOT(cache, entry_no));
     }
     else {
         // invalidate all entries
         BITMAP_CLR(cache->flags, CACHE_VALID_FLAG);
-        vmm_memset(cache->valid_bits, 0, cache->bitmap_size);
-        vmm_memset(cache->dirty_bits, 0, cache->bitmap_size);
+        for (i = 0; i < cache->num_of_words; i++) {
+            cache->valid_bits[i] = 0;
+            cache->dirty_bits[i] = 0;
+        }
     }
 }
 
@@ -178,26 +213,37 @@ void cache64_flush_dirty(
     void *arg
 )
 {
+    UINT32 slot;
+    UINT32 bit;
+    UINT32 i;
+    UINT64 dirty;
+
     VMM_ASSERT(cache);
 
     if (entry_no < cache->num_of_entries) {
         // flush specific entry
-        if (CACHE_FIELD_IS_DIRTY(cache, entry_no)) {
-            CACHE_FIELD_CLR_DIRTY(cache, entry_no);
+        slot = CACHE_SLOT(cache, entry_no);
+        if (CACHE_FIELD_IS_DIRTY(cache, slot)) {
+            CACHE_FIELD_CLR_DIRTY(cache, slot);
             if (NULL != function) {
-                function(entry_no, arg);
+                function(entry_no, cache->table[slot], arg);
             }
         }
     }
     else {
-        // flush all entries
+        // flush all entries: visit the set bits of each dirty word only
         BITMAP_CLR(cache->flags, CACHE_DIRTY_FLAG);
-
-        if (NULL != function) {
-            ENUMERATE_DIRTY_ENTRIES(cache, function, arg);
-        }
-        else {
-            vmm_memset(cache->dirty_bits, 0, cache->bitmap_size);
+        for (i = 0; i < cache->num_of_words; i++) {
+            dirty = cache->dirty_bits[i];
+            cache->dirty_bits[i] = 0;
+            if (NULL == function) {
+                continue;
+            }
+            while (hw_scan_bit_forward64(&bit, dirty)) {
+                dirty &= dirty - 1;
+                slot = i * 64 + bit;
+                function(cache->layout->entry_of_slot[slot], cache->table[slot], arg);
+            }
         }
     }
 }
@@ -206,15 +252,22 @@ void cache64_flush_dirty(
 void cache64_flush_to_memory(CACHE64_OBJECT cache, void *p_dest, 
                              UINT32 max_bytes)
 {
-    UINT32 cache_size = sizeof(*cache->table) * cache->num_of_entries;
+    UINT64 *dest = (UINT64 *) p_dest;
+    UINT32 num_of_entries;
+    UINT32 entry_no;
+
     VMM_ASSERT(cache);
     VMM_ASSERT(p_dest);
 
-    if (cache_size > max_bytes) {
+    num_of_entries = cache->num_of_entries;
+    if (sizeof(*cache->table) * num_of_entries > max_bytes) {
         VMM_LOG(mask_anonymous, level_trace,"[cache64] %s: Warning!!! Destination size less then required\n", __FUNCTION__);
-        cache_size = max_bytes;
+        num_of_entries = max_bytes / sizeof(*cache->table);
+    }
+    // the memory image is in entry order
+    for (entry_no = 0; entry_no < num_of_entries; entry_no++) {
+        dest[entry_no] = cache->table[CACHE_SLOT(cache, entry_no)];
     }
-    vmm_memcpy(p_dest, cache->table, cache_size);
 }
 #endif
 
@@ -229,9 +282,6 @@ BOOLEAN cache64_is_dirty(CACHE64_OBJECT cache)
 void cache64_destroy(CACHE64_OBJECT cache)
 {
     VMM_ASSERT(cache);
-    vmm_mfree(cache->table);
-    vmm_mfree(cache->dirty_bits);
-    vmm_mfree(cache->valid_bits);
-    vmm_mfree(cache);
+    vmm_memory_free(cache);
 }
 
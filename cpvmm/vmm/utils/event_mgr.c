@@ -28,6 +28,8 @@
 #include "guest.h"
 #include "list.h"
 #include "vmm_callback.h"
+#include "hw_utils.h"
+#include "hw_interlocked.h"
 #ifdef JLMDEBUG
 #include "jlmdebug.h"
 #endif
@@ -36,10 +38,25 @@
 #define NO_EVENT_SPECIFIC_LIMIT (UINT32)-1
 
 
-typedef struct _EVENT_ENTRY
+/*
+ *  Observer lists are read-copy-update: a published list is never modified.
+ *  Register/unregister build a new list under the event manager update lock,
+ *  publish it with a single pointer store and retire the old one, which is
+ *  freed once every host CPU has gone through a quiescent point (a VM exit,
+ *  see event_manager_quiescent_point). Raising an event takes no lock.
+ */
+typedef struct _OBSERVER_LIST
 {
-    VMM_READ_WRITE_LOCK     lock;
+    UINT32                  count;
+    UINT32                  pad;
+    struct _OBSERVER_LIST   *next_retired;
+    UINT64                  retire_epoch;
     event_callback          call[OBSERVERS_LIMIT];
+} OBSERVER_LIST;
+
+typedef struct _EVENT_ENTRY
+{
+    OBSERVER_LIST * volatile observers;
 } EVENT_ENTRY, *PEVENT_ENTRY;
 
 typedef struct  _CPU_EVENTS
@@ -60,6 +77,10 @@ typedef struct _EVENT_MANAGER
     HASH64_HANDLE   gcpu_events;
     LIST_ELEMENT    guest_events;
     EVENT_ENTRY     general_event[EVENTS_COUNT]; // events not related to particular gcpu, e.g. guest create
+    VMM_LOCK        update_lock;                 // serializes observer list updates
+    OBSERVER_LIST * volatile retired;            // lists waiting for a grace period
+    volatile UINT64 epoch;                       // incremented when a list is retired
+    volatile UINT64 cpu_epoch[VMM_MAX_CPU_SUPPORTED]; // epoch seen at the last quiescent point
 } EVENT_MANAGER;
 
 UINT32      host_physical_cpus;
@@ -216,8 +237,6 @@ static UINT32  event_observers_limit (UVMM_EVENT_INTERNAL e)
 
 UINT32 event_manager_initialize(UINT32 num_of_host_cpus)
 {
-    PEVENT_ENTRY    general_event;
-    int i;
     GUEST_HANDLE guest = NULL;
     GUEST_ID guest_id = INVALID_GUEST_ID;
     GUEST_ECONTEXT context;
@@ -227,13 +246,11 @@ UINT32 event_manager_initialize(UINT32 num_of_host_cpus)
      *  and in the events enumeration UVMM_EVENT_INTERNAL
      */
     VMM_ASSERT(ARRAY_SIZE(events_characteristics) == EVENTS_COUNT);
+    VMM_ASSERT(num_of_host_cpus <= VMM_MAX_CPU_SUPPORTED);
     host_physical_cpus = num_of_host_cpus;
     vmm_memset( &event_mgr, 0, sizeof( event_mgr ));
     event_mgr.gcpu_events = hash64_create_default_hash(host_physical_cpus * host_physical_cpus);
-    for(i = 0; i < EVENTS_COUNT; i++) {
-        general_event = &(event_mgr.general_event[i]);
-        lock_initialize_read_write_lock(&(general_event->lock));
-    }
+    lock_initialize(&event_mgr.update_lock);
     list_init(&event_mgr.guest_events);
     for(guest = guest_first(&context); guest != NULL; guest = guest_next(&context)) {
         guest_id = guest_get_id(guest);
@@ -249,17 +266,10 @@ UINT32 event_manager_guest_initialize(GUEST_ID guest_id)
     GUEST_GCPU_ECONTEXT gcpu_context;
     GUEST_HANDLE guest = guest_handle(guest_id);
     GUEST_EVENTS *p_new_guest_events;
-    PEVENT_ENTRY event;
-    int i;
 
     p_new_guest_events = vmm_malloc(sizeof(*p_new_guest_events));
     VMM_ASSERT(p_new_guest_events);
     vmm_memset(p_new_guest_events, 0, sizeof(*p_new_guest_events));
-    // init lock for each event
-    for(i = 0; i < EVENTS_COUNT; i++) {
-        event = &(p_new_guest_events->event[i]);
-        lock_initialize_read_write_lock(&(event->lock));
-    }
     p_new_guest_events->guest_id = guest_id;
     /* for each guest/cpu we keep the event (callbacks) array */
     for( gcpu = guest_gcpu_first(guest, &gcpu_context); gcpu; gcpu = guest_gcpu_next(&gcpu_context)) {
@@ -285,8 +295,6 @@ UINT32 event_manager_gcpu_initialize(GUEST_CPU_HANDLE gcpu)
 {
     const VIRTUAL_CPU_ID* p_vcpu = NULL;
     PCPU_EVENTS gcpu_events = NULL;
-    PEVENT_ENTRY event = NULL;
-    int i;
 
 #ifdef JLMDEBUG1
     bprint("event_manager_gcpu_initialize\n");
@@ -295,6 +303,7 @@ UINT32 event_manager_gcpu_initialize(GUEST_CPU_HANDLE gcpu)
     VMM_ASSERT(p_vcpu);
     gcpu_events = (CPU_EVENTS *) vmm_malloc(sizeof(CPU_EVENTS));
     VMM_ASSERT(gcpu_events);
+    vmm_memset(gcpu_events, 0, sizeof(CPU_EVENTS));
 
     VMM_LOG(mask_anonymous, level_trace,
             "event mgr add gcpu guest id=%d cpu id=%d with key %p\n", 
@@ -303,11 +312,6 @@ UINT32 event_manager_gcpu_initialize(GUEST_CPU_HANDLE gcpu)
     hash64_insert(event_mgr.gcpu_events,
              (UINT64) (p_vcpu->guest_id<<(8*sizeof(GUEST_ID))|p_vcpu->guest_cpu_id),
              (UINT64) gcpu_events);
-    // init lock for each event
-    for(i = 0; i < EVENTS_COUNT; i++) {
-        event = &(gcpu_events->event[i]);
-        lock_initialize_read_write_lock(&(event->lock));
-    }
     return 0;
 }
 #ifdef INCLUDE_UNUSED_CODE
@@ -318,29 +322,95 @@ void event_cleanup_event_manger(void)
 }
 #endif
 
+// Publish new observer list for event, retire the old one.
+// Must be called with update lock held.
+static void event_publish_observers(PEVENT_ENTRY p_event, OBSERVER_LIST *observers)
+{
+    OBSERVER_LIST *old_observers = p_event->observers;
+
+    // the list must be complete before it becomes visible to raisers
+    hw_store_fence();
+    p_event->observers = observers;
+    if (NULL != old_observers) {
+        old_observers->retire_epoch = event_mgr.epoch + 1;
+        old_observers->next_retired = event_mgr.retired;
+        event_mgr.retired = old_observers;
+        // raisers which load the list after the epoch changed see the new one
+        hw_store_fence();
+        event_mgr.epoch = old_observers->retire_epoch;
+    }
+}
+
+// Free retired lists that no host CPU can still be walking.
+static void event_reclaim_observers(void)
+{
+    OBSERVER_LIST *observers;
+    OBSERVER_LIST **pp_observers;
+    UINT64 min_epoch = (UINT64) -1;
+    UINT32 cpu_id;
+
+    lock_acquire(&event_mgr.update_lock);
+    for (cpu_id = 0; cpu_id < host_physical_cpus; cpu_id++) {
+        if (event_mgr.cpu_epoch[cpu_id] < min_epoch)
+            min_epoch = event_mgr.cpu_epoch[cpu_id];
+    }
+    pp_observers = (OBSERVER_LIST **) &event_mgr.retired;
+    while (NULL != (observers = *pp_observers)) {
+        if (observers->retire_epoch <= min_epoch) {
+            *pp_observers = observers->next_retired;
+            vmm_mfree(observers);
+        }
+        else {
+            pp_observers = &observers->next_retired;
+        }
+    }
+    lock_release(&event_mgr.update_lock);
+}
+
+void event_manager_quiescent_point(void)
+{
+    CPU_ID cpu_id = hw_cpu_id();
+    UINT64 epoch = event_mgr.epoch;
+
+    // Written only when changed, to keep the cache line shared. The last
+    // CPU to catch up with the epoch of a retired list is the one to free it.
+    if (event_mgr.cpu_epoch[cpu_id] != epoch) {
+        event_mgr.cpu_epoch[cpu_id] = epoch;
+        if (NULL != event_mgr.retired)
+            event_reclaim_observers();
+    }
+}
+
 BOOLEAN event_register_internal(PEVENT_ENTRY p_event,
     UVMM_EVENT_INTERNAL  e, event_callback  call)
 {
-    UINT32  i = 0;
     UINT32  observers_limits;
+    OBSERVER_LIST *old_observers;
+    OBSERVER_LIST *new_observers;
     BOOLEAN registered = FALSE;
 
 #ifdef LMDEBUG
     bprint("event_register_internal\n");
 #endif
     observers_limits = event_observers_limit(e);
-    lock_acquire_writelock(&p_event->lock);
-    //  Find free observer slot
-    while (i < observers_limits && p_event->call[i])
-        ++i;
-    if (i < observers_limits) {
-        p_event->call[i] = call;
+    new_observers = (OBSERVER_LIST *) vmm_malloc(sizeof(OBSERVER_LIST));
+    VMM_ASSERT(new_observers);
+    lock_acquire(&event_mgr.update_lock);
+    old_observers = p_event->observers;
+    if (NULL != old_observers) {
+        vmm_memcpy(new_observers->call, old_observers->call, sizeof(new_observers->call));
+        new_observers->count = old_observers->count;
+    }
+    if (new_observers->count < observers_limits) {
+        new_observers->call[new_observers->count++] = call;
+        event_publish_observers(p_event, new_observers);
         registered = TRUE;
     }
-    else {
+    lock_release(&event_mgr.update_lock);
+    if (!registered) {
+        vmm_mfree(new_observers);
         VMM_DEADLOOP();
     }
-    lock_release_writelock(&p_event->lock);
     return registered;
 }
 
@@ -410,26 +480,35 @@ BOOLEAN event_gcpu_register( UVMM_EVENT_INTERNAL e,
 BOOLEAN event_unregister_internal( PEVENT_ENTRY p_event,
     UVMM_EVENT_INTERNAL e, event_callback call)
 {
-    UINT32          i= 0;
-    UINT32          observers_limits;
+    UINT32          i;
+    OBSERVER_LIST   *old_observers;
+    OBSERVER_LIST   *new_observers;
     BOOLEAN         unregistered = FALSE;
 
-    observers_limits = event_observers_limit(e);
-    lock_acquire_writelock(&p_event->lock);
-    while (i < observers_limits && p_event->call[i]) {
-        if (p_event->call[i] == call) {
-            unregistered = TRUE;
-            //  Match, delete entry (promote following entries, one entry forward)
-            while ((i+1) < observers_limits && p_event->call[i+1]) {
-                p_event->call[i] = p_event->call[i+1];
-                ++i;
-            }
-            p_event->call[i] = 0;
-            break;
+    (void)e;
+    new_observers = (OBSERVER_LIST *) vmm_malloc(sizeof(OBSERVER_LIST));
+    VMM_ASSERT(new_observers);
+    lock_acquire(&event_mgr.update_lock);
+    old_observers = p_event->observers;
+    if (NULL != old_observers) {
+        //  Copy all entries but the matching one, keeping their order
+        for (i = 0; i < old_observers->count; ++i) {
+            if (!unregistered && old_observers->call[i] == call)
+                unregistered = TRUE;
+            else
+                new_observers->call[new_observers->count++] = old_observers->call[i];
         }
-        ++i;
-    } // while (i < observers_limits && list->call[i])
-    lock_release_writelock(&p_event->lock);
+    }
+    if (unregistered) {
+        if (0 == new_observers->count) {
+            vmm_mfree(new_observers);
+            new_observers = NULL;
+        }
+        event_publish_observers(p_event, new_observers);
+    }
+    lock_release(&event_mgr.update_lock);
+    if (!unregistered)
+        vmm_mfree(new_observers);
     return unregistered;
 }
 
@@ -488,26 +567,18 @@ BOOLEAN event_gcpu_unregister( UVMM_EVENT_INTERNAL e,
 BOOLEAN event_raise_internal(PEVENT_ENTRY p_event, UVMM_EVENT_INTERNAL e,
     GUEST_CPU_HANDLE gcpu, void* p)
 {
-    UINT32          i= 0;
-    UINT32          observers_limits;
-    event_callback  call[OBSERVERS_LIMIT];
-    BOOLEAN         event_is_handled = FALSE;
+    UINT32          i;
+    // stays valid until this CPU reaches a quiescent point
+    OBSERVER_LIST   *observers = p_event->observers;
 
-    observers_limits = event_observers_limit(e);
-    lock_acquire_readlock(&p_event->lock);
-#ifdef JLMDEBUG1
-    bprint("event_guest_raise_internal observers limit: %d, LIMIT: %d\n",
-            observers_limits, OBSERVERS_LIMIT);
-#endif
-    VMM_ASSERT(observers_limits<=OBSERVERS_LIMIT);
-    vmm_memcpy(call, p_event->call, sizeof(call));
-    lock_release_readlock(&p_event->lock);
-    while(i<observers_limits && call[i]) {
-        call[i](gcpu, p);
-        event_is_handled= TRUE;
-        ++i;
+    (void)e;
+    if (NULL == observers) {
+        return FALSE;
+    }
+    for (i = 0; i < observers->count; ++i) {
+        observers->call[i](gcpu, p);
     }
-    return event_is_handled;
+    return observers->count != 0;
 }
 
 
@@ -580,8 +651,8 @@ BOOLEAN event_is_registered( UVMM_EVENT_INTERNAL e, GUEST_CPU_HANDLE gcpu,
         event_callback call)
 {
     PEVENT_ENTRY    list;
-    UINT32          i = 0;
-    UINT32          observers_limits;
+    OBSERVER_LIST   *observers;
+    UINT32          i;
     BOOLEAN         res = FALSE;
 
     if (call == 0) 
@@ -591,17 +662,15 @@ BOOLEAN event_is_registered( UVMM_EVENT_INTERNAL e, GUEST_CPU_HANDLE gcpu,
     list = get_gcpu_observers(e, gcpu);
     if (list == NULL)
         return FALSE;
-    observers_limits = event_observers_limit(e);
-    lock_acquire_readlock(&list->lock);
-    // Find free observer slot
-    while (i < observers_limits && list->call[i]) {
-        if (list->call[i] == call) {
+    observers = list->observers;
+    if (observers == NULL)
+        return FALSE;
+    for (i = 0; i < observers->count; ++i) {
+        if (observers->call[i] == call) {
             res = TRUE;
             break;
         }
-        ++i;
     }
-    lock_release_readlock(&list->lock);
     return res;
 }
 #endif
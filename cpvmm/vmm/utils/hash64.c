@@ -14,6 +14,7 @@
 
 #include <vmm_defs.h>
 #include <heap.h>
+#include <hw_utils.h>
 #include <hash64_api.h>
 #include <common_libc.h>
 #include <vmm_dbg.h>
@@ -27,6 +28,8 @@ INLINE void* hash64_uint64_to_ptr(UINT64 value) {
     return (void*)(value);
 }
 
+#ifdef ENABLE_VTLB
+// the lists of values of the multiple values hash
 INLINE UINT64 hash64_ptr_to_uint64(void* ptr) {
     return (UINT64)ptr;
 }
@@ -37,6 +40,7 @@ INLINE void* hash64_allocate_node(HASH64_TABLE* hash) {
 
     return node_alloc_func(context);
 }
+#endif
 
 INLINE void hash64_free_node(HASH64_TABLE* hash, void* data) {
     HASH64_NODE_DEALLOCATION_FUNC node_dealloc_func = hash64_get_node_dealloc_func(hash);
@@ -65,70 +69,302 @@ INLINE void hash64_mem_free(HASH64_TABLE* hash, void* data) {
     }
 }
 
-static HASH64_NODE** hash64_retrieve_appropriate_array_cell(
-                            HASH64_TABLE* hash, UINT64 key) {
-    HASH64_FUNC hash_func;
-    UINT32 cell_index;
-    HASH64_NODE** array;
+#define HASH64_MIGRATE_BUCKETS  4       // buckets moved on every modification
+#define HASH64_TAG_ONES         0x0001010101010101ULL
+#define HASH64_TAG_HIGHS        0x0080808080808080ULL
 
-    hash_func = hash64_get_hash_func(hash);
-    cell_index = hash_func(key, hash64_get_hash_size(hash));
-    array = hash64_get_array(hash);
-    return &(array[cell_index]);
+// keep at most 7/8 of the slots in use, longer probe sequences cost more
+// than the memory saved
+#define HASH64_MAX_LOAD(__num_of_buckets) \
+    ((__num_of_buckets) * HASH64_BUCKET_SLOTS * 7 / 8)
+
+// 64 bit finalizer of MurmurHash3. Keys are mostly page aligned addresses
+// and small indices, so the low bits alone do not spread them.
+INLINE UINT64 hash64_mix(UINT64 key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
 }
 
-static HASH64_NODE* hash64_find(HASH64_TABLE* hash,
-                         UINT64 key) {
-    HASH64_NODE** cell;
-    HASH64_NODE* node;
+INLINE UINT8 hash64_tag(UINT64 hash_value) {
+    return (UINT8)(0x80 | (hash_value >> 57));
+}
 
-    cell = hash64_retrieve_appropriate_array_cell(hash, key);
-    node = *cell;
+// Returns bit 8*i+7 set for every slot i whose tag equals "tag". Matching
+// against tag 0 finds the free slots exactly; other matches may include
+// false positives, which are filtered out by comparing the keys.
+INLINE UINT64 hash64_match_tags(HASH64_BUCKET* bucket, UINT8 tag) {
+    UINT64 x = bucket->tags.word ^ (HASH64_TAG_ONES * tag);
 
-    while (node != NULL) {
-        if (hash64_node_get_key(node) == key) {
+    return (x - HASH64_TAG_ONES) & ~x & HASH64_TAG_HIGHS;
+}
+
+// bsf inline: hw_scan_bit_forward64 is a call, and every probe of
+// every lookup scans its tag matches
+INLINE UINT32 hash64_first_bit(UINT64 matches) {
+    UINT64 bit;
+
+    __asm__ ("\tbsfq %[matches], %[bit]\n"
+    : [bit] "=r" (bit)
+    : [matches] "rm" (matches)
+    : "cc");
+    return (UINT32)bit;
+}
+
+static UINT32 hash64_buckets_for_size(UINT32 hash_size) {
+    UINT32 num_of_buckets = 1;
+
+    while (num_of_buckets * HASH64_BUCKET_SLOTS < hash_size) {
+        num_of_buckets *= 2;
+    }
+    return num_of_buckets;
+}
+
+static BOOLEAN hash64_array_alloc(HASH64_TABLE* hash, HASH64_ARRAY* array,
+                                  UINT32 num_of_buckets) {
+    HASH64_BUCKET* buckets;
+
+    buckets = (HASH64_BUCKET*)hash64_mem_alloc(hash, num_of_buckets * sizeof(HASH64_BUCKET));
+    if (buckets == NULL) {
+        return FALSE;
+    }
+    vmm_zeromem(buckets, sizeof(HASH64_BUCKET) * num_of_buckets);
+    array->buckets = buckets;
+    array->num_of_buckets = num_of_buckets;
+    array->element_count = 0;
+    return TRUE;
+}
+
+static void hash64_array_free(HASH64_TABLE* hash, HASH64_ARRAY* array) {
+    if (array->num_of_buckets != 0) {
+        hash64_mem_free(hash, array->buckets);
+    }
+    array->buckets = NULL;
+    array->num_of_buckets = 0;
+    array->element_count = 0;
+}
+
+INLINE BOOLEAN hash64_array_find(HASH64_ARRAY* array, UINT64 key,
+                    UINT64 hash_value, UINT32* bucket_index, UINT32* slot) {
+    HASH64_BUCKET* bucket;
+    UINT64 matches;
+    UINT32 mask;
+    UINT32 index;
+    UINT32 probes;
+    UINT32 bit;
+    UINT8 tag = hash64_tag(hash_value);
+
+    if (array->num_of_buckets == 0) {
+        return FALSE;
+    }
+    mask = array->num_of_buckets - 1;
+    index = (UINT32)hash_value & mask;
+    for (probes = 0; probes < array->num_of_buckets; probes++) {
+        bucket = &array->buckets[index];
+        matches = hash64_match_tags(bucket, tag);
+        while (matches != 0) {
+            bit = hash64_first_bit(matches);
+            if (bucket->entries[bit / 8].key == key) {
+                *bucket_index = index;
+                *slot = bit / 8;
+                return TRUE;
+            }
+            matches &= matches - 1;
+        }
+        if (bucket->tags.bytes.overflow == 0) {
             break;
         }
-        node = hash64_node_get_next(node);
+        index = (index + 1) & mask;
     }
-    return node;
+    return FALSE;
 }
 
-static BOOLEAN hash64_insert_internal(HASH64_TABLE* hash,
-                    UINT64 key, UINT64 value, BOOLEAN update_when_found) {
-    HASH64_NODE* node = NULL;
+// The key must not be in the array
+INLINE BOOLEAN hash64_array_add(HASH64_ARRAY* array, UINT64 key,
+                                UINT64 hash_value, UINT64 value) {
+    HASH64_BUCKET* bucket;
+    UINT64 free_slots;
+    UINT32 mask;
+    UINT32 index;
+    UINT32 slot;
 
-    if (update_when_found) {
-        node = hash64_find(hash, key);
+    if (array->element_count >= array->num_of_buckets * HASH64_BUCKET_SLOTS) {
+        return FALSE;
     }
-    else {
-        // The key should not exist
-        // BEFORE_VMLAUNCH. CRITICAL check that should not fail.
-        VMM_ASSERT(hash64_find(hash, key) == NULL);
+    // there is a free slot, so every bucket passed below is really passed
+    mask = array->num_of_buckets - 1;
+    index = (UINT32)hash_value & mask;
+    while (1) {
+        bucket = &array->buckets[index];
+        free_slots = hash64_match_tags(bucket, 0);
+        if (free_slots != 0) {
+            break;
+        }
+        if (bucket->tags.bytes.overflow != HASH64_OVERFLOW_STICKY) {
+            bucket->tags.bytes.overflow++;
+        }
+        index = (index + 1) & mask;
     }
+    slot = hash64_first_bit(free_slots) / 8;
+    bucket->tags.bytes.tags[slot] = hash64_tag(hash_value);
+    bucket->entries[slot].key = key;
+    bucket->entries[slot].value = value;
+    array->element_count++;
+    return TRUE;
+}
 
-    if (node == NULL) {
-        HASH64_NODE** cell;
+INLINE void hash64_array_delete(HASH64_ARRAY* array, UINT64 hash_value,
+                                UINT32 bucket_index, UINT32 slot) {
+    UINT32 mask = array->num_of_buckets - 1;
+    UINT32 index;
+
+    array->buckets[bucket_index].tags.bytes.tags[slot] = 0;
+    array->element_count--;
+    for (index = (UINT32)hash_value & mask; index != bucket_index;
+         index = (index + 1) & mask) {
+        if (array->buckets[index].tags.bytes.overflow != HASH64_OVERFLOW_STICKY) {
+            VMM_ASSERT(array->buckets[index].tags.bytes.overflow != 0);
+            array->buckets[index].tags.bytes.overflow--;
+        }
+    }
+}
+
+// Moves up to "num_of_buckets" buckets of the old array into the current one
+static void hash64_migrate(HASH64_TABLE* hash, UINT32 num_of_buckets) {
+    HASH64_ARRAY* old = &hash->old;
+    HASH64_BUCKET* bucket;
+    UINT32 slot;
 
-        node = hash64_allocate_node(hash);
-        if (node == NULL) {
-           return FALSE;
+    while (num_of_buckets > 0 && hash64_is_migrating(hash)) {
+        bucket = &old->buckets[hash->migrate_index];
+        for (slot = 0; slot < HASH64_BUCKET_SLOTS; slot++) {
+            if (bucket->tags.bytes.tags[slot] != 0) {
+                BOOLEAN res;
+
+                res = hash64_array_add(&hash->current, bucket->entries[slot].key,
+                        hash64_mix(bucket->entries[slot].key),
+                        bucket->entries[slot].value);
+                // BEFORE_VMLAUNCH. CRITICAL check that should not fail.
+                VMM_ASSERT(res);
+                // keep the overflow counter, keys of later buckets still
+                // probe through this one
+                bucket->tags.bytes.tags[slot] = 0;
+                old->element_count--;
+            }
+        }
+        hash->migrate_index++;
+        if (hash->migrate_index == old->num_of_buckets) {
+            VMM_ASSERT(old->element_count == 0);
+            hash64_array_free(hash, old);
         }
-        cell = hash64_retrieve_appropriate_array_cell(hash, key);
+        num_of_buckets--;
+    }
+}
 
-        hash64_node_set_next(node, *cell);
-        *cell = node;
+// Switches to a bigger array, the entries are moved by hash64_migrate
+static BOOLEAN hash64_grow(HASH64_TABLE* hash, UINT32 num_of_buckets) {
+    HASH64_ARRAY array;
 
-        hash64_node_set_key(node, key);
+    if (num_of_buckets <= hash->current.num_of_buckets) {
+        return TRUE;
+    }
+    // only one move at a time
+    hash64_migrate(hash, (UINT32)-1);
+    if (!hash64_array_alloc(hash, &array, num_of_buckets)) {
+        return FALSE;
+    }
+    hash->old = hash->current;
+    hash->current = array;
+    hash->migrate_index = 0;
+    if (hash->old.element_count == 0) {
+        hash64_array_free(hash, &hash->old);
+    }
+    return TRUE;
+}
 
-        hash64_inc_element_count(hash);
+// Not safe against concurrent modifications: a key being migrated is
+// added to the current array before it is cleared in the old one, and
+// the old array is freed once the move completes. Lookups must hold the
+// lock that serializes the modifications of the hash.
+static BOOLEAN hash64_find(HASH64_TABLE* hash, UINT64 key, UINT64 hash_value,
+                    HASH64_ARRAY** array, UINT32* bucket_index, UINT32* slot) {
+    if (hash64_array_find(&hash->current, key, hash_value, bucket_index, slot)) {
+        *array = &hash->current;
+        return TRUE;
     }
-    else {
+    if (hash64_is_migrating(hash) &&
+        hash64_array_find(&hash->old, key, hash_value, bucket_index, slot)) {
+        *array = &hash->old;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Returns the location of the value stored for the key, or NULL. The
+// location is valid until the next modification of the hash.
+static UINT64* hash64_find_value(HASH64_TABLE* hash, UINT64 key) {
+    HASH64_ARRAY* array;
+    UINT32 bucket_index;
+    UINT32 slot;
+
+    if (!hash64_find(hash, key, hash64_mix(key), &array, &bucket_index, &slot)) {
+        return NULL;
+    }
+    return &array->buckets[bucket_index].entries[slot].value;
+}
+
+static BOOLEAN hash64_insert_internal(HASH64_TABLE* hash,
+                    UINT64 key, UINT64 value, BOOLEAN update_when_found) {
+    UINT64 hash_value = hash64_mix(key);
+    HASH64_ARRAY* array;
+    UINT32 bucket_index;
+    UINT32 slot;
+
+    if (hash64_is_migrating(hash)) {
+        hash64_migrate(hash, HASH64_MIGRATE_BUCKETS);
+    }
+
+    if (hash64_find(hash, key, hash_value, &array, &bucket_index, &slot)) {
+        // The key should not exist
         // BEFORE_VMLAUNCH. CRITICAL check that should not fail.
-        VMM_ASSERT(hash64_node_get_key(node) == key);
+        VMM_ASSERT(update_when_found);
+        if (!update_when_found) {
+            return FALSE;
+        }
+        array->buckets[bucket_index].entries[slot].value = value;
+        return TRUE;
     }
-    hash64_node_set_value(node, value);
-    VMM_ASSERT(hash64_find(hash, key) != NULL);
+
+    if (hash->current.element_count >= HASH64_MAX_LOAD(hash->current.num_of_buckets)) {
+        // if there is no memory, keep filling the current array
+        hash64_grow(hash, hash->current.num_of_buckets * 2);
+    }
+    if (!hash64_array_add(&hash->current, key, hash_value, value)) {
+        return FALSE;
+    }
+    hash64_inc_element_count(hash);
+    return TRUE;
+}
+
+static BOOLEAN hash64_remove_internal(HASH64_TABLE* hash, UINT64 key) {
+    UINT64 hash_value = hash64_mix(key);
+    HASH64_ARRAY* array;
+    UINT32 bucket_index;
+    UINT32 slot;
+
+    if (hash64_is_migrating(hash)) {
+        hash64_migrate(hash, HASH64_MIGRATE_BUCKETS);
+    }
+
+    if (!hash64_find(hash, key, hash_value, &array, &bucket_index, &slot)) {
+        return FALSE;
+    }
+    hash64_array_delete(array, hash_value, bucket_index, slot);
+    VMM_ASSERT(hash64_get_element_count(hash) > 0);
+    hash64_dec_element_count(hash);
     return TRUE;
 }
 
@@ -141,8 +377,6 @@ static HASH64_HANDLE hash64_create_hash_internal(
             void* node_allocation_deallocation_context,
             UINT32 hash_size, BOOLEAN is_multiple_values_hash) {
     HASH64_TABLE* hash;
-    HASH64_NODE** array;
-    UINT32 index;
 
     if (mem_alloc_func == NULL) {
         hash = (HASH64_TABLE*)vmm_memory_alloc(sizeof(HASH64_TABLE));
@@ -154,20 +388,13 @@ static HASH64_HANDLE hash64_create_hash_internal(
     if (hash == NULL) {
         goto hash_allocation_failed;
     }
+    vmm_zeromem(hash, sizeof(HASH64_TABLE));
+    hash64_set_mem_alloc_func(hash, mem_alloc_func);
+    hash64_set_mem_dealloc_func(hash, mem_dealloc_func);
 
-    if (mem_alloc_func == NULL) {
-        array = (HASH64_NODE**)vmm_memory_alloc(sizeof(HASH64_NODE*) * hash_size);
-    }
-    else {
-        array = (HASH64_NODE**)mem_alloc_func(sizeof(HASH64_NODE*) * hash_size);
-    }
-
-    if (array == NULL) {
+    if (!hash64_array_alloc(hash, &hash->current, hash64_buckets_for_size(hash_size))) {
         goto array_allocation_failed;
     }
-    for (index = 0; index < hash_size; index++) {
-        array[index] = NULL;
-    }
 
     // BEFORE_VMLAUNCH. CRITICAL check that should not fail.
     VMM_ASSERT(node_alloc_func != NULL);
@@ -175,12 +402,9 @@ static HASH64_HANDLE hash64_create_hash_internal(
     VMM_ASSERT(node_dealloc_func != NULL);
 
     hash64_set_hash_size(hash, hash_size);
-    hash64_set_array(hash, array);
     // BEFORE_VMLAUNCH. CRITICAL check that should not fail.
     VMM_ASSERT(hash_func != NULL);
     hash64_set_hash_func(hash, hash_func);
-    hash64_set_mem_alloc_func(hash, mem_alloc_func);
-    hash64_set_mem_dealloc_func(hash, mem_dealloc_func);
     hash64_set_node_alloc_func(hash, node_alloc_func);
     hash64_set_node_dealloc_func(hash, node_dealloc_func);
     hash64_set_allocation_deallocation_context(hash, node_allocation_deallocation_context);
@@ -206,51 +430,43 @@ hash_allocation_failed:
     return HASH64_INVALID_HANDLE;
 }
 
-static void hash64_destroy_hash_internal(HASH64_TABLE* hash) {
-        HASH64_INTERNAL_MEM_DEALLOCATION_FUNC mem_dealloc_func;
-        HASH64_NODE_DEALLOCATION_FUNC node_dealloc_func;
-        HASH64_NODE** array;
-        UINT32 i;
-
-    array = hash64_get_array(hash);
-    mem_dealloc_func = hash64_get_mem_dealloc_func(hash);
-    node_dealloc_func = hash64_get_node_dealloc_func(hash);
-    for (i = 0; i < hash64_get_hash_size(hash); i++) {
-        HASH64_NODE* node = array[i];
-
-        if (hash64_get_element_count(hash) == 0) {
-            VMM_ASSERT(node == NULL);
-            break;
-        }
-
-        while (node != NULL) {
-            HASH64_NODE* next_node = hash64_node_get_next(node);
+static void hash64_free_values_lists(HASH64_TABLE* hash, HASH64_ARRAY* array) {
+    UINT32 index;
+    UINT32 slot;
 
-            VMM_ASSERT(hash64_get_element_count(hash) != 0);
+    for (index = 0; index < array->num_of_buckets; index++) {
+        for (slot = 0; slot < HASH64_BUCKET_SLOTS; slot++) {
+            HASH64_NODE* node;
 
-            if (hash64_is_multiple_values_hash(hash)) {
-                UINT64 node_value = hash64_node_get_value(node);
-                HASH64_NODE* internal_node = (HASH64_NODE*)hash64_uint64_to_ptr(node_value);
-                while (internal_node != NULL) {
-                    HASH64_NODE* next_internal_node = hash64_node_get_next(internal_node);
-                    node_dealloc_func(hash64_get_allocation_deallocation_context(hash), internal_node);
-                    internal_node = next_internal_node;
-                }
+            if (array->buckets[index].tags.bytes.tags[slot] == 0) {
+                continue;
+            }
+            node = (HASH64_NODE*)hash64_uint64_to_ptr(
+                        array->buckets[index].entries[slot].value);
+            while (node != NULL) {
+                HASH64_NODE* next_node = hash64_node_get_next(node);
+                hash64_free_node(hash, node);
+                node = next_node;
             }
-            node_dealloc_func(hash64_get_allocation_deallocation_context(hash), node);
-            hash64_dec_element_count(hash);
-            node = next_node;
         }
     }
+}
 
-    VMM_ASSERT(hash64_get_element_count(hash) == 0);
+static void hash64_destroy_hash_internal(HASH64_TABLE* hash) {
+    HASH64_INTERNAL_MEM_DEALLOCATION_FUNC mem_dealloc_func;
+
+    if (hash64_is_multiple_values_hash(hash)) {
+        hash64_free_values_lists(hash, &hash->current);
+        hash64_free_values_lists(hash, &hash->old);
+    }
+    hash64_array_free(hash, &hash->current);
+    hash64_array_free(hash, &hash->old);
 
+    mem_dealloc_func = hash64_get_mem_dealloc_func(hash);
     if (mem_dealloc_func == NULL) {
-        vmm_memory_free(array);
         vmm_memory_free(hash);
     }
     else {
-        mem_dealloc_func(array);
         mem_dealloc_func(hash);
     }
 }
@@ -281,7 +497,7 @@ void hash64_destroy_hash(HASH64_HANDLE hash_handle) {
 
 UINT32 hash64_default_hash_func(UINT64 key, UINT32 size)
 {
-    return (UINT32)(key % size);
+    return (UINT32)(((hash64_mix(key) >> 32) * size) >> 32);
 }
 
 #pragma warning (push)
@@ -309,15 +525,14 @@ HASH64_HANDLE hash64_create_default_hash(UINT32 hash_size)
 
 BOOLEAN hash64_lookup(HASH64_HANDLE hash_handle, UINT64 key, UINT64* value) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE* node;
+    UINT64* node_value;
 
     if (hash == NULL) {
         return FALSE;
     }
-    node = hash64_find(hash, key);
-    if (node != NULL) {
-        VMM_ASSERT(hash64_node_get_key(node) == key);
-        *value = hash64_node_get_value(node);
+    node_value = hash64_find_value(hash, key);
+    if (node_value != NULL) {
+        *value = *node_value;
         return TRUE;
     }
     return FALSE;
@@ -346,42 +561,14 @@ BOOLEAN hash64_update(HASH64_HANDLE hash_handle,
 BOOLEAN hash64_remove(HASH64_HANDLE hash_handle,
                      UINT64 key) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE* node;
-    HASH64_NODE** cell;
+    BOOLEAN res;
 
     if (hash == NULL) {
         return FALSE;
     }
-    VMM_ASSERT(hash64_find(hash, key) != NULL);
-    cell = hash64_retrieve_appropriate_array_cell(hash, key);
-    node = *cell;
-    if (node == NULL) {
-        return FALSE;
-    }
-    if (hash64_node_get_key(node) == key) {
-        *cell = hash64_node_get_next(node);
-        VMM_ASSERT(hash64_find(hash, key) == NULL);
-        hash64_free_node(hash, node);
-        VMM_ASSERT(hash64_get_element_count(hash) > 0);
-        hash64_dec_element_count(hash);
-        return TRUE;
-    }
-
-    while(node != NULL) {
-        HASH64_NODE* prev_node = node;
-        node = hash64_node_get_next(node);
-
-        if ((node != NULL) &&
-            (hash64_node_get_key(node) == key)) {
-            hash64_node_set_next(prev_node, hash64_node_get_next(node));
-            VMM_ASSERT(hash64_find(hash, key) == NULL);
-            hash64_free_node(hash, node);
-            VMM_ASSERT(hash64_get_element_count(hash) > 0);
-            hash64_dec_element_count(hash);
-            return TRUE;
-        }
-    }
-    return FALSE;
+    res = hash64_remove_internal(hash, key);
+    VMM_ASSERT(res);
+    return res;
 }
 
 BOOLEAN hash64_is_empty(HASH64_HANDLE hash_handle) {
@@ -394,50 +581,19 @@ BOOLEAN hash64_is_empty(HASH64_HANDLE hash_handle) {
     return (hash64_get_element_count(hash) == 0);
 }
 
+// The entries are not rehashed here, they move to the new array a few
+// buckets at a time on the following insertions and removals
 BOOLEAN hash64_change_size_and_rehash(HASH64_HANDLE hash_handle,
                                       UINT32 hash_size) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE** old_array;
-    HASH64_NODE** new_array;
-    UINT32 old_hash_size;
-    UINT32 i;
 
     if (hash == NULL) {
         return FALSE;
     }
-
-    new_array = (HASH64_NODE**)hash64_mem_alloc(hash, sizeof(HASH64_NODE*) * hash_size);
-
-    if (new_array == NULL) {
+    if (!hash64_grow(hash, hash64_buckets_for_size(hash_size))) {
         return FALSE;
     }
-
-    vmm_zeromem(new_array, sizeof(HASH64_NODE*) * hash_size);
-
-    old_array = hash64_get_array(hash);
-    old_hash_size = hash64_get_hash_size(hash);
-
-    hash64_set_array(hash, new_array);
     hash64_set_hash_size(hash, hash_size);
-
-    for (i = 0; i < old_hash_size; i++) {
-        HASH64_NODE* node = old_array[i];
-        while (node != NULL) {
-            HASH64_NODE* next_node = hash64_node_get_next(node);
-            UINT64 key;
-            HASH64_NODE** new_cell;
-
-            key = hash64_node_get_key(node);
-            new_cell = hash64_retrieve_appropriate_array_cell(hash, key);
-            hash64_node_set_next(node, *new_cell);
-            *new_cell = node;
-
-            node = next_node;
-        }
-        old_array[i] = NULL;
-    }
-
-    hash64_mem_free(hash, old_array);
     return TRUE;
 }
 
@@ -452,7 +608,7 @@ UINT32 hash64_get_current_size(HASH64_HANDLE hash_handle) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
 
     VMM_ASSERT(hash != NULL);
-    return hash64_get_hash_size(hash);
+    return hash->size;
 }
 
 HASH64_HANDLE hash64_create_multiple_values_hash( HASH64_FUNC hash_func,
@@ -481,19 +637,17 @@ void hash64_destroy_multiple_values_hash(HASH64_HANDLE hash_handle) {
 BOOLEAN hash64_lookup_in_multiple_values_hash(HASH64_HANDLE hash_handle,
                       UINT64 key, HASH64_MULTIPLE_VALUES_HASH_ITERATOR* iter) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE* top_node;
-    UINT64 top_node_value;
+    UINT64* list_head;
 
     if (hash == NULL) {
         return FALSE;
     }
     VMM_ASSERT(hash64_is_multiple_values_hash(hash));
-    top_node = hash64_find(hash, key);
-    if (top_node == NULL) {
+    list_head = hash64_find_value(hash, key);
+    if (list_head == NULL) {
         return FALSE;
     }
-    top_node_value = hash64_node_get_value(top_node);
-    *iter = (HASH64_MULTIPLE_VALUES_HASH_ITERATOR)hash64_uint64_to_ptr(top_node_value);
+    *iter = (HASH64_MULTIPLE_VALUES_HASH_ITERATOR)hash64_uint64_to_ptr(*list_head);
     return TRUE;
 }
 
@@ -510,11 +664,12 @@ UINT64 hash64_multiple_values_hash_iterator_get_value(
     return hash64_node_get_value(node);
 }
 
+// The value stored in the table for each key is the head of the sorted
+// list of its values
 BOOLEAN hash64_insert_into_multiple_values_hash(HASH64_HANDLE hash_handle,
                       UINT64 key, UINT64 value) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE* top_node;
-    UINT64 top_node_value;
+    UINT64* list_head;
     HASH64_NODE* node;
     HASH64_NODE* node_tmp;
 
@@ -524,23 +679,6 @@ BOOLEAN hash64_insert_into_multiple_values_hash(HASH64_HANDLE hash_handle,
 
     VMM_ASSERT(hash64_is_multiple_values_hash(hash));
 
-    top_node = hash64_find(hash, key);
-
-
-    if (top_node == NULL) {
-        HASH64_NODE** cell;
-        top_node = hash64_allocate_node(hash);
-        if (top_node == NULL) {
-            return FALSE;
-        }
-        hash64_node_set_key(top_node, key);
-        hash64_node_set_value(top_node, hash64_ptr_to_uint64(NULL));
-        cell = hash64_retrieve_appropriate_array_cell(hash, key);
-        hash64_node_set_next(top_node, *cell);
-        *cell = top_node;
-        hash64_inc_element_count(hash);
-    }
-
     node = hash64_allocate_node(hash);
     if (node == NULL) {
         return FALSE;
@@ -549,12 +687,21 @@ BOOLEAN hash64_insert_into_multiple_values_hash(HASH64_HANDLE hash_handle,
     hash64_node_set_key(node, key);
     hash64_node_set_value(node, value);
 
-    top_node_value = hash64_node_get_value(top_node);
-    node_tmp = (HASH64_NODE*)hash64_uint64_to_ptr(top_node_value);
+    list_head = hash64_find_value(hash, key);
+    if (list_head == NULL) {
+        hash64_node_set_next(node, NULL);
+        if (!hash64_insert_internal(hash, key, hash64_ptr_to_uint64(node), FALSE)) {
+            hash64_free_node(hash, node);
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    node_tmp = (HASH64_NODE*)hash64_uint64_to_ptr(*list_head);
     if ((node_tmp == NULL) ||
         (hash64_node_get_value(node_tmp) >= value)) {
         hash64_node_set_next(node, node_tmp);
-        hash64_node_set_value(top_node, hash64_ptr_to_uint64(node));
+        *list_head = hash64_ptr_to_uint64(node);
         return TRUE;
     }
 
@@ -576,8 +723,7 @@ BOOLEAN hash64_insert_into_multiple_values_hash(HASH64_HANDLE hash_handle,
 BOOLEAN hash64_remove_from_multiple_values_hash(HASH64_HANDLE hash_handle,
                       UINT64 key, UINT64 value) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE* top_node;
-    UINT64 top_node_value;
+    UINT64* list_head;
     HASH64_NODE* node;
 
     if (hash == NULL) {
@@ -586,26 +732,26 @@ BOOLEAN hash64_remove_from_multiple_values_hash(HASH64_HANDLE hash_handle,
 
     VMM_ASSERT(hash64_is_multiple_values_hash(hash));
 
-    top_node = hash64_find(hash, key);
+    list_head = hash64_find_value(hash, key);
 
-    if (top_node == NULL) {
+    if (list_head == NULL) {
         return FALSE;
     }
 
-    top_node_value = hash64_node_get_value(top_node);
-    node = (HASH64_NODE*)hash64_uint64_to_ptr(top_node_value);
+    node = (HASH64_NODE*)hash64_uint64_to_ptr(*list_head);
 
     if (hash64_node_get_value(node) == value) {
         HASH64_NODE* next_node = hash64_node_get_next(node);
         hash64_free_node(hash, node);
-        top_node_value = hash64_ptr_to_uint64(next_node);
-        hash64_node_set_value(top_node, top_node_value);
         if (next_node == NULL) {
             BOOLEAN res;
             // There is only one value
-            res = hash64_remove(hash_handle, key);
+            res = hash64_remove_internal(hash, key);
             VMM_ASSERT(res);
         }
+        else {
+            *list_head = hash64_ptr_to_uint64(next_node);
+        }
         return TRUE;
     }
 
@@ -655,9 +801,8 @@ BOOLEAN hash64_is_value_in_multiple_values_hash(HASH64_HANDLE hash_handle,
 BOOLEAN hash64_remove_range_from_multiple_values_hash(HASH64_HANDLE hash_handle,
                            UINT64 key, UINT64 value_from, UINT64 value_to) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE* top_node;
+    UINT64* list_head;
     HASH64_NODE* node;
-    UINT64 top_node_value;
     BOOLEAN removed_any_value = FALSE;
 
     if (hash == NULL) {
@@ -666,14 +811,13 @@ BOOLEAN hash64_remove_range_from_multiple_values_hash(HASH64_HANDLE hash_handle,
 
     VMM_ASSERT(hash64_is_multiple_values_hash(hash));
 
-    top_node = hash64_find(hash, key);
+    list_head = hash64_find_value(hash, key);
 
-    if (top_node == NULL) {
+    if (list_head == NULL) {
         return FALSE;
     }
 
-    top_node_value = hash64_node_get_value(top_node);
-    node = (HASH64_NODE*)hash64_uint64_to_ptr(top_node_value);
+    node = (HASH64_NODE*)hash64_uint64_to_ptr(*list_head);
 
     VMM_ASSERT(node != NULL);
     VMM_ASSERT(value_from <= value_to);
@@ -694,14 +838,15 @@ BOOLEAN hash64_remove_range_from_multiple_values_hash(HASH64_HANDLE hash_handle,
 
         if (removed_any_value) {
             VMM_ASSERT((node == NULL) || (hash64_node_get_value(node) > value_to));
-            top_node_value = hash64_ptr_to_uint64(node);
-            hash64_node_set_value(top_node, top_node_value);
             if (node == NULL) {
                 BOOLEAN res;
                 // all the entries were removed
-                res = hash64_remove(hash_handle, key);
+                res = hash64_remove_internal(hash, key);
                 VMM_ASSERT(res);
             }
+            else {
+                *list_head = hash64_ptr_to_uint64(node);
+            }
             return TRUE;
         }
     }
@@ -739,10 +884,42 @@ BOOLEAN hash64_multiple_values_is_empty(HASH64_HANDLE hash_handle) {
 #endif
 
 #ifdef DEBUG
+static void hash64_print_array(HASH64_TABLE* hash, HASH64_ARRAY* array) {
+    UINT32 index;
+    UINT32 slot;
+
+    for (index = 0; index < array->num_of_buckets; index++) {
+        HASH64_BUCKET* bucket = &array->buckets[index];
+
+        if (bucket->tags.word == 0) {
+            continue;
+        }
+        VMM_LOG(mask_anonymous, level_trace,"[%d] overflow %d: ", index, bucket->tags.bytes.overflow);
+        for (slot = 0; slot < HASH64_BUCKET_SLOTS; slot++) {
+            UINT64 value = bucket->entries[slot].value;
+
+            if (bucket->tags.bytes.tags[slot] == 0) {
+                continue;
+            }
+            if (hash64_is_multiple_values_hash(hash)) {
+                UINT32 counter = 0;
+                HASH64_NODE* node_value = hash64_uint64_to_ptr(value);
+                while (node_value != NULL) {
+                    counter++;
+                    node_value = hash64_node_get_next(node_value);
+                }
+                VMM_LOG(mask_anonymous, level_trace,"(%P : %d); ", bucket->entries[slot].key, counter);
+            }
+            else {
+                VMM_LOG(mask_anonymous, level_trace,"(%P : %P); ", bucket->entries[slot].key, value);
+            }
+        }
+        VMM_LOG(mask_anonymous, level_trace,"\n");
+    }
+}
+
 void hash64_print(HASH64_HANDLE hash_handle) {
     HASH64_TABLE* hash = (HASH64_TABLE*)hash_handle;
-    HASH64_NODE** array;
-    UINT32 i;
 
     VMM_LOG(mask_anonymous, level_trace,"Hash64:\n");
     VMM_LOG(mask_anonymous, level_trace,"========================\n");
@@ -750,33 +927,15 @@ void hash64_print(HASH64_HANDLE hash_handle) {
         VMM_LOG(mask_anonymous, level_trace,"%s: ERROR in parameter\n", __FUNCTION__);
         return;
     }
-    VMM_LOG(mask_anonymous, level_trace,"Num of cells: %d\n", hash64_get_hash_size(hash));
+    VMM_LOG(mask_anonymous, level_trace,"Num of cells: %d\n", hash->size);
+    VMM_LOG(mask_anonymous, level_trace,"Num of buckets: %d\n", hash->current.num_of_buckets);
     VMM_LOG(mask_anonymous, level_trace,"Num of elements: %d\n", hash64_get_element_count(hash));
 
-    array = hash64_get_array(hash);
-    for (i = 0; i < hash64_get_hash_size(hash); i++) {
-        if (array[i] != NULL) {
-            HASH64_NODE* node = array[i];
-            VMM_LOG(mask_anonymous, level_trace,"[%d]: ", i);
-
-            while (node != NULL) {
-                if (hash64_is_multiple_values_hash(hash)) {
-                    UINT32 counter = 0;
-                    HASH64_NODE* node_value = hash64_uint64_to_ptr(hash64_node_get_value(node));
-                    while (node_value != NULL) {
-                        counter++;
-                        node_value = hash64_node_get_next(node_value);
-                    }
-                    VMM_LOG(mask_anonymous, level_trace,"(%P : %d); ", hash64_node_get_key(node), counter);
-                }
-                else {
-                    VMM_LOG(mask_anonymous, level_trace,"(%P : %P); ", hash64_node_get_key(node), hash64_node_get_value(node));
-                }
-                node = hash64_node_get_next(node);
-            }
-
-            VMM_LOG(mask_anonymous, level_trace,"\n");
-        }
+    hash64_print_array(hash, &hash->current);
+    if (hash64_is_migrating(hash)) {
+        VMM_LOG(mask_anonymous, level_trace,"Moving from %d buckets, next %d:\n",
+                hash->old.num_of_buckets, hash->migrate_index);
+        hash64_print_array(hash, &hash->old);
     }
 }
 #endif
@@ -30,14 +30,11 @@ INLINE HASH64_NODE* hash64_node_get_next(HASH64_NODE* cell) {
     return cell->next;
 }
 
+#ifdef ENABLE_VTLB
 INLINE void hash64_node_set_next(HASH64_NODE* cell, HASH64_NODE* next) {
     cell->next = next;
 }
 
-INLINE UINT64 hash64_node_get_key(HASH64_NODE* cell) {
-    return cell->key;
-}
-
 INLINE void hash64_node_set_key(HASH64_NODE* cell, UINT64 key) {
     cell->key = key;
 }
@@ -49,9 +46,50 @@ INLINE UINT64 hash64_node_get_value(HASH64_NODE* cell) {
 INLINE void hash64_node_set_value(HASH64_NODE* cell, UINT64 value) {
     cell->value = value;
 }
+#endif
 
+// Entries of the 1-1 hash live in an open-addressing table of buckets
+// of two cache lines, which the adjacent line prefetcher fetches
+// together. Every bucket holds HASH64_BUCKET_SLOTS entries and one tag
+// byte per entry (0 for a free slot, otherwise 0x80 | 7 bits of the key
+// hash), so a lookup compares all the tags of a bucket with a single
+// 64 bit load before it touches any key.
+// Keys which do not fit into their home bucket go to the next buckets;
+// "overflow" counts the keys that passed a bucket this way, and a lookup
+// stops at the first bucket whose counter is zero.
+#define HASH64_BUCKET_SLOTS     7
+#define HASH64_OVERFLOW_STICKY  0xFF    // counter saturated, never decremented
+
+typedef struct HASH64_BUCKET_S {
+  union {
+    struct {
+      UINT8 tags[HASH64_BUCKET_SLOTS];
+      UINT8 overflow;
+    } bytes;
+    UINT64 word;
+  } tags;
+  struct {
+    UINT64 key;
+    UINT64 value;
+  } entries[HASH64_BUCKET_SLOTS];
+  UINT64 padding; // not in use
+} HASH64_BUCKET;
+
+typedef struct HASH64_ARRAY_S {
+  HASH64_BUCKET* buckets;
+  UINT32 num_of_buckets;                // power of 2, 0 if not allocated
+  UINT32 element_count;
+} HASH64_ARRAY;
+
+// When the table grows, the old array is kept and its buckets are moved
+// to the new one a few at a time on every modification, so no single
+// insertion pays for rehashing the whole table. Lookups search both
+// arrays while the move is in progress.
 typedef struct HASH64_TABLE_S {
-  HASH64_NODE** array;
+  HASH64_ARRAY current;
+  HASH64_ARRAY old;
+  UINT32 migrate_index;                 // next bucket of "old" to move
+  UINT32 padding; // not in use
   HASH64_FUNC hash_func;
   HASH64_INTERNAL_MEM_ALLOCATION_FUNC mem_alloc_func;
   HASH64_INTERNAL_MEM_DEALLOCATION_FUNC mem_dealloc_func;
@@ -61,27 +99,14 @@ typedef struct HASH64_TABLE_S {
   UINT32 size;
   UINT32 element_count;
   BOOLEAN is_multiple_values_hash;
-  UINT32 padding; // not in use
 } HASH64_TABLE;
 
-INLINE UINT32 hash64_get_hash_size(HASH64_TABLE* hash) {
-    return hash->size;
-}
-
 INLINE void hash64_set_hash_size(HASH64_TABLE* hash, UINT32 size) {
     hash->size = size;
 }
 
-INLINE HASH64_NODE** hash64_get_array(HASH64_TABLE* hash) {
-    return hash->array;
-}
-
-INLINE void hash64_set_array(HASH64_TABLE* hash, HASH64_NODE** array) {
-    hash->array = array;
-}
-
-INLINE HASH64_FUNC hash64_get_hash_func(HASH64_TABLE* hash) {
-    return hash->hash_func;
+INLINE BOOLEAN hash64_is_migrating(HASH64_TABLE* hash) {
+    return hash->old.num_of_buckets != 0;
 }
 
 INLINE void hash64_set_hash_func(HASH64_TABLE* hash, HASH64_FUNC hash_func) {
@@ -105,9 +130,11 @@ INLINE void hash64_set_mem_dealloc_func(HASH64_TABLE* hash,
     hash->mem_dealloc_func = mem_dealloc_func;
 }
 
+#ifdef ENABLE_VTLB
 INLINE HASH64_NODE_ALLOCATION_FUNC hash64_get_node_alloc_func(HASH64_TABLE* hash) {
     return hash->node_alloc_func;
 }
+#endif
 
 INLINE void hash64_set_node_alloc_func(HASH64_TABLE* hash, 
         HASH64_NODE_ALLOCATION_FUNC node_alloc_func) {
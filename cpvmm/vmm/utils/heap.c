@@ -17,6 +17,7 @@
 #include "common_libc.h"
 #include "lock.h"
 #include "heap.h"
+#include "hw_utils.h"
 #include "vmm_dbg.h"
 #include "file_codes.h"
 #include "profiling.h"
@@ -68,6 +69,185 @@ static HEAP_PAGE_INT        max_used_pages = 0;
 
 extern UINT32 g_heap_pa_num;
 
+// Free runs are kept on segregated free lists: list k holds the runs
+// of 2^k .. 2^(k+1)-1 pages, and bit k of free_list_bitmap is set when
+// list k is not empty.  An allocation either takes the head of its own
+// list or the head of the first non-empty larger list, so it doesn't
+// depend on the heap size.  The first and the last page of a free run
+// both hold the run length, so a released buffer is merged with both
+// neighbours without scanning.
+#define HEAP_NO_PAGE            ((HEAP_PAGE_INT) ~0)
+#define HEAP_NUM_FREE_LISTS     30
+
+static HEAP_PAGE_INT        free_list_heads[HEAP_NUM_FREE_LISTS];
+static UINT32               free_list_bitmap = 0;
+
+// Single pages are the most common request.  Each CPU keeps a small
+// cache of them, refilled from and flushed to the heap in batches, so
+// most single page allocations and frees don't touch heap_lock.  The
+// cache lock is only contended when the heap is short of memory and
+// the caches are drained, or when hw_cpu_id() is not yet meaningful
+// (before the GDT is loaded), so using it keeps both cases correct.
+#define HEAP_CPU_CACHE_SIZE     16
+#define HEAP_CPU_CACHE_BATCH    (HEAP_CPU_CACHE_SIZE / 2)
+
+typedef struct {
+    VMM_LOCK      lock;
+    UINT32        count;
+    HEAP_PAGE_INT pages[HEAP_CPU_CACHE_SIZE];
+} HEAP_CPU_CACHE;
+
+static HEAP_CPU_CACHE       heap_cpu_caches[VMM_MAX_CPU_SUPPORTED];
+
+static UINT32 heap_size_class(HEAP_PAGE_INT number_of_pages)
+{
+    UINT32 size_class = 0;
+
+    hw_scan_bit_backward(&size_class, number_of_pages);
+    return size_class;
+}
+
+// mark pages first..first+number_of_pages-1 as a free run and put it on
+// its free list
+static void heap_insert_free_run(HEAP_PAGE_INT first, HEAP_PAGE_INT number_of_pages)
+{
+    UINT32 size_class = heap_size_class(number_of_pages);
+    HEAP_PAGE_INT last = first + number_of_pages - 1;
+
+    heap_array[last].in_use = 0;
+    heap_array[last].cached = 0;
+    heap_array[last].number_of_pages = number_of_pages;
+    heap_array[first].in_use = 0;
+    heap_array[first].cached = 0;
+    heap_array[first].number_of_pages = number_of_pages;
+
+    heap_array[first].prev_free = HEAP_NO_PAGE;
+    heap_array[first].next_free = free_list_heads[size_class];
+    if (free_list_heads[size_class] != HEAP_NO_PAGE) {
+        heap_array[free_list_heads[size_class]].prev_free = first;
+    }
+    free_list_heads[size_class] = first;
+    free_list_bitmap |= (1 << size_class);
+}
+
+static void heap_remove_free_run(HEAP_PAGE_INT first)
+{
+    UINT32 size_class = heap_size_class(heap_array[first].number_of_pages);
+    HEAP_PAGE_INT next = heap_array[first].next_free;
+    HEAP_PAGE_INT prev = heap_array[first].prev_free;
+
+    if (prev != HEAP_NO_PAGE) {
+        heap_array[prev].next_free = next;
+    }
+    else {
+        free_list_heads[size_class] = next;
+    }
+    if (next != HEAP_NO_PAGE) {
+        heap_array[next].prev_free = prev;
+    }
+    if (free_list_heads[size_class] == HEAP_NO_PAGE) {
+        free_list_bitmap &= ~(1 << size_class);
+    }
+}
+
+// Returns the first page of a free run of at least number_of_pages pages,
+// or HEAP_NO_PAGE
+static HEAP_PAGE_INT heap_find_free_run(HEAP_PAGE_INT number_of_pages)
+{
+    UINT32 size_class = heap_size_class(number_of_pages);
+    UINT32 larger_lists;
+    UINT32 list;
+    HEAP_PAGE_INT page;
+
+    // reuse a run of about the requested size first, to keep large runs whole
+    page = free_list_heads[size_class];
+    if (page != HEAP_NO_PAGE && heap_array[page].number_of_pages >= number_of_pages) {
+        return page;
+    }
+
+    // any run on a larger list fits
+    larger_lists = free_list_bitmap & ~((2 << size_class) - 1);
+    if (hw_scan_bit_forward(&list, larger_lists)) {
+        return free_list_heads[list];
+    }
+
+    // the rest of the own list may still hold a run that fits
+    for (; page != HEAP_NO_PAGE; page = heap_array[page].next_free) {
+        if (heap_array[page].number_of_pages >= number_of_pages) {
+            return page;
+        }
+    }
+    return HEAP_NO_PAGE;
+}
+
+// Carves number_of_pages pages off a free run and marks them in use.
+// Called with heap_lock held.
+static HEAP_PAGE_INT heap_alloc_run(HEAP_PAGE_INT number_of_pages)
+{
+    HEAP_PAGE_INT first;
+    HEAP_PAGE_INT run_pages;
+    HEAP_PAGE_INT i;
+
+    first = heap_find_free_run(number_of_pages);
+    if (first == HEAP_NO_PAGE) {
+        return HEAP_NO_PAGE;
+    }
+    run_pages = heap_array[first].number_of_pages;
+    VMM_ASSERT((first + run_pages) <= heap_total_pages); // validity check
+
+    heap_remove_free_run(first);
+    if (run_pages > number_of_pages) {
+        heap_insert_free_run(first + number_of_pages, run_pages - number_of_pages);
+    }
+
+    heap_array[first].in_use = 1;
+    heap_array[first].cached = 0;
+    heap_array[first].number_of_pages = number_of_pages;
+    // mark next number_of_pages-1 pages as in_use
+    for (i = first + 1; i < (first + number_of_pages); ++i) {
+        heap_array[i].in_use = 1;
+        heap_array[i].cached = 0;
+        heap_array[i].number_of_pages = 0;
+    }
+
+    if (max_used_pages < (first + number_of_pages))
+        max_used_pages = first + number_of_pages;
+    return first;
+}
+
+// Releases the buffer starting at page first and merges it with free
+// neighbours.  Called with heap_lock held.
+static void heap_free_run(HEAP_PAGE_INT first)
+{
+    HEAP_PAGE_INT pages_to_release = heap_array[first].number_of_pages;
+    HEAP_PAGE_INT next = first + pages_to_release;
+    HEAP_PAGE_INT prev_first;
+    HEAP_PAGE_INT i;
+
+    for (i = first; i < next; ++i) {
+        heap_array[i].in_use = 0;
+        heap_array[i].cached = 0;
+        heap_array[i].number_of_pages = 0;
+    }
+
+    // merge with the following free run
+    if (next < heap_total_pages && 0 == heap_array[next].in_use) {
+        VMM_ASSERT((next + heap_array[next].number_of_pages) <= heap_total_pages);
+        pages_to_release += heap_array[next].number_of_pages;
+        heap_remove_free_run(next);
+    }
+
+    // merge with the preceding free run, found through its last page
+    if (first > 0 && 0 == heap_array[first - 1].in_use) {
+        prev_first = first - heap_array[first - 1].number_of_pages;
+        heap_remove_free_run(prev_first);
+        pages_to_release += first - prev_first;
+        first = prev_first;
+    }
+
+    heap_insert_free_run(first, pages_to_release);
+}
+
 HEAP_PAGE_INT vmm_heap_get_total_pages(void)
 {
     return heap_total_pages;
@@ -133,9 +313,21 @@ ADDRESS vmm_heap_initialize( IN ADDRESS heap_buffer_address, IN size_t  heap_buf
     // ASSERT for now.
     VMM_ASSERT(heap_total_pages > 0);
 
+    for (i = 0; i < HEAP_NUM_FREE_LISTS; ++i) {
+        free_list_heads[i] = HEAP_NO_PAGE;
+    }
+    free_list_bitmap = 0;
+
     for (i = 0; i < heap_total_pages ; ++i) {
         heap_array[i].in_use = 0;
-        heap_array[i].number_of_pages = (heap_total_pages - i);
+        heap_array[i].cached = 0;
+        heap_array[i].number_of_pages = 0;
+    }
+    heap_insert_free_run(0, heap_total_pages);
+
+    for (i = 0; i < VMM_MAX_CPU_SUPPORTED; ++i) {
+        lock_initialize(&heap_cpu_caches[i].lock);
+        heap_cpu_caches[i].count = 0;
     }
 
     //VMM_DEBUG_CODE(vmm_heap_show());
@@ -187,11 +379,16 @@ ADDRESS vmm_heap_extend( IN ADDRESS ex_heap_buffer_address,
     VMM_ASSERT(heap_total_pages > 0);
 
     heap_array[ex_heap_start_page].in_use = 1;
+    heap_array[ex_heap_start_page].cached = 0;
     heap_array[ex_heap_start_page].number_of_pages = 1;
 
     for (i = ex_heap_start_page + 1; i < heap_total_pages ; ++i) {
         heap_array[i].in_use = 0;
-        heap_array[i].number_of_pages = (heap_total_pages - i);
+        heap_array[i].cached = 0;
+        heap_array[i].number_of_pages = 0;
+    }
+    if (ex_heap_pages > 1) {
+        heap_insert_free_run(ex_heap_start_page + 1, ex_heap_pages - 1);
     }
     
     lock_release(&heap_lock);
@@ -213,45 +410,129 @@ static void * page_alloc_unprotected(
 #endif
     HEAP_PAGE_INT number_of_pages)
 {
-    HEAP_PAGE_INT i;
     HEAP_PAGE_INT allocated_page_no;
     void *p_buffer = NULL;
 
-    if (number_of_pages == 0) {
+    allocated_page_no = heap_alloc_run(number_of_pages);
+    if (HEAP_NO_PAGE != allocated_page_no) {
+        p_buffer = HEAP_PAGE_TO_POINTER(allocated_page_no);
+#ifdef DEBUG
+        heap_array[allocated_page_no].file_name = file_name;
+        heap_array[allocated_page_no].line_number = line_number;
+#endif
+    }
+    return p_buffer;
+}
+
+
+static HEAP_CPU_CACHE * heap_cpu_cache(void)
+{
+    CPU_ID cpu_id = hw_cpu_id();
+
+    if (cpu_id >= VMM_MAX_CPU_SUPPORTED) {
         return NULL;
     }
+    return &heap_cpu_caches[cpu_id];
+}
 
-    for (i = 0; i < heap_total_pages ; ++i) {
-        if ((0 == heap_array[i].in_use) && (number_of_pages <= heap_array[i].number_of_pages)) {
-            VMM_ASSERT((i + heap_array[i].number_of_pages) <= heap_total_pages); // validity check
-
-            // found the suitable buffer
-            allocated_page_no = i;
-            p_buffer = HEAP_PAGE_TO_POINTER(allocated_page_no);
-            heap_array[allocated_page_no].in_use = 1;
-            heap_array[allocated_page_no].number_of_pages = number_of_pages;
+
+// Takes a single page from this CPU's cache, refilling the cache from
+// the heap when it is empty.
+static void * heap_cached_page_alloc(
 #ifdef DEBUG
-            heap_array[i].file_name = file_name;
-            heap_array[i].line_number = line_number;
+    char *file_name,
+    INT32 line_number
+#else
+    void
 #endif
-            // mark next number_of_pages-1 pages as in_use
-            for (i = allocated_page_no + 1; i < (allocated_page_no + number_of_pages); ++i) {
-                heap_array[i].in_use = 1;
-                heap_array[i].number_of_pages = 0;
+    )
+{
+    HEAP_CPU_CACHE *cache = heap_cpu_cache();
+    HEAP_PAGE_INT page_no;
+    void *p_buffer = NULL;
+
+    if (NULL == cache) {
+        return NULL;
+    }
+    lock_acquire(&cache->lock);
+    if (0 == cache->count) {
+        lock_acquire(&heap_lock);
+        while (cache->count < HEAP_CPU_CACHE_BATCH) {
+            page_no = heap_alloc_run(1);
+            if (HEAP_NO_PAGE == page_no) {
+                break;
             }
-           
-            if (max_used_pages < (allocated_page_no + number_of_pages))  
-                max_used_pages = allocated_page_no + number_of_pages;
-            break;    // leave the outer loop
+            heap_array[page_no].cached = 1;
+            cache->pages[cache->count++] = page_no;
         }
+        lock_release(&heap_lock);
     }
+    if (cache->count > 0) {
+        page_no = cache->pages[--cache->count];
+        heap_array[page_no].cached = 0;
+#ifdef DEBUG
+        heap_array[page_no].file_name = file_name;
+        heap_array[page_no].line_number = line_number;
+#endif
+        p_buffer = HEAP_PAGE_TO_POINTER(page_no);
+    }
+    lock_release(&cache->lock);
+    return p_buffer;
+}
 
-    if (NULL == p_buffer) {
-        VMM_LOG(mask_anonymous, level_trace,"ERROR: (%s %d)  Failed to allocate %d pages\n", __FILE__, __LINE__, number_of_pages );
+
+// Parks a released single page in this CPU's cache, flushing the older
+// half of the cache to the heap when it is full.
+static BOOLEAN heap_cached_page_free(HEAP_PAGE_INT page_no)
+{
+    HEAP_CPU_CACHE *cache = heap_cpu_cache();
+    UINT32 i;
+
+    if (NULL == cache) {
+        return FALSE;
     }
+    lock_acquire(&cache->lock);
+    if (HEAP_CPU_CACHE_SIZE == cache->count) {
+        lock_acquire(&heap_lock);
+        for (i = 0; i < HEAP_CPU_CACHE_BATCH; ++i) {
+            heap_free_run(cache->pages[i]);
+        }
+        lock_release(&heap_lock);
+        for (i = HEAP_CPU_CACHE_BATCH; i < HEAP_CPU_CACHE_SIZE; ++i) {
+            cache->pages[i - HEAP_CPU_CACHE_BATCH] = cache->pages[i];
+        }
+        cache->count -= HEAP_CPU_CACHE_BATCH;
+    }
+    heap_array[page_no].cached = 1;
+    cache->pages[cache->count++] = page_no;
+    lock_release(&cache->lock);
+    return TRUE;
+}
 
-    TMSL_PROFILING_MEMORY_ALLOC((UINT64)p_buffer, number_of_pages * PAGE_4KB_SIZE, PROF_MEM_CONTEXT_TMSL);
-    return p_buffer;
+
+// Returns the pages of all per-CPU caches to the heap.
+// Returns TRUE if any page was returned.
+static BOOLEAN heap_drain_cpu_caches(void)
+{
+    HEAP_CPU_CACHE *cache;
+    BOOLEAN drained = FALSE;
+    UINT32 cpu;
+
+    for (cpu = 0; cpu < VMM_MAX_CPU_SUPPORTED; ++cpu) {
+        cache = &heap_cpu_caches[cpu];
+        if (0 == cache->count) {
+            continue;
+        }
+        lock_acquire(&cache->lock);
+        lock_acquire(&heap_lock);
+        while (cache->count > 0) {
+            heap_free_run(cache->pages[--cache->count]);
+            drained = TRUE;
+        }
+        lock_release(&heap_lock);
+        lock_release(&cache->lock);
+    }
+    return drained;
 }
 
 
@@ -268,13 +549,47 @@ void* vmm_page_allocate(
 {
     void *p_buffer = NULL;
 
-    lock_acquire(&heap_lock);
-    p_buffer = page_alloc_unprotected(
+    if (number_of_pages == 0) {
+        return NULL;
+    }
+
+    if (1 == number_of_pages) {
+        p_buffer = heap_cached_page_alloc(
 #ifdef DEBUG
-                     file_name, line_number,
+                         file_name, line_number
 #endif
-                     number_of_pages);
-    lock_release(&heap_lock);
+                         );
+    }
+
+    if (NULL == p_buffer) {
+        lock_acquire(&heap_lock);
+        p_buffer = page_alloc_unprotected(
+#ifdef DEBUG
+                         file_name, line_number,
+#endif
+                         number_of_pages);
+        lock_release(&heap_lock);
+    }
+
+    // pages parked in the per-CPU caches may close the gap
+    if (NULL == p_buffer && heap_drain_cpu_caches()) {
+        lock_acquire(&heap_lock);
+        p_buffer = page_alloc_unprotected(
+#ifdef DEBUG
+                         file_name, line_number,
+#endif
+                         number_of_pages);
+        lock_release(&heap_lock);
+    }
+
+    if (NULL == p_buffer) {
+        VMM_LOG(mask_anonymous, level_trace,"ERROR: (%s %d)  Failed to allocate %d pages\n", __FILE__, __LINE__, number_of_pages );
+    }
+#ifdef HEAP_TRACE
+    vmm_printf("HEAP TRACE: a %d %p\n", number_of_pages, p_buffer);
+#endif
+
+    TMSL_PROFILING_MEMORY_ALLOC((UINT64)p_buffer, number_of_pages * PAGE_4KB_SIZE, PROF_MEM_CONTEXT_TMSL);
     return p_buffer;
 }
 
@@ -295,10 +610,8 @@ HEAP_PAGE_INT vmm_page_allocate_scattered(
     HEAP_PAGE_INT i;
     HEAP_PAGE_INT number_of_allocated_pages;
 
-    lock_acquire(&heap_lock);
-
     for (i = 0; i < number_of_pages; ++i) {
-        p_page_array[i] = page_alloc_unprotected(
+        p_page_array[i] = vmm_page_allocate(
             #ifdef DEBUG
                                      file_name, line_number,
             #endif
@@ -308,7 +621,6 @@ HEAP_PAGE_INT vmm_page_allocate_scattered(
             break;    // leave the loop
         }
     }
-    lock_release(&heap_lock);
 
     number_of_allocated_pages = i;
 
@@ -320,20 +632,6 @@ HEAP_PAGE_INT vmm_page_allocate_scattered(
 }
 
 
-static void vmm_mark_pages_free(
-    HEAP_PAGE_INT page_from,
-    HEAP_PAGE_INT page_to,
-    HEAP_PAGE_INT pages_to_release)
-{
-    HEAP_PAGE_INT i;
-
-    for (i = page_from; i < page_to; ++i) {
-        heap_array[i].in_use = 0;
-        heap_array[i].number_of_pages = pages_to_release - (i - page_from);
-    }
-}
-
-
 // FUNCTION : vmm_page_free()
 // PURPOSE  : Release previously allocated buffer
 // ARGUMENTS: IN void *p_buffer - buffer to be released
@@ -341,8 +639,6 @@ static void vmm_mark_pages_free(
 void vmm_page_free(IN void *p_buffer)
 {
     HEAP_PAGE_INT release_from_page_id;    // first page to release
-    HEAP_PAGE_INT release_to_page_id;      // page next to last to release
-    HEAP_PAGE_INT pages_to_release;        // num of pages, to be released
     ADDRESS address;
 
     address = (ADDRESS) (size_t) p_buffer;
@@ -356,44 +652,33 @@ void vmm_page_free(IN void *p_buffer)
         VMM_DEADLOOP();
         return;
     }
-    lock_acquire(&heap_lock);
 
     release_from_page_id = HEAP_POINTER_TO_PAGE(p_buffer);
 
     //VMM_LOG(mask_anonymous, level_trace,"HEAP: trying to free page_id %d\n", release_from_page_id);
 
+    // the descriptors of an allocated buffer belong to its owner, so
+    // they can be checked before taking any lock
     if (0 == heap_array[release_from_page_id].in_use ||
-        0 == heap_array[release_from_page_id].number_of_pages) {
+        0 == heap_array[release_from_page_id].number_of_pages ||
+        0 != heap_array[release_from_page_id].cached) {
         VMM_LOG(mask_anonymous, level_trace,"ERROR: (%s %d)  Page %d is not in use\n", __FILE__, __LINE__, release_from_page_id);
         // BEFORE_VMLAUNCH. CRITICAL check that should not fail.
         VMM_DEADLOOP();
         return;
     }
+#ifdef HEAP_TRACE
+    vmm_printf("HEAP TRACE: f %p\n", p_buffer);
+#endif
 
-    pages_to_release = heap_array[release_from_page_id].number_of_pages;
-
-    // check if the next to the last released page is free
-    // and if so merge both regions
-
-    release_to_page_id = release_from_page_id + pages_to_release;
-
-    if (release_to_page_id < heap_total_pages &&
-        0 == heap_array[release_to_page_id].in_use  &&
-        (release_to_page_id + heap_array[release_to_page_id].number_of_pages) <= heap_total_pages) {
-        pages_to_release += heap_array[release_to_page_id].number_of_pages;
-    }
-
-    // move backward, to grab all free pages, trying to prevent fragmentation
-    while (release_from_page_id > 0  &&
-           0 == heap_array[release_from_page_id - 1].in_use &&
-           0 != heap_array[release_from_page_id - 1].number_of_pages) // 3rd check is for sanity only
-    {
-        release_from_page_id--;
-        pages_to_release++;
+    if (1 == heap_array[release_from_page_id].number_of_pages &&
+        heap_cached_page_free(release_from_page_id)) {
+        TMSL_PROFILING_MEMORY_FREE((UINT64)p_buffer, PROF_MEM_CONTEXT_TMSL);
+        return;
     }
 
-    vmm_mark_pages_free(release_from_page_id, release_to_page_id, pages_to_release);
-
+    lock_acquire(&heap_lock);
+    heap_free_run(release_from_page_id);
     lock_release(&heap_lock);
     TMSL_PROFILING_MEMORY_FREE((UINT64)p_buffer, PROF_MEM_CONTEXT_TMSL);
 }
@@ -423,7 +708,8 @@ UINT32 vmm_page_buff_size(IN void *p_buffer)
     //VMM_LOG(mask_anonymous, level_trace,"HEAP: trying to free page_id %d\n", release_from_page_id);
 
     if (0 == heap_array[release_from_page_id].in_use ||
-        0 == heap_array[release_from_page_id].number_of_pages) {
+        0 == heap_array[release_from_page_id].number_of_pages ||
+        0 != heap_array[release_from_page_id].cached) {
         VMM_LOG(mask_anonymous, level_trace,"ERROR: (%s %d)  Page %d is not in use\n", __FILE__, __LINE__, release_from_page_id);
         VMM_DEADLOOP();
         return 0;
@@ -446,6 +732,7 @@ void* vmm_memory_allocate(
     IN UINT32 size)
 {
     void *p_buffer = NULL;
+    UINT32 offset;
 
     if (size == 0) {
         return NULL;
@@ -458,7 +745,9 @@ void* vmm_memory_allocate(
 #endif
                             (HEAP_PAGE_INT) (size / PAGE_4KB_SIZE));
     if (NULL != p_buffer) {
-        vmm_memset(p_buffer, 0, size);
+        for (offset = 0; offset < size; offset += PAGE_4KB_SIZE) {
+            vmm_zero_page((UINT8*)p_buffer + offset);
+        }
     }
     return p_buffer;
 }
@@ -531,7 +820,10 @@ void vmm_heap_show(void)
     for (i = 0; i < heap_total_pages; ) {
         VMM_LOG(mask_anonymous, level_trace,"Pages %d..%d ", i, i + heap_array[i].number_of_pages - 1);
 
-        if (heap_array[i].in_use) {
+        if (heap_array[i].cached) {
+            VMM_LOG(mask_anonymous, level_trace,"cached\n");
+        }
+        else if (heap_array[i].in_use) {
             VMM_LOG(mask_anonymous, level_trace,"allocated in %s line=%d\n", heap_array[i].file_name, heap_array[i].line_number);
         }
         else {
@@ -17,121 +17,210 @@
 #include "lock.h"
 #include "ipc.h"
 #include "vmm_dbg.h"
+#include "cli.h"
 #include "file_codes.h"
 
 #define VMM_DEADLOOP()                 VMM_DEADLOOP_LOG(LOCK_C)
 #define VMM_ASSERT(__condition)        VMM_ASSERT_LOG(LOCK_C, __condition)
 #define VMM_ASSERT_NOLOCK(__condition) VMM_ASSERT_NOLOCK_LOG(LOCK_C, __condition)
 
-// lock_try_acquire - returns TRUE if lock was acquired and FALSE if not
-BOOLEAN lock_try_acquire(VMM_LOCK* lock);
+// keeps the compiler from moving accesses to the protected data past the
+// release store, the CPU doesn't reorder stores
+#define LOCK_COMPILER_BARRIER()     __asm__ __volatile__("" ::: "memory")
+
+#define LOCK_TICKET(__value)        ((UINT16) ((__value) >> LOCK_TICKET_SHIFT))
+#define LOCK_SERVING(__value)       ((UINT16) ((__value) & LOCK_TICKET_MASK))
+
+
+#ifdef LOCK_STATS
+
+#define LOCK_STATS_MAX_LOCKS    1024
+
+// locks are registered the first time they are acquired. They are not
+// unregistered, a lock in memory that was freed still shows up until its
+// memory is reused for a lock
+static VMM_LOCK *lock_stats_locks[LOCK_STATS_MAX_LOCKS];
+static volatile INT32 lock_stats_num_locks = 0;
+
+// called by the owner of the lock
+static void lock_stats_update(VMM_LOCK* lock, UINT64 spin_start)
+{
+    INT32 slot;
+
+    if (0 == lock->stats_index) {
+        for (slot = 0; slot < lock_stats_num_locks && slot < LOCK_STATS_MAX_LOCKS; slot++) {
+            if (lock_stats_locks[slot] == lock) {
+                break;
+            }
+        }
+        if (slot >= lock_stats_num_locks || slot >= LOCK_STATS_MAX_LOCKS) {
+            slot = hw_interlocked_add(&lock_stats_num_locks, 1);
+        }
+        if (slot < LOCK_STATS_MAX_LOCKS) {
+            lock_stats_locks[slot] = lock;
+        }
+        lock->stats_index = (UINT32) slot + 1;
+    }
+    lock->acquisitions++;
+    if (spin_start != 0) {
+        lock->contended_acquisitions++;
+        lock->spin_cycles += hw_rdtsc() - spin_start;
+    }
+}
+
+#define LOCK_SPIN_START()       hw_rdtsc()
+#else
+#define lock_stats_update(__lock, __spin_start)   ((void) (__spin_start))
+#define LOCK_SPIN_START()       1
+#endif
 
 
 void lock_acquire(VMM_LOCK* lock)
 {
-    (void)lock;
     CPU_ID this_cpu_id = hw_cpu_id();
+    UINT64 spin_start = 0;
+    UINT16 ticket;
 
     if (! lock) {
         return; // error
     }
-    while (FALSE == lock_try_acquire(lock)) {
+    ticket = LOCK_TICKET(hw_interlocked_add((INT32 volatile *)(&(lock->u.uint32_lock)),
+                                            1 << LOCK_TICKET_SHIFT));
+    if (lock->u.ticket.serving != ticket) {
         VMM_ASSERT_NOLOCK(lock->owner_cpu_id != this_cpu_id);
-        hw_pause();
+        spin_start = LOCK_SPIN_START();
+        while (lock->u.ticket.serving != ticket) {
+            hw_pause();
+        }
     }
     lock->owner_cpu_id = this_cpu_id;
+    lock_stats_update(lock, spin_start);
 }
 
+// A CPU waiting here may handle an IPC that takes the same lock, it must not
+// hold a ticket meanwhile. So it only takes the lock when the lock is free,
+// which gives up the fairness of lock_acquire.
 void interruptible_lock_acquire(VMM_LOCK* lock)
 {
-    (void)lock;
     CPU_ID this_cpu_id = hw_cpu_id();
     BOOLEAN ipc_processed = FALSE;
+    UINT64 spin_start = 0;
 
     if (!lock) {
         return; // error
     }
     while (FALSE == lock_try_acquire(lock)) {
+        if (0 == spin_start) {
+            spin_start = LOCK_SPIN_START();
+        }
         ipc_processed = ipc_process_one_ipc();
         if(FALSE == ipc_processed) {
             hw_pause();
         }
     }
     lock->owner_cpu_id = this_cpu_id;
+    lock_stats_update(lock, spin_start);
 }
 
 void lock_release(VMM_LOCK* lock)
 {
-    (void)lock;
     if (!lock) {
         return;  // error
     }
     lock->owner_cpu_id = (CPU_ID)-1;
-#if 0
-    hw_interlocked_assign((INT32 volatile *)(&(lock->uint32_lock)), 0);
-#else
-    lock->uint32_lock= 0;
-#endif
+    LOCK_COMPILER_BARRIER();
+    // only the owner writes serving, a 16 bit store leaves next alone
+    lock->u.ticket.serving = (UINT16) (lock->u.ticket.serving + 1);
 }
 
+// lock_try_acquire - returns TRUE if lock was acquired and FALSE if not
 BOOLEAN lock_try_acquire(VMM_LOCK* lock)
 {
-  (void)lock;
-    UINT32 expected_value = 0, current_value;
-    UINT32 new_value = 1;
+    UINT32 expected_value, current_value;
+
     if (!lock) {
         return FALSE;  // error
     }
+    expected_value = lock->u.uint32_lock;
+    if (LOCK_TICKET(expected_value) != LOCK_SERVING(expected_value)) {
+        return FALSE;  // held
+    }
     current_value =
-            hw_interlocked_compare_exchange((INT32 volatile *)(&(lock->uint32_lock)),
-                                              expected_value, new_value);
+            hw_interlocked_compare_exchange((INT32 volatile *)(&(lock->u.uint32_lock)),
+                                            expected_value,
+                                            expected_value + (1 << LOCK_TICKET_SHIFT));
     return (current_value == expected_value);
 }
 
 
 void lock_initialize(VMM_LOCK* lock)
 {
-    (void)lock;
-    lock_release( lock );
+    if (!lock) {
+        return;  // error
+    }
+    lock->owner_cpu_id = (CPU_ID)-1;
+#ifdef LOCK_STATS
+    lock->stats_index = 0;
+    lock->acquisitions = 0;
+    lock->contended_acquisitions = 0;
+    lock->spin_cycles = 0;
+#endif
+    lock->u.uint32_lock = 0;
 }
 
 void lock_initialize_read_write_lock(VMM_READ_WRITE_LOCK* lock)
 {
-    (void)lock;
     lock_initialize(&lock->lock);
     lock->readers = 0;
 }
 
 
+// returns TRUE if there is no writer and the reader is in
+static BOOLEAN lock_try_enter_reader(VMM_READ_WRITE_LOCK* lock)
+{
+    if (0 == (hw_interlocked_add(&lock->readers, 1) & RW_LOCK_WRITER)) {
+        return TRUE;
+    }
+    // back out and let the writer go first
+    hw_interlocked_add(&lock->readers, -1);
+    return FALSE;
+}
+
 void lock_acquire_readlock(VMM_READ_WRITE_LOCK* lock)
 {
-    (void)lock;
-    lock_acquire(&lock->lock);
-    hw_interlocked_increment((INT32*)(&lock->readers));
-    lock_release(&lock->lock);
+    while (FALSE == lock_try_enter_reader(lock)) {
+        while (lock->readers & RW_LOCK_WRITER) {
+            hw_pause();
+        }
+    }
 }
 
 void interruptible_lock_acquire_readlock(VMM_READ_WRITE_LOCK* lock)
 {
-    (void)lock;
-    interruptible_lock_acquire(&lock->lock);
-    hw_interlocked_increment((INT32*)(&lock->readers));
-    lock_release(&lock->lock);
+    BOOLEAN ipc_processed = FALSE;
+
+    while (FALSE == lock_try_enter_reader(lock)) {
+        while (lock->readers & RW_LOCK_WRITER) {
+            ipc_processed = ipc_process_one_ipc();
+            if(FALSE == ipc_processed) {
+                hw_pause();
+            }
+        }
+    }
 }
 
 void lock_release_readlock( VMM_READ_WRITE_LOCK * lock )
 {
-    (void)lock;
-    hw_interlocked_decrement((INT32*)(&lock->readers));
+    hw_interlocked_add(&lock->readers, -1);
 }
 
 
 void lock_acquire_writelock(VMM_READ_WRITE_LOCK * lock)
 {
-    (void)lock;
     lock_acquire(&lock->lock);
-    // wait until readers == 0
-    while(lock->readers) {
+    hw_interlocked_add(&lock->readers, RW_LOCK_WRITER);
+    // wait until the readers are out
+    while (lock->readers != RW_LOCK_WRITER) {
         hw_pause();
     }
 }
@@ -139,12 +228,12 @@ void lock_acquire_writelock(VMM_READ_WRITE_LOCK * lock)
 
 void interruptible_lock_acquire_writelock(VMM_READ_WRITE_LOCK * lock)
 {
-    (void)lock;
     BOOLEAN ipc_processed = FALSE;
 
     interruptible_lock_acquire(&lock->lock);
-    //  wait until readers == 0
-    while(lock->readers) {
+    hw_interlocked_add(&lock->readers, RW_LOCK_WRITER);
+    //  wait until the readers are out
+    while (lock->readers != RW_LOCK_WRITER) {
         ipc_processed = ipc_process_one_ipc();
         if(FALSE == ipc_processed) {
             hw_pause();
@@ -155,7 +244,7 @@ void interruptible_lock_acquire_writelock(VMM_READ_WRITE_LOCK * lock)
 
 void lock_release_writelock(VMM_READ_WRITE_LOCK* lock)
 {
-    (void)lock;
+    hw_interlocked_add(&lock->readers, -RW_LOCK_WRITER);
     lock_release(&lock->lock);
 }
 
@@ -166,10 +255,50 @@ void lock_print( VMM_LOCK* lock )
 {
   (void)lock;
 #if 0  // lock print
-    VMM_LOG(mask_anonymous, level_trace,"lock %p: value=%d, owner=%d\r\n", lock, lock->uint32_lock, lock->owner_cpu_id);
+    VMM_LOG(mask_anonymous, level_trace,"lock %p: serving=%d, next=%d, owner=%d\r\n", lock,
+            lock->u.ticket.serving, lock->u.ticket.next, lock->owner_cpu_id);
 #endif
 }
 
 )
 
 
+#if defined DEBUG && defined LOCK_STATS
+// debug locks [reset]
+static int cli_show_lock_stats(unsigned argc, char *args[])
+{
+    BOOLEAN reset = (argc > 1 && 0 == CLI_STRNCMP(args[1], "reset", sizeof("reset")));
+    VMM_LOCK *lock;
+    INT32 num_locks = lock_stats_num_locks;
+    INT32 slot;
+
+    if (num_locks > LOCK_STATS_MAX_LOCKS) {
+        CLI_PRINT("%d locks, only the first %d are shown\n", num_locks, LOCK_STATS_MAX_LOCKS);
+        num_locks = LOCK_STATS_MAX_LOCKS;
+    }
+    CLI_PRINT("lock              acquisitions contended  spin cycles\n");
+    for (slot = 0; slot < num_locks; slot++) {
+        lock = lock_stats_locks[slot];
+        if (NULL == lock || 0 == lock->acquisitions) {
+            continue;
+        }
+        CLI_PRINT("%P %12lld %9lld %12lld\n", lock, lock->acquisitions,
+                  lock->contended_acquisitions, lock->spin_cycles);
+        if (reset) {
+            lock->acquisitions = 0;
+            lock->contended_acquisitions = 0;
+            lock->spin_cycles = 0;
+        }
+    }
+    return 0;
+}
+#endif
+
+void lock_cli_init(void)
+{
+#if defined DEBUG && defined LOCK_STATS
+    CLI_AddCommand(cli_show_lock_stats, "debug locks",
+                   "Print lock acquisitions, contention and spin cycles", "[reset]",
+                   CLI_ACCESS_LEVEL_USER);
+#endif
+}
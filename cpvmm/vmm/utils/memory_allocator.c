@@ -33,7 +33,8 @@
 
 typedef struct {
     UINT32 size;
-    UINT32 offset;
+    UINT16 offset;
+    UINT16 owner_cpu;   // CPU whose magazine the element came from
 } MEM_ALLOCATION_INFO;
 
 // pool per element size (2^x bytes, x = 0, 1,...11)
@@ -43,6 +44,38 @@ typedef struct {
 static POOL_HANDLE pools[NUMBER_OF_POOLS] = {POOL_INVALID_HANDLE};
 static VMM_LOCK lock = LOCK_INIT_STATE;
 
+// Each CPU keeps a magazine of free elements in front of every pool, so
+// most allocations and frees don't take the pools lock.  Magazines are
+// refilled from and flushed to the pools in batches.  An element freed
+// on another CPU than the one it was allocated on is pushed on the
+// owner's remote_free stack without locking; the owner takes the whole
+// stack at once when its magazine runs empty.  Only the owner removes
+// elements from the stack, so it has no ABA problem.
+//
+// A CPU only uses its magazines after it has loaded the VMM GDT and
+// called vmm_mem_allocator_enable_cpu_cache(): before that hw_cpu_id()
+// decodes the loader's task register, which names no CPU.  An NMI or
+// exception handler that allocates while its CPU is already inside the
+// magazines finds the cache busy and goes to the pools instead.
+#define MEM_MAGAZINE_SIZE   16
+#define MEM_MAGAZINE_BATCH  (MEM_MAGAZINE_SIZE / 2)
+#define MEM_NO_OWNER        ((UINT16) ~0)
+
+typedef struct {
+    void*           elements[MEM_MAGAZINE_SIZE];
+    UINT32          count;
+    UINT32          padding;
+    volatile UINT64 remote_free;    // elements linked through their first 8 bytes
+} MEM_MAGAZINE;
+
+typedef struct {
+    MEM_MAGAZINE    magazines[NUMBER_OF_POOLS];
+    volatile UINT32 busy;           // owner is using the magazines
+} MEM_CPU_CACHE;
+
+// set by each CPU once its hw_cpu_id() is valid
+static MEM_CPU_CACHE* cpu_caches[VMM_MAX_CPU_SUPPORTED] = {NULL};
+
 static UINT32 buffer_size_to_pool_index(UINT32 size)
 {
     UINT32 pool_index = 0;
@@ -58,6 +91,157 @@ static UINT32 buffer_size_to_pool_index(UINT32 size)
     return pool_index;
 }
 
+// returns previous value; new_value is stored if it was expected
+static UINT64 mem_compare_exchange_64(volatile UINT64 *destination,
+                                      UINT64 expected, UINT64 new_value)
+{
+    UINT64 previous;
+
+    __asm__ volatile(
+        "\tlock; cmpxchgq %[new_value], %[destination]\n"
+    : "=a" (previous), [destination] "+m" (*destination)
+    : [new_value] "r" (new_value), "0" (expected)
+    : "memory", "cc");
+    return previous;
+}
+
+// Called with lock held
+static POOL_HANDLE mem_get_pool(UINT32 pool_index)
+{
+    POOL_HANDLE pool = pools[pool_index];
+
+    if(NULL == pool) {
+        pool = pools[pool_index] = assync_pool_create((UINT32)(1 << pool_index));
+        VMM_ASSERT(pool);
+    }
+    return pool;
+}
+
+// Returns the cache of the running CPU marked busy, or NULL if the CPU
+// has no cache yet or is already using it further down the stack.
+static MEM_CPU_CACHE* mem_cpu_cache_enter(CPU_ID cpu_id)
+{
+    MEM_CPU_CACHE* cache;
+
+    if (cpu_id >= VMM_MAX_CPU_SUPPORTED) {
+        return NULL;
+    }
+    cache = cpu_caches[cpu_id];
+    if (NULL == cache || cache->busy) {
+        return NULL;
+    }
+    // only handlers on this CPU race with us, and they run to completion
+    cache->busy = 1;
+    __asm__ volatile("" ::: "memory");
+    return cache;
+}
+
+static void mem_cpu_cache_leave(MEM_CPU_CACHE* cache)
+{
+    __asm__ volatile("" ::: "memory");
+    cache->busy = 0;
+}
+
+// return the older half of a full magazine to its pool
+static void mem_magazine_flush(MEM_MAGAZINE* magazine, UINT32 pool_index)
+{
+    UINT32 i;
+
+    lock_acquire(&lock);
+    for (i = 0; i < MEM_MAGAZINE_BATCH; i++) {
+        pool_free(pools[pool_index], magazine->elements[i]);
+    }
+    lock_release(&lock);
+    for (i = MEM_MAGAZINE_BATCH; i < MEM_MAGAZINE_SIZE; i++) {
+        magazine->elements[i - MEM_MAGAZINE_BATCH] = magazine->elements[i];
+    }
+    magazine->count -= MEM_MAGAZINE_BATCH;
+}
+
+static void mem_magazine_put(MEM_MAGAZINE* magazine, UINT32 pool_index,
+                             void* element)
+{
+    if (MEM_MAGAZINE_SIZE == magazine->count) {
+        mem_magazine_flush(magazine, pool_index);
+    }
+    magazine->elements[magazine->count++] = element;
+}
+
+static void mem_magazine_push_remote(MEM_MAGAZINE* magazine, void* element)
+{
+    UINT64 head;
+
+    do {
+        head = magazine->remote_free;
+        *(volatile UINT64*)element = head;
+    } while (mem_compare_exchange_64(&magazine->remote_free, head,
+                                     (UINT64)element) != head);
+}
+
+static void mem_magazine_take_remote(MEM_MAGAZINE* magazine, UINT32 pool_index)
+{
+    UINT64 head;
+    void* element;
+
+    do {
+        head = magazine->remote_free;
+    } while (head != 0 &&
+             mem_compare_exchange_64(&magazine->remote_free, head, 0) != head);
+
+    while (head != 0) {
+        element = (void*)head;
+        head = *(volatile UINT64*)element;
+        mem_magazine_put(magazine, pool_index, element);
+    }
+}
+
+static void* mem_magazine_allocate(MEM_MAGAZINE* magazine, UINT32 pool_index)
+{
+    POOL_HANDLE pool;
+    void* element;
+
+    if (0 == magazine->count && 0 != magazine->remote_free) {
+        mem_magazine_take_remote(magazine, pool_index);
+    }
+    if (0 == magazine->count) {
+        lock_acquire(&lock);
+        pool = mem_get_pool(pool_index);
+        while (magazine->count < MEM_MAGAZINE_BATCH) {
+            element = pool_allocate(pool);
+            if (NULL == element) {
+                break;
+            }
+            magazine->elements[magazine->count++] = element;
+        }
+        lock_release(&lock);
+    }
+    if (0 == magazine->count) {
+        return NULL;
+    }
+    return magazine->elements[--magazine->count];
+}
+
+// FUNCTION : vmm_mem_allocator_enable_cpu_cache()
+// PURPOSE  : Start using the magazines of the calling CPU. Must be called
+//            on that CPU after hw_gdt_load().
+void vmm_mem_allocator_enable_cpu_cache(CPU_ID cpu_id)
+{
+    MEM_CPU_CACHE* cache;
+
+    VMM_ASSERT(cpu_id < VMM_MAX_CPU_SUPPORTED);
+    VMM_ASSERT(cpu_id == hw_cpu_id());
+    if (NULL != cpu_caches[cpu_id]) {
+        return;
+    }
+    VMM_ASSERT(sizeof(MEM_CPU_CACHE) <= PAGE_4KB_SIZE);
+    cache = (MEM_CPU_CACHE*) vmm_page_alloc(1);
+    if (NULL == cache) {
+        return;
+    }
+    vmm_zeromem(cache, sizeof(MEM_CPU_CACHE));
+    cpu_caches[cpu_id] = cache;
+}
+
 #pragma warning (push)
 #pragma warning (disable : 4100)
 
@@ -71,6 +255,9 @@ static void* vmm_mem_allocate_internal( char *file_name,
     UINT64 allocated_addr;
     MEM_ALLOCATION_INFO *alloc_info;
     UINT32 size_to_request;
+    CPU_ID cpu_id;
+    MEM_CPU_CACHE* cache;
+    UINT16 owner_cpu = MEM_NO_OWNER;
 
     // Unused variables
     (void)file_name;
@@ -103,22 +290,37 @@ static void* vmm_mem_allocate_internal( char *file_name,
         size_to_request = size + sizeof(MEM_ALLOCATION_INFO);
     }
 
+    // aligned requests take twice their size, which may not fit the largest pool
+    if (size_to_request > (1 << (NUMBER_OF_POOLS - 1))) {
+        VMM_LOG(mask_anonymous, level_trace,"%s: WARNING: Aligned allocation needs more than 2KB (requested size = 0x%x, alignment = 0x%x from %s:%d)\n", __FUNCTION__, size, alignment, file_name, line_number);
+        VMM_ASSERT(0);
+        return NULL;
+    }
+
     pool_index = buffer_size_to_pool_index(size_to_request);
     pool_element_size = 1 << pool_index;
 
-    lock_acquire(&lock);
+    ptr = NULL;
+    cpu_id = hw_cpu_id();
+    cache = mem_cpu_cache_enter(cpu_id);
+    if (NULL != cache) {
+        ptr = mem_magazine_allocate(&cache->magazines[pool_index], pool_index);
+        mem_cpu_cache_leave(cache);
+        if (NULL != ptr) {
+            owner_cpu = cpu_id;
+        }
+    }
+
+    if (NULL == ptr) {
+        lock_acquire(&lock);
 #ifdef JLMDEBUG1
-    bprint("pool_index: %d, pools: 0x%016x,\nval = %p, expected = %p\n",
-            pool_index, pools, pools[pool_index], pools[0]);
+        bprint("pool_index: %d, pools: 0x%016x,\nval = %p, expected = %p\n",
+                pool_index, pools, pools[pool_index], pools[0]);
 #endif
-    pool = pools[pool_index];
-    if(NULL == pool) {
-        pool = pools[pool_index] = assync_pool_create((UINT32)pool_element_size);
-        VMM_ASSERT(pool);
+        pool = mem_get_pool(pool_index);
+        ptr = pool_allocate(pool);
+        lock_release(&lock);
     }
-
-    ptr = pool_allocate(pool);
-    lock_release(&lock);
     if(NULL == ptr) {
         return NULL;
     }
@@ -131,7 +333,8 @@ static void* vmm_mem_allocate_internal( char *file_name,
     alloc_info = (MEM_ALLOCATION_INFO*)
                     (allocated_addr + alignment - sizeof(MEM_ALLOCATION_INFO));
     alloc_info->size = pool_element_size;
-    alloc_info->offset = alignment;
+    alloc_info->offset = (UINT16)alignment;
+    alloc_info->owner_cpu = owner_cpu;
     return (void *)(allocated_addr + alignment);
 }
 
@@ -153,6 +356,8 @@ void vmm_mem_free( char *file_name, INT32 line_number, IN void *buff)
     UINT32 pool_element_size = 0;
     UINT32 pool_index = 0;
     POOL_HANDLE pool = NULL;
+    UINT16 owner_cpu;
+    MEM_CPU_CACHE* cache;
     // Unused variables
     (void)file_name;
     (void)line_number;
@@ -169,6 +374,26 @@ void vmm_mem_free( char *file_name, INT32 line_number, IN void *buff)
     pool_index = buffer_size_to_pool_index(pool_element_size);
     allocated_buffer = (void*)((UINT64)buff - alloc_info->offset);
 
+    // magazine elements are pool elements, so a nested free on the owner
+    // can give the element straight back to its pool
+    owner_cpu = alloc_info->owner_cpu;
+    if (owner_cpu != MEM_NO_OWNER) {
+        if (owner_cpu != hw_cpu_id()) {
+            cache = cpu_caches[owner_cpu];
+            VMM_ASSERT(cache != NULL);
+            mem_magazine_push_remote(&cache->magazines[pool_index],
+                                     allocated_buffer);
+            return;
+        }
+        cache = mem_cpu_cache_enter(owner_cpu);
+        if (NULL != cache) {
+            mem_magazine_put(&cache->magazines[pool_index], pool_index,
+                             allocated_buffer);
+            mem_cpu_cache_leave(cache);
+            return;
+        }
+    }
+
     lock_acquire(&lock);
     pool = pools[pool_index];
     VMM_ASSERT(pool != NULL);
@@ -45,6 +45,10 @@
 #include "memory_dump.h"
 #include "vmexit_dtr_tr.h"
 #include "profiling.h"
+#include "exit_trace.h"
+#include "vmm_log_buffer.h"
+#include "event_mgr.h"
+#include "cli.h"
 #ifdef JLMDEBUG
 #include "jlmdebug.h"
 #endif
@@ -76,6 +80,7 @@ extern VMEXIT_HANDLING_STATUS vmexit_vmread_instruction(GUEST_CPU_HANDLE gcpu);
 extern VMEXIT_HANDLING_STATUS vmexit_vmwrite_instruction(GUEST_CPU_HANDLE gcpu);
 VMEXIT_HANDLING_STATUS vmexit_halt_instruction(GUEST_CPU_HANDLE gcpu);
 VMEXIT_HANDLING_STATUS vmexit_xsetbv(GUEST_CPU_HANDLE gcpu);
+static VMEXIT_HANDLING_STATUS vmexit_preemption_timer(GUEST_CPU_HANDLE gcpu);
 VMEXIT_HANDLING_STATUS vmexit_vmentry_failure_due2_machine_check(GUEST_CPU_HANDLE gcpu);
 #ifdef FAST_VIEW_SWITCH
 VMEXIT_HANDLING_STATUS vmexit_invalid_vmfunc(GUEST_CPU_HANDLE gcpu);
@@ -94,16 +99,37 @@ typedef struct _GUEST_VMEXIT_CONTROL {
     GUEST_ID            guest_id;
     char                padding[6];
     VMEXIT_HANDLER      vmexit_handlers[Ia32VmxExitBasicReasonCount];
+    VMEXIT_FAST_PATH_HANDLER fast_path_handlers[Ia32VmxExitBasicReasonCount];
     UINT64              vmexit_counter[Ia32VmxExitBasicReasonCount];
     LIST_ELEMENT        list[1];
 } GUEST_VMEXIT_CONTROL;
 
 typedef struct {
     LIST_ELEMENT guest_vmexit_controls[1];
+    // reasons some guest has a fast path handler for, one bit per reason
+    UINT64       fast_path_reasons;
 } VMEXIT_GLOBAL_STATE;
 
 static VMEXIT_GLOBAL_STATE         vmexit_global_state;  // for all guests
 
+// Per CPU accounting of the VM exits of every basic reason: number of exits,
+// handler cycles from the VM exit to the VM entry, and a log2 histogram of
+// them. A CPU only updates its own table, the CLI reads them unlocked.
+#define VMEXIT_STATS_NUM_BUCKETS    24  // the last one counts 2^23 cycles and more
+
+typedef struct _VMEXIT_REASON_STATS {
+    UINT64  count;
+    UINT64  fast_path_count;
+    UINT64  cycles;
+    UINT64  max_cycles;
+    UINT32  histogram[VMEXIT_STATS_NUM_BUCKETS];
+} VMEXIT_REASON_STATS;
+
+static VMEXIT_REASON_STATS *vmexit_stats[VMM_MAX_CPU_SUPPORTED];
+static CPU_ID vmexit_stats_num_cpus = 0;
+
+static void vmexit_cli_register(void);
+
 typedef void (*VMEXIT_CLASSIFICATION_FUNC)(GUEST_CPU_HANDLE gcpu, UINT32 reason);
 
 static VMEXIT_CLASSIFICATION_FUNC vmexit_classification_func[Ia32VmxExitBasicReasonCount] = {
@@ -189,9 +215,20 @@ void vmexit_initialize(void)
 {
     GUEST_HANDLE   guest;
     GUEST_ECONTEXT guest_ctx;
+    CPU_ID         cpu_id;
 
     vmm_memset( &vmexit_global_state, 0, sizeof(vmexit_global_state) );
     list_init(vmexit_global_state.guest_vmexit_controls);
+    for (cpu_id = 0; cpu_id < g_num_of_cpus && cpu_id < VMM_MAX_CPU_SUPPORTED; cpu_id++) {
+        // a few KB per CPU, more than vmm_malloc() serves
+        vmexit_stats[cpu_id] = (VMEXIT_REASON_STATS *)
+            vmm_memory_alloc(sizeof(VMEXIT_REASON_STATS) * Ia32VmxExitBasicReasonCount);
+        if (NULL == vmexit_stats[cpu_id]) {
+            VMM_LOG(mask_anonymous, level_trace,"CPU%d: VM exit statistics are not allocated\n", cpu_id);
+        }
+    }
+    vmexit_stats_num_cpus = cpu_id;
+    vmexit_cli_register();
     io_vmexit_initialize();
     vmcall_intialize();
     for( guest = guest_first( &guest_ctx ); guest; guest = guest_next( &guest_ctx )) {
@@ -217,6 +254,7 @@ void vmexit_guest_initialize(GUEST_ID guest_id)
     // install default handlers
     for (i = 0; i < Ia32VmxExitBasicReasonCount; ++i) {
         guest_vmexit_control->vmexit_handlers[i] = vmexit_handler_default;
+        guest_vmexit_control->fast_path_handlers[i] = NULL;
     }
 
     //  commented out handlers installed by means of vmexit_install_handler
@@ -253,6 +291,7 @@ void vmexit_guest_initialize(GUEST_ID guest_id)
     guest_vmexit_control->vmexit_handlers[Ia32VmxExitBasicReasonMonitorTrapFlag] = vmexit_mtf;
     guest_vmexit_control->vmexit_handlers[Ia32VmxExitBasicReasonFailureDueMachineCheck] = vmexit_vmentry_failure_due2_machine_check;
     guest_vmexit_control->vmexit_handlers[Ia32VmxExitBasicReasonXsetbvInstruction] = vmexit_xsetbv;
+    guest_vmexit_control->vmexit_handlers[Ia32VmxExitBasicReasonPreemptionTimerExpired] = vmexit_preemption_timer;
 #ifdef FAST_VIEW_SWITCH
     guest_vmexit_control->vmexit_handlers[Ia32VmxExitBasicReasonInvalidVmfunc] = vmexit_invalid_vmfunc;
 #endif
@@ -281,6 +320,7 @@ void vmexit_guest_initialize(GUEST_ID guest_id)
     vmexit_cpuid_guest_intialize(guest_id);
     // install VMCALL services
     vmcall_guest_intialize(guest_id);
+    exit_trace_guest_initialize(guest_id);
     VMM_LOG(mask_uvmm, level_trace,"vmexit_guest_initialize end guest_id=#%d\n", 
             guest_id);
 }
@@ -377,7 +417,7 @@ void vmexit_bottom_up_common_handler(GUEST_CPU_HANDLE gcpu, UINT32 reason) {
     if (vmexit_handling_status != VMEXIT_HANDLED) {
         // Currently it can happen only for exception
         if (reason != Ia32VmxExitBasicReasonSoftwareInterruptExceptionNmi) {
-            VMM_LOG(mask_uvmm, level_trace,"%s: reason = %d\n", 
+            VMM_LOG_FAST(mask_uvmm, level_trace,"%s: reason = %d\n", 
                     __FUNCTION__, reason);
         }
         VMM_ASSERT(reason == Ia32VmxExitBasicReasonSoftwareInterruptExceptionNmi);
@@ -466,7 +506,7 @@ void vmexit_handler_invoke( GUEST_CPU_HANDLE gcpu, UINT32 reason)
             LOOP_FOREVER;
         }
 #endif
-        VMM_LOG(mask_uvmm, level_trace,"Warning: Unknown VMEXIT reason(%d)\n", 
+        VMM_LOG_FAST(mask_uvmm, level_trace,"Warning: Unknown VMEXIT reason(%d)\n", 
                 reason);
         vmexit_handler_default(gcpu);
     }
@@ -578,6 +618,10 @@ VMEXIT_HANDLING_STATUS vmexit_xsetbv(GUEST_CPU_HANDLE gcpu)
 // RETURNS  : vmexit handling status
 VMEXIT_HANDLING_STATUS vmexit_halt_instruction(GUEST_CPU_HANDLE gcpu)
 {
+    // a gCPU that shares its host CPU yields the rest of its time slice
+    if (scheduler_halt_gcpu(gcpu)) {
+        return VMEXIT_HANDLED;
+    }
     if (!report_uvmm_event(UVMM_EVENT_HALT_INSTRUCTION, 
                            (VMM_IDENTIFICATION_DATA)gcpu, 
                            (const GUEST_VCPU*)guest_vcpu(gcpu), NULL)) {
@@ -587,6 +631,17 @@ VMEXIT_HANDLING_STATUS vmexit_halt_instruction(GUEST_CPU_HANDLE gcpu)
     return VMEXIT_HANDLED;
 }
 
+// The VMX preemption timer ends the time slice of a gCPU that shares its
+// host CPU; the scheduler picks the next gCPU after every exit
+#pragma warning(push)
+#pragma warning(disable : 4100)  // Supress warnings about unreferenced formal parameter
+static VMEXIT_HANDLING_STATUS vmexit_preemption_timer(GUEST_CPU_HANDLE gcpu)
+{
+    (void)gcpu;
+    return VMEXIT_HANDLED;
+}
+#pragma warning(pop)
+
 
 // Handler for vmexit that happens in vmentry due to machine check
 // RETURNS  : VMEXIT_HANDLING_STATUS
@@ -711,12 +766,119 @@ VMM_STATUS vmexit_install_handler(GUEST_ID guest_id, VMEXIT_HANDLER  handler,
     return status;
 }
 
+// Install a VMEXIT fast path handler
+// ARGUMENTS: GUEST_ID                 guest_id
+//          : VMEXIT_FAST_PATH_HANDLER handler, NULL to remove it
+//          : UINT32                   reason
+// RETURNS  : VMM_STATUS
+VMM_STATUS vmexit_install_fast_path_handler(GUEST_ID guest_id,
+                    VMEXIT_FAST_PATH_HANDLER handler, UINT32 reason)
+{
+    GUEST_VMEXIT_CONTROL *guest_vmexit_control = NULL;
+    LIST_ELEMENT *iter = NULL;
+    UINT64 fast_path_reasons = 0;
+    UINT32 i;
+
+    guest_vmexit_control = vmexit_find_guest_vmexit_control(guest_id);
+    VMM_ASSERT(guest_vmexit_control);
+    if (reason >= Ia32VmxExitBasicReasonCount) {
+        VMM_LOG(mask_uvmm, level_error,
+                "CPU%d: Error: VMEXIT Reason(%d) exceeds supported limit\n",
+                hw_cpu_id(), reason);
+        return VMM_ERROR;
+    }
+    guest_vmexit_control->fast_path_handlers[reason] = handler;
+
+    // recompute the reasons any guest has a fast path for
+    LIST_FOR_EACH(vmexit_global_state.guest_vmexit_controls, iter) {
+        guest_vmexit_control = LIST_ENTRY(iter, GUEST_VMEXIT_CONTROL, list);
+        for (i = 0; i < Ia32VmxExitBasicReasonCount; i++) {
+            if (NULL != guest_vmexit_control->fast_path_handlers[i]) {
+                BIT_SET64(fast_path_reasons, i);
+            }
+        }
+    }
+    vmexit_global_state.fast_path_reasons = fast_path_reasons;
+    return VMM_OK;
+}
+
+// Account a VM exit on this CPU and put it in the exit trace. Called right
+// before the VM entry.
+static void vmexit_account(UINT64 exit_tsc, UINT32 reason, UINT64 guest_rip,
+                           GUEST_CPU_HANDLE gcpu, BOOLEAN fast_path)
+{
+    VMEXIT_REASON_STATS  *stats = vmexit_stats[hw_cpu_id()];
+    const VIRTUAL_CPU_ID *vcpu = guest_vcpu(gcpu);
+    UINT64                cycles = hw_rdtsc() - exit_tsc;
+    UINT32                bucket;
+
+    if (NULL != stats && reason < Ia32VmxExitBasicReasonCount) {
+        stats = &stats[reason];
+        stats->count++;
+        if (fast_path) {
+            stats->fast_path_count++;
+        }
+        stats->cycles += cycles;
+        if (cycles > stats->max_cycles) {
+            stats->max_cycles = cycles;
+        }
+        if (!hw_scan_bit_backward64(&bucket, cycles)) {
+            bucket = 0;
+        }
+        stats->histogram[MIN(bucket, VMEXIT_STATS_NUM_BUCKETS - 1)]++;
+    }
+    exit_trace_record(exit_tsc, reason, guest_rip,
+                      vcpu->guest_id, vcpu->guest_cpu_id);
+}
+
+// Look for a fast path handler for this VM exit and run it.
+// Only plain VM exits of non-layered guests in native mode qualify, and none
+// that happened while delivering an event, since the bookkeeping skipped
+// here is what handles those. The VMCS software cache is still disabled,
+// so the handler reads and writes the hardware VMCS.
+// RETURNS  : TRUE if the handler fully handled the VM exit
+static BOOLEAN vmexit_fast_path(GUEST_CPU_HANDLE gcpu, IA32_VMX_EXIT_REASON reason)
+{
+    GUEST_VMEXIT_CONTROL *guest_vmexit_control;
+    VMEXIT_FAST_PATH_HANDLER handler;
+    IA32_VMX_VMCS_VM_EXIT_INFO_IDT_VECTORING idt_vectoring_info;
+    VMCS_OBJECT *vmcs;
+
+    if (reason.Bits.FailedVmEntry || reason.Bits.BasicReason >= Ia32VmxExitBasicReasonCount ||
+        !BIT_GET64(vmexit_global_state.fast_path_reasons, reason.Bits.BasicReason)) {
+        return FALSE;
+    }
+    if (gcpu_get_guest_level(gcpu) != GUEST_LEVEL_1_SIMPLE ||
+        !IS_MODE_NATIVE(gcpu) || NULL != gcpu->vmexit_func ||
+        0 != gcpu->hw_enforcements || CLI_active()) {
+        return FALSE;
+    }
+    guest_vmexit_control = vmexit_find_guest_vmexit_control(gcpu->vcpu.guest_id);
+    handler = (NULL != guest_vmexit_control) ?
+              guest_vmexit_control->fast_path_handlers[reason.Bits.BasicReason] : NULL;
+    if (NULL == handler) {
+        return FALSE;
+    }
+    vmcs = gcpu_get_vmcs(gcpu);
+    idt_vectoring_info.Uint32 = (UINT32) vmcs_read(vmcs, VMCS_EXIT_INFO_IDT_VECTORING);
+    if (idt_vectoring_info.Bits.Valid) {
+        return FALSE;
+    }
+    if (!handler(gcpu)) {
+        return FALSE;
+    }
+    // nothing is left for gcpu_resume() to apply
+    VMM_ASSERT(0 == GET_IMPORTANT_EVENT_OCCURED_FLAG(gcpu));
+    return TRUE;
+}
+
 UINT64 gcpu_read_guestrip(void);
 
 
 // Called by vmexit_func() upon each VMEXIT
 void vmexit_common_handler(void)
 {
+    UINT64                  exit_tsc = hw_rdtsc();
     GUEST_CPU_HANDLE        gcpu;
     GUEST_CPU_HANDLE        next_gcpu;
     VMCS_OBJECT             *vmcs;
@@ -752,6 +914,9 @@ void vmexit_common_handler(void)
 #endif
     }
 
+    // no event is being raised on this CPU between VM exits
+    event_manager_quiescent_point();
+
     // Disable the VMCS Software Shadow/Cache
     // This is required since GCPU and VMCS cache has not yet been 
     // flushed and might have stale values from previous VMExit
@@ -777,6 +942,23 @@ void vmexit_common_handler(void)
         }
 #endif
         nmi_window_update_before_vmresume(gcpu_get_vmcs(gcpu));
+        vmexit_account(exit_tsc, initial_vmexit_check_data.vmexit_reason,
+                       initial_vmexit_check_data.current_cpu_rip, gcpu, FALSE);
+        vmentry_func(FALSE);
+    }
+
+    // OPTIMIZATION: VM exits with a fast path handler, e.g. CPUID, are
+    // handled and resumed right away
+    reason.Uint32 = initial_vmexit_check_data.vmexit_reason;
+    if (vmexit_fast_path(gcpu, reason)) {
+#ifdef FAST_VIEW_SWITCH
+        if (fvs_is_eptp_switching_supported()) {
+            fvs_save_resumed_eptp(gcpu);
+        }
+#endif
+        nmi_window_update_before_vmresume(gcpu_get_vmcs(gcpu));
+        vmexit_account(exit_tsc, reason.Bits.BasicReason,
+                       initial_vmexit_check_data.current_cpu_rip, gcpu, TRUE);
         vmentry_func(FALSE);
     }
 
@@ -858,10 +1040,94 @@ void vmexit_common_handler(void)
     if (x20) {
         bprint("vmexit_common_handler about to resume\n");
     }
+#endif
+    vmexit_account(exit_tsc, reason.Bits.BasicReason,
+                   initial_vmexit_check_data.current_cpu_rip, gcpu, FALSE);
+#ifdef VMM_LOG_BUFFER
+    // the buffered log is written out from exits that are not on a fast path
+    vmm_log_drain(FALSE);
 #endif
     gcpu_resume(next_gcpu);
 }
 
+#ifdef CLI_INCLUDE
+// debug vmexit stats [cpu_id] [hist] [reset]
+static int cli_show_vmexit_stats(unsigned argc, char *args[])
+{
+    VMEXIT_REASON_STATS total;
+    VMEXIT_REASON_STATS *stats;
+    BOOLEAN histograms = FALSE;
+    BOOLEAN reset = FALSE;
+    CPU_ID first_cpu = 0;
+    CPU_ID last_cpu = vmexit_stats_num_cpus;    // exclusive
+    CPU_ID cpu_id;
+    UINT32 reason, bucket;
+    unsigned i;
+
+    for (i = 1; i < argc; i++) {
+        if (0 == CLI_STRNCMP(args[i], "hist", sizeof("hist"))) {
+            histograms = TRUE;
+        }
+        else if (0 == CLI_STRNCMP(args[i], "reset", sizeof("reset"))) {
+            reset = TRUE;
+        }
+        else {
+            first_cpu = (CPU_ID) CLI_ATOL(args[i]);
+            if (first_cpu >= vmexit_stats_num_cpus) {
+                CLI_PRINT("CpuId must be in [0..%d] range\n", (int) vmexit_stats_num_cpus - 1);
+                return -1;
+            }
+            last_cpu = first_cpu + 1;
+        }
+    }
+    CLI_PRINT("reason        count   fast path   mean cycles    max cycles\n");
+    for (reason = 0; reason < Ia32VmxExitBasicReasonCount; reason++) {
+        vmm_memset(&total, 0, sizeof(total));
+        for (cpu_id = first_cpu; cpu_id < last_cpu; cpu_id++) {
+            if (NULL == vmexit_stats[cpu_id]) {
+                continue;
+            }
+            stats = &vmexit_stats[cpu_id][reason];
+            total.count += stats->count;
+            total.fast_path_count += stats->fast_path_count;
+            total.cycles += stats->cycles;
+            total.max_cycles = MAX(total.max_cycles, stats->max_cycles);
+            for (bucket = 0; bucket < VMEXIT_STATS_NUM_BUCKETS; bucket++) {
+                total.histogram[bucket] += stats->histogram[bucket];
+            }
+            if (reset) {
+                vmm_memset(stats, 0, sizeof(*stats));
+            }
+        }
+        if (0 == total.count) {
+            continue;
+        }
+        CLI_PRINT("%6d %12lld %11lld %13lld %13lld\n", reason, total.count,
+                  total.fast_path_count, total.cycles / total.count, total.max_cycles);
+        if (!histograms) {
+            continue;
+        }
+        for (bucket = 0; bucket < VMEXIT_STATS_NUM_BUCKETS; bucket++) {
+            if (0 != total.histogram[bucket]) {
+                CLI_PRINT("       < 2^%-2d cycles %12d\n", bucket + 1, total.histogram[bucket]);
+            }
+        }
+    }
+    return 0;
+}
+
+static void vmexit_cli_register(void)
+{
+    CLI_AddCommand(cli_show_vmexit_stats, "debug vmexit stats",
+                   "Print VM exit counts and handler cycles per exit reason",
+                   "[cpu_id] [hist] [reset]", CLI_ACCESS_LEVEL_USER);
+}
+#else
+
+static void vmexit_cli_register(void) {}
+
+#endif
+
 static GUEST_VMEXIT_CONTROL* vmexit_find_guest_vmexit_control(GUEST_ID guest_id)
 {
     LIST_ELEMENT *iter = NULL;
@@ -90,6 +90,13 @@ static VMEXIT_HANDLING_STATUS vmexit_cpuid_instruction(GUEST_CPU_HANDLE gcpu)
     return VMEXIT_HANDLED;
 }
 
+// CPUID only changes the GP registers and RIP, it doesn't need the rest of
+// the VM exit handling
+static BOOLEAN vmexit_cpuid_fast_path(GUEST_CPU_HANDLE gcpu)
+{
+    return (vmexit_cpuid_instruction(gcpu) == VMEXIT_HANDLED);
+}
+
 static void cpuid_leaf_1h_filter( GUEST_CPU_HANDLE gcpu UNUSED, CPUID_PARAMS *p_cpuid UNUSED )
 {
     VMM_ASSERT(p_cpuid);
@@ -143,6 +150,8 @@ void vmexit_cpuid_guest_intialize( GUEST_ID  guest_id)
     // install CPUID vmexit handler
     vmexit_install_handler( guest_id, vmexit_cpuid_instruction,
                 Ia32VmxExitBasicReasonCpuidInstruction);
+    vmexit_install_fast_path_handler( guest_id, vmexit_cpuid_fast_path,
+                Ia32VmxExitBasicReasonCpuidInstruction);
 
     // register cpuid(leaf 0x1) filter handler
     vmexit_cpuid_filter_install(guest, CPUID_LEAF_1H,cpuid_leaf_1h_filter);
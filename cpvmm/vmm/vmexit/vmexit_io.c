@@ -38,20 +38,35 @@
 
 #define IO_VMEXIT_MAX_COUNT   64
 
+// Ports are mapped to their descriptors through a two level table, indexed
+// by the high 7 and the low 9 bits of the port. The first level and each
+// second level page take a 4KB heap page; second level pages are
+// allocated when the first port in their range is registered.
+#define IO_PORT_PAGE_SHIFT    9
+#define IO_PORT_PAGE_SIZE     (1 << IO_PORT_PAGE_SHIFT)
+#define IO_PORT_PAGE_MASK     (IO_PORT_PAGE_SIZE - 1)
+#define IO_PORT_PAGE_COUNT    (0x10000 / IO_PORT_PAGE_SIZE)
+
 typedef struct {
-    IO_PORT_ID          io_port;    // in fact only 16 bits are meaningful
+    IO_PORT_ID          io_port;    // first port of the registered range
     UINT16              pad;
-    RW_ACCESS           io_access;
+    UINT32              io_port_count; // ports still mapped to the descriptor
     //IO_PORT_OWNER       io_owner; //TODO: resolve owner conflict issues.
     IO_ACCESS_HANDLER   io_handler; //TODO: will use io_tmsl_handler & io_uvmm_handler.
     void*               io_handler_context;
 } IO_VMEXIT_DESCRIPTOR;
 
+typedef struct {
+    IO_VMEXIT_DESCRIPTOR *ports[IO_PORT_PAGE_SIZE];
+} IO_PORT_PAGE;
+
 
+// allocated with vmm_malloc, so it must stay below 2040 bytes
 typedef struct {
     GUEST_ID             guest_id;
     char                 padding[6];
     UINT8               *io_bitmap;
+    IO_PORT_PAGE       **io_port_pages; // IO_PORT_PAGE_COUNT entries
     IO_VMEXIT_DESCRIPTOR io_descriptors[IO_VMEXIT_MAX_COUNT];
     LIST_ELEMENT         list[1];
 } GUEST_IO_VMEXIT_CONTROL;
@@ -65,8 +80,8 @@ static IO_VMEXIT_GLOBAL_STATE io_vmexit_global_state;
 
 
 static VMEXIT_HANDLING_STATUS io_vmexit_handler(GUEST_CPU_HANDLE gcpu);
-static IO_VMEXIT_DESCRIPTOR * io_port_lookup(GUEST_ID guest_id, IO_PORT_ID port_id);
-static IO_VMEXIT_DESCRIPTOR * io_free_port_lookup(GUEST_ID guest_id);
+static IO_VMEXIT_DESCRIPTOR * io_port_lookup(GUEST_IO_VMEXIT_CONTROL *io_ctrl, IO_PORT_ID port_id);
+static IO_VMEXIT_DESCRIPTOR * io_free_port_lookup(GUEST_IO_VMEXIT_CONTROL *io_ctrl);
 static void io_blocking_read_handler(
     GUEST_CPU_HANDLE gcpu,
     IO_PORT_ID       port_id,
@@ -131,14 +146,23 @@ void io_vmexit_guest_initialize(GUEST_ID guest_id)
     VMM_LOG(mask_anonymous, level_trace,"io_vmexit_guest_initialize start\r\n");
 
     io_ctrl = (GUEST_IO_VMEXIT_CONTROL *) vmm_malloc(sizeof(GUEST_IO_VMEXIT_CONTROL));
-    // BEFORE_VMLAUNCH. MALLOC should not fail.
-    VMM_ASSERT(io_ctrl);
+    if (NULL == io_ctrl) {
+        // BEFORE_VMLAUNCH. MALLOC should not fail.
+        VMM_LOG(mask_anonymous, level_trace,"IO VMEXIT control for guest %d is not allocated\n", guest_id);
+        VMM_DEADLOOP();
+        return;
+    }
 
     io_ctrl->guest_id = guest_id;
     io_ctrl->io_bitmap = vmm_memory_alloc(2 * PAGE_4KB_SIZE);
-
-    // BEFORE_VMLAUNCH
-    VMM_ASSERT(io_ctrl->io_bitmap);
+    io_ctrl->io_port_pages = (IO_PORT_PAGE **)
+                vmm_memory_alloc(IO_PORT_PAGE_COUNT * sizeof(IO_PORT_PAGE *));
+    if (NULL == io_ctrl->io_bitmap || NULL == io_ctrl->io_port_pages) {
+        // BEFORE_VMLAUNCH
+        VMM_LOG(mask_anonymous, level_trace,"IO bitmap or port table for guest %d is not allocated\n", guest_id);
+        VMM_DEADLOOP();
+        return;
+    }
 
     list_add(io_vmexit_global_state.guest_io_vmexit_controls, io_ctrl->list);
 
@@ -168,6 +192,11 @@ void io_vmexit_activate(GUEST_CPU_HANDLE gcpu)
     io_ctrl = io_vmexit_find_guest_io_control(guest_id);
 
     VMM_ASSERT(io_ctrl);
+    if (NULL == io_ctrl) {
+        VMM_LOG(mask_anonymous, level_trace,"IO VMEXITs are not initialized for guest %d\n", guest_id);
+        VMM_DEADLOOP();
+        return;
+    }
         
     vmm_memset(&exec_controls, 0, sizeof(exec_controls));
     vmm_memset(&vmexit_request, 0, sizeof(vmexit_request));
@@ -199,47 +228,32 @@ void io_vmexit_activate(GUEST_CPU_HANDLE gcpu)
 
 // FUNCTION : io_port_lookup()
 // PURPOSE  : Look for descriptor for specified port
-// ARGUMENTS: GUEST_ID    guest_id
+// ARGUMENTS: GUEST_IO_VMEXIT_CONTROL *io_ctrl
 //          : UINT16      port_id
 // RETURNS  : Pointer to the descriptor, NULL if not found
 IO_VMEXIT_DESCRIPTOR * io_port_lookup(
-    GUEST_ID    guest_id,
+    GUEST_IO_VMEXIT_CONTROL *io_ctrl,
     IO_PORT_ID  port_id)
 {
-    GUEST_IO_VMEXIT_CONTROL *io_ctrl = NULL;
-    unsigned i;
+    IO_PORT_PAGE *page = io_ctrl->io_port_pages[port_id >> IO_PORT_PAGE_SHIFT];
 
-    io_ctrl = io_vmexit_find_guest_io_control(guest_id);
-    if(NULL == io_ctrl) {
+    if (NULL == page) {
         return NULL;
     }
-
-    for (i = 0; i < NELEMENTS(io_ctrl->io_descriptors); ++i) {
-        if (io_ctrl->io_descriptors[i].io_port == port_id
-        &&  io_ctrl->io_descriptors[i].io_handler != NULL) {
-            return &io_ctrl->io_descriptors[i];
-        }
-    }
-    return NULL;
+    return page->ports[port_id & IO_PORT_PAGE_MASK];
 }
 
 
 // FUNCTION : io_free_port_lookup()
 // PURPOSE  : Look for unallocated descriptor
-// ARGUMENTS: GUEST_ID    guest_id
+// ARGUMENTS: GUEST_IO_VMEXIT_CONTROL *io_ctrl
 // RETURNS  : Pointer to the descriptor, NULL if not found
-IO_VMEXIT_DESCRIPTOR * io_free_port_lookup(GUEST_ID guest_id)
+IO_VMEXIT_DESCRIPTOR * io_free_port_lookup(GUEST_IO_VMEXIT_CONTROL *io_ctrl)
 {
-    GUEST_IO_VMEXIT_CONTROL *io_ctrl = NULL;
     unsigned i;
 
-    io_ctrl = io_vmexit_find_guest_io_control(guest_id);
-    if(NULL == io_ctrl) {
-        return NULL;
-    }
-
     for (i = 0; i < NELEMENTS(io_ctrl->io_descriptors); ++i) {
-        if (NULL == io_ctrl->io_descriptors[i].io_handler) {
+        if (0 == io_ctrl->io_descriptors[i].io_port_count) {
             return &io_ctrl->io_descriptors[i];
         }
     }
@@ -247,6 +261,35 @@ IO_VMEXIT_DESCRIPTOR * io_free_port_lookup(GUEST_ID guest_id)
 }
 
 
+// FUNCTION : io_port_unmap()
+// PURPOSE  : Remove port from the port table. The descriptor is released
+//          : when the last port of its range is removed.
+// ARGUMENTS: GUEST_IO_VMEXIT_CONTROL *io_ctrl
+//          : IO_PORT_ID              port_id
+// RETURNS  : void
+static void io_port_unmap(
+    GUEST_IO_VMEXIT_CONTROL *io_ctrl,
+    IO_PORT_ID  port_id)
+{
+    IO_PORT_PAGE         *page = io_ctrl->io_port_pages[port_id >> IO_PORT_PAGE_SHIFT];
+    IO_VMEXIT_DESCRIPTOR *p_desc;
+
+    if (NULL == page) {
+        return;
+    }
+    p_desc = page->ports[port_id & IO_PORT_PAGE_MASK];
+    if (NULL == p_desc) {
+        return;
+    }
+    page->ports[port_id & IO_PORT_PAGE_MASK] = NULL;
+    VMM_ASSERT(p_desc->io_port_count > 0);
+    if (0 == --p_desc->io_port_count) {
+        p_desc->io_handler = NULL;
+        p_desc->io_handler_context = NULL;
+    }
+}
+
+
 #pragma warning( push )
 #pragma warning (disable : 4100)  // Supress warnings about unreferenced formal parameter
 
@@ -389,37 +432,103 @@ void io_vmexit_transparent_handler( GUEST_CPU_HANDLE  gcpu,
 VMM_STATUS io_vmexit_handler_register( GUEST_ID guest_id, IO_PORT_ID port_id,
                 IO_ACCESS_HANDLER   handler, void* context)
 {
-    IO_VMEXIT_DESCRIPTOR *p_desc = io_port_lookup(guest_id, port_id);
-    VMM_STATUS           status;
+    return io_vmexit_handler_register_range(guest_id, port_id, port_id,
+                                            handler, context);
+}
+
+
+// FUNCTION : io_vmexit_handler_register_range()
+// PURPOSE  : Register/update one IO handler for all ports in the range
+//          : [port_from, port_to] of the guest. The range uses a single
+//          : descriptor, whatever its size.
+// ARGUMENTS: GUEST_ID            guest_id
+//          : IO_PORT_ID          port_from
+//          : IO_PORT_ID          port_to
+//          : IO_ACCESS_HANDLER   handler
+// RETURNS  : status
+VMM_STATUS io_vmexit_handler_register_range( GUEST_ID guest_id,
+                IO_PORT_ID port_from, IO_PORT_ID port_to,
+                IO_ACCESS_HANDLER handler, void* context)
+{
     GUEST_IO_VMEXIT_CONTROL *io_ctrl = NULL;
+    IO_VMEXIT_DESCRIPTOR    *p_desc;
+    IO_PORT_PAGE            *page;
+    UINT32                   port_count = (UINT32) port_to - port_from + 1;
+    UINT32                   i;
 
     io_ctrl = io_vmexit_find_guest_io_control(guest_id);
 
     VMM_ASSERT(io_ctrl);
     VMM_ASSERT(handler);
 
-    if (NULL != p_desc) {
-        VMM_LOG(mask_anonymous, level_trace,"IO Handler for Guest(%d) Port(%d) is already regitered. Update...\n",
-            guest_id, port_id);
+    if (NULL == io_ctrl) {
+        VMM_LOG(mask_anonymous, level_trace,"IO VMEXITs are not initialized for Guest(%d)\n", guest_id);
+        return VMM_ERROR;
     }
-    else {
-        p_desc = io_free_port_lookup(guest_id);
+
+    if (port_from > port_to) {
+        VMM_LOG(mask_anonymous, level_trace,"Invalid IO port range(%d-%d)\n",
+            port_from, port_to);
+        return VMM_ERROR;
     }
 
+    // If the range is exactly the one registered before, update it in place
+    p_desc = io_port_lookup(io_ctrl, port_from);
+    if (NULL != p_desc && p_desc->io_port_count == port_count) {
+        for (i = port_from; i <= port_to; ++i) {
+            if (io_port_lookup(io_ctrl, (IO_PORT_ID) i) != p_desc) {
+                break;
+            }
+        }
+        if (i <= port_to) {
+            p_desc = NULL;
+        }
+    }
+    else {
+        p_desc = NULL;
+    }
     if (NULL != p_desc) {
-        BITARRAY_SET(io_ctrl->io_bitmap, port_id);
-        p_desc->io_port    = port_id;
+        VMM_LOG(mask_anonymous, level_trace,"IO Handler for Guest(%d) Port(%d) is already regitered. Update...\n",
+            guest_id, port_from);
         p_desc->io_handler = handler;
         p_desc->io_handler_context = context;
-        status = VMM_OK;
+        return VMM_OK;
     }
-    else {
-        // if reach the MAX number (IO_VMEXIT_MAX_COUNT) of ports, 
+
+    p_desc = io_free_port_lookup(io_ctrl);
+    if (NULL == p_desc) {
+        // if reach the MAX number (IO_VMEXIT_MAX_COUNT) of ranges,
         // return ERROR, but not deadloop.
-        status = VMM_ERROR;
         VMM_LOG(mask_anonymous, level_trace,"Not enough space to register IO handler\n");
+        return VMM_ERROR;
     }
-    return status;
+
+    for (i = port_from >> IO_PORT_PAGE_SHIFT; i <= (UINT32) port_to >> IO_PORT_PAGE_SHIFT; ++i) {
+        if (NULL == io_ctrl->io_port_pages[i]) {
+            page = (IO_PORT_PAGE *) vmm_memory_alloc(sizeof(IO_PORT_PAGE));
+            if (NULL == page) {
+                VMM_LOG(mask_anonymous, level_trace,"Not enough memory to register IO handler\n");
+                return VMM_ERROR;
+            }
+            io_ctrl->io_port_pages[i] = page;
+        }
+    }
+
+    // ports of other ranges are taken over by the new one
+    for (i = port_from; i <= port_to; ++i) {
+        if (NULL != io_port_lookup(io_ctrl, (IO_PORT_ID) i)) {
+            VMM_LOG(mask_anonymous, level_trace,"IO Handler for Guest(%d) Port(%d) is already regitered. Update...\n",
+                guest_id, i);
+            io_port_unmap(io_ctrl, (IO_PORT_ID) i);
+        }
+        io_ctrl->io_port_pages[i >> IO_PORT_PAGE_SHIFT]->ports[i & IO_PORT_PAGE_MASK] = p_desc;
+        BITARRAY_SET(io_ctrl->io_bitmap, i);
+    }
+    p_desc->io_port    = port_from;
+    p_desc->io_handler = handler;
+    p_desc->io_handler_context = context;
+    p_desc->io_port_count = port_count;
+    return VMM_OK;
 }
 
 
@@ -432,18 +541,21 @@ VMM_STATUS io_vmexit_handler_unregister(
     GUEST_ID    guest_id,
     IO_PORT_ID  port_id)
 {
-    IO_VMEXIT_DESCRIPTOR *p_desc = io_port_lookup(guest_id, port_id);
+    IO_VMEXIT_DESCRIPTOR *p_desc;
     VMM_STATUS           status;
     GUEST_IO_VMEXIT_CONTROL *io_ctrl = NULL;
 
     io_ctrl = io_vmexit_find_guest_io_control(guest_id);
 
     VMM_ASSERT(io_ctrl);
+    if (NULL == io_ctrl) {
+        return VMM_ERROR;
+    }
 
+    p_desc = io_port_lookup(io_ctrl, port_id);
     if (NULL != p_desc) {
         BITARRAY_CLR(io_ctrl->io_bitmap, port_id);
-        p_desc->io_handler = NULL;
-        p_desc->io_handler_context = NULL;
+        io_port_unmap(io_ctrl, port_id);
         status = VMM_OK;
     }
     else {
@@ -623,7 +735,8 @@ VMEXIT_HANDLING_STATUS io_vmexit_handler(GUEST_CPU_HANDLE gcpu)
     IO_PORT_ID              port_id  = (0 == p_qualification->IoInstruction.OpEncoding) ?
                                 (UINT16) gcpu_get_native_gp_reg(gcpu, IA32_REG_RDX) :
                                 (UINT16) p_qualification->IoInstruction.PortNumber;
-    IO_VMEXIT_DESCRIPTOR   *p_desc   = io_port_lookup(guest_id, port_id);
+    GUEST_IO_VMEXIT_CONTROL *io_ctrl = io_vmexit_find_guest_io_control(guest_id);
+    IO_VMEXIT_DESCRIPTOR   *p_desc   = (NULL == io_ctrl) ? NULL : io_port_lookup(io_ctrl, port_id);
     unsigned                port_size = (unsigned) p_qualification->IoInstruction.Size + 1;
     RW_ACCESS               access = p_qualification->IoInstruction.Direction ? READ_ACCESS : WRITE_ACCESS;
     IO_ACCESS_HANDLER       handler = ((NULL == p_desc) ? io_blocking_handler : p_desc->io_handler);
@@ -709,11 +822,22 @@ void io_vmexit_block_port(
     unsigned i;
     GUEST_IO_VMEXIT_CONTROL *io_ctrl = NULL;
 
+    // the whole range takes one descriptor, which replaces the handlers
+    // installed before on its ports
+    if (VMM_OK == io_vmexit_handler_register_range(guest_id, port_from, port_to,
+                                                   io_blocking_handler, NULL)) {
+        return;
+    }
+
+    // out of descriptors: unmap the ports, lookups fall back to the
+    // blocking handler
     io_ctrl = io_vmexit_find_guest_io_control(guest_id);
     VMM_ASSERT(io_ctrl);
-    // unregister handler in case it was installed before
+    if (NULL == io_ctrl) {
+        return;
+    }
     for (i = port_from; i <= port_to; ++i) {
-        io_vmexit_handler_unregister(guest_id, (IO_PORT_ID)i);
+        io_port_unmap(io_ctrl, (IO_PORT_ID)i);
         BITARRAY_SET(io_ctrl->io_bitmap, i);
     }
 }
@@ -63,13 +63,12 @@
 #define HYPER_V_MSR_MAX 0x400000F0
 #define LOW_BITS_32_MASK    ((UINT64)UINT32_ALL_ONES)
 
-typedef struct {
+typedef struct _MSR_VMEXIT_DESCRIPTOR {
     MSR_ID              msr_id;
-    UINT8               pad[4];
+    BOOLEAN             in_use;
     MSR_ACCESS_HANDLER  msr_read_handler;
     MSR_ACCESS_HANDLER  msr_write_handler;
     void               *msr_context;
-    LIST_ELEMENT        msr_list;
 } MSR_VMEXIT_DESCRIPTOR;
 
 
@@ -87,7 +86,7 @@ static struct {
 };
 
 
-static MSR_VMEXIT_DESCRIPTOR *msr_descriptor_lookup(LIST_ELEMENT *msr_list, MSR_ID msr_id);
+static MSR_VMEXIT_DESCRIPTOR *msr_descriptor_lookup(MSR_VMEXIT_CONTROL *p_msr_ctrl, MSR_ID msr_id);
 VMM_STATUS msr_vmexit_bits_config(UINT8 *p_bitmap, MSR_ID msr_id, RW_ACCESS access, BOOLEAN set);
 static BOOLEAN  msr_common_vmexit_handler(GUEST_CPU_HANDLE gcpu, RW_ACCESS access, 
                     UINT64 *msr_value);
@@ -187,23 +186,71 @@ VMM_STATUS msr_vmexit_bits_config( UINT8 *p_bitmap, MSR_ID msr_id,
 #pragma optimize("",on)
 
 
-MSR_VMEXIT_DESCRIPTOR * msr_descriptor_lookup( LIST_ELEMENT *msr_list, MSR_ID msr_id)
+// Returns the msr_index entry of MSR, or NULL if MSR is outside of the
+// ranges covered by the bitmap
+static UINT8 *msr_index_entry(MSR_VMEXIT_CONTROL *p_msr_ctrl, MSR_ID msr_id)
 {
-    MSR_VMEXIT_DESCRIPTOR   *p_msr_desc;
-    LIST_ELEMENT            *list_iterator;
+    if (msr_id <= MSR_LOW_LAST) {
+        return &p_msr_ctrl->msr_index[msr_id - MSR_LOW_FIRST];
+    }
+    if (MSR_HIGH_FIRST <= msr_id && msr_id <= MSR_HIGH_LAST) {
+        return &p_msr_ctrl->msr_index[(MSR_LOW_LAST - MSR_LOW_FIRST + 1) +
+                                      (msr_id - MSR_HIGH_FIRST)];
+    }
+    return NULL;
+}
+
+MSR_VMEXIT_DESCRIPTOR * msr_descriptor_lookup( MSR_VMEXIT_CONTROL *p_msr_ctrl, MSR_ID msr_id)
+{
+    UINT8 *p_index;
 
 #ifdef JLMDEBUG1
     bprint("msr_descriptor_lookup\n");
 #endif
-    LIST_FOR_EACH(msr_list, list_iterator) {
-        p_msr_desc = LIST_ENTRY(list_iterator, MSR_VMEXIT_DESCRIPTOR, msr_list);
-        if (p_msr_desc->msr_id == msr_id) {
-            return p_msr_desc;  // found
+    // no handler can be registered outside of the bitmap ranges
+    p_index = msr_index_entry(p_msr_ctrl, msr_id);
+    if (NULL == p_index || 0 == *p_index) {
+        return NULL;
+    }
+    return &p_msr_ctrl->msr_descriptors[*p_index - 1];
+}
+
+// Takes a free descriptor and indexes it for MSR
+// RETURNS  : NULL if MSR is outside of the bitmap ranges or no descriptor is free
+static MSR_VMEXIT_DESCRIPTOR *msr_descriptor_allocate(MSR_VMEXIT_CONTROL *p_msr_ctrl,
+                MSR_ID msr_id)
+{
+    MSR_VMEXIT_DESCRIPTOR *p_desc;
+    UINT8 *p_index;
+    UINT32 i;
+
+    p_index = msr_index_entry(p_msr_ctrl, msr_id);
+    if (NULL == p_index) {
+        return NULL;
+    }
+    for (i = 0; i < MSR_MAX_DESCRIPTORS; i++) {
+        p_desc = &p_msr_ctrl->msr_descriptors[i];
+        if (!p_desc->in_use) {
+            vmm_memset(p_desc, 0, sizeof(*p_desc));
+            p_desc->msr_id = msr_id;
+            p_desc->in_use = TRUE;
+            *p_index = (UINT8)(i + 1);
+            return p_desc;
         }
     }
     return NULL;
 }
 
+static void msr_descriptor_free(MSR_VMEXIT_CONTROL *p_msr_ctrl,
+                MSR_VMEXIT_DESCRIPTOR *p_desc)
+{
+    UINT8 *p_index = msr_index_entry(p_msr_ctrl, p_desc->msr_id);
+
+    VMM_ASSERT(p_index);
+    *p_index = 0;
+    p_desc->in_use = FALSE;
+}
+
 static void msr_vmexit_register_mtrr_accesses_handler(GUEST_HANDLE guest) {
 
     UINT32 i,msr_addr;
@@ -275,6 +322,15 @@ void msr_vmexit_guest_setup(GUEST_HANDLE guest)
     // allocate zero-filled 4K-page to store MSR VMEXIT bitmap
     p_msr_ctrl->msr_bitmap = vmm_memory_alloc(PAGE_4KB_SIZE);
     VMM_ASSERT(p_msr_ctrl->msr_bitmap);
+    // handler dispatch table, looked up on every MSR VMEXIT
+    p_msr_ctrl->msr_index = vmm_memory_alloc(MSR_INDEX_SIZE);
+    VMM_ASSERT(p_msr_ctrl->msr_index);
+    vmm_memset(p_msr_ctrl->msr_index, 0, MSR_INDEX_SIZE);
+    p_msr_ctrl->msr_descriptors = vmm_memory_alloc(
+                    sizeof(MSR_VMEXIT_DESCRIPTOR) * MSR_MAX_DESCRIPTORS);
+    VMM_ASSERT(p_msr_ctrl->msr_descriptors);
+    vmm_memset(p_msr_ctrl->msr_descriptors, 0,
+               sizeof(MSR_VMEXIT_DESCRIPTOR) * MSR_MAX_DESCRIPTORS);
     vmexit_install_handler(guest_get_id(guest), vmexit_msr_read,  
                            Ia32VmxExitBasicReasonMsrRead);
     vmexit_install_handler(guest_get_id(guest), vmexit_msr_write, 
@@ -349,14 +405,9 @@ VMM_STATUS msr_vmexit_handler_register( GUEST_HANDLE guest, MSR_ID msr_id,
         bprint("msr_vmexit_handler_register 0x1b\n");
 #endif
     // check first if it already registered
-    p_desc = msr_descriptor_lookup(p_msr_ctrl->msr_list, msr_id);
+    p_desc = msr_descriptor_lookup(p_msr_ctrl, msr_id);
     if (NULL == p_desc) {
-        // allocate new descriptor and chain it to the list
-        p_desc = vmm_malloc(sizeof(*p_desc)); if (NULL != p_desc)
-        {
-            vmm_memset(p_desc, 0, sizeof(*p_desc));
-            list_add(p_msr_ctrl->msr_list, &p_desc->msr_list);
-        }
+        p_desc = msr_descriptor_allocate(p_msr_ctrl, msr_id);
     }
     else {
         VMM_LOG(mask_uvmm, level_trace,"MSR(%p) handler already registered. Update...\n", msr_id);
@@ -377,7 +428,7 @@ VMM_STATUS msr_vmexit_handler_register( GUEST_HANDLE guest, MSR_ID msr_id,
     }
     else {
         status = VMM_ERROR;
-        VMM_LOG(mask_uvmm, level_trace,"MSR(%p) handler registration failed due to lack of space\n", msr_id);
+        VMM_LOG(mask_uvmm, level_trace,"MSR(%p) handler registration failed due to bad ID or lack of space\n", msr_id);
     }
     return status;
 }
@@ -397,7 +448,7 @@ VMM_STATUS msr_vmexit_handler_unregister( GUEST_HANDLE guest,
 #ifdef JLMDEBUG1
     bprint("msr_vmexit_handler_unregister\n");
 #endif
-    p_desc = msr_descriptor_lookup(p_msr_ctrl->msr_list, msr_id);
+    p_desc = msr_descriptor_lookup(p_msr_ctrl, msr_id);
     if (NULL == p_desc) {
         status = VMM_ERROR;
         VMM_LOG(mask_uvmm, level_trace,"MSR(%p) handler is not registered\n", msr_id);
@@ -410,8 +461,7 @@ VMM_STATUS msr_vmexit_handler_unregister( GUEST_HANDLE guest,
         if (access & READ_ACCESS)  p_desc->msr_read_handler = NULL;
 
         if (NULL == p_desc->msr_write_handler && NULL == p_desc->msr_read_handler) {
-            list_remove(&p_desc->msr_list);
-            vmm_mfree(p_desc);
+            msr_descriptor_free(p_msr_ctrl, p_desc);
         }
     }
     return status;
@@ -506,7 +556,7 @@ BOOLEAN msr_common_vmexit_handler( GUEST_CPU_HANDLE gcpu,
     p_msr_ctrl = guest_get_msr_control(guest);
     VMM_ASSERT(p_msr_ctrl);
     
-    msr_descriptor = msr_descriptor_lookup(p_msr_ctrl->msr_list, msr_id);
+    msr_descriptor = msr_descriptor_lookup(p_msr_ctrl, msr_id);
 
     if (NULL != msr_descriptor) {
 #ifdef JLMDEBUG1
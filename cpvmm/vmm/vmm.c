@@ -44,6 +44,8 @@
 #include "vmexit.h"
 #include "vmm_dbg.h"
 #include "vmx_trace.h"
+#include "exit_trace.h"
+#include "vmm_log_buffer.h"
 #include "event_mgr.h"
 #include <pat_manager.h>
 #include "host_pci_configuration.h"
@@ -57,6 +59,7 @@
 #include "guest/guest_cpu/unrestricted_guest.h"
 #include "vmx_teardown.h"
 #include "vmcs_api.h"
+#include "page_walker.h"
 #ifdef FAST_VIEW_SWITCH
 #include "fvs.h"
 #endif
@@ -178,7 +181,7 @@ void vmm_application_procs_main(UINT32 local_apic_id);
 int cli_show_memory_layout(unsigned argc, char *args[]);
 void make_guest_state_compliant(GUEST_CPU_HANDLE gcpu);
 
-#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG
+#if defined DEBUG || defined ENABLE_RELEASE_VMM_LOG || defined VMM_LOG_BUFFER
 //      implementation
 INLINE UINT8 lapic_id(void)
 {
@@ -478,6 +481,7 @@ void vmm_bsp_proc_main(UINT32 local_apic_id, const VMM_STARTUP_STRUCT* startup_s
 
     vmdb_initialize();
     vmm_serial_cli_init();
+    lock_cli_init();
 
 #ifdef DEBUG
     CLI_AddCommand(
@@ -521,6 +525,14 @@ void vmm_bsp_proc_main(UINT32 local_apic_id, const VMM_STARTUP_STRUCT* startup_s
     hw_gdt_load(cpu_id);
     VMM_LOG(mask_uvmm, level_trace,"BSP: GDT is loaded.\n");
 
+    // hw_cpu_id() is valid from now on
+    vmm_mem_allocator_enable_cpu_cache(cpu_id);
+#ifdef MAM_TRANSLATION_CACHE
+    if (!mam_translation_cache_initialize(num_of_cpus)) {
+        VMM_LOG(mask_uvmm, level_error, "BSP: Address translations won't be cached\n");
+    }
+#endif
+
     // Initialize IDT for all cpus
     isr_setup();
     VMM_LOG(mask_uvmm, level_trace,"\nBSP: ISR setup is finished. \n");
@@ -653,6 +665,14 @@ void vmm_bsp_proc_main(UINT32 local_apic_id, const VMM_STARTUP_STRUCT* startup_s
             build_extend_heap_hpa_to_hva();
     }
     VMM_DEBUG_CODE(vmm_trace_init(VMM_MAX_GUESTS_SUPPORTED, num_of_cpus));
+    if (!exit_trace_initialize(num_of_cpus)) {
+        VMM_LOG(mask_uvmm, level_error,"BSP: VM exit trace is not available\n");
+    }
+#ifdef VMM_LOG_BUFFER
+    if (!vmm_log_initialize(num_of_cpus)) {
+        VMM_LOG(mask_uvmm, level_error,"BSP: Buffered log is not available\n");
+    }
+#endif
 
 #ifdef PCI_SCAN
     host_pci_initialize();
@@ -674,6 +694,8 @@ void vmm_bsp_proc_main(UINT32 local_apic_id, const VMM_STARTUP_STRUCT* startup_s
         enable_fx_ops();
     }
     hw_write_cr4(vmcs_hw_make_compliant_cr4(hw_read_cr4()));
+    // XMM registers are usable from here on; select the memcpy/memset strategies
+    vmm_mem_ops_init();
     num_of_guests = startup_struct->number_of_secondary_guests + 1;
 #ifdef JLMDEBUG
     bprint("evmm: control registers are vmx compatible\n");
@@ -788,6 +810,8 @@ void vmm_bsp_proc_main(UINT32 local_apic_id, const VMM_STARTUP_STRUCT* startup_s
     // Initialize Event Manager
     // must be called after heap and CLI initialization
     event_manager_initialize(num_of_cpus);
+    // must be called after Event Manager initialization
+    pw_cache_initialize();
 #ifdef PCI_SCAN
     gpci_initialize();
 #endif
@@ -1003,11 +1027,13 @@ void vmm_application_procs_main(UINT32 local_apic_id)
     GUEST_CPU_HANDLE initial_gcpu = NULL;
 
     WAIT_FOR_APPLICATION_PROCS_LAUNCH();
-    VMM_LOG(mask_uvmm, level_trace,"\n\nAP%d: Alive.  Local APIC ID=%P\n", 
-            cpu_id, lapic_id());
 
-    // Load GDT/IDT
+    // Load GDT/IDT, before anything allocates: hw_cpu_id() is only valid
+    // from here on
     hw_gdt_load(cpu_id);
+    vmm_mem_allocator_enable_cpu_cache(cpu_id);
+    VMM_LOG(mask_uvmm, level_trace,"\n\nAP%d: Alive.  Local APIC ID=%P\n", 
+            cpu_id, lapic_id());
     VMM_LOG(mask_uvmm, level_trace,"AP%d: GDT is loaded.\n", cpu_id);
     isr_handling_start();
     VMM_LOG(mask_uvmm, level_trace,"AP%d: ISR handling started.\n", cpu_id);
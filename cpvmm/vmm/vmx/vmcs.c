@@ -21,6 +21,7 @@
 #include "libc.h"
 #include "host_memory_manager_api.h"
 #include "memory_allocator.h"
+#include "cache64.h"
 #include "vmcs_internal.h"
 #include "cli.h"
 #include "vmm_api.h"
@@ -354,6 +355,37 @@ static VMCS_FIELD g_control_fields[] = {
 #endif
 };
 
+// Fields read or written on most VM exits; they get the first slots of
+// the VMCS caches (see CACHE64_LAYOUT)
+static const UINT32 g_hot_fields[] = {
+    VMCS_EXIT_INFO_REASON,
+    VMCS_EXIT_INFO_QUALIFICATION,
+    VMCS_EXIT_INFO_INSTRUCTION_LENGTH,
+    VMCS_EXIT_INFO_INSTRUCTION_INFO,
+    VMCS_EXIT_INFO_IDT_VECTORING,
+    VMCS_EXIT_INFO_EXCEPTION_INFO,
+    VMCS_EXIT_INFO_GUEST_PHYSICAL_ADDRESS,
+    VMCS_EXIT_INFO_GUEST_LINEAR_ADDRESS,
+    VMCS_GUEST_RIP,
+    VMCS_GUEST_RSP,
+    VMCS_GUEST_RFLAGS,
+    VMCS_GUEST_INTERRUPTIBILITY,
+    VMCS_GUEST_SLEEP_STATE,
+    VMCS_GUEST_CR0,
+    VMCS_GUEST_CR3,
+    VMCS_GUEST_CR4,
+    VMCS_GUEST_CS_AR,
+    VMCS_GUEST_EFER,
+    VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS,
+    VMCS_ENTER_INTERRUPT_INFO,
+    VMCS_ENTER_EXCEPTION_ERROR_CODE,
+    VMCS_ENTER_INSTRUCTION_LENGTH,
+    VMCS_ENTER_CONTROL_VECTOR,
+    VMCS_EXCEPTION_BITMAP,
+};
+
+static CACHE64_LAYOUT g_vmcs_cache_layout;
+
 /*      translation encoding -> field enum */
 
 #define NUMBER_OF_ENCODING_TYPES    16
@@ -536,6 +568,13 @@ void vmcs_manager_init(void)
     constraints = vmcs_hw_get_vmx_constraints();
     enable_vmcs_2_0_fields( constraints );
     init_enc_2_field_tables();
+    cache64_layout_init(&g_vmcs_cache_layout, VMCS_FIELD_COUNT,
+                        g_hot_fields, NELEMENTS(g_hot_fields));
+}
+
+const CACHE64_LAYOUT* vmcs_get_cache_layout(void)
+{
+    return &g_vmcs_cache_layout;
 }
 
 // Enable VMCS 2.0 fields if exist
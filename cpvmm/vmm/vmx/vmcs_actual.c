@@ -49,6 +49,7 @@
 typedef struct _VMCS_ACTUAL_OBJECT {
     struct _VMCS_OBJECT     vmcs_base[1];
     CACHE64_OBJECT      cache;
+    BOOLEAN            *sw_shadow_disable; // flag of the owning host CPU
     ADDRESS             hpa;
     ADDRESS             hva;
     GUEST_CPU_HANDLE    gcpu_owner;
@@ -61,6 +62,10 @@ typedef struct _VMCS_ACTUAL_OBJECT {
 #define CPU_NEVER_USED ((CPU_ID)-1)
 #define HW_VMCS_IS_EMPTY ((UINT64)-1)
 
+extern BOOLEAN vmcs_sw_shadow_disable[];
+// sw_shadow_disable of a VMCS not owned by any CPU: the cache is in use
+static BOOLEAN vmcs_act_sw_shadow_never_disabled = FALSE;
+
 static const char* g_instr_error_message[] = {
     "VMCS_INSTR_NO_INSTRUCTION_ERROR",                                  // VMxxxxx
     "VMCS_INSTR_VMCALL_IN_ROOT_ERROR",                                  // VMCALL
@@ -119,7 +124,8 @@ static void vmcs_act_delete_msr_from_vmenter_load_list(struct _VMCS_OBJECT *vmcs
 static void vmcs_act_delete_msr_from_vmexit_store_and_vmenter_load_lists(
                         struct _VMCS_OBJECT *vmcs, UINT32 msr_index);
 
-static void vmcs_act_flush_field_to_cpu(UINT32 entry_no, VMCS_ACTUAL_OBJECT *p_vmcs);
+static void vmcs_act_flush_field_to_cpu(UINT32 entry_no, UINT64 value,
+                        VMCS_ACTUAL_OBJECT *p_vmcs);
 static void vmcs_act_flush_nmi_depended_field_to_cpu(VMCS_ACTUAL_OBJECT *p_vmcs, 
                         UINT64 value);
 static UINT64 vmcs_act_read_from_hardware(VMCS_ACTUAL_OBJECT *p_vmcs, 
@@ -245,7 +251,7 @@ struct _VMCS_OBJECT * vmcs_act_create(GUEST_CPU_HANDLE gcpu)
         VMM_LOG(mask_anonymous, level_trace,"[vmcs] %s: Allocation failed\n", __FUNCTION__);
         return NULL;
     }
-    p_vmcs->cache = cache64_create(VMCS_FIELD_COUNT);
+    p_vmcs->cache = cache64_create(VMCS_FIELD_COUNT, vmcs_get_cache_layout());
     if (NULL == p_vmcs->cache) {
         vmm_mfree(p_vmcs);
         VMM_LOG(mask_anonymous, level_trace,"[vmcs] %s: Allocation failed\n", __FUNCTION__);
@@ -257,6 +263,7 @@ struct _VMCS_OBJECT * vmcs_act_create(GUEST_CPU_HANDLE gcpu)
     p_vmcs->hva = vmcs_hw_allocate_region(&p_vmcs->hpa);    // validate it's ok TBD
     p_vmcs->flags|= NEVER_ACTIVATED_FLAG;
     p_vmcs->owning_host_cpu = CPU_NEVER_USED;
+    p_vmcs->sw_shadow_disable = &vmcs_act_sw_shadow_never_disabled;
     p_vmcs->gcpu_owner = gcpu;
     p_vmcs->vmcs_base->vmcs_read = vmcs_act_read;
     p_vmcs->vmcs_base->vmcs_write = vmcs_act_write;
@@ -303,12 +310,11 @@ GUEST_CPU_HANDLE vmcs_act_get_owner(const struct _VMCS_OBJECT *vmcs)
     return p_vmcs->gcpu_owner;
 }
 
-extern BOOLEAN vmcs_sw_shadow_disable[];
 void vmcs_act_write(struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id, UINT64 value)
 {
     struct _VMCS_ACTUAL_OBJECT *p_vmcs = (struct _VMCS_ACTUAL_OBJECT *) vmcs;
     VMM_ASSERT(p_vmcs);
-    if (!vmcs_sw_shadow_disable[hw_cpu_id()])
+    if (!*p_vmcs->sw_shadow_disable)
         cache64_write(p_vmcs->cache, value, (UINT32 )field_id);
     else
         vmcs_act_write_to_hardware(p_vmcs, field_id, value);
@@ -322,6 +328,9 @@ UINT64 vmcs_act_read(const struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id)
 
     VMM_ASSERT(p_vmcs);
     VMM_ASSERT(field_id < VMCS_FIELD_COUNT);
+    if (*p_vmcs->sw_shadow_disable) {
+        return vmcs_act_read_from_hardware(p_vmcs, field_id);
+    }
     if (TRUE != cache64_read(p_vmcs->cache, &value, (UINT32) field_id)) {
         // special case - if hw VMCS was never filled, there is nothing to read
         // from HW
@@ -331,7 +340,8 @@ UINT64 vmcs_act_read(const struct _VMCS_OBJECT *vmcs, VMCS_FIELD field_id)
             return 0;
         }
         value = vmcs_act_read_from_hardware(p_vmcs, field_id);
-        cache64_write(p_vmcs->cache, value, (UINT32) field_id); // update cache
+        // no need to write back what the hardware already has
+        cache64_fill(p_vmcs->cache, value, (UINT32) field_id);
     }
     return value;
 }
@@ -436,14 +446,9 @@ void vmcs_act_flush_to_cpu(const struct _VMCS_OBJECT *vmcs)
 }
 
 
-void vmcs_act_flush_field_to_cpu(UINT32 field_id, VMCS_ACTUAL_OBJECT *p_vmcs)
+void vmcs_act_flush_field_to_cpu(UINT32 field_id, UINT64 value,
+                                 VMCS_ACTUAL_OBJECT *p_vmcs)
 {
-    UINT64 value;
-
-    if(FALSE == cache64_read(p_vmcs->cache, &value, field_id)) {
-        VMM_LOG(mask_anonymous, level_trace,"Read field %d from cache failed.\n", field_id);
-        return;
-    }
     if (VMCS_CONTROL_VECTOR_PROCESSOR_EVENTS != field_id) {
         vmcs_act_write_to_hardware(p_vmcs, (VMCS_FIELD)field_id, value);
     }
@@ -503,6 +508,7 @@ void vmcs_act_flush_to_memory(struct _VMCS_OBJECT *vmcs)
     // reset launching field
     p_vmcs->flags&= (UINT16)(~LAUNCHED_FLAG);
     p_vmcs->owning_host_cpu = CPU_NEVER_USED;
+    p_vmcs->sw_shadow_disable = &vmcs_act_sw_shadow_never_disabled;
     // restore previous
     restore_previous_vmcs_ptr(previous_vmcs);
 }
@@ -610,6 +616,7 @@ void vmcs_activate(VMCS_OBJECT* obj)
         error_processing(p_vmcs->hpa, ret_val, "vmx_vmptrld", VMCS_FIELD_COUNT);
     }
     p_vmcs->owning_host_cpu = this_cpu;
+    p_vmcs->sw_shadow_disable = &vmcs_sw_shadow_disable[this_cpu];
     p_vmcs->flags|= ACTIVATED_FLAG;
     // TEST 1 VMM_ASSERT((p_vmcs->flags&ACTIVATED_FLAG) == 1);
     p_vmcs->flags&= (UINT16)(~NEVER_ACTIVATED_FLAG);
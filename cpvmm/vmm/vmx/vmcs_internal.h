@@ -16,6 +16,7 @@
 #define VMCS_INTERNAL_H
 
 #include <vmm_defs.h>
+#include "cache64.h"
 
 void vmcs_destroy_all_msr_lists_internal(struct _VMCS_OBJECT* vmcs,
                                          BOOLEAN addresses_are_in_hpa);
@@ -90,6 +91,10 @@ void vmcs_delete_msr_from_vmexit_store_and_vmenter_load_lists_internal(
             BOOLEAN   is_msr_list_addr_hpa);
 
 
+// Entry placement shared by the caches of all VMCS objects, set up by
+// vmcs_manager_init()
+const CACHE64_LAYOUT* vmcs_get_cache_layout(void);
+
 typedef void (*VMCS_ADD_MSR_FUNC)(struct _VMCS_OBJECT *vmcs, UINT32 msr_index, UINT64 value);
 typedef void (*VMCS_CLEAR_MSR_LIST_FUNC)(struct _VMCS_OBJECT* vmcs);
 typedef BOOLEAN (*VMCS_IS_MSR_IN_LIST_FUNC)(struct _VMCS_OBJECT* vmcs, UINT32 msr_index);
@@ -468,24 +468,23 @@ static void* ms_retrieve_ptr_to_additional_memory(IN VMCS_OBJECT* vmcs, IN VMCS_
 
 static void ms_merge_bitmaps(IN void* bitmap0, IN void* bitmap1,
                       IN OUT void* merged_bitmap) {
-    UINT64 bitmap0_hva = (UINT64)bitmap0;
-    UINT64 bitmap1_hva = (UINT64)bitmap1;
-    UINT64 merged_bitmap_hva = (UINT64)merged_bitmap;
-    UINT64 merged_bitmap_hva_final = merged_bitmap_hva + PAGE_4KB_SIZE;
+    const UINT64* words0 = (const UINT64*)bitmap0;
+    const UINT64* words1 = (const UINT64*)bitmap1;
+    UINT64* merged_words = (UINT64*)merged_bitmap;
+    UINT64 merged_value;
+    UINT32 i;
 
     VMM_ASSERT((bitmap0 != NULL) || (bitmap1 != NULL));
     VMM_ASSERT(merged_bitmap);
 
-    while (merged_bitmap_hva < merged_bitmap_hva_final) {
-        UINT64 value0 = (bitmap0 == NULL) ? (UINT64)0 : *((UINT64*)bitmap0_hva);
-        UINT64 value1 = (bitmap1 == NULL) ? (UINT64)0 : *((UINT64*)bitmap1_hva);
-        UINT64 merged_value = value0 | value1;
-
-        *((UINT64*)merged_bitmap_hva) = merged_value;
-
-        bitmap0_hva += sizeof(UINT64);
-        bitmap1_hva += sizeof(UINT64);
-        merged_bitmap_hva += sizeof(UINT64);
+    // The merged page mostly holds the result of the previous merge:
+    // store only the words that change
+    for (i = 0; i < PAGE_4KB_SIZE / sizeof(UINT64); i++) {
+        merged_value = ((words0 == NULL) ? (UINT64)0 : words0[i]) |
+                       ((words1 == NULL) ? (UINT64)0 : words1[i]);
+        if (merged_words[i] != merged_value) {
+            merged_words[i] = merged_value;
+        }
     }
 }
 
@@ -506,6 +505,64 @@ static BOOLEAN ms_is_msr_in_list(IN IA32_VMX_MSR_ENTRY* list, IN UINT32 msr_inde
 }
 #endif
 
+// Value of an MSR in the merged list, after the EFER fixup of copy_mode
+static UINT64 ms_merged_msr_data(IN const IA32_VMX_MSR_ENTRY* entry,
+                                 IN MSR_LIST_COPY_MODE copy_mode) {
+    UINT64 data = entry->MsrData;
+
+    if ((copy_mode & MSR_LIST_COPY_WITH_EFER_CHANGE) &&
+        (entry->MsrIndex == IA32_MSR_EFER)) {
+        IA32_EFER_S* efer = (IA32_EFER_S*)(&data);
+        efer->Bits.LME = ((copy_mode & MSR_LIST_COPY_AND_SET_64_BIT_MODE_IN_EFER) == MSR_LIST_COPY_AND_SET_64_BIT_MODE_IN_EFER) ? 1 : 0;
+        efer->Bits.LMA = efer->Bits.LME;
+    }
+    return data;
+}
+
+// Check whether the merged list already is what ms_merge_msr_list() would
+// build: the first list, then the entries of the second list that are not
+// in it yet. The data of the VMExit MSR-store list is written by the
+// hardware, so only its indexes are compared.
+static BOOLEAN ms_msr_list_is_merged(IN VMCS_OBJECT* merged_vmcs,
+                       IN IA32_VMX_MSR_ENTRY* first_list, IN IA32_VMX_MSR_ENTRY* second_list,
+                       IN UINT32 first_list_count, IN UINT32 second_list_count,
+                       IN MSR_LIST_COPY_MODE copy_mode, IN VMCS_FIELD msr_list_addr_field,
+                       IN VMCS_FIELD msr_list_count_field) {
+    UINT32 merged_list_count = (UINT32)vmcs_read(merged_vmcs, msr_list_count_field);
+    BOOLEAN compare_data = (msr_list_addr_field != VMCS_EXIT_MSR_STORE_ADDRESS);
+    IA32_VMX_MSR_ENTRY* merged_list;
+    IA32_VMX_MSR_ENTRY* entry;
+    UINT32 merged = 0;
+    UINT32 i;
+    UINT32 j;
+
+    if (merged_list_count == 0) {
+        return (first_list_count == 0) && (second_list_count == 0);
+    }
+    if (merged_list_count < first_list_count) {
+        return FALSE;
+    }
+    merged_list = ms_retrieve_ptr_to_additional_memory(merged_vmcs, msr_list_addr_field, MS_HPA);
+
+    for (i = 0; i < first_list_count + second_list_count; i++) {
+        entry = (i < first_list_count) ? &first_list[i] : &second_list[i - first_list_count];
+        if (i >= first_list_count) {
+            for (j = 0; j < merged && merged_list[j].MsrIndex != entry->MsrIndex; j++) {
+            }
+            if (j < merged) {
+                continue;       // in the first list, or a duplicate
+            }
+        }
+        if ((merged >= merged_list_count) ||
+            (merged_list[merged].MsrIndex != entry->MsrIndex) ||
+            (compare_data && merged_list[merged].MsrData != ms_merged_msr_data(entry, copy_mode))) {
+            return FALSE;
+        }
+        merged++;
+    }
+    return (merged == merged_list_count);
+}
+
 static void ms_merge_msr_list(IN GUEST_CPU_HANDLE gcpu, IN VMCS_OBJECT* merged_vmcs,
                        IN IA32_VMX_MSR_ENTRY* first_list, IN IA32_VMX_MSR_ENTRY* second_list,
                        IN UINT32 first_list_count, IN UINT32 second_list_count,
@@ -516,15 +573,20 @@ static void ms_merge_msr_list(IN GUEST_CPU_HANDLE gcpu, IN VMCS_OBJECT* merged_v
                        IN VMCS_FIELD msr_list_count_field) {
     UINT32 i;
 
-    clear_list_func(merged_vmcs);
+    // rebuild the list only if an entry changed since the last merge
+    if (!ms_msr_list_is_merged(merged_vmcs, first_list, second_list, first_list_count,
+                               second_list_count, copy_mode, msr_list_addr_field,
+                               msr_list_count_field)) {
+        clear_list_func(merged_vmcs);
 
-    for (i = 0; i < first_list_count; i++) {
-        add_msr_func(merged_vmcs, first_list[i].MsrIndex, first_list[i].MsrData);
-    }
+        for (i = 0; i < first_list_count; i++) {
+            add_msr_func(merged_vmcs, first_list[i].MsrIndex, first_list[i].MsrData);
+        }
 
-    for (i = 0; i < second_list_count; i++) {
-        if (!is_msr_in_list_func(merged_vmcs, second_list[i].MsrIndex)) {
-            add_msr_func(merged_vmcs, second_list[i].MsrIndex, second_list[i].MsrData);
+        for (i = 0; i < second_list_count; i++) {
+            if (!is_msr_in_list_func(merged_vmcs, second_list[i].MsrIndex)) {
+                add_msr_func(merged_vmcs, second_list[i].MsrIndex, second_list[i].MsrData);
+            }
         }
     }
 
@@ -116,7 +116,7 @@ struct _VMCS_OBJECT * vmcs_0_create(struct _VMCS_OBJECT *vmcs_origin)
         return NULL;
     }
 
-    vmcs_clone->cache = cache64_create(VMCS_FIELD_COUNT);
+    vmcs_clone->cache = cache64_create(VMCS_FIELD_COUNT, vmcs_get_cache_layout());
     if (NULL == vmcs_clone->cache) {
         vmm_mfree(vmcs_clone);
         VMM_LOG(mask_anonymous, level_trace,"[vmcs] %s: Allocation failed\n", __FUNCTION__);
@@ -294,7 +294,7 @@ struct _VMCS_OBJECT * vmcs_1_create(GUEST_CPU_HANDLE gcpu, ADDRESS gpa)
         return NULL;
     }
 
-    p_vmcs->cache = cache64_create(VMCS_FIELD_COUNT);
+    p_vmcs->cache = cache64_create(VMCS_FIELD_COUNT, vmcs_get_cache_layout());
     if (NULL == p_vmcs->cache) {
         vmm_mfree(p_vmcs);
         VMM_LOG(mask_anonymous, level_trace,"[vmcs] %s: Allocation failed\n", __FUNCTION__);
@@ -5,6 +5,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
+#include <time.h>
 
 #include <openssl/aes.h>
 #include <openssl/rsa.h>
@@ -21,6 +23,12 @@
 #include <tpm2_lib.h>
 #include <gflags/gflags.h>
 
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
 //
 // Copyright 2015 Google Corporation, All Rights Reserved.
 //
@@ -53,13 +61,32 @@
 //  referencing the Quote Key and creates the decrypt information
 //  required by ActivateCredential.  It saves the encrypted
 //  information in the response file.
+//
+//  Given --program_cert_request_dir instead of a single request file,
+//  it runs as a signing service: the policy key, policy cert and
+//  signing instructions are loaded once, every request file in the
+//  directory without a matching response is verified and signed on a
+//  pool of --num_workers threads, and the responses are written to
+//  --program_response_dir as a batch.  With --poll_interval > 0 the
+//  directory is rescanned forever.  Clients must write a request under
+//  a name starting with '.', which is never read, and rename it into
+//  place once complete; responses are put in place the same way.
+//  Requests that can't be read or signed are moved to
+//  --program_failed_request_dir (by default "failed" in the request
+//  directory) rather than retried on every scan.
 
 // Calling sequence: ServerSignProgramKeyRequest.exe
 //    --program_cert_request_file=input-file-name
 //    --program_cert_response_file=output-file-name
+// or
+//    --program_cert_request_dir=input-directory
+//    --program_response_dir=output-directory
+//    [--program_failed_request_dir=directory]
+//    [--num_workers=n] [--poll_interval=seconds] [--repeat=n]
 
 
 using std::string;
+using std::vector;
 
 
 #define CALLING_SEQUENCE "ServerSignProgramKeyRequest.exe " \
@@ -82,6 +109,12 @@ DEFINE_string(policy_cert_file, "policy_cert_file", "input-file-name");
 DEFINE_string(policy_identifier, "cloudproxy", "policy domain name");
 DEFINE_string(cloudproxy_key_file, "", "input-file-name");
 DEFINE_string(program_response_file, "", "output-file-name");
+DEFINE_string(program_cert_request_dir, "", "input-directory");
+DEFINE_string(program_response_dir, "", "output-directory");
+DEFINE_string(program_failed_request_dir, "", "directory for rejected requests");
+DEFINE_int32(num_workers, 4, "signing threads");
+DEFINE_int32(poll_interval, 0, "seconds between request directory scans");
+DEFINE_int32(repeat, 1, "times to sign each batch (benchmarking)");
 
 #ifndef GFLAGS_NS
 #define GFLAGS_NS google
@@ -89,162 +122,66 @@ DEFINE_string(program_response_file, "", "output-file-name");
 
 #define MAX_SIZE_PARAMS 8192
 
-// magic constant for tpm generated
-#define TpmMagicConstant 0xff544347
-
 // Consults policy database to confirm pcr's are OK
 bool ValidPCR(TPM_ALG_ID hash, byte* pcr_selection, byte* digest) {
   return true;
 }
 
-int main(int an, char** av) {
-  int ret_val = 0;
-
-  printf("\nServerSignProgramKeyRequest\n\n");
-
-  GFLAGS_NS::ParseCommandLineFlags(&an, &av, true);
+// State shared by every request.  Everything but quote_verifier is
+// loaded once and read-only afterwards; quote_verifier caches keys and
+// certs as requests are verified and does its own locking.
+struct SigningContext {
+  TPM_ALG_ID hash_alg_id;
+  RSA* signing_key;
+  X509* policy_cert;
+  EVP_PKEY* policy_key;
+  signing_instructions_message signing_message;
+  QuoteVerifier quote_verifier;
+};
 
-  int size_cert_request = MAX_SIZE_PARAMS;
-  byte cert_request_buf[MAX_SIZE_PARAMS];
-  x509_cert_request_parameters_message cert_request;
- 
+bool LoadSigningContext(SigningContext* ctx) {
   int in_size = MAX_SIZE_PARAMS;
   byte in_buf[MAX_SIZE_PARAMS];
-
-  X509_REQ* req = nullptr;
-  X509* program_cert = nullptr;
-  X509* policy_cert = nullptr;
-  X509* endorsement_cert = nullptr;
-  X509_STORE_CTX* verify_ctx = nullptr;
-
-  TPM2B_DIGEST unmarshaled_credential;
-  TPM2B_DIGEST marshaled_credential;
-  TPM2B_NAME unmarshaled_name;
-  TPM2B_NAME marshaled_name;
-  TPM2B_DIGEST unmarshaled_integrityHmac;
-  TPM2B_DIGEST marshaled_integrityHmac;
-  TPM2B_ENCRYPTED_SECRET unmarshaled_encrypted_secret;
-  TPM2B_ENCRYPTED_SECRET marshaled_encrypted_secret;
-  int size_hmac = MAX_SIZE_PARAMS;
-  byte encrypted_data_hmac[MAX_SIZE_PARAMS];
-  int size_encrypted_data = MAX_SIZE_PARAMS;
-  byte encrypted_data[MAX_SIZE_PARAMS];
-  int size_encIdentity = MAX_SIZE_PARAMS;
-  byte encIdentity[MAX_SIZE_PARAMS];
-
-  TPM_ALG_ID hash_alg_id;
-  if (FLAGS_hash_alg == "sha1") {
-    hash_alg_id = TPM_ALG_SHA1;
-  } else if (FLAGS_hash_alg == "sha256") {
-    hash_alg_id = TPM_ALG_SHA256;
-  } else {
-    printf("Unknown hash algorithm\n");
-    return 1;
-  }
-
-  int size_quote_out;
-
-  byte* der_program_cert = nullptr;
-  int der_program_cert_size = 0;
   byte der_policy_cert[MAX_SIZE_PARAMS];
   int der_policy_cert_size = MAX_SIZE_PARAMS;
-  byte* endorsement_blob = nullptr;
-  int endorsement_blob_size;
-  program_cert = X509_new();
-  byte program_key_quoted_hash[256];
-  int signed_quote_hash_size = 0;
-  byte signed_quote_hash[MAX_SIZE_PARAMS];
-  int quote_struct_size = 0;
-  byte quote_struct[MAX_SIZE_PARAMS];
-  byte decrypted_quote[MAX_SIZE_PARAMS];
-
   private_key_blob_message private_key;
-  program_cert_request_message request;
-  program_cert_response_message response;
-  signing_instructions_message signing_message;
-  x509_cert_request_parameters_message cert_parameters;
-
-  int cert_OK = 0;
-  byte* p_byte = nullptr;
-
-  string name;
   string input;
-  string output;
   string private_key_blob;
+  byte* p_byte = nullptr;
 
-  SHA_CTX sha1;
-  SHA256_CTX sha256;
-  RSA* signing_key = nullptr;
-  byte* signing_blob = nullptr;
-  RSA* quote_key = RSA_new();
-  TPMS_ATTEST attested_quote;
-  string serialized_program_key;
-
-  if (FLAGS_signing_instructions_file == "") {
-    printf("signing_instructions_file is empty\n");
-    ret_val = 1;
-    goto done;
-  }
-  if (FLAGS_program_cert_request_file == "") {
-    printf("program_cert_request_file is empty\n");
-    ret_val = 1;
-    goto done;
-  }
-  if (FLAGS_cloudproxy_key_file == "") {
-    printf("cloudproxy_key_file is empty\n");
-    ret_val = 1;
-    goto done;
-  }
-  if (FLAGS_program_response_file == "") {
-    printf("program_response_file is empty\n");
-    ret_val = 1;
-    goto done;
-  }
-
-  OpenSSL_add_all_algorithms();
-
-  // Get request
-  if (!ReadFileIntoBlock(FLAGS_program_cert_request_file, &size_cert_request,
-                         cert_request_buf)) {
-    printf("Can't read cert request\n");
-    ret_val = 1;
-    goto done;
-  }
-
-#ifdef DEBUG
-  printf("Program cert request (%d): ", size_cert_request);
-  PrintBytes(size_cert_request, cert_request_buf);
-  printf("\n");
-#endif
+  ctx->signing_key = nullptr;
+  ctx->policy_cert = nullptr;
+  ctx->policy_key = nullptr;
 
-  input.assign((const char*)cert_request_buf, size_cert_request);
-  if (!request.ParseFromString(input)) {
-    printf("Can't parse cert request\n");
-    ret_val = 1;
-    goto done;
+  if (FLAGS_hash_alg == "sha1") {
+    ctx->hash_alg_id = TPM_ALG_SHA1;
+  } else if (FLAGS_hash_alg == "sha256") {
+    ctx->hash_alg_id = TPM_ALG_SHA256;
+  } else {
+    printf("Unknown hash algorithm\n");
+    return false;
   }
 
   // Get signing instructions
   if (!ReadFileIntoBlock(FLAGS_signing_instructions_file, &in_size, in_buf)) {
     printf("Can't read signing instructions %s\n",
            FLAGS_signing_instructions_file.c_str());
-    ret_val = 1;
-    goto done;
+    return false;
   }
   input.assign((const char*)in_buf, in_size);
-  if (!signing_message.ParseFromString(input)) {
+  if (!ctx->signing_message.ParseFromString(input)) {
     printf("Can't parse signing instructions\n");
-    ret_val = 1;
-    goto done;
+    return false;
   }
   printf("issuer: %s, duration: %ld, purpose: %s, hash: %s\n",
-         signing_message.issuer().c_str(), (long)signing_message.duration(),
-         signing_message.purpose().c_str(), signing_message.hash_alg().c_str());
-  if (!signing_message.can_sign()) {
+         ctx->signing_message.issuer().c_str(),
+         (long)ctx->signing_message.duration(),
+         ctx->signing_message.purpose().c_str(),
+         ctx->signing_message.hash_alg().c_str());
+  if (!ctx->signing_message.can_sign()) {
     printf("Signing is invalid\n");
-    ret_val = 1;
-    goto done;
-  } 
+    return false;
+  }
 
   // Get cloudproxy key
   in_size = MAX_SIZE_PARAMS;
@@ -258,34 +195,93 @@ int main(int an, char** av) {
   }
 
   private_key_blob = private_key.blob();
-  PrintBytes(private_key_blob.size(), (byte*)private_key_blob.data());
-  printf("\n");
-  signing_blob = (byte*)private_key_blob.data();
-  p_byte = signing_blob;
-  signing_key = d2i_RSAPrivateKey(nullptr, (const byte**)&p_byte,
-                                  private_key_blob.size());
-  if (signing_key == nullptr) {
+  p_byte = (byte*)private_key_blob.data();
+  ctx->signing_key = d2i_RSAPrivateKey(nullptr, (const byte**)&p_byte,
+                                       private_key_blob.size());
+  if (ctx->signing_key == nullptr) {
     printf("Can't translate private key\n");
-    ret_val = 1;
-    goto done;
+    return false;
   }
 
 #ifdef DEBUG
-  print_internal_private_key(*signing_key);
+  print_internal_private_key(*ctx->signing_key);
 #endif
 
-  // Extract program key request
-  if (!request.has_quote_key_info()) {
-    printf("No information to construct cred\n");
-    ret_val = 1;
-    goto done;
-  }
-
   // Get Policy cert
   if (!ReadFileIntoBlock(FLAGS_policy_cert_file, &der_policy_cert_size,
                          der_policy_cert)) {
     printf("Can't read policy cert \n");
-    ret_val = 1;
+    return false;
+  }
+  p_byte = der_policy_cert;
+  ctx->policy_cert = d2i_X509(nullptr, (const byte**)&p_byte,
+                              der_policy_cert_size);
+  if (ctx->policy_cert == nullptr) {
+    printf("Can't convert policy cert\n");
+    return false;
+  }
+  ctx->policy_key = X509_get_pubkey(ctx->policy_cert);
+  if (ctx->policy_key == nullptr) {
+    printf("Can't get policy key\n");
+    return false;
+  }
+  return true;
+}
+
+void FreeSigningContext(SigningContext* ctx) {
+  if (ctx->signing_key != nullptr)
+    RSA_free(ctx->signing_key);
+  if (ctx->policy_key != nullptr)
+    EVP_PKEY_free(ctx->policy_key);
+  if (ctx->policy_cert != nullptr)
+    X509_free(ctx->policy_cert);
+  ctx->signing_key = nullptr;
+  ctx->policy_key = nullptr;
+  ctx->policy_cert = nullptr;
+}
+
+// Verify one request and build its response.  Safe to call from several
+// threads at once with the same ctx.
+bool SignProgramKeyRequest(SigningContext& ctx,
+                           program_cert_request_message& request,
+                           program_cert_response_message* response) {
+  TPM_ALG_ID hash_alg_id = ctx.hash_alg_id;
+  bool ret = false;
+
+  X509_REQ* req = nullptr;
+  X509* program_cert = X509_new();
+
+  TPM2B_DIGEST unmarshaled_credential;
+  TPM2B_DIGEST marshaled_credential;
+  TPM2B_NAME unmarshaled_name;
+  TPM2B_NAME marshaled_name;
+  TPM2B_DIGEST unmarshaled_integrityHmac;
+  TPM2B_DIGEST marshaled_integrityHmac;
+  TPM2B_ENCRYPTED_SECRET unmarshaled_encrypted_secret;
+  TPM2B_ENCRYPTED_SECRET marshaled_encrypted_secret;
+  int size_hmac = MAX_SIZE_PARAMS;
+  byte encrypted_data_hmac[MAX_SIZE_PARAMS];
+  int size_encrypted_data = MAX_SIZE_PARAMS;
+  byte encrypted_data[MAX_SIZE_PARAMS];
+  int size_encIdentity = MAX_SIZE_PARAMS;
+  byte encIdentity[MAX_SIZE_PARAMS];
+
+  byte* der_program_cert = nullptr;
+  int der_program_cert_size = 0;
+  byte* endorsement_blob = nullptr;
+  int endorsement_blob_size;
+  byte program_key_quoted_hash[256];
+
+  x509_cert_request_parameters_message cert_parameters;
+
+  SHA_CTX sha1;
+  SHA256_CTX sha256;
+  TPMS_ATTEST attested_quote;
+  string serialized_program_key;
+
+  // Extract program key request
+  if (!request.has_quote_key_info()) {
+    printf("No information to construct cred\n");
     goto done;
   }
 
@@ -293,28 +289,10 @@ int main(int an, char** av) {
   endorsement_blob = (byte*)request.endorsement_cert_blob().data();
   endorsement_blob_size = request.endorsement_cert_blob().size();
 
-  p_byte = der_policy_cert;
-  policy_cert = d2i_X509(nullptr, (const byte**)&p_byte,
-                         der_policy_cert_size);
-  if (policy_cert == nullptr) {
-    printf("Can't convert policy cert\n");
-    ret_val = 1;
-    goto done;
-  }
-
   // Verify endorsement cert
-  p_byte = endorsement_blob;
-  endorsement_cert = d2i_X509(nullptr, (const byte**)&p_byte,
-                              endorsement_blob_size);
-  if ((verify_ctx = X509_STORE_CTX_new()) == nullptr) {
-    printf("Can't new X509_STORE_CTX\n");
-    ret_val = 1;
-    goto done;
-  }
-  cert_OK = X509_verify(endorsement_cert, X509_get_pubkey(policy_cert));
-  if (cert_OK <= 0) {
+  if (!ctx.quote_verifier.VerifyEndorsementCert(endorsement_blob_size,
+           endorsement_blob, ctx.policy_key)) {
     printf("Endorsement cert does not verivy\n");
-    ret_val = 1;
     goto done;
   }
 
@@ -327,23 +305,22 @@ int main(int an, char** av) {
       request.program_key().program_key_exponent());
   cert_parameters.mutable_key()->mutable_rsa_key()->set_modulus(
        request.program_key().program_key_modulus());
+#ifdef DEBUG
   print_cert_request_message(cert_parameters); printf("\n");
+#endif
 
   req = X509_REQ_new();
   if (!GenerateX509CertificateRequest(cert_parameters, false, req)) {
     printf("Can't generate certificate request\n");
-    ret_val = 1;
     goto done;
   }
 
   // sign program key
-  if (!SignX509Certificate(signing_key, false, signing_message, nullptr, req,
-                           false, program_cert)) {
+  if (!SignX509Certificate(ctx.signing_key, false, ctx.signing_message,
+                           nullptr, req, false, program_cert)) {
     printf("Can't sign x509 request for program key\n");
-    ret_val = 1;
     goto done;
   }
-  printf("\nmessage signed\n");
 
   // Serialize program cert
   der_program_cert = nullptr;
@@ -370,7 +347,6 @@ int main(int an, char** av) {
     SHA256_Final(program_key_quoted_hash, &sha256);
   } else {
     printf("Unknown hash alg\n");
-    ret_val = 1;
     goto done;
   }
 
@@ -380,43 +356,20 @@ int main(int an, char** av) {
   printf("\n");
 #endif
 
-  // "Encrypt" with quote key to verify
+  // Verify the quote with the quote key
   if (!request.quote_key_info().has_public_key()) {
     printf("no quote key\n");
-    ret_val = 1;
     goto done;
   }
 
-  quote_struct_size = request.quoted_blob().size();
-  memcpy(quote_struct, request.quoted_blob().data(), quote_struct_size);
-
-#ifdef DEBUG_EXTRA
-  printf("\nmodulus size: %d\n",
-      (int)request.quote_key_info().public_key().rsa_key().modulus().size());
-  printf("exponent size: %d\n",
-      (int)request.quote_key_info().public_key().rsa_key().exponent().size());
-  printf("modulus: ");
-  PrintBytes(request.quote_key_info().public_key().rsa_key().modulus().size(),
-             (byte*)request.quote_key_info().public_key().rsa_key().modulus().data());
-  printf("\n");
-  printf("exponent: ");
-  PrintBytes(request.quote_key_info().public_key().rsa_key().exponent().size(),
-             (byte*)request.quote_key_info().public_key().rsa_key().exponent().data());
-  printf("\n");
-  printf("quote_struct: ");
-  PrintBytes(quote_struct_size, quote_struct);
-  printf("\n");
-#endif
-
-  // Decode quote structure
-  if (!UnmarshalCertifyInfo(quote_struct_size, quote_struct, &attested_quote)) {
-    printf("Invalid attested structure\n");
-    ret_val = 1;
-    goto done;
-  }
-  if (attested_quote.magic !=  TpmMagicConstant) {
-    printf("Invalid magic number\n");
-    ret_val = 1;
+  // Check the quote's magic number and signature.
+  if (!ctx.quote_verifier.VerifyQuote(hash_alg_id,
+           request.quote_key_info().name(),
+           request.quote_key_info().public_key().rsa_key(),
+           request.quoted_blob().size(), (byte*)request.quoted_blob().data(),
+           request.quote_signature().size(),
+           (byte*)request.quote_signature().data(), &attested_quote)) {
+    printf("quote signature is wrong\n");
     goto done;
   }
 
@@ -424,68 +377,16 @@ int main(int an, char** av) {
                &attested_quote.attested.quote.pcrSelect.pcrSelections[0].sizeofSelect,
                attested_quote.attested.quote.pcrDigest.buffer)) {
     printf("Invalid pcr\n");
-    ret_val = 1;
-    goto done;
-  }
-
-  // Set quote key exponent and modulus
-  quote_key->n = bin_to_BN(
-      request.quote_key_info().public_key().rsa_key().modulus().size(),
-      (byte*)request.quote_key_info().public_key().rsa_key().modulus().data());
-  quote_key->e = bin_to_BN(
-      request.quote_key_info().public_key().rsa_key().exponent().size(),
-      (byte*)request.quote_key_info().public_key().rsa_key().exponent().data());
-  size_quote_out = RSA_public_encrypt(request.quote_signature().size(),
-                        (const byte*)request.quote_signature().data(),
-                        decrypted_quote, quote_key, RSA_NO_PADDING);
-  if (size_quote_out > MAX_SIZE_PARAMS) {
-    printf("quote signature is too big\n");
-    ret_val = 1;
     goto done;
   }
-  signed_quote_hash_size = MAX_SIZE_PARAMS;
-  if (!ComputeQuotedValue(hash_alg_id, quote_struct_size, quote_struct,
-                          &signed_quote_hash_size, signed_quote_hash)) {
-    printf("Cant compute ComputeQuotedValue\n");
-    ret_val = 1;
-    goto done;
-    }
 
   // Check hash of request
   if (memcmp(attested_quote.extraData.buffer, program_key_quoted_hash, 
              attested_quote.extraData.size) != 0) {
     printf("Program key hash does not match\n");
-    ret_val = 1;
-    goto done;
-  }
-
-#ifdef DEBUG
-  printf("\nquote signature size: %d\n", size_quote_out);
-  printf("Quote structure: ");
-  PrintBytes(quote_struct_size, quote_struct);
-  printf("\n");
-  printf("Quote hash: ");
-  PrintBytes(signed_quote_hash_size, signed_quote_hash);
-  printf("\n");
-  printf("Decrypted hash: ");
-  PrintBytes(size_quote_out, decrypted_quote);
-  printf("\n");
-#endif
-
-  // recover pcr hash and magic number and check them
-  // Compare signature and computed hash
-  if (memcmp(signed_quote_hash,
-             decrypted_quote + size_quote_out - SizeHash(hash_alg_id),
-             SizeHash(hash_alg_id)) != 0) {
-    printf("quote signature is wrong\n");
-    PrintBytes(SizeHash(hash_alg_id), signed_quote_hash); printf("\n");
-    PrintBytes(size_quote_out, decrypted_quote); printf("\n");
-    ret_val = 1;
     goto done;
   }
 
-  // Prepare encrypted secret, 
-
   // Generate encryption key for signed program cert
   // This is the "credential."
   unmarshaled_credential.size = 16;
@@ -498,7 +399,6 @@ int main(int an, char** av) {
          unmarshaled_name.size);
   ChangeEndian16(&unmarshaled_name.size, &marshaled_name.size);
   memcpy(marshaled_name.name, unmarshaled_name.name, unmarshaled_name.size);
-  printf("Quote name : ");PrintBytes(unmarshaled_name.size, unmarshaled_name.name); printf("\n");
 
   // Encrypt signed program cert and prepare ActivateCredential buffer
   if (!MakeCredential(endorsement_blob_size, endorsement_blob,
@@ -508,7 +408,6 @@ int main(int an, char** av) {
                     &unmarshaled_encrypted_secret, &marshaled_encrypted_secret,
                     &unmarshaled_integrityHmac, &marshaled_integrityHmac)) {
     printf("MakeCredential failed\n");
-    ret_val = 1;
     goto done;
   }
 
@@ -518,73 +417,279 @@ int main(int an, char** av) {
                  &size_hmac, (byte*)encrypted_data_hmac,
                  &size_encrypted_data, encrypted_data)) {
     printf("EncryptDataWithCredential failed\n");
-    ret_val = 1;
     goto done;
   }
 
-#ifdef DEBUG
-  printf("\ncredential secret: ");
-  PrintBytes(16, unmarshaled_credential.buffer);
-  printf("\n");
-  printf("\nder_program_cert: ");
-  PrintBytes(der_program_cert_size, der_program_cert);
-  printf("\n");
-  printf("\nencrypted der_program_cert: ");
-  PrintBytes(der_program_cert_size, encrypted_data);
-  printf("\n");
-  printf("der_program_cert_size: %d\n", der_program_cert_size);
-  printf("size_encrypted_data: %d\n", size_encrypted_data);
-  printf("\nencrypted secret: ");
-  PrintBytes(unmarshaled_encrypted_secret.size, unmarshaled_encrypted_secret.secret);
-  printf("\n");
-  {
-    int size_decrypted_cert = MAX_SIZE_PARAMS;
-    byte decrypted_cert[MAX_SIZE_PARAMS];
-    if (!EncryptDataWithCredential(false, hash_alg_id,
-                 unmarshaled_credential, marshaled_credential,
-                 size_encrypted_data, encrypted_data,
-                 &size_hmac, (byte*) encrypted_data_hmac,
-                 &size_decrypted_cert, decrypted_cert)) {
-      printf("EncryptDataWithCredential failed\n");
-    } else {
-      printf("\ndecrypted der_program_cert: ");
-      PrintBytes(size_decrypted_cert, decrypted_cert);
-      printf("\n");
+  response->set_secret(marshaled_encrypted_secret.secret,
+                       unmarshaled_encrypted_secret.size);
+  response->set_encidentity(encIdentity, size_encIdentity);
+  response->set_integrityhmac((byte*)&marshaled_integrityHmac,
+                              unmarshaled_integrityHmac.size + sizeof(uint16_t));
+  response->set_encrypted_cert_hmac((byte*) encrypted_data_hmac, size_hmac);
+  response->set_encrypted_cert(encrypted_data, size_encrypted_data);
+  ret = true;
+
+done:
+  if (der_program_cert != nullptr)
+    OPENSSL_free(der_program_cert);
+  if (req != nullptr)
+    X509_REQ_free(req);
+  X509_free(program_cert);
+  return ret;
+}
+
+// One request file of a batch and, once signed, its serialized response.
+struct BatchEntry {
+  string name;
+  string request;
+  string response;
+  bool signed_ok;
+};
+
+void SignBatchWorker(SigningContext* ctx, vector<BatchEntry>* batch,
+                     std::atomic<int>* next) {
+  for (;;) {
+    int i = (*next)++;
+    if (i >= (int)batch->size())
+      return;
+    BatchEntry& entry = (*batch)[i];
+    program_cert_request_message request;
+    program_cert_response_message response;
+    entry.signed_ok = false;
+    if (!request.ParseFromString(entry.request)) {
+      printf("Can't parse cert request %s\n", entry.name.c_str());
+      continue;
     }
-    if (size_decrypted_cert == der_program_cert_size &&
-        memcmp(decrypted_cert, der_program_cert, size_decrypted_cert) == 0) {
-    printf("Original cert and decrypted cert match\n");
-    } else {
-      printf("Original cert and decrypted cert DO NOT match\n");
+    if (!SignProgramKeyRequest(*ctx, request, &response)) {
+      printf("Can't sign cert request %s\n", entry.name.c_str());
+      continue;
     }
+    response.SerializeToString(&entry.response);
+    entry.signed_ok = true;
   }
-  printf("\nhmac: ");
-  PrintBytes(unmarshaled_integrityHmac.size, unmarshaled_integrityHmac.buffer);
-  printf("\n");
-  printf("\nencIdentity: ");
-  PrintBytes(size_encIdentity, encIdentity);
-  printf("\n");
-#endif
+}
 
-  response.set_secret(marshaled_encrypted_secret.secret,
-                      unmarshaled_encrypted_secret.size);
-  response.set_encidentity(encIdentity, size_encIdentity);
-  response.set_integrityhmac((byte*)&marshaled_integrityHmac,
-                            unmarshaled_integrityHmac.size + sizeof(uint16_t));
-  response.set_encrypted_cert_hmac((byte*) encrypted_data_hmac, size_hmac);
-  response.set_encrypted_cert(encrypted_data, size_encrypted_data);
+// Moves a request that could not be read or signed out of the request
+// directory.  If that fails it is remembered in failed, so it is still
+// not retried while the service runs.
+void MoveFailedRequest(const string& name, std::set<string>* failed) {
+  string request_file = FLAGS_program_cert_request_dir + "/" + name;
+  string failed_file = FLAGS_program_failed_request_dir + "/" + name;
+  if (rename(request_file.c_str(), failed_file.c_str()) != 0) {
+    printf("Can't move %s to %s\n", request_file.c_str(),
+           failed_file.c_str());
+    failed->insert(name);
+  }
+}
+
+// Read every request in the request directory that has no response yet.
+// Names starting with '.' are requests still being written.
+bool ReadRequestBatch(vector<BatchEntry>* batch, std::set<string>* failed) {
+  DIR* dir = opendir(FLAGS_program_cert_request_dir.c_str());
+  if (dir == nullptr) {
+    printf("Can't open %s\n", FLAGS_program_cert_request_dir.c_str());
+    return false;
+  }
+  struct dirent* ent;
+  struct stat st;
+  byte in_buf[MAX_SIZE_PARAMS];
+  while ((ent = readdir(dir)) != nullptr) {
+    if (ent->d_name[0] == '.')
+      continue;
+    if (failed->find(ent->d_name) != failed->end())
+      continue;
+    string response_file = FLAGS_program_response_dir + "/" + ent->d_name;
+    if (access(response_file.c_str(), F_OK) == 0)
+      continue;
+    string request_file = FLAGS_program_cert_request_dir + "/" + ent->d_name;
+    if (stat(request_file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    int in_size = MAX_SIZE_PARAMS;
+    if (!ReadFileIntoBlock(request_file, &in_size, in_buf) || in_size <= 0) {
+      printf("Can't read cert request %s\n", request_file.c_str());
+      MoveFailedRequest(ent->d_name, failed);
+      continue;
+    }
+    BatchEntry entry;
+    entry.name = ent->d_name;
+    entry.request.assign((const char*)in_buf, in_size);
+    entry.signed_ok = false;
+    batch->push_back(entry);
+  }
+  closedir(dir);
+  return true;
+}
+
+// Each response is written under a name starting with '.' and renamed
+// into place, so clients never see a partial one.
+bool WriteResponseBatch(vector<BatchEntry>& batch) {
+  bool ret = true;
+  for (int i = 0; i < (int)batch.size(); i++) {
+    if (!batch[i].signed_ok)
+      continue;
+    string response_file = FLAGS_program_response_dir + "/" + batch[i].name;
+    string temp_file = FLAGS_program_response_dir + "/." + batch[i].name;
+    if (!WriteFileFromBlock(temp_file, batch[i].response.size(),
+                            (byte*)batch[i].response.data()) ||
+        rename(temp_file.c_str(), response_file.c_str()) != 0) {
+      printf("Can't write response %s\n", response_file.c_str());
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+// Sign a batch on num_workers threads.  For benchmarking, the batch is
+// signed FLAGS_repeat times and the certificate rate is reported.
+void SignBatch(SigningContext& ctx, vector<BatchEntry>& batch,
+               int num_workers) {
+  struct timespec start;
+  struct timespec stop;
+  int num_signed = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < FLAGS_repeat; r++) {
+    std::atomic<int> next(0);
+    vector<std::thread> workers;
+    for (int i = 0; i < num_workers; i++)
+      workers.push_back(std::thread(SignBatchWorker, &ctx, &batch, &next));
+    for (int i = 0; i < num_workers; i++)
+      workers[i].join();
+    for (int i = 0; i < (int)batch.size(); i++) {
+      if (batch[i].signed_ok)
+        num_signed++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double seconds = ElapsedSeconds(start, stop);
+  printf("%d certificates issued in %.3f seconds, %.2f certificates/sec "
+         "(%d workers)\n", num_signed, seconds,
+         seconds > 0.0 ? num_signed / seconds : 0.0, num_workers);
+}
+
+int RunSigningService(SigningContext& ctx) {
+  int num_workers = FLAGS_num_workers;
+  if (num_workers <= 0)
+    num_workers = 1;
+  if (FLAGS_repeat <= 0)
+    FLAGS_repeat = 1;
+
+  if (FLAGS_program_failed_request_dir == "") {
+    FLAGS_program_failed_request_dir =
+        FLAGS_program_cert_request_dir + "/failed";
+  }
+  if (mkdir(FLAGS_program_failed_request_dir.c_str(), S_IRWXU) != 0 &&
+      errno != EEXIST) {
+    printf("Can't create %s\n", FLAGS_program_failed_request_dir.c_str());
+    return 1;
+  }
+
+  int ret = 0;
+  std::set<string> failed;
+  InitOpenSSLThreading();
+  for (;;) {
+    vector<BatchEntry> batch;
+    if (!ReadRequestBatch(&batch, &failed)) {
+      ret = 1;
+      break;
+    }
+    if (batch.size() > 0) {
+      SignBatch(ctx, batch, num_workers);
+      if (!WriteResponseBatch(batch)) {
+        ret = 1;
+        break;
+      }
+      for (int i = 0; i < (int)batch.size(); i++) {
+        if (!batch[i].signed_ok)
+          MoveFailedRequest(batch[i].name, &failed);
+      }
+    }
+    if (FLAGS_poll_interval <= 0)
+      break;
+    sleep(FLAGS_poll_interval);
+  }
+  CleanupOpenSSLThreading();
+  return ret;
+}
+
+int main(int an, char** av) {
+  int ret_val = 0;
+  SigningContext ctx;
+  int size_cert_request = MAX_SIZE_PARAMS;
+  byte cert_request_buf[MAX_SIZE_PARAMS];
+  program_cert_request_message request;
+  program_cert_response_message response;
+  string input;
+  string output;
+
+  printf("\nServerSignProgramKeyRequest\n\n");
+
+  GFLAGS_NS::ParseCommandLineFlags(&an, &av, true);
+
+  bool service_mode = FLAGS_program_cert_request_dir != "";
+  if (FLAGS_signing_instructions_file == "") {
+    printf("signing_instructions_file is empty\n");
+    return 1;
+  }
+  if (FLAGS_cloudproxy_key_file == "") {
+    printf("cloudproxy_key_file is empty\n");
+    return 1;
+  }
+  if (service_mode) {
+    if (FLAGS_program_response_dir == "") {
+      printf("program_response_dir is empty\n");
+      return 1;
+    }
+  } else {
+    if (FLAGS_program_cert_request_file == "") {
+      printf("program_cert_request_file is empty\n");
+      return 1;
+    }
+    if (FLAGS_program_response_file == "") {
+      printf("program_response_file is empty\n");
+      return 1;
+    }
+  }
+
+  OpenSSL_add_all_algorithms();
+
+  if (!LoadSigningContext(&ctx)) {
+    ret_val = 1;
+    goto done;
+  }
+
+  if (service_mode) {
+    ret_val = RunSigningService(ctx);
+    goto done;
+  }
+
+  // Get request
+  if (!ReadFileIntoBlock(FLAGS_program_cert_request_file, &size_cert_request,
+                         cert_request_buf)) {
+    printf("Can't read cert request\n");
+    ret_val = 1;
+    goto done;
+  }
 
 #ifdef DEBUG
-  printf("\nmac'ed: ");
-  PrintBytes(response.encrypted_cert().size(),
-            (byte*)response.encrypted_cert().data());
-  printf("\n");
-  printf("\nmac   : ");
-  PrintBytes(response.encrypted_cert_hmac().size(),
-            (byte*)response.encrypted_cert_hmac().data());
+  printf("Program cert request (%d): ", size_cert_request);
+  PrintBytes(size_cert_request, cert_request_buf);
   printf("\n");
 #endif
 
+  input.assign((const char*)cert_request_buf, size_cert_request);
+  if (!request.ParseFromString(input)) {
+    printf("Can't parse cert request\n");
+    ret_val = 1;
+    goto done;
+  }
+
+  if (!SignProgramKeyRequest(ctx, request, &response)) {
+    ret_val = 1;
+    goto done;
+  }
+  printf("\nmessage signed\n");
+
   // Serialize output
   response.SerializeToString(&output);
   if (!WriteFileFromBlock(FLAGS_program_response_file,
@@ -596,7 +701,6 @@ int main(int an, char** av) {
   }
 
 done:
+  FreeSigningContext(&ctx);
   return ret_val;
 }
-
-
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tpm2_lib.h>
+
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl_helpers.h>
+#include <gflags/gflags.h>
+
+#include <string>
+using std::string;
+
+//
+// Copyright 2015 Google Corporation, All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// or in the the file LICENSE-2.0.txt in the top level sourcedirectory
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License
+//
+// File: kdfbenchmark.cc
+
+// Microbenchmark for session key derivation and session HMACs.
+// Calling sequence: kdfbenchmark.exe [--iterations=n] [--hash_alg=sha1]
+
+DEFINE_int32(iterations, 100000, "derivations per measurement");
+DEFINE_string(hash_alg, "sha256", "sha1 or sha256");
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+bool CalculateSessionKey(ProtectedSessionAuthInfo& in, TPM2B_DIGEST& rawSalt);
+bool CalculateSessionHmac(ProtectedSessionAuthInfo& in, bool dir, uint32_t cmd,
+                int numNames, TPM2B_NAME* names,
+                int size_parms, byte* parms, int* size_hmac, byte* hmac);
+
+// The KDFa loop as it was: a fresh HMAC_CTX keyed on every counter
+// iteration.
+bool RekeyedKDFa(uint16_t hashAlg, string& key, string& label,
+                 string& contextU, string& contextV, int bits, byte* out) {
+  HMAC_CTX ctx;
+  uint32_t len = 32;
+  uint32_t counter = 0;
+  int bytes_left = (bits + 7) / 8;
+  int size_buf = 0;
+  byte buf[512];
+
+  size_buf += sizeof(uint32_t);
+  memcpy(&buf[size_buf], label.c_str(), label.size() + 1);
+  size_buf += label.size() + 1;
+  memcpy(&buf[size_buf], contextU.data(), contextU.size());
+  size_buf += contextU.size();
+  memcpy(&buf[size_buf], contextV.data(), contextV.size());
+  size_buf += contextV.size();
+  ChangeEndian32((uint32_t*)&bits, (uint32_t*)&buf[size_buf]);
+  size_buf += sizeof(uint32_t);
+  while (bytes_left > 0) {
+    counter++;
+    ChangeEndian32(&counter, (uint32_t*)buf);
+    HMAC_CTX_init(&ctx);
+    if (hashAlg == TPM_ALG_SHA1) {
+      HMAC_Init_ex(&ctx, key.data(), key.size(), EVP_sha1(), nullptr);
+    } else {
+      HMAC_Init_ex(&ctx, key.data(), key.size(), EVP_sha256(), nullptr);
+    }
+    HMAC_Update(&ctx, buf, size_buf);
+    HMAC_Final(&ctx, out, &len);
+    HMAC_CTX_cleanup(&ctx);
+    out += len;
+    bytes_left -= len;
+  }
+  return true;
+}
+
+// KDFa and HmacKdf::KDFa must give the bytes the rekeyed loop gives,
+// for every label and output length, including lengths that are not a
+// multiple of the hash size.
+bool CheckKDFa(TPM_ALG_ID hash_alg, string& key, string& contextU,
+               string& contextV) {
+  const char* labels[] = {"ATH", "STORAGE", "INTEGRITY", "PROTECT", ""};
+  int bits[] = {8, 128, 160, 256, 264, 512, 1000};
+  string no_context;
+  byte expected[256];
+  byte out[256];
+  HmacKdf kdf;
+
+  if (!kdf.SetKey(hash_alg, key.size(), (byte*)key.data()))
+    return false;
+  for (int i = 0; i < (int)(sizeof(labels) / sizeof(labels[0])); i++) {
+    string label(labels[i]);
+    for (int j = 0; j < (int)(sizeof(bits) / sizeof(bits[0])); j++) {
+      int size = (bits[j] + 7) / 8;
+      for (int k = 0; k < 2; k++) {
+        string& u = k == 0 ? contextU : no_context;
+        RekeyedKDFa(hash_alg, key, label, u, contextV, bits[j], expected);
+        memset(out, 0, sizeof(out));
+        if (!KDFa(hash_alg, key, label, u, contextV, bits[j], sizeof(out),
+                  out) || memcmp(out, expected, size) != 0) {
+          printf("KDFa differs: label \"%s\", %d bits\n", labels[i], bits[j]);
+          return false;
+        }
+        memset(out, 0, sizeof(out));
+        if (!kdf.KDFa(label, u.size(), (byte*)u.data(), contextV.size(),
+                      (byte*)contextV.data(), bits[j], sizeof(out), out) ||
+            memcmp(out, expected, size) != 0) {
+          printf("HmacKdf::KDFa differs: label \"%s\", %d bits\n",
+                 labels[i], bits[j]);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void Report(const char* name, int n, struct timespec& start,
+            struct timespec& stop) {
+  double seconds = ElapsedSeconds(start, stop);
+  printf("  %-32s %10.0f ops/sec  %8.3f us/op\n", name, n / seconds,
+         1000000.0 * seconds / n);
+}
+
+int main(int an, char** av) {
+  GFLAGS_NS::ParseCommandLineFlags(&an, &av, true);
+
+  TPM_ALG_ID hash_alg = TPM_ALG_SHA256;
+  if (FLAGS_hash_alg == "sha1")
+    hash_alg = TPM_ALG_SHA1;
+  int hash_size = SizeHash(hash_alg);
+  int n = FLAGS_iterations;
+  struct timespec start;
+  struct timespec stop;
+
+  ProtectedSessionAuthInfo authInfo;
+  authInfo.hash_alg_ = hash_alg;
+  authInfo.newNonce_.size = hash_size;
+  authInfo.oldNonce_.size = hash_size;
+  RAND_bytes(authInfo.newNonce_.buffer, hash_size);
+  RAND_bytes(authInfo.oldNonce_.buffer, hash_size);
+  authInfo.targetAuthValue_.size = 4;
+  memset(authInfo.targetAuthValue_.buffer, 1, 4);
+  authInfo.tpmSessionAttributes_ = CONTINUESESSION;
+
+  TPM2B_DIGEST salt;
+  salt.size = hash_size;
+  RAND_bytes(salt.buffer, salt.size);
+
+  string key((const char*)salt.buffer, salt.size);
+  string label("ATH");
+  string contextU((const char*)authInfo.newNonce_.buffer, hash_size);
+  string contextV((const char*)authInfo.oldNonce_.buffer, hash_size);
+  byte out[128];
+
+  if (!CheckKDFa(hash_alg, key, contextU, contextV))
+    return 1;
+  printf("KDFa output matches the rekeyed loop\n\n");
+
+  printf("Session key derivation, %s, %d iterations\n",
+         FLAGS_hash_alg.c_str(), n);
+
+  // 512 bits: two counter iterations with SHA-256, four with SHA-1.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < n; i++)
+    RekeyedKDFa(hash_alg, key, label, contextU, contextV, 512, out);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  Report("KDFa, rekeyed per iteration", n, start, stop);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < n; i++)
+    KDFa(hash_alg, key, label, contextU, contextV, 512, sizeof(out), out);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  Report("KDFa, same key each call", n, start, stop);
+
+  // KDFa only skips keying when the key is that of its previous call.
+  string other_key(key);
+  other_key[0] ^= 1;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < n; i++)
+    KDFa(hash_alg, (i & 1) ? other_key : key, label, contextU, contextV,
+         512, sizeof(out), out);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  Report("KDFa, new key each call", n, start, stop);
+
+  HmacKdf kdf;
+  kdf.SetKey(hash_alg, salt.size, salt.buffer);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < n; i++)
+    kdf.KDFa(label, hash_size, authInfo.newNonce_.buffer,
+             hash_size, authInfo.oldNonce_.buffer, 512, sizeof(out), out);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  Report("HmacKdf, keyed once", n, start, stop);
+
+  // The salt is the same every time, so this is the best case; a new
+  // session has a new salt and pays for keying once.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < n; i++)
+    CalculateSessionKey(authInfo, salt);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  Report("CalculateSessionKey", n, start, stop);
+
+  TPM2B_NAME names[2];
+  for (int i = 0; i < 2; i++) {
+    names[i].size = hash_size + sizeof(uint16_t);
+    RAND_bytes(names[i].name, names[i].size);
+  }
+  byte parms[4] = {0, 8, 0, 0};
+  int size_hmac = 0;
+  // The session's HMAC context is keyed by the first call only.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < n; i++)
+    CalculateSessionHmac(authInfo, false, TPM_CC_NV_Read, 2, names,
+                         sizeof(parms), parms, &size_hmac, out);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  Report("CalculateSessionHmac", n, start, stop);
+  return 0;
+}
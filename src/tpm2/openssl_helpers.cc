@@ -21,6 +21,8 @@
 #include <openssl/aes.h>
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
 
 #include <string>
 using std::string;
@@ -365,53 +367,130 @@ void XorBlocks(int size, byte* in1, byte* in2, byte* out) {
     out[i] = in1[i] ^ in2[i];
 }
 
-bool KDFa(uint16_t hashAlg, string& key, string& label, string& contextU,
-          string& contextV, int bits, int out_size, byte* out) {
-  HMAC_CTX ctx;
-  uint32_t len = 32;
+HmacKdf::HmacKdf() {
+  HMAC_CTX_init(&ctx_);
+  keyed_ = false;
+  md_ = nullptr;
+  hash_size_ = 0;
+}
+
+HmacKdf::~HmacKdf() {
+  ClearKey();
+  HMAC_CTX_cleanup(&ctx_);
+}
+
+void HmacKdf::ClearKey() {
+  if (key_.size() > 0)
+    OPENSSL_cleanse(&key_[0], key_.size());
+  key_.clear();
+  keyed_ = false;
+}
+
+void HmacKdf::Clear() {
+  ClearKey();
+  HMAC_CTX_cleanup(&ctx_);
+  HMAC_CTX_init(&ctx_);
+}
+
+bool HmacKdf::SetKey(uint16_t hashAlg, int key_size, byte* key) {
+  const EVP_MD* md;
+
+  if (hashAlg == TPM_ALG_SHA1) {
+    md = EVP_sha1();
+  } else if (hashAlg == TPM_ALG_SHA256) {
+    md = EVP_sha256();
+  } else {
+    return false;
+  }
+  if (keyed_ && md == md_ && (int)key_.size() == key_size &&
+      memcmp(key_.data(), key, key_size) == 0)
+    return true;
+  ClearKey();
+  md_ = md;
+  hash_size_ = SizeHash(hashAlg);
+  if (HMAC_Init_ex(&ctx_, key, key_size, md_, nullptr) != 1)
+    return false;
+  key_.assign((const char*)key, key_size);
+  keyed_ = true;
+  return true;
+}
+
+bool HmacKdf::Hmac(int num_bufs, int* sizes, byte** bufs, byte* out) {
+  unsigned len = 0;
+
+  if (!keyed_)
+    return false;
+  // A null key restarts from the saved pad states.
+  if (HMAC_Init_ex(&ctx_, nullptr, 0, nullptr, nullptr) != 1)
+    return false;
+  for (int i = 0; i < num_bufs; i++) {
+    if (sizes[i] > 0)
+      HMAC_Update(&ctx_, bufs[i], sizes[i]);
+  }
+  return HMAC_Final(&ctx_, out, &len) == 1;
+}
+
+// KDFa(key, label, contextU, contextV, bits): HMAC over
+//   counter || label || 0 || contextU || contextV || bits
+// for counter = 1, 2, ... until bits of output are produced.
+bool HmacKdf::KDFa(const string& label, int size_contextU, byte* contextU,
+                   int size_contextV, byte* contextV, int bits,
+                   int out_size, byte* out) {
   uint32_t counter = 0;
+  byte b_counter[sizeof(uint32_t)];
+  byte b_bits[sizeof(uint32_t)];
+  byte block[64];
   int bytes_left = (bits + 7) / 8;
-  byte* current_out = out;
-  int size_buf = 0;
-  byte buf[MAX_SIZE_PARAMS];
-  int n;
-
-  memset(buf, 0, 128);
-  ChangeEndian32(&counter, (uint32_t*)&buf[size_buf]);
-  size_buf += sizeof(uint32_t);
-  n = strlen(label.c_str()) + 1;
-  if ((size_buf + n) > MAX_SIZE_PARAMS) return false;
-  memcpy(&buf[size_buf], label.data(), n);
-  size_buf += n;
-  if ((size_buf + contextU.size()) > MAX_SIZE_PARAMS) return false;
-  memcpy(&buf[size_buf], contextU.data(), contextU.size());
-  size_buf += contextU.size();
-  if ((size_buf + contextV.size()) > MAX_SIZE_PARAMS) return false;
-  memcpy(&buf[size_buf], contextV.data(), contextV.size());
-  size_buf += contextV.size();
-  if ((size_buf + sizeof(uint32_t)) > MAX_SIZE_PARAMS) return false;
-  ChangeEndian32((uint32_t*)&bits, (uint32_t*)&buf[size_buf]);
-  size_buf += sizeof(uint32_t);
 
+  if (bytes_left > out_size)
+    return false;
+  ChangeEndian32((uint32_t*)&bits, (uint32_t*)b_bits);
+
+  int sizes[5] = {
+    (int)sizeof(uint32_t), (int)strlen(label.c_str()) + 1,
+    size_contextU, size_contextV, (int)sizeof(uint32_t)
+  };
+  byte* bufs[5] = {
+    b_counter, (byte*)label.c_str(), contextU, contextV, b_bits
+  };
   while (bytes_left > 0) {
     counter++;
-    ChangeEndian32(&counter, (uint32_t*)buf);
-
-    HMAC_CTX_init(&ctx);
-    if (hashAlg == TPM_ALG_SHA1 ) {
-      HMAC_Init_ex(&ctx, key.data(), key.size(), EVP_sha1(), nullptr);
+    ChangeEndian32(&counter, (uint32_t*)b_counter);
+    if (bytes_left >= hash_size_) {
+      if (!Hmac(5, sizes, bufs, out))
+        return false;
+      out += hash_size_;
+      bytes_left -= hash_size_;
     } else {
-      HMAC_Init_ex(&ctx, key.data(), key.size(), EVP_sha256(), nullptr);
+      if (!Hmac(5, sizes, bufs, block))
+        return false;
+      memcpy(out, block, bytes_left);
+      bytes_left = 0;
     }
-    HMAC_Update(&ctx, buf, size_buf);
-    HMAC_Final(&ctx, current_out, &len);
-    HMAC_CTX_cleanup(&ctx);
-    current_out += len;
-    bytes_left -= len;
   }
   return true;
 }
 
+// Each thread keeps its context, so derivations from the key of the
+// previous call, as of the symmetric and HMAC keys from one seed, skip
+// keying.  The key stays there until ClearKDFaKey or the next key.
+static thread_local HmacKdf kdfa_context;
+
+bool KDFa(uint16_t hashAlg, string& key, string& label, string& contextU,
+          string& contextV, int bits, int out_size, byte* out) {
+  HmacKdf& kdf = kdfa_context;
+
+  if (!kdf.SetKey(hashAlg, key.size(), (byte*)key.data()))
+    return false;
+  return kdf.KDFa(label, contextU.size(), (byte*)contextU.data(),
+                  contextV.size(), (byte*)contextV.data(),
+                  bits, out_size, out);
+}
+
+void ClearKDFaKey() {
+  kdfa_context.Clear();
+}
+
 bool AesCtrCrypt(int key_size_bits, byte* key, int size,
                  byte* in, byte* out) {
   AES_KEY ectx;
@@ -512,3 +591,39 @@ int SizeHash(TPM_ALG_ID hash) {
     return -1;
   }
 }
+
+static pthread_mutex_t* openssl_locks = nullptr;
+
+static void OpenSSLLockingCallback(int mode, int n, const char* file,
+                                   int line) {
+  if (mode & CRYPTO_LOCK)
+    pthread_mutex_lock(&openssl_locks[n]);
+  else
+    pthread_mutex_unlock(&openssl_locks[n]);
+}
+
+static void OpenSSLThreadIdCallback(CRYPTO_THREADID* id) {
+  CRYPTO_THREADID_set_numeric(id, (unsigned long)pthread_self());
+}
+
+void InitOpenSSLThreading() {
+  if (openssl_locks != nullptr)
+    return;
+  int num_locks = CRYPTO_num_locks();
+  openssl_locks = new pthread_mutex_t[num_locks];
+  for (int i = 0; i < num_locks; i++)
+    pthread_mutex_init(&openssl_locks[i], nullptr);
+  CRYPTO_THREADID_set_callback(OpenSSLThreadIdCallback);
+  CRYPTO_set_locking_callback(OpenSSLLockingCallback);
+}
+
+void CleanupOpenSSLThreading() {
+  if (openssl_locks == nullptr)
+    return;
+  CRYPTO_set_locking_callback(nullptr);
+  CRYPTO_THREADID_set_callback(nullptr);
+  for (int i = 0; i < CRYPTO_num_locks(); i++)
+    pthread_mutex_destroy(&openssl_locks[i]);
+  delete []openssl_locks;
+  openssl_locks = nullptr;
+}
@@ -35,6 +35,7 @@
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <openssl/hmac.h>
 
 #include <string>
 using std::string;
@@ -70,10 +71,48 @@ bool AesCtrCrypt(int key_size_bits, byte* key, int size,
                  byte* in, byte* out);
 bool KDFa(uint16_t hashAlg, string& key, string& label, string& contextU,
           string& contextV, int bits, int out_size, byte* out);
+// Wipes the key the calling thread's KDFa context holds.
+void ClearKDFaKey();
+
+// HMAC context that is keyed once and reused.  SetKey hashes the inner
+// and outer key pads, unless the context already holds that key; every
+// later Hmac or KDFa iteration restarts from those saved states instead
+// of rekeying.
+class HmacKdf {
+private:
+  HMAC_CTX ctx_;
+  bool keyed_;
+  const EVP_MD* md_;
+  int hash_size_;
+  string key_;
+
+  HmacKdf(const HmacKdf&);
+  HmacKdf& operator=(const HmacKdf&);
+  void ClearKey();
+
+public:
+  HmacKdf();
+  ~HmacKdf();
+
+  bool SetKey(uint16_t hashAlg, int key_size, byte* key);
+  // Wipes the key and the pad states derived from it.
+  void Clear();
+  int HashSize() { return hash_size_; }
+  // HMAC over the concatenation of num_bufs buffers.
+  bool Hmac(int num_bufs, int* sizes, byte** bufs, byte* out);
+  bool KDFa(const string& label, int size_contextU, byte* contextU,
+            int size_contextV, byte* contextV, int bits, int out_size,
+            byte* out);
+};
 bool AesCFBEncrypt(byte* key, int in_size, byte* in, int iv_size, byte* iv,
                    int* out_size, byte* out);
 bool AesCFBDecrypt(byte* key, int in_size, byte* in, int iv_size, byte* iv,
                    int* out_size, byte* out);
 int SizeHash(TPM_ALG_ID hash);
+
+// OpenSSL 1.0 needs locking callbacks before it is used from more than
+// one thread.
+void InitOpenSSLThreading();
+void CleanupOpenSSLThreading();
 #endif
 
@@ -32,8 +32,11 @@
 #include <tpm2.pb.h>
 #include <openssl/sha.h>
 #include <openssl_helpers.h>
+#include <quote_protocol.h>
 
 #include <string>
+#include <thread>
+#include <vector>
 #define DEBUG
 
 void print_quote_certifyinfo(TPMS_ATTEST& in) {
@@ -159,3 +162,221 @@ bool ComputeQuotedValue(TPM_ALG_ID alg, int credInfo_size, byte* credInfo,
 }
 
 
+
+// magic constant for tpm generated
+#define TpmMagicConstant 0xff544347
+
+// bounds on the entries QuoteVerifier keeps
+#define MaxCachedQuoteKeys 1024
+#define MaxCachedEndorsementCerts 1024
+
+QuoteVerifier::CachedKey::~CachedKey() {
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < (int)free_ctxs[i].size(); j++)
+      EVP_PKEY_CTX_free(free_ctxs[i][j]);
+  }
+  if (key != nullptr)
+    EVP_PKEY_free(key);
+}
+
+QuoteVerifier::QuoteVerifier() {
+  key_cache_hits_ = 0ULL;
+  key_cache_misses_ = 0ULL;
+}
+
+// Returns the key cached under name if it has key's modulus and
+// exponent or, if not, a new uncached one.  *cached tells which.
+std::shared_ptr<QuoteVerifier::CachedKey> QuoteVerifier::GetQuoteKey(
+        const string& name, const rsa_public_key_message& key,
+        bool* cached) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<string, std::shared_ptr<CachedKey>>::iterator it =
+        quote_keys_.find(name);
+    if (it != quote_keys_.end() && it->second->modulus == key.modulus() &&
+        it->second->exponent == key.exponent()) {
+      key_cache_hits_++;
+      *cached = true;
+      return it->second;
+    }
+    key_cache_misses_++;
+  }
+  *cached = false;
+
+  RSA* rsa = RSA_new();
+  rsa->n = bin_to_BN(key.modulus().size(), (byte*)key.modulus().data());
+  rsa->e = bin_to_BN(key.exponent().size(), (byte*)key.exponent().data());
+  if (rsa->n == nullptr || rsa->e == nullptr) {
+    RSA_free(rsa);
+    return nullptr;
+  }
+  std::shared_ptr<CachedKey> new_key(new CachedKey);
+  new_key->modulus = key.modulus();
+  new_key->exponent = key.exponent();
+  new_key->key = EVP_PKEY_new();
+  EVP_PKEY_assign_RSA(new_key->key, rsa);
+  return new_key;
+}
+
+// Called once a quote has verified with cached_key; it replaces any key
+// cached under name.  Entries still in use when dropped are freed by
+// their last user.
+void QuoteVerifier::CacheQuoteKey(const string& name,
+                                  std::shared_ptr<CachedKey> cached_key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<string, std::shared_ptr<CachedKey>>::iterator it =
+      quote_keys_.find(name);
+  if (it != quote_keys_.end()) {
+    it->second = cached_key;
+    return;
+  }
+  if (quote_keys_.size() >= MaxCachedQuoteKeys) {
+    quote_keys_.erase(quote_key_order_.front());
+    quote_key_order_.pop_front();
+  }
+  quote_keys_[name] = cached_key;
+  quote_key_order_.push_back(name);
+}
+
+EVP_PKEY_CTX* QuoteVerifier::GetVerifyContext(CachedKey* key,
+                                              TPM_ALG_ID hash_alg) {
+  int i = hash_alg == TPM_ALG_SHA1 ? 0 : 1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (key->free_ctxs[i].size() > 0) {
+      EVP_PKEY_CTX* ctx = key->free_ctxs[i].back();
+      key->free_ctxs[i].pop_back();
+      return ctx;
+    }
+  }
+  EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(key->key, nullptr);
+  if (ctx == nullptr)
+    return nullptr;
+  if (EVP_PKEY_verify_init(ctx) <= 0 ||
+      EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0 ||
+      EVP_PKEY_CTX_set_signature_md(ctx, hash_alg == TPM_ALG_SHA1 ?
+                                    EVP_sha1() : EVP_sha256()) <= 0) {
+    EVP_PKEY_CTX_free(ctx);
+    return nullptr;
+  }
+  return ctx;
+}
+
+void QuoteVerifier::ReturnVerifyContext(CachedKey* key, TPM_ALG_ID hash_alg,
+                                        EVP_PKEY_CTX* ctx) {
+  int i = hash_alg == TPM_ALG_SHA1 ? 0 : 1;
+  std::lock_guard<std::mutex> lock(mutex_);
+  key->free_ctxs[i].push_back(ctx);
+}
+
+bool QuoteVerifier::VerifyEndorsementCert(int size_cert, byte* der_cert,
+                                          EVP_PKEY* policy_key) {
+  byte digests[2 * SHA256_DIGEST_LENGTH];
+  byte* der_policy_key = nullptr;
+  int size_policy_key = i2d_PUBKEY(policy_key, &der_policy_key);
+  if (size_policy_key <= 0)
+    return false;
+  SHA256(der_policy_key, size_policy_key, digests);
+  OPENSSL_free(der_policy_key);
+  SHA256(der_cert, size_cert, &digests[SHA256_DIGEST_LENGTH]);
+  string id((const char*)digests, sizeof(digests));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (endorsement_certs_.find(id) != endorsement_certs_.end())
+      return true;
+  }
+
+  const byte* p_byte = der_cert;
+  X509* cert = d2i_X509(nullptr, &p_byte, size_cert);
+  if (cert == nullptr)
+    return false;
+  bool ok = X509_verify(cert, policy_key) > 0;
+  X509_free(cert);
+  if (ok) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (endorsement_certs_.find(id) == endorsement_certs_.end()) {
+      if (endorsement_certs_.size() >= MaxCachedEndorsementCerts) {
+        endorsement_certs_.erase(endorsement_cert_order_.front());
+        endorsement_cert_order_.pop_front();
+      }
+      endorsement_certs_.insert(id);
+      endorsement_cert_order_.push_back(id);
+    }
+  }
+  return ok;
+}
+
+bool QuoteVerifier::VerifyQuote(TPM_ALG_ID hash_alg,
+                                const string& quote_key_name,
+                                const rsa_public_key_message& quote_key,
+                                int quote_size, byte* quote,
+                                int sig_size, byte* sig,
+                                TPMS_ATTEST* attest) {
+  const EVP_MD* md;
+  byte quote_hash[EVP_MAX_MD_SIZE];
+  unsigned size_quote_hash = 0;
+
+  if (hash_alg == TPM_ALG_SHA1) {
+    md = EVP_sha1();
+  } else if (hash_alg == TPM_ALG_SHA256) {
+    md = EVP_sha256();
+  } else {
+    printf("unsupported hash alg\n");
+    return false;
+  }
+  if (!UnmarshalCertifyInfo(quote_size, quote, attest)) {
+    printf("Invalid attested structure\n");
+    return false;
+  }
+  if (attest->magic != TpmMagicConstant) {
+    printf("Invalid magic number\n");
+    return false;
+  }
+  if (EVP_Digest(quote, quote_size, quote_hash, &size_quote_hash,
+                 md, nullptr) != 1)
+    return false;
+
+  bool cached;
+  std::shared_ptr<CachedKey> key = GetQuoteKey(quote_key_name, quote_key,
+                                               &cached);
+  if (key == nullptr)
+    return false;
+  EVP_PKEY_CTX* ctx = GetVerifyContext(key.get(), hash_alg);
+  if (ctx == nullptr)
+    return false;
+  bool ok = EVP_PKEY_verify(ctx, sig, sig_size, quote_hash,
+                            size_quote_hash) == 1;
+  ReturnVerifyContext(key.get(), hash_alg, ctx);
+  if (ok && !cached)
+    CacheQuoteKey(quote_key_name, key);
+  return ok;
+}
+
+static void VerifyQuotesWorker(QuoteVerifier* verifier, int num_quotes,
+                               QuoteToVerify* quotes, int start, int stride) {
+  for (int i = start; i < num_quotes; i += stride) {
+    QuoteToVerify& q = quotes[i];
+    q.verified = verifier->VerifyQuote(q.hash_alg, q.quote_key_name,
+                                       *q.quote_key, q.quote_size, q.quote,
+                                       q.sig_size, q.sig, &q.attest);
+  }
+}
+
+// OpenSSL locking must be set up (InitOpenSSLThreading) before calling
+// this with num_threads > 1.
+void QuoteVerifier::VerifyQuotes(int num_quotes, QuoteToVerify* quotes,
+                                 int num_threads) {
+  if (num_threads <= 1 || num_quotes <= 1) {
+    VerifyQuotesWorker(this, num_quotes, quotes, 0, 1);
+    return;
+  }
+  if (num_threads > num_quotes)
+    num_threads = num_quotes;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.push_back(std::thread(VerifyQuotesWorker, this, num_quotes,
+                                  quotes, i, num_threads));
+  }
+  for (int i = 0; i < num_threads; i++)
+    workers[i].join();
+}
@@ -32,10 +32,19 @@
 #include <errno.h>
 
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
 
 #include <tpm2.pb.h>
 
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 using std::string;
 
 void print_quote_certifyinfo(TPMS_ATTEST& in);
@@ -45,5 +54,70 @@ bool ProtoToCertifyInfo(quote_certification_information& message, TPMS_ATTEST* o
 bool CertifyInfoToProto(TPMS_ATTEST& in, quote_certification_information& message);
 bool ComputeQuotedValue(TPM_ALG_ID alg, int credInfo_size, byte* credInfo,
                         int* size_quoted, byte* quoted);
+
+// A quote to check and, after QuoteVerifier::VerifyQuotes, its result.
+struct QuoteToVerify {
+  TPM_ALG_ID hash_alg;
+  string quote_key_name;
+  const rsa_public_key_message* quote_key;
+  int quote_size;
+  byte* quote;
+  int sig_size;
+  byte* sig;
+  TPMS_ATTEST attest;
+  bool verified;
+};
+
+// Verifies quotes and endorsement certs for an attestation server.
+// Quote (AIK) keys are cached by TPM name together with EVP_PKEY_CTXs
+// already initialized for PKCS#1 v1.5 verification.  A key is only
+// cached once a quote has verified with it, and a cached key is only
+// used for a quote that presents the same modulus and exponent; any
+// other key is checked uncached and, if its quote verifies, replaces
+// the cached one.  Endorsement certs are cached, once verified, by the
+// SHA-256 of their DER encoding and that of the policy key.  Both
+// caches hold at most a fixed number of entries, the oldest being
+// dropped first.  All methods are thread safe.
+class QuoteVerifier {
+private:
+  struct CachedKey {
+    string modulus;
+    string exponent;
+    EVP_PKEY* key;
+    std::vector<EVP_PKEY_CTX*> free_ctxs[2];
+    CachedKey() : key(nullptr) {}
+    ~CachedKey();
+  };
+
+  std::mutex mutex_;
+  std::map<string, std::shared_ptr<CachedKey>> quote_keys_;
+  std::list<string> quote_key_order_;
+  std::set<string> endorsement_certs_;
+  std::list<string> endorsement_cert_order_;
+
+  std::shared_ptr<CachedKey> GetQuoteKey(const string& name,
+                                         const rsa_public_key_message& key,
+                                         bool* cached);
+  void CacheQuoteKey(const string& name,
+                     std::shared_ptr<CachedKey> cached_key);
+  EVP_PKEY_CTX* GetVerifyContext(CachedKey* key, TPM_ALG_ID hash_alg);
+  void ReturnVerifyContext(CachedKey* key, TPM_ALG_ID hash_alg,
+                           EVP_PKEY_CTX* ctx);
+
+public:
+  uint64_t key_cache_hits_;
+  uint64_t key_cache_misses_;
+
+  QuoteVerifier();
+
+  bool VerifyEndorsementCert(int size_cert, byte* der_cert,
+                             EVP_PKEY* policy_key);
+  // Checks the quote's magic number and signature and fills in attest.
+  bool VerifyQuote(TPM_ALG_ID hash_alg, const string& quote_key_name,
+                   const rsa_public_key_message& quote_key,
+                   int quote_size, byte* quote, int sig_size, byte* sig,
+                   TPMS_ATTEST* attest);
+  void VerifyQuotes(int num_quotes, QuoteToVerify* quotes, int num_threads);
+};
 #endif
 
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tpm2_lib.h>
+
+#include <openssl/bn.h>
+#include <openssl/objects.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/sha.h>
+#include <openssl_helpers.h>
+#include <quote_protocol.h>
+
+#include <string>
+using std::string;
+
+//
+// Copyright 2015 Google Corporation, All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// or in the the file LICENSE-2.0.txt in the top level sourcedirectory
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License
+//
+// File: quotetest.cc
+
+// Checks QuoteVerifier on quotes signed with software RSA keys: a batch
+// verified on several threads, bad signatures and magic numbers, and
+// that the key cache only holds keys a quote has verified with.
+// Calling sequence: quotetest.exe
+
+#define NUM_KEYS 4
+#define NUM_QUOTES 64
+#define NUM_THREADS 4
+#define MAX_QUOTE_SIZE 256
+#define MAX_SIG_SIZE 256
+#define TpmMagicConstant 0xff544347
+
+int num_failed = 0;
+
+void Check(bool ok, const char* what) {
+  printf("  %-48s %s\n", what, ok ? "passed" : "FAILED");
+  if (!ok)
+    num_failed++;
+}
+
+// A TPMS_ATTEST for a quote of one PCR bank, marshaled as the tpm does.
+int MakeQuote(uint32_t magic, int size_extra, byte* extra, byte* out) {
+  byte* p = out;
+  uint16_t type = TPM_ST_ATTEST_QUOTE;
+  uint16_t size16;
+  uint32_t count = 1;
+  uint16_t hash = TPM_ALG_SHA256;
+  uint64_t zero = 0ULL;
+
+  ChangeEndian32(&magic, (uint32_t*)p);
+  p += sizeof(uint32_t);
+  ChangeEndian16(&type, (uint16_t*)p);
+  p += sizeof(uint16_t);
+  size16 = 0;
+  ChangeEndian16(&size16, (uint16_t*)p);
+  p += sizeof(uint16_t);
+  size16 = size_extra;
+  ChangeEndian16(&size16, (uint16_t*)p);
+  p += sizeof(uint16_t);
+  memcpy(p, extra, size_extra);
+  p += size_extra;
+  // clock, resetCount, restartCount, safe and firmwareVersion
+  memset(p, 0, 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + 1);
+  p += 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + 1;
+  ChangeEndian32(&count, (uint32_t*)p);
+  p += sizeof(uint32_t);
+  ChangeEndian16(&hash, (uint16_t*)p);
+  p += sizeof(uint16_t);
+  *(p++) = 3;
+  *(p++) = 0x80;
+  *(p++) = 0;
+  *(p++) = 0;
+  size16 = SHA256_DIGEST_LENGTH;
+  ChangeEndian16(&size16, (uint16_t*)p);
+  p += sizeof(uint16_t);
+  SHA256((byte*)&zero, sizeof(zero), p);
+  p += SHA256_DIGEST_LENGTH;
+  return p - out;
+}
+
+bool SignQuote(RSA* key, int quote_size, byte* quote, int* sig_size,
+               byte* sig) {
+  byte digest[SHA256_DIGEST_LENGTH];
+  unsigned size = 0;
+
+  SHA256(quote, quote_size, digest);
+  if (RSA_sign(NID_sha256, digest, SHA256_DIGEST_LENGTH, sig, &size,
+               key) != 1)
+    return false;
+  *sig_size = size;
+  return true;
+}
+
+void PublicKey(RSA* key, rsa_public_key_message* message) {
+  byte buf[512];
+  int n;
+
+  n = BN_bn2bin(key->n, buf);
+  message->set_modulus(buf, n);
+  n = BN_bn2bin(key->e, buf);
+  message->set_exponent(buf, n);
+  message->set_bit_modulus_size(8 * RSA_size(key));
+}
+
+struct TestQuote {
+  byte quote[MAX_QUOTE_SIZE];
+  byte sig[MAX_SIG_SIZE];
+};
+
+int main(int an, char** av) {
+  RSA* keys[NUM_KEYS + 1];
+  rsa_public_key_message public_keys[NUM_KEYS + 1];
+  string names[NUM_KEYS];
+  TestQuote test_quotes[NUM_QUOTES];
+  QuoteToVerify quotes[NUM_QUOTES];
+  byte extra[SHA256_DIGEST_LENGTH];
+
+  printf("QuoteVerifier tests\n");
+  for (int i = 0; i <= NUM_KEYS; i++) {
+    BIGNUM* e = BN_new();
+    BN_set_word(e, RSA_F4);
+    keys[i] = RSA_new();
+    if (RSA_generate_key_ex(keys[i], 2048, e, nullptr) != 1) {
+      printf("Can't generate key\n");
+      return 1;
+    }
+    BN_free(e);
+    PublicKey(keys[i], &public_keys[i]);
+  }
+  for (int i = 0; i < NUM_KEYS; i++)
+    names[i] = "quote-key-" + std::to_string(i);
+
+  InitOpenSSLThreading();
+
+  // A batch on several threads; every key is used by several quotes.
+  for (int i = 0; i < NUM_QUOTES; i++) {
+    int k = i % NUM_KEYS;
+    RAND_bytes(extra, sizeof(extra));
+    quotes[i].hash_alg = TPM_ALG_SHA256;
+    quotes[i].quote_key_name = names[k];
+    quotes[i].quote_key = &public_keys[k];
+    quotes[i].quote = test_quotes[i].quote;
+    quotes[i].quote_size = MakeQuote(TpmMagicConstant, sizeof(extra),
+                                     extra, quotes[i].quote);
+    quotes[i].sig = test_quotes[i].sig;
+    if (!SignQuote(keys[k], quotes[i].quote_size, quotes[i].quote,
+                   &quotes[i].sig_size, quotes[i].sig)) {
+      printf("Can't sign quote\n");
+      return 1;
+    }
+    quotes[i].verified = false;
+  }
+  // Two quotes are damaged: a bad signature, and a bad magic number
+  // under a good signature.
+  quotes[1].sig[10] ^= 1;
+  quotes[3].quote[0] ^= 1;
+  SignQuote(keys[3], quotes[3].quote_size, quotes[3].quote,
+            &quotes[3].sig_size, quotes[3].sig);
+
+  QuoteVerifier verifier;
+  verifier.VerifyQuotes(NUM_QUOTES, quotes, NUM_THREADS);
+  bool ok = true;
+  for (int i = 0; i < NUM_QUOTES; i++) {
+    if (quotes[i].verified != (i != 1 && i != 3))
+      ok = false;
+  }
+  Check(ok, "batch verified on threads");
+  Check(quotes[0].attest.extraData.size == SHA256_DIGEST_LENGTH,
+        "attest filled in");
+  Check(verifier.key_cache_hits_ + verifier.key_cache_misses_ ==
+        NUM_QUOTES, "every quote looked up its key");
+  Check(verifier.key_cache_hits_ > 0, "keys reused across the batch");
+
+  // A quote signed with another key under a cached name verifies
+  // against the key it presents, and doesn't use the cached key.
+  QuoteVerifier single;
+  TPMS_ATTEST attest;
+  QuoteToVerify& q = quotes[0];
+  Check(single.VerifyQuote(q.hash_alg, names[0], public_keys[0],
+                           q.quote_size, q.quote, q.sig_size, q.sig,
+                           &attest), "quote verifies");
+  Check(single.VerifyQuote(q.hash_alg, names[0], public_keys[0],
+                           q.quote_size, q.quote, q.sig_size, q.sig,
+                           &attest) && single.key_cache_hits_ == 1,
+        "verified key cached");
+  TestQuote other;
+  int other_size = MakeQuote(TpmMagicConstant, sizeof(extra), extra,
+                             other.quote);
+  int other_sig_size = 0;
+  SignQuote(keys[NUM_KEYS], other_size, other.quote, &other_sig_size,
+            other.sig);
+  Check(!single.VerifyQuote(TPM_ALG_SHA256, names[0], public_keys[0],
+                            other_size, other.quote, other_sig_size,
+                            other.sig, &attest),
+        "cached key rejects other signer");
+  uint64_t hits = single.key_cache_hits_;
+  Check(single.VerifyQuote(TPM_ALG_SHA256, names[0], public_keys[NUM_KEYS],
+                           other_size, other.quote, other_sig_size,
+                           other.sig, &attest) &&
+        single.key_cache_hits_ == hits, "other key checked uncached");
+
+  // A key whose quote fails is not cached.
+  uint64_t misses = single.key_cache_misses_;
+  Check(!single.VerifyQuote(q.hash_alg, names[1], public_keys[1],
+                            q.quote_size, q.quote, q.sig_size, q.sig,
+                            &attest), "wrong key rejected");
+  Check(!single.VerifyQuote(q.hash_alg, names[1], public_keys[1],
+                            q.quote_size, q.quote, q.sig_size, q.sig,
+                            &attest) &&
+        single.key_cache_misses_ == misses + 2, "rejected key not cached");
+
+  CleanupOpenSSLThreading();
+  for (int i = 0; i <= NUM_KEYS; i++)
+    RSA_free(keys[i]);
+  if (num_failed != 0) {
+    printf("%d checks FAILED\n", num_failed);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -36,8 +36,11 @@ S= $(SRC_DIR)/src/github.com/jlmucb/cloudproxy/src/tpm2
 O= $(OBJ_DIR)/tpm20
 INCLUDE= -I$(S) -I$(SRC_DIR)/keys -I/usr/local/include -I$(GOOGLE_INCLUDE)
 
-CFLAGS=$(INCLUDE) -O3 -g -Wall -std=c++11 -Wno-strict-aliasing -Wno-deprecated # -DGFLAGS_NS=google
-CFLAGS1=$(INCLUDE) -O1 -g -Wall -std=c++11
+CFLAGS=$(INCLUDE) -O3 -g -Wall -std=c++11 -Wno-strict-aliasing -Wno-deprecated $(TRACE_FLAGS) # -DGFLAGS_NS=google
+CFLAGS1=$(INCLUDE) -O1 -g -Wall -std=c++11 $(TRACE_FLAGS)
+
+# make -f tpm2.mak TRACE_FLAGS=-DTPM2_TRACE to trace tpm commands.
+TRACE_FLAGS=
 
 CC=g++
 LINK=g++
@@ -110,6 +113,17 @@ dobj_PadTest =	$(O)/tpm2_lib.o \
   $(O)/quote_protocol.o \
   $(O)/openssl_helpers.o \
   $(O)/padtest.o
+dobj_KdfBenchmark =	$(O)/tpm2_lib.o \
+  $(O)/tpm2.pb.o \
+  $(O)/conversions.o \
+  $(O)/openssl_helpers.o \
+  $(O)/kdfbenchmark.o
+dobj_QuoteTest =	$(O)/tpm2_lib.o \
+  $(O)/tpm2.pb.o \
+  $(O)/conversions.o \
+  $(O)/quote_protocol.o \
+  $(O)/openssl_helpers.o \
+  $(O)/quotetest.o
 
 all:	$(EXE_DIR)/tpm2_util.exe \
 	$(EXE_DIR)/GeneratePolicyKey.exe \
@@ -123,7 +137,9 @@ all:	$(EXE_DIR)/tpm2_util.exe \
 	$(EXE_DIR)/ClientGenerateProgramKeyRequest.exe \
 	$(EXE_DIR)/ServerSignProgramKeyRequest.exe \
 	$(EXE_DIR)/ClientGetProgramKeyCert.exe \
-	$(EXE_DIR)/padtest.exe
+	$(EXE_DIR)/padtest.exe \
+	$(EXE_DIR)/kdfbenchmark.exe \
+	$(EXE_DIR)/quotetest.exe
 
 clean:
 	@echo "removing object files"
@@ -262,4 +278,18 @@ $(EXE_DIR)/padtest.exe: $(dobj_PadTest)
 	@echo "linking padtest"
 	$(LINK) -o $(EXE_DIR)/padtest.exe $(dobj_PadTest) $(LDFLAGS)
 
+$(O)/kdfbenchmark.o: $(S)/kdfbenchmark.cc
+	@echo "compiling kdfbenchmark.cc"
+	$(CC) $(CFLAGS) -c -o $(O)/kdfbenchmark.o $(S)/kdfbenchmark.cc
+
+$(EXE_DIR)/kdfbenchmark.exe: $(dobj_KdfBenchmark)
+	@echo "linking kdfbenchmark"
+	$(LINK) -o $(EXE_DIR)/kdfbenchmark.exe $(dobj_KdfBenchmark) $(LDFLAGS)
+
+$(O)/quotetest.o: $(S)/quotetest.cc
+	@echo "compiling quotetest.cc"
+	$(CC) $(CFLAGS) -c -o $(O)/quotetest.o $(S)/quotetest.cc
 
+$(EXE_DIR)/quotetest.exe: $(dobj_QuoteTest)
+	@echo "linking quotetest"
+	$(LINK) -o $(EXE_DIR)/quotetest.exe $(dobj_QuoteTest) $(LDFLAGS)
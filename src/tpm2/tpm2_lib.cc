@@ -8,6 +8,7 @@
 #include <tpm20.h>
 #include <tpm2_lib.h>
 #include <errno.h>
+#include <time.h>
 #include <conversions.h>
 
 #include <openssl/aes.h>
@@ -116,6 +117,11 @@ bool WriteFileFromBlock(const string& filename, int size, byte* block) {
   return n > 0;
 }
 
+double ElapsedSeconds(struct timespec& start, struct timespec& stop) {
+  return (double)(stop.tv_sec - start.tv_sec) +
+         ((double)(stop.tv_nsec - start.tv_nsec)) / 1000000000.0;
+}
+
 // Debug routines
 void printCommand(const char* name, int size, byte* buf) {
   printf("\n");
@@ -145,10 +151,18 @@ void Update(int size, byte** ptr_buf, int* out_size, int* space_left) {
 
 LocalTpm::LocalTpm() {
   tpm_fd_ = -1;
+#ifdef TPM2_TRACE
+  trace_ = new TpmTrace;
+#else
+  trace_ = nullptr;
+#endif
 }
 
 LocalTpm::~LocalTpm() {
   tpm_fd_ = -1;
+#ifdef TPM2_TRACE
+  delete trace_;
+#endif
 }
 
 bool LocalTpm::OpenTpm(const char* device) {
@@ -161,7 +175,18 @@ void LocalTpm::CloseTpm() {
   tpm_fd_ = -1;
 }
 
+#ifdef TPM2_TRACE
+uint64_t MonotonicNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+#endif
+
 bool LocalTpm::SendCommand(int size, byte* command) {
+#ifdef TPM2_TRACE
+  trace_->CommandSent(size, command);
+#endif
   int n = write(tpm_fd_, command, size);
   if (n < 0)
     printf("SendCommand Error: %s\n", strerror(errno));
@@ -170,9 +195,189 @@ bool LocalTpm::SendCommand(int size, byte* command) {
 
 bool LocalTpm::GetResponse(int* size, byte* response) {
   int n = read(tpm_fd_, response, *size);
+#ifdef TPM2_TRACE
+  trace_->ResponseReceived(n, response);
+#endif
   return n > 0;
 }
 
+#ifdef TPM2_TRACE
+int TraceCommandIndex(uint32_t command_code) {
+  if (command_code < TPM_CC_FIRST || command_code > TPM_CC_LAST)
+    return TPM_TRACE_NUM_COMMANDS - 1;
+  return command_code - TPM_CC_FIRST;
+}
+
+// Values below 8us get a bucket each; above that, each power of two is
+// split into 4 buckets.
+int TraceLatencyBucket(uint64_t latency_us) {
+  if (latency_us < 8)
+    return (int)latency_us;
+  int msb = 63 - __builtin_clzll(latency_us);
+  int bucket = 8 + (msb - 3) * 4 + (int)((latency_us >> (msb - 2)) & 3);
+  if (bucket >= TPM_TRACE_NUM_BUCKETS)
+    bucket = TPM_TRACE_NUM_BUCKETS - 1;
+  return bucket;
+}
+
+uint64_t TraceBucketLimit(int bucket) {
+  if (bucket < 8)
+    return bucket + 1;
+  int msb = 3 + (bucket - 8) / 4;
+  uint64_t sub = (bucket - 8) % 4;
+  return (1ULL << msb) + ((sub + 1) << (msb - 2));
+}
+
+TpmTrace::TpmTrace() {
+  command_start_ns_ = 0ULL;
+  next_.store(0);
+  for (int i = 0; i < TPM_TRACE_RING_SIZE; i++)
+    sequence_[i].store(0);
+  for (uint32_t i = 0; i < TPM_TRACE_NUM_COMMANDS; i++) {
+    for (int j = 0; j < TPM_TRACE_NUM_BUCKETS; j++)
+      histogram_[i][j].store(0);
+  }
+}
+
+void TpmTrace::CommandSent(int size, byte* command) {
+  pending_.command_size_ = size;
+  pending_.command_code_ = 0;
+  if (size >= (int)sizeof(TPM2_COMMAND_HEADER)) {
+    ChangeEndian32(&((TPM2_COMMAND_HEADER*)command)->commandCode,
+                   &pending_.command_code_);
+  }
+  command_start_ns_ = MonotonicNanoseconds();
+}
+
+void TpmTrace::ResponseReceived(int size, byte* response) {
+  pending_.latency_ns_ = MonotonicNanoseconds() - command_start_ns_;
+  pending_.response_size_ = size > 0 ? size : 0;
+  pending_.response_code_ = 0;
+  if (size >= (int)sizeof(TPM2_RESPONSE_HEADER)) {
+    ChangeEndian32(&((TPM2_RESPONSE_HEADER*)response)->responseCode,
+                   &pending_.response_code_);
+  }
+  Record(pending_);
+}
+
+void TpmTrace::Record(TpmTraceRecord& record) {
+  uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+  int slot = index % TPM_TRACE_RING_SIZE;
+
+  sequence_[slot].store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  ring_[slot] = record;
+  sequence_[slot].store(2 * index + 2, std::memory_order_release);
+
+  int bucket = TraceLatencyBucket(record.latency_ns_ / 1000ULL);
+  histogram_[TraceCommandIndex(record.command_code_)][bucket].fetch_add(1,
+      std::memory_order_relaxed);
+}
+
+int TpmTrace::Snapshot(int max_records, TpmTraceRecord* records) {
+  uint64_t last = next_.load(std::memory_order_acquire);
+  uint64_t first = 0;
+  int n = 0;
+
+  if (max_records > TPM_TRACE_RING_SIZE)
+    max_records = TPM_TRACE_RING_SIZE;
+  if (last > (uint64_t)max_records)
+    first = last - max_records;
+  for (uint64_t index = first; index < last; index++) {
+    int slot = index % TPM_TRACE_RING_SIZE;
+    uint64_t seq = sequence_[slot].load(std::memory_order_acquire);
+    if (seq != 2 * index + 2)
+      continue;
+    records[n] = ring_[slot];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence_[slot].load(std::memory_order_relaxed) != seq)
+      continue;
+    n++;
+  }
+  return n;
+}
+
+uint64_t TpmTrace::Count(uint32_t command_code) {
+  int c = TraceCommandIndex(command_code);
+  uint64_t total = 0;
+  for (int j = 0; j < TPM_TRACE_NUM_BUCKETS; j++)
+    total += histogram_[c][j].load(std::memory_order_relaxed);
+  return total;
+}
+
+uint64_t TpmTrace::PercentileMicroseconds(uint32_t command_code, double p) {
+  int c = TraceCommandIndex(command_code);
+  uint64_t total = Count(command_code);
+  if (total == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(p * total);
+  if (rank >= total)
+    rank = total - 1;
+  uint64_t seen = 0;
+  for (int j = 0; j < TPM_TRACE_NUM_BUCKETS; j++) {
+    seen += histogram_[c][j].load(std::memory_order_relaxed);
+    if (seen > rank)
+      return TraceBucketLimit(j);
+  }
+  return TraceBucketLimit(TPM_TRACE_NUM_BUCKETS - 1);
+}
+
+void TpmTrace::PrintReport() {
+  printf("\n%-28s %8s %10s %10s\n", "command", "count", "p50(us)", "p99(us)");
+  for (uint32_t cc = TPM_CC_FIRST; cc <= TPM_CC_LAST + 1; cc++) {
+    uint64_t count = Count(cc);
+    if (count == 0)
+      continue;
+    const char* name = cc <= TPM_CC_LAST ? TpmCommandName(cc) : "other";
+    printf("%-28s %8lld %10lld %10lld\n", name, (long long)count,
+           (long long)PercentileMicroseconds(cc, 0.50),
+           (long long)PercentileMicroseconds(cc, 0.99));
+  }
+  printf("\n");
+}
+
+#define TPM_COMMAND_NAME(x) case TPM_CC_##x: return #x;
+
+const char* TpmCommandName(uint32_t command_code) {
+  switch (command_code) {
+  TPM_COMMAND_NAME(ActivateCredential)
+  TPM_COMMAND_NAME(Certify)
+  TPM_COMMAND_NAME(ContextLoad)
+  TPM_COMMAND_NAME(ContextSave)
+  TPM_COMMAND_NAME(Create)
+  TPM_COMMAND_NAME(CreatePrimary)
+  TPM_COMMAND_NAME(DictionaryAttackLockReset)
+  TPM_COMMAND_NAME(EvictControl)
+  TPM_COMMAND_NAME(FlushContext)
+  TPM_COMMAND_NAME(GetCapability)
+  TPM_COMMAND_NAME(GetRandom)
+  TPM_COMMAND_NAME(Load)
+  TPM_COMMAND_NAME(MakeCredential)
+  TPM_COMMAND_NAME(NV_DefineSpace)
+  TPM_COMMAND_NAME(NV_Increment)
+  TPM_COMMAND_NAME(NV_Read)
+  TPM_COMMAND_NAME(NV_UndefineSpace)
+  TPM_COMMAND_NAME(NV_Write)
+  TPM_COMMAND_NAME(PCR_Event)
+  TPM_COMMAND_NAME(PCR_Read)
+  TPM_COMMAND_NAME(PolicyGetDigest)
+  TPM_COMMAND_NAME(PolicyPassword)
+  TPM_COMMAND_NAME(PolicyPCR)
+  TPM_COMMAND_NAME(PolicySecret)
+  TPM_COMMAND_NAME(Quote)
+  TPM_COMMAND_NAME(ReadClock)
+  TPM_COMMAND_NAME(ReadPublic)
+  TPM_COMMAND_NAME(RSA_Encrypt)
+  TPM_COMMAND_NAME(Shutdown)
+  TPM_COMMAND_NAME(StartAuthSession)
+  TPM_COMMAND_NAME(Startup)
+  TPM_COMMAND_NAME(Unseal)
+  default:
+    return "unknown";
+  }
+}
+#endif
+
 int Tpm2_SetCommand(uint16_t tag, uint32_t cmd, byte* buf,
                     int size_param, byte* params) {
   uint32_t size = sizeof(TPM2_COMMAND_HEADER) + size_param;
@@ -3341,21 +3546,42 @@ bool CalculateBindName(LocalTpm& tpm, TPM_HANDLE bind_obj,
 }
 
 
+ProtectedSessionAuthInfo::ProtectedSessionAuthInfo() {
+  hmac_ = nullptr;
+}
+
+ProtectedSessionAuthInfo::~ProtectedSessionAuthInfo() {
+  ClearKeys();
+  delete hmac_;
+}
+
+void ProtectedSessionAuthInfo::ClearKeys() {
+  if (hmac_ != nullptr)
+    hmac_->Clear();
+  OPENSSL_cleanse(sessionKey_, sizeof(sessionKey_));
+  sessionKeySize_ = 0;
+  ClearKDFaKey();
+}
+
 // HMac(sessionkey||auth, cpHash, nonceNewer, nonceOlder, sessionAttrs)
 // cpHash ≔ Hash(commandCode {|| Name1 {|| Name2 {|| Name3 }}} {|| parameters })
+// The pieces are fed straight to the digest and HMAC contexts rather than
+// being marshaled into intermediate buffers first.
 bool CalculateSessionHmac(ProtectedSessionAuthInfo& in, bool dir, uint32_t cmd,
                 int numNames, TPM2B_NAME* names,
                 int size_parms, byte* parms, int* size_hmac, byte* hmac) {
-  SHA_CTX sha1;
-  SHA256_CTX sha256;
-  byte toHash[256];
+  EVP_MD_CTX md_ctx;
+  const EVP_MD* md;
   byte cpHash[32];
+  unsigned size_cpHash = 0;
+  uint32_t zero = 0;
+  uint32_t b_cmd;
 
-#if 1
-  printf("\nCalculateSessionHmac\n");
-#endif
-
-  if (in.hash_alg_!= TPM_ALG_SHA1 && in.hash_alg_ != TPM_ALG_SHA256) {
+  if (in.hash_alg_ == TPM_ALG_SHA1) {
+    md = EVP_sha1();
+  } else if (in.hash_alg_ == TPM_ALG_SHA256) {
+    md = EVP_sha256();
+  } else {
     printf("CalculateSessionHmac: unsupported hash algorithm\n");
     return false;
   }
@@ -3366,92 +3592,54 @@ bool CalculateSessionHmac(ProtectedSessionAuthInfo& in, bool dir, uint32_t cmd,
 
   memcpy(hmac_key, in.sessionKey_, in.sessionKeySize_);
   sizeHmacKey += in.sessionKeySize_;
-
   memcpy(&hmac_key[in.sessionKeySize_], in.targetAuthValue_.buffer,
        in.targetAuthValue_.size);
   sizeHmacKey += in.targetAuthValue_.size;
 
-#if 1
+#ifdef DEBUG
+  printf("\nCalculateSessionHmac\n");
   printf("hmac_key: ");
   PrintBytes(sizeHmacKey, hmac_key); printf("\n");
 #endif
 
-  int current_out_size = 0;
-  int room_left = 256;
-
   // If dir is true, this is a response buffer and we add 4 bytes of 0
   // for some reason.
-  if (dir) {
-    uint32_t zero = 0;
-    memcpy(&toHash[current_out_size], (byte*)&zero, sizeof(uint32_t));
-    current_out_size += sizeof(uint32_t);
-  }
-  ChangeEndian32((uint32_t*)&cmd, (uint32_t*)&toHash[current_out_size]);
-  current_out_size += sizeof(uint32_t);
-  room_left -= sizeof(uint32_t);
-  for (int i = 0; i < numNames; i++) {
-    memcpy(&toHash[current_out_size], names[i].name, names[i].size);
-    current_out_size += names[i].size;
-    room_left -= names[i].size;
-  }
-  memcpy(&toHash[current_out_size], parms, size_parms);
-  current_out_size += size_parms;
-  room_left -= size_parms;
+  ChangeEndian32(&cmd, &b_cmd);
+  EVP_MD_CTX_init(&md_ctx);
+  EVP_DigestInit_ex(&md_ctx, md, nullptr);
+  if (dir)
+    EVP_DigestUpdate(&md_ctx, (byte*)&zero, sizeof(uint32_t));
+  EVP_DigestUpdate(&md_ctx, (byte*)&b_cmd, sizeof(uint32_t));
+  for (int i = 0; i < numNames; i++)
+    EVP_DigestUpdate(&md_ctx, names[i].name, names[i].size);
+  if (size_parms > 0)
+    EVP_DigestUpdate(&md_ctx, parms, size_parms);
+  EVP_DigestFinal_ex(&md_ctx, cpHash, &size_cpHash);
+  EVP_MD_CTX_cleanup(&md_ctx);
 
-#if 1
-  printf("toHash for cpHash: ");
-  PrintBytes(current_out_size, toHash); printf("\n");
-#endif
-
-  // Note: current_out_size is repurposed.
-  if (in.hash_alg_ == TPM_ALG_SHA1) {
-    SHA1_Init(&sha1);
-    SHA1_Update(&sha1, toHash, current_out_size);
-    SHA1_Final(cpHash, &sha1);
-    current_out_size = 20;
-  } else {
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, toHash, current_out_size);
-    SHA256_Final(cpHash, &sha256);
-    current_out_size = 32;
-  }
-
-#if 1
+#ifdef DEBUG
   printf("cpHash: ");
-  PrintBytes(current_out_size, cpHash); printf("\n");
-#endif
-
-  memcpy(toHash, cpHash, current_out_size);
-  room_left -= current_out_size;
-  byte* current = &toHash[current_out_size];
-
-  // nonceNewer, nonceOlder, sessionAttrs
-  memcpy(current, in.newNonce_.buffer, in.newNonce_.size);
-  Update(in.newNonce_.size, &current, &current_out_size, &room_left);
-  memcpy(current, in.oldNonce_.buffer, in.oldNonce_.size);
-  Update(in.oldNonce_.size, &current, &current_out_size, &room_left);
-  memcpy(current, &in.tpmSessionAttributes_, 1);
-  Update(1, &current, &current_out_size, &room_left);
-
-#if 1
-  printf("Hmac in: ");
-  PrintBytes(current_out_size, toHash); printf("\n");
+  PrintBytes(size_cpHash, cpHash); printf("\n");
 #endif
 
-  HMAC_CTX hctx;
-  HMAC_CTX_init(&hctx);
-  if (in.hash_alg_ == TPM_ALG_SHA1) {
-    HMAC_Init_ex(&hctx, hmac_key, sizeHmacKey, EVP_sha1(), nullptr);
-    *size_hmac = 20;
-  } else {
-    HMAC_Init_ex(&hctx, hmac_key, sizeHmacKey, EVP_sha256(), nullptr);
-    *size_hmac = 32;
+  // cpHash, nonceNewer, nonceOlder, sessionAttrs
+  if (in.hmac_ == nullptr)
+    in.hmac_ = new HmacKdf;
+  int sizes[4] = {
+    (int)size_cpHash, in.newNonce_.size, in.oldNonce_.size, 1
+  };
+  byte* bufs[4] = {
+    cpHash, in.newNonce_.buffer, in.oldNonce_.buffer,
+    &in.tpmSessionAttributes_
+  };
+  if (!in.hmac_->SetKey(in.hash_alg_, sizeHmacKey, hmac_key) ||
+      !in.hmac_->Hmac(4, sizes, bufs, hmac)) {
+    printf("CalculateSessionHmac: hmac failed\n");
+    return false;
   }
-  HMAC_Update(&hctx, (const byte*)toHash, (size_t)current_out_size);
-  HMAC_Final(&hctx, hmac, (unsigned*)size_hmac);
-  HMAC_CTX_cleanup(&hctx);
+  *size_hmac = in.hmac_->HashSize();
 
-#if 1
+#ifdef DEBUG
   printf("Hmac out: ");
   PrintBytes(*size_hmac, hmac); printf("\n\n");
 #endif
@@ -3465,7 +3653,7 @@ bool CalculateSessionKey(ProtectedSessionAuthInfo& in, TPM2B_DIGEST& rawSalt) {
   int sizeKey= SizeHash(in.hash_alg_);
   in.sessionKeySize_ = sizeKey;
 
-#if 1
+#ifdef DEBUG
   printf("\nCalculateSessionKey\n");
   printf("Auth value: ");
   PrintBytes(in.targetAuthValue_.size, in.targetAuthValue_.buffer); printf("\n");
@@ -3483,7 +3671,7 @@ bool CalculateSessionKey(ProtectedSessionAuthInfo& in, TPM2B_DIGEST& rawSalt) {
   contextU.assign((const char*)in.newNonce_.buffer, in.newNonce_.size);
   contextV.assign((const char*)in.oldNonce_.buffer, in.oldNonce_.size);
 
-#if 1
+#ifdef DEBUG
   printf("CalculateSessionKey KDFa:\n");
   printf("    key    : ");
   PrintBytes(key.size(), (byte*)key.data()); printf("\n");
@@ -3501,7 +3689,7 @@ bool CalculateSessionKey(ProtectedSessionAuthInfo& in, TPM2B_DIGEST& rawSalt) {
     return false;
   }
 
-#if 1
+#ifdef DEBUG
   printf("CalculateSessionKey, key: ");
   PrintBytes(sizeKey, in.sessionKey_); printf("\n");
 #endif
@@ -4028,3 +4216,213 @@ bool Tpm2_ReadProtectedNv(LocalTpm& tpm, TPMI_RH_NV_INDEX index,
   return true;
 }
 
+
+// Start a salted, unbound HMAC session with tpm_key and derive its
+// session key.  The salt is OAEP padded with the "SECRET" label and
+// encrypted to tpm_key_public.
+bool Tpm2_StartSaltedHmacSession(LocalTpm& tpm, TPM_HANDLE tpm_key,
+                           TPM2B_PUBLIC& tpm_key_public,
+                           TPMT_SYM_DEF& symmetric, TPMI_ALG_HASH hash_alg,
+                           ProtectedSessionAuthInfo* authInfo) {
+  int hashSize = SizeHash(hash_alg);
+  if (hashSize <= 0) {
+    printf("Tpm2_StartSaltedHmacSession: unsupported hash algorithm\n");
+    return false;
+  }
+  int size_modulus = tpm_key_public.publicArea.unique.rsa.size;
+
+  authInfo->hash_alg_ = hash_alg;
+  authInfo->newNonce_.size = hashSize;
+  authInfo->oldNonce_.size = hashSize;
+  memset(authInfo->newNonce_.buffer, 0, hashSize);
+  RAND_bytes(authInfo->oldNonce_.buffer, authInfo->oldNonce_.size);
+
+  TPM2B_DIGEST secret;
+  secret.size = hashSize;
+  RAND_bytes(secret.buffer, secret.size);
+
+  RSA* rsa_tpmKey = RSA_new();
+  rsa_tpmKey->n = bin_to_BN(size_modulus,
+                            tpm_key_public.publicArea.unique.rsa.buffer);
+  uint64_t exp = 0x010001ULL;
+  byte b_exp[16];
+  ChangeEndian64((uint64_t*)&exp, (uint64_t*)b_exp);
+  rsa_tpmKey->e = bin_to_BN(sizeof(uint64_t), b_exp);
+
+  TPM2B_ENCRYPTED_SECRET salt;
+  byte padded_secret[1024];
+  memset(padded_secret, 0, 1024);
+  RSA_padding_add_PKCS1_OAEP(padded_secret, size_modulus,
+      secret.buffer, secret.size,
+      (byte*)"SECRET", strlen("SECRET")+1);
+  int n = RSA_public_encrypt(size_modulus, padded_secret, salt.secret,
+                             rsa_tpmKey, RSA_NO_PADDING);
+  RSA_free(rsa_tpmKey);
+  if (n <= 0) {
+    printf("Tpm2_StartSaltedHmacSession: can't encrypt salt\n");
+    return false;
+  }
+  salt.size = n;
+
+  TPM_HANDLE sessionHandle = 0;
+  if (!Tpm2_StartProtectedAuthSession(tpm, tpm_key, TPM_RH_NULL, *authInfo,
+         salt, TPM_SE_HMAC, symmetric, hash_alg, &sessionHandle)) {
+    printf("Tpm2_StartProtectedAuthSession fails\n");
+    return false;
+  }
+  authInfo->sessionHandle_ = sessionHandle;
+  authInfo->tpmSessionAttributes_ = CONTINUESESSION;
+  if (!CalculateSessionKey(*authInfo, secret)) {
+    printf("Can't calculate HMac session key\n");
+    Tpm2_FlushContext(tpm, sessionHandle);
+    authInfo->ClearKeys();
+    return false;
+  }
+  return true;
+}
+
+ProtectedSessionPool::ProtectedSessionPool() {
+  tpm_ = nullptr;
+  tpm_key_ = 0;
+  hash_alg_ = TPM_ALG_SHA1;
+  max_sessions_ = 0;
+  num_open_ = 0;
+  num_free_ = 0;
+  sessions_started_ = 0ULL;
+  sessions_reused_ = 0ULL;
+  for (int i = 0; i < MAX_POOLED_SESSIONS; i++) {
+    in_use_[i] = false;
+    open_[i] = false;
+  }
+}
+
+ProtectedSessionPool::~ProtectedSessionPool() {
+  FlushAll();
+}
+
+bool ProtectedSessionPool::Init(LocalTpm& tpm, TPM_HANDLE tpm_key,
+                                TPM2B_PUBLIC& tpm_key_public,
+                                TPMT_SYM_DEF& symmetric,
+                                TPMI_ALG_HASH hash_alg, int max_sessions) {
+  if (hash_alg != TPM_ALG_SHA1 && hash_alg != TPM_ALG_SHA256)
+    return false;
+  if (max_sessions <= 0 || max_sessions > MAX_POOLED_SESSIONS)
+    max_sessions = MAX_POOLED_SESSIONS;
+  FlushAll();
+  tpm_ = &tpm;
+  tpm_key_ = tpm_key;
+  tpm_key_public_ = tpm_key_public;
+  symmetric_ = symmetric;
+  hash_alg_ = hash_alg;
+  max_sessions_ = max_sessions;
+  return true;
+}
+
+ProtectedSessionAuthInfo* ProtectedSessionPool::GetSession(
+        TPMI_RH_NV_INDEX index, uint32_t nv_attributes, uint16_t nv_size,
+        string& authString) {
+  if (tpm_ == nullptr)
+    return nullptr;
+
+  // A bad password is the caller's error, not the session's: check it
+  // before a session is taken so no session is started or flushed for it.
+  byte tbuf[128];
+  int l = SetPasswordData(authString, 128, tbuf);
+  if (l < 2)
+    return nullptr;
+
+  int slot = -1;
+  if (num_free_ > 0) {
+    for (int i = 0; i < max_sessions_; i++) {
+      if (open_[i] && !in_use_[i]) {
+        slot = i;
+        break;
+      }
+    }
+  }
+  if (slot >= 0) {
+    num_free_--;
+    sessions_reused_++;
+  } else {
+    if (num_open_ >= max_sessions_)
+      return nullptr;
+    for (int i = 0; i < max_sessions_; i++) {
+      if (!open_[i]) {
+        slot = i;
+        break;
+      }
+    }
+    // Tpm2_StartSaltedHmacSession flushes the handle of a session it
+    // started but could not finish setting up.
+    if (!Tpm2_StartSaltedHmacSession(*tpm_, tpm_key_, tpm_key_public_,
+                                     symmetric_, hash_alg_, &sessions_[slot]))
+      return nullptr;
+    open_[slot] = true;
+    num_open_++;
+    sessions_started_++;
+  }
+  in_use_[slot] = true;
+
+  ProtectedSessionAuthInfo* authInfo = &sessions_[slot];
+  authInfo->protectedHandle_ = index;
+  authInfo->protectedAttributes_ = nv_attributes;
+  authInfo->protectedSize_ = nv_size;
+  authInfo->targetAuthValue_.size = l - 2;
+  memcpy(authInfo->targetAuthValue_.buffer, &tbuf[2], l - 2);
+  return authInfo;
+}
+
+void ProtectedSessionPool::ReturnSession(ProtectedSessionAuthInfo* authInfo,
+                                         bool succeeded) {
+  int slot = authInfo - sessions_;
+  if (slot < 0 || slot >= max_sessions_ || !in_use_[slot])
+    return;
+  in_use_[slot] = false;
+  if (succeeded) {
+    num_free_++;
+    return;
+  }
+  // Our nonces may no longer match the tpm's.
+  Tpm2_FlushContext(*tpm_, sessions_[slot].sessionHandle_);
+  sessions_[slot].ClearKeys();
+  open_[slot] = false;
+  num_open_--;
+}
+
+void ProtectedSessionPool::FlushAll() {
+  for (int i = 0; i < max_sessions_; i++) {
+    if (open_[i]) {
+      Tpm2_FlushContext(*tpm_, sessions_[i].sessionHandle_);
+      sessions_[i].ClearKeys();
+    }
+    open_[i] = false;
+    in_use_[i] = false;
+  }
+  num_open_ = 0;
+  num_free_ = 0;
+}
+
+bool ProtectedSessionPool::IncrementNv(TPMI_RH_NV_INDEX index,
+                                       uint32_t nv_attributes,
+                                       uint16_t nv_size, string& authString) {
+  ProtectedSessionAuthInfo* authInfo = GetSession(index, nv_attributes,
+                                                  nv_size, authString);
+  if (authInfo == nullptr)
+    return false;
+  bool ret = Tpm2_IncrementProtectedNv(*tpm_, index, *authInfo);
+  ReturnSession(authInfo, ret);
+  return ret;
+}
+
+bool ProtectedSessionPool::ReadNv(TPMI_RH_NV_INDEX index,
+                                  uint32_t nv_attributes, uint16_t nv_size,
+                                  string& authString,
+                                  uint16_t* size, byte* data) {
+  ProtectedSessionAuthInfo* authInfo = GetSession(index, nv_attributes,
+                                                  nv_size, authString);
+  if (authInfo == nullptr)
+    return false;
+  bool ret = Tpm2_ReadProtectedNv(*tpm_, index, *authInfo, size, data);
+  ReturnSession(authInfo, ret);
+  return ret;
+}
@@ -20,6 +20,7 @@
 #ifndef _TPM2_LIB_H__
 #define _TPM2_LIB_H__
 
+#include <time.h>
 #include <tpm20.h>
 #include <tpm2_types.h>
 
@@ -42,6 +43,7 @@ bool testPcrBit(int pcrNum, byte* array);
 
 bool ReadFileIntoBlock(const string& filename, int* size, byte* block);
 bool WriteFileFromBlock(const string& filename, int size, byte* block);
+double ElapsedSeconds(struct timespec& start, struct timespec& stop);
 
 void PrintCapabilities(int size, byte* buf);
 bool GetReadPublicOut(uint16_t size_in, byte* input, TPM2B_PUBLIC* outPublic);
@@ -63,11 +65,67 @@ bool EncryptDataWithCredential(bool encrypt_flag, TPM_ALG_ID hash_alg_id,
                                int* size_hmac, byte* encrypted_data_hmac,
                                int* size_output_data, byte* output_data);
 
+#ifdef TPM2_TRACE
+#include <atomic>
+
+// One command/response exchange with the tpm.
+struct TpmTraceRecord {
+  uint32_t command_code_;
+  uint32_t command_size_;
+  uint32_t response_code_;
+  uint32_t response_size_;
+  uint64_t latency_ns_;
+};
+
+#define TPM_TRACE_RING_SIZE 1024
+#define TPM_TRACE_NUM_BUCKETS 96
+// Codes outside [TPM_CC_FIRST, TPM_CC_LAST] share the last slot.
+#define TPM_TRACE_NUM_COMMANDS (TPM_CC_LAST - TPM_CC_FIRST + 2)
+
+// Command trace, only compiled in with TPM2_TRACE.  Records go into a
+// lock free ring: writers claim a slot with an atomic increment and
+// publish it with an even sequence number; readers copy only slots
+// whose sequence number did not change during the copy.  Latencies are
+// also counted in a log-linear histogram (4 buckets per power of two
+// microseconds) per command code, from which percentiles are read.
+class TpmTrace {
+private:
+  TpmTraceRecord pending_;
+  uint64_t command_start_ns_;
+  std::atomic<uint64_t> next_;
+  std::atomic<uint64_t> sequence_[TPM_TRACE_RING_SIZE];
+  TpmTraceRecord ring_[TPM_TRACE_RING_SIZE];
+  std::atomic<uint32_t> histogram_[TPM_TRACE_NUM_COMMANDS]
+                                  [TPM_TRACE_NUM_BUCKETS];
+
+public:
+  TpmTrace();
+
+  // Called by LocalTpm around each exchange with the tpm.
+  void CommandSent(int size, byte* command);
+  void ResponseReceived(int size, byte* response);
+  void Record(TpmTraceRecord& record);
+  // Copies up to max_records of the most recent records, oldest first.
+  int Snapshot(int max_records, TpmTraceRecord* records);
+  uint64_t Count(uint32_t command_code);
+  // Upper bound, in microseconds, of the bucket holding percentile p.
+  uint64_t PercentileMicroseconds(uint32_t command_code, double p);
+  void PrintReport();
+};
+
+const char* TpmCommandName(uint32_t command_code);
+#endif
+
+class TpmTrace;
+
 // Local Tpm interaction
 class LocalTpm {
 
 private:
   int tpm_fd_;
+  // Allocated when tpm2_lib.cc is built with TPM2_TRACE, so the layout
+  // does not depend on how each file including this one is compiled.
+  TpmTrace* trace_;
 
 public:
   LocalTpm();
@@ -77,6 +135,8 @@ public:
   void CloseTpm();
   bool SendCommand(int size, byte* command);
   bool GetResponse(int* size, byte* response);
+  // nullptr unless tracing is compiled in.
+  TpmTrace* Trace() { return trace_; }
 };
 
 // Helpers
@@ -236,7 +296,13 @@ bool Tpm2_DictionaryAttackLockReset(LocalTpm& tpm);
 
 #define CONTINUESESSION 0x01
 
+class HmacKdf;
+
 class ProtectedSessionAuthInfo {
+private:
+  ProtectedSessionAuthInfo(const ProtectedSessionAuthInfo&);
+  ProtectedSessionAuthInfo& operator=(const ProtectedSessionAuthInfo&);
+
 public:
   TPMI_ALG_HASH hash_alg_;
   TPM2B_NONCE oldNonce_;
@@ -250,6 +316,15 @@ public:
   byte tpmSessionAttributes_;
   int sessionKeySize_;
   byte sessionKey_[64];
+  // Keyed with sessionKey_||targetAuthValue_ by CalculateSessionHmac,
+  // which only rekeys it when those change.
+  HmacKdf* hmac_;
+
+  ProtectedSessionAuthInfo();
+  ~ProtectedSessionAuthInfo();
+  // Wipes the session key, the HMAC context keyed with it and the KDFa
+  // context it was derived with, once the session is flushed.
+  void ClearKeys();
 };
 
 bool CalculateNvName(ProtectedSessionAuthInfo& in, TPM_HANDLE nv_handle,
@@ -271,5 +346,54 @@ bool Tpm2_ReadProtectedNv(LocalTpm& tpm, TPMI_RH_NV_INDEX index,
 bool Tpm2_DefineProtectedSpace(LocalTpm& tpm, TPM_HANDLE owner, TPMI_RH_NV_INDEX index,
                       ProtectedSessionAuthInfo& authInfo, uint32_t attributes,
                       uint16_t size_data);
+bool Tpm2_StartSaltedHmacSession(LocalTpm& tpm, TPM_HANDLE tpm_key,
+                           TPM2B_PUBLIC& tpm_key_public,
+                           TPMT_SYM_DEF& symmetric, TPMI_ALG_HASH hash_alg,
+                           ProtectedSessionAuthInfo* authInfo);
+
+// Starting a salted session costs a StartAuthSession round trip, an RSA
+// encryption of the salt and a KDFa.  ProtectedSessionPool keeps those
+// sessions open (CONTINUESESSION) and hands them out again, so repeated
+// protected NV operations only pay for the command HMACs.  The nonces
+// roll on every command, so a session whose command fails is flushed
+// instead of being returned to the pool.  TPMs are only required to keep
+// three sessions loaded, hence the limit.
+#define MAX_POOLED_SESSIONS 3
+
+class ProtectedSessionPool {
+private:
+  LocalTpm* tpm_;
+  TPM_HANDLE tpm_key_;
+  TPM2B_PUBLIC tpm_key_public_;
+  TPMT_SYM_DEF symmetric_;
+  TPMI_ALG_HASH hash_alg_;
+  int max_sessions_;
+  int num_open_;
+  int num_free_;
+  ProtectedSessionAuthInfo sessions_[MAX_POOLED_SESSIONS];
+  bool in_use_[MAX_POOLED_SESSIONS];
+  bool open_[MAX_POOLED_SESSIONS];
+
+public:
+  uint64_t sessions_started_;
+  uint64_t sessions_reused_;
+
+  ProtectedSessionPool();
+  ~ProtectedSessionPool();
+
+  bool Init(LocalTpm& tpm, TPM_HANDLE tpm_key, TPM2B_PUBLIC& tpm_key_public,
+            TPMT_SYM_DEF& symmetric, TPMI_ALG_HASH hash_alg, int max_sessions);
+  ProtectedSessionAuthInfo* GetSession(TPMI_RH_NV_INDEX index,
+                                       uint32_t nv_attributes,
+                                       uint16_t nv_size, string& authString);
+  void ReturnSession(ProtectedSessionAuthInfo* authInfo, bool succeeded);
+  void FlushAll();
+
+  bool IncrementNv(TPMI_RH_NV_INDEX index, uint32_t nv_attributes,
+                   uint16_t nv_size, string& authString);
+  bool ReadNv(TPMI_RH_NV_INDEX index, uint32_t nv_attributes,
+              uint16_t nv_size, string& authString,
+              uint16_t* size, byte* data);
+};
 #endif
 
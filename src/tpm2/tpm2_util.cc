@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include <tpm20.h>
 #include <tpm2_lib.h>
@@ -76,7 +77,7 @@ DEFINE_uint64(startHandle, 0x80000000, "start handle range");
 #define GFLAGS_NS google
 #endif
 
-int num_tpmutil_ops = 28;
+int num_tpmutil_ops = 29;
 std::string tpmutil_ops[] = {
     "--command=Startup",
     "--command=Shutdown",
@@ -106,6 +107,7 @@ std::string tpmutil_ops[] = {
     "--command=ContextCombinedTest",
     "--command=EndorsementCombinedTest",
     "--command=NvCombinedSessionTest",
+    "--command=NvSessionPoolBenchmark",
 };
 
 // standard buffer size
@@ -117,6 +119,7 @@ bool Tpm2_QuoteCombinedTest(LocalTpm& tpm, int pcr_num);
 bool Tpm2_KeyCombinedTest(LocalTpm& tpm, int pcr_num);
 bool Tpm2_NvCombinedTest(LocalTpm& tpm);
 bool Tpm2_NvCombinedSessionTest(LocalTpm& tpm);
+bool Tpm2_NvSessionPoolBenchmark(LocalTpm& tpm, int num_increments);
 bool Tpm2_ContextCombinedTest(LocalTpm& tpm);
 bool Tpm2_EndorsementCombinedTest(LocalTpm& tpm);
 
@@ -452,6 +455,12 @@ int main(int an, char** av) {
     } else {
       printf("NvCombinedSessionTest failed\n");
     }
+  } else if (FLAGS_command == "NvSessionPoolBenchmark") {
+    if (Tpm2_NvSessionPoolBenchmark(tpm, FLAGS_num_param)) {
+      printf("NvSessionPoolBenchmark succeeded\n");
+    } else {
+      printf("NvSessionPoolBenchmark failed\n");
+    }
   } else if (FLAGS_command == "ContextCombinedTest") {
     if (Tpm2_ContextCombinedTest(tpm)) {
       printf("ContextCombinedTest succeeded\n");
@@ -475,6 +484,10 @@ int main(int an, char** av) {
     PrintOptions();
   }
 done:
+#ifdef TPM2_TRACE
+  if (tpm.Trace() != nullptr)
+    tpm.Trace()->PrintReport();
+#endif
   tpm.CloseTpm();
 }
 
@@ -1463,3 +1476,126 @@ done:
   }
   return ret;
 }
+
+// Compare counter increments/sec with a fresh salted session per
+// increment against increments through a ProtectedSessionPool.
+bool Tpm2_NvSessionPoolBenchmark(LocalTpm& tpm, int num_increments) {
+  printf("Tpm2_NvSessionPoolBenchmark\n\n");
+  extern int SetPasswordData(string& password, int size, byte* buf);
+
+  int slot = 1000;
+  string authString("01020304");
+  uint16_t size_data = 8;
+  uint32_t nv_attributes = NV_COUNTER | NV_AUTHWRITE | NV_AUTHREAD;
+  TPM_HANDLE nv_handle = GetNvHandle(slot);
+  bool ret = true;
+  struct timespec start;
+  struct timespec stop;
+  double fresh_seconds = 0.0;
+  double pooled_seconds = 0.0;
+
+  if (num_increments <= 0)
+    num_increments = 16;
+
+  TPML_PCR_SELECTION pcrSelect;
+  memset((void*)&pcrSelect, 0, sizeof(TPML_PCR_SELECTION));
+  TPMT_SYM_DEF symmetric;
+  symmetric.algorithm = TPM_ALG_AES;
+  symmetric.keyBits.aes = 128;
+  symmetric.mode.aes = TPM_ALG_CFB;
+
+  string emptyAuth;
+  TPM_HANDLE ekHandle = 0;
+  TPM2B_PUBLIC pub_out;
+  TPMA_OBJECT primary_flags;
+  *(uint32_t*)(&primary_flags) = 0;
+  primary_flags.fixedTPM = 1;
+  primary_flags.fixedParent = 1;
+  primary_flags.sensitiveDataOrigin = 1;
+  primary_flags.userWithAuth = 1;
+  primary_flags.decrypt = 1;
+  primary_flags.restricted = 1;
+
+  Tpm2_UndefineSpace(tpm, TPM_RH_OWNER, nv_handle);
+  if (!Tpm2_DefineSpace(tpm, TPM_RH_OWNER, nv_handle, authString,
+                        0, nullptr, nv_attributes, size_data)) {
+    printf("DefineSpace failed\n");
+    return false;
+  }
+  if (!Tpm2_IncrementNv(tpm, nv_handle, authString)) {
+    printf("Initial Tpm2_IncrementNv fails\n");
+    return false;
+  }
+  if (!Tpm2_CreatePrimary(tpm, TPM_RH_ENDORSEMENT, emptyAuth, pcrSelect,
+                          TPM_ALG_RSA, TPM_ALG_SHA1, primary_flags,
+                          TPM_ALG_AES, 128, TPM_ALG_CFB, TPM_ALG_NULL,
+                          2048, 0x010001, &ekHandle, &pub_out)) {
+    printf("CreatePrimary failed\n");
+    return false;
+  }
+
+  // One salted session per increment.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < num_increments; i++) {
+    ProtectedSessionAuthInfo authInfo;
+    if (!Tpm2_StartSaltedHmacSession(tpm, ekHandle, pub_out, symmetric,
+                                     TPM_ALG_SHA1, &authInfo)) {
+      ret = false;
+      goto done;
+    }
+    authInfo.protectedHandle_ = nv_handle;
+    authInfo.protectedAttributes_ = nv_attributes;
+    authInfo.protectedSize_ = size_data;
+    byte tbuf[128];
+    int l = SetPasswordData(authString, 128, tbuf);
+    authInfo.targetAuthValue_.size = l - 2;
+    memcpy(authInfo.targetAuthValue_.buffer, &tbuf[2], l - 2);
+    bool incremented = Tpm2_IncrementProtectedNv(tpm, nv_handle, authInfo);
+    Tpm2_FlushContext(tpm, authInfo.sessionHandle_);
+    authInfo.ClearKeys();
+    if (!incremented) {
+      printf("Tpm2_IncrementProtectedNv fails\n");
+      ret = false;
+      goto done;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  fresh_seconds = ElapsedSeconds(start, stop);
+
+  // Pooled sessions.
+  {
+    ProtectedSessionPool pool;
+    if (!pool.Init(tpm, ekHandle, pub_out, symmetric, TPM_ALG_SHA1, 1)) {
+      printf("Can't init session pool\n");
+      ret = false;
+      goto done;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_increments; i++) {
+      if (!pool.IncrementNv(nv_handle, nv_attributes, size_data,
+                            authString)) {
+        printf("Pooled IncrementNv fails\n");
+        ret = false;
+        break;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    pooled_seconds = ElapsedSeconds(start, stop);
+    printf("Sessions started: %lld, reused: %lld\n",
+           (long long)pool.sessions_started_, (long long)pool.sessions_reused_);
+  }
+  if (!ret)
+    goto done;
+
+  printf("\n%d increments\n", num_increments);
+  printf("  fresh sessions : %.2f increments/sec\n",
+         num_increments / fresh_seconds);
+  printf("  pooled sessions: %.2f increments/sec\n",
+         num_increments / pooled_seconds);
+
+done:
+  if (ekHandle != 0) {
+    Tpm2_FlushContext(tpm, ekHandle);
+  }
+  return ret;
+}